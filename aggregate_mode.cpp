@@ -0,0 +1,648 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: aggregate_mode.cpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: Corpus-wide statistics gathered with fixed-size, mergeable sketches.
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "portable_pe_dump.hpp"
+
+/*
+-------------------------------------
+Aggregate statistics
+-------------------------------------
+
+Each field of interest (imported functions, imported DLLs, machine,
+subsystem, section names) is summarized by three sketches:
+
+ - Count-Min: approximate frequency of any value (never underestimates).
+ - HyperLogLog: approximate number of distinct values (~1% error).
+ - Space-Saving: the top-K most frequent values (heavy hitters).
+
+All three have a size fixed at construction, so memory doesn't grow with
+the corpus, and all three are mergeable: two sketches built over disjoint
+sets of files can be combined into the sketch of the union. Every worker
+thread fills its own set of sketches without any locking, and they are
+merged when the workers are done. The merged state can also be saved to a
+file (--sketch-out) and merged with the states of other machines/shards
+later (--sketch-in), which gives the same result as a single big run.
+
+The sketch files are written in the native byte order; they are meant to
+be merged on the same kind of machine that produced them.
+
+-------------------------------------
+*/
+
+namespace
+{
+
+std::uint64_t hashValue(const std::string & value)
+{
+    return mixHash(hashString(value));
+}
+
+// ========================================================
+// Binary I/O helpers for the sketch files:
+// ========================================================
+
+template<class T>
+void writePod(std::ostream & out, const T & value)
+{
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template<class T>
+bool readPod(std::istream & in, T & value)
+{
+    return static_cast<bool>(in.read(reinterpret_cast<char *>(&value), sizeof(T)));
+}
+
+void writeString(std::ostream & out, const std::string & str)
+{
+    writePod(out, static_cast<std::uint32_t>(str.size()));
+    out.write(str.data(), static_cast<std::streamsize>(str.size()));
+}
+
+bool readString(std::istream & in, std::string & str)
+{
+    std::uint32_t length = 0;
+    if (!readPod(in, length) || length > (1u << 20))
+    {
+        return false;
+    }
+    str.resize(length);
+    return length == 0 || static_cast<bool>(in.read(&str[0], length));
+}
+
+// ========================================================
+// Count-Min sketch
+// ========================================================
+
+class CountMinSketch
+{
+public:
+    static const std::uint32_t Depth = 4;
+    static const std::uint32_t Width = 8192; // Error ~ e/Width * total count
+
+    CountMinSketch() : counters_(Depth * Width, 0) { }
+
+    void add(const std::uint64_t hash, const std::uint64_t count = 1)
+    {
+        for (std::uint32_t d = 0; d < Depth; ++d)
+        {
+            counters_[d * Width + cell(hash, d)] += count;
+        }
+    }
+
+    std::uint64_t estimate(const std::uint64_t hash) const
+    {
+        std::uint64_t best = UINT64_MAX;
+        for (std::uint32_t d = 0; d < Depth; ++d)
+        {
+            best = std::min(best, counters_[d * Width + cell(hash, d)]);
+        }
+        return best;
+    }
+
+    void merge(const CountMinSketch & other)
+    {
+        for (std::size_t i = 0; i < counters_.size(); ++i)
+        {
+            counters_[i] += other.counters_[i];
+        }
+    }
+
+    void save(std::ostream & out) const
+    {
+        out.write(reinterpret_cast<const char *>(counters_.data()),
+                  static_cast<std::streamsize>(counters_.size() * sizeof(std::uint64_t)));
+    }
+
+    bool load(std::istream & in)
+    {
+        return static_cast<bool>(in.read(reinterpret_cast<char *>(counters_.data()),
+                                         static_cast<std::streamsize>(counters_.size() * sizeof(std::uint64_t))));
+    }
+
+private:
+    // Kirsch-Mitzenmacher: derive the row hashes from the two halves of a 64-bit hash.
+    static std::uint32_t cell(const std::uint64_t hash, const std::uint32_t row)
+    {
+        const std::uint32_t h1 = static_cast<std::uint32_t>(hash);
+        const std::uint32_t h2 = static_cast<std::uint32_t>(hash >> 32) | 1;
+        return (h1 + row * h2) % Width;
+    }
+
+    std::vector<std::uint64_t> counters_;
+};
+
+// ========================================================
+// HyperLogLog
+// ========================================================
+
+class HyperLogLog
+{
+public:
+    static const std::uint32_t PrecisionBits = 14;
+    static const std::uint32_t NumRegisters  = 1u << PrecisionBits;
+
+    HyperLogLog() : registers_(NumRegisters, 0) { }
+
+    void add(const std::uint64_t hash)
+    {
+        const std::uint32_t index = static_cast<std::uint32_t>(hash >> (64 - PrecisionBits));
+        const std::uint64_t rest  = (hash << PrecisionBits) | (1ull << (PrecisionBits - 1));
+
+        std::uint8_t rank = 1;
+        for (std::uint64_t bit = 1ull << 63; (rest & bit) == 0; bit >>= 1)
+        {
+            ++rank;
+        }
+        registers_[index] = std::max(registers_[index], rank);
+    }
+
+    double estimate() const
+    {
+        const double m = NumRegisters;
+        double sum = 0.0;
+        std::uint32_t zeros = 0;
+        for (const std::uint8_t r : registers_)
+        {
+            sum += std::ldexp(1.0, -r);
+            if (r == 0) { ++zeros; }
+        }
+
+        const double alpha = 0.7213 / (1.0 + 1.079 / m);
+        const double raw   = alpha * m * m / sum;
+
+        // Small range correction (linear counting).
+        if (raw <= 2.5 * m && zeros != 0)
+        {
+            return m * std::log(m / zeros);
+        }
+        return raw;
+    }
+
+    void merge(const HyperLogLog & other)
+    {
+        for (std::size_t i = 0; i < registers_.size(); ++i)
+        {
+            registers_[i] = std::max(registers_[i], other.registers_[i]);
+        }
+    }
+
+    void save(std::ostream & out) const
+    {
+        out.write(reinterpret_cast<const char *>(registers_.data()), static_cast<std::streamsize>(registers_.size()));
+    }
+
+    bool load(std::istream & in)
+    {
+        return static_cast<bool>(in.read(reinterpret_cast<char *>(registers_.data()),
+                                         static_cast<std::streamsize>(registers_.size())));
+    }
+
+private:
+    std::vector<std::uint8_t> registers_;
+};
+
+// ========================================================
+// Space-Saving top-K (heavy hitters)
+// ========================================================
+
+class SpaceSaving
+{
+public:
+    struct Item
+    {
+        std::string   value;
+        std::uint64_t count; // Upper bound of the true count
+        std::uint64_t error; // count - error is a lower bound
+    };
+
+    explicit SpaceSaving(const std::size_t capacity)
+        : capacity_{ capacity }
+        , items_{}
+        , byCount_{}
+    { }
+
+    void add(const std::string & value, const std::uint64_t count = 1)
+    {
+        auto iter = items_.find(value);
+        if (iter != items_.end())
+        {
+            bump(iter->first, iter->second, count);
+            return;
+        }
+
+        if (items_.size() < capacity_)
+        {
+            items_.emplace(value, Counter{ count, 0 });
+            byCount_.emplace(count, value);
+            return;
+        }
+
+        // Evict the smallest counter; the newcomer inherits its count as the error bound.
+        const auto smallest = byCount_.begin();
+        const std::uint64_t minCount = smallest->first;
+        items_.erase(smallest->second);
+        byCount_.erase(smallest);
+
+        items_.emplace(value, Counter{ minCount + count, minCount });
+        byCount_.emplace(minCount + count, value);
+    }
+
+    // Mergeable summaries (Agarwal et al.): a value missing from a full
+    // summary could have had at most that summary's minimum count.
+    void merge(const SpaceSaving & other)
+    {
+        const std::uint64_t minThis  = (items_.size()       >= capacity_)       ? byCount_.begin()->first       : 0;
+        const std::uint64_t minOther = (other.items_.size() >= other.capacity_) ? other.byCount_.begin()->first : 0;
+
+        std::unordered_map<std::string, Counter> combined;
+        for (const auto & item : items_)
+        {
+            const auto o = other.items_.find(item.first);
+            combined[item.first] = (o != other.items_.end()) ?
+                Counter{ item.second.count + o->second.count, item.second.error + o->second.error } :
+                Counter{ item.second.count + minOther,        item.second.error + minOther };
+        }
+        for (const auto & item : other.items_)
+        {
+            if (items_.find(item.first) == items_.end())
+            {
+                combined[item.first] = Counter{ item.second.count + minThis, item.second.error + minThis };
+            }
+        }
+
+        std::vector<std::pair<std::string, Counter>> sorted(combined.begin(), combined.end());
+        std::sort(sorted.begin(), sorted.end(),
+                  [](const std::pair<std::string, Counter> & a, const std::pair<std::string, Counter> & b)
+                  {
+                      return a.second.count > b.second.count;
+                  });
+        if (sorted.size() > capacity_)
+        {
+            sorted.resize(capacity_);
+        }
+
+        items_.clear();
+        byCount_.clear();
+        for (const auto & item : sorted)
+        {
+            items_.emplace(item.first, item.second);
+            byCount_.emplace(item.second.count, item.first);
+        }
+    }
+
+    std::vector<Item> top(const std::size_t k) const
+    {
+        std::vector<Item> result;
+        for (auto iter = byCount_.rbegin(); iter != byCount_.rend() && result.size() < k; ++iter)
+        {
+            const Counter & counter = items_.find(iter->second)->second;
+            result.push_back(Item{ iter->second, counter.count, counter.error });
+        }
+        return result;
+    }
+
+    void save(std::ostream & out) const
+    {
+        writePod(out, static_cast<std::uint32_t>(items_.size()));
+        for (const auto & item : items_)
+        {
+            writeString(out, item.first);
+            writePod(out, item.second.count);
+            writePod(out, item.second.error);
+        }
+    }
+
+    bool load(std::istream & in)
+    {
+        items_.clear();
+        byCount_.clear();
+
+        std::uint32_t numItems = 0;
+        if (!readPod(in, numItems) || numItems > capacity_)
+        {
+            return false;
+        }
+        for (std::uint32_t i = 0; i < numItems; ++i)
+        {
+            std::string value;
+            Counter counter{ 0, 0 };
+            if (!readString(in, value) || !readPod(in, counter.count) || !readPod(in, counter.error))
+            {
+                return false;
+            }
+            items_.emplace(value, counter);
+            byCount_.emplace(counter.count, value);
+        }
+        return true;
+    }
+
+private:
+    struct Counter
+    {
+        std::uint64_t count;
+        std::uint64_t error;
+    };
+
+    void bump(const std::string & value, Counter & counter, const std::uint64_t count)
+    {
+        byCount_.erase(byCount_.find(std::make_pair(counter.count, value)));
+        counter.count += count;
+        byCount_.emplace(counter.count, value);
+    }
+
+    const std::size_t capacity_;
+    std::unordered_map<std::string, Counter> items_;
+    std::set<std::pair<std::uint64_t, std::string>> byCount_; // Ordered by count for O(log K) eviction
+};
+
+// ========================================================
+// Per-field and per-corpus statistics
+// ========================================================
+
+class FieldSketch
+{
+public:
+    FieldSketch(const char * title, const std::size_t topCapacity)
+        : title_{ title }
+        , total_{ 0 }
+        , frequencies_{}
+        , distinct_{}
+        , heavyHitters_{ topCapacity }
+    { }
+
+    FieldSketch(const FieldSketch &) = delete;
+    FieldSketch & operator = (const FieldSketch &) = delete;
+
+    void add(const std::string & value)
+    {
+        const std::uint64_t hash = hashValue(value);
+        frequencies_.add(hash);
+        distinct_.add(hash);
+        heavyHitters_.add(value);
+        ++total_;
+    }
+
+    void merge(const FieldSketch & other)
+    {
+        total_ += other.total_;
+        frequencies_.merge(other.frequencies_);
+        distinct_.merge(other.distinct_);
+        heavyHitters_.merge(other.heavyHitters_);
+    }
+
+    void print(std::ostream & out, const std::size_t topK) const
+    {
+        out << title_ << " (" << total_ << " total, ~"
+            << static_cast<std::uint64_t>(distinct_.estimate() + 0.5) << " distinct):\n";
+
+        for (const auto & item : heavyHitters_.top(topK))
+        {
+            // Both sketches overestimate, so the smaller of the two is the tighter bound.
+            const std::uint64_t count = std::min(item.count, frequencies_.estimate(hashValue(item.value)));
+            const double percent = (total_ > 0) ? (100.0 * count / total_) : 0.0;
+
+            out << "  " << std::left << std::setw(48) << item.value << " "
+                << std::right << std::setw(10) << count << "  ("
+                << std::fixed << std::setprecision(1) << percent << "%)\n";
+        }
+        out << "\n";
+    }
+
+    void save(std::ostream & out) const
+    {
+        writePod(out, total_);
+        frequencies_.save(out);
+        distinct_.save(out);
+        heavyHitters_.save(out);
+    }
+
+    bool load(std::istream & in)
+    {
+        return readPod(in, total_) && frequencies_.load(in) &&
+               distinct_.load(in) && heavyHitters_.load(in);
+    }
+
+private:
+    const char *   title_;
+    std::uint64_t  total_;
+    CountMinSketch frequencies_;
+    HyperLogLog    distinct_;
+    SpaceSaving    heavyHitters_;
+};
+
+const char SketchFileMagic[8] = { 'P', 'P', 'E', 'A', 'G', 'G', '0', '1' };
+
+struct CorpusStats
+{
+    std::uint64_t filesParsed = 0;
+    std::uint64_t filesFailed = 0;
+    std::uint64_t bytesParsed = 0;
+
+    FieldSketch machines         { "Machine",            64   };
+    FieldSketch subsystems       { "Subsystem",          64   };
+    FieldSketch sectionNames     { "Section names",      256  };
+    FieldSketch importedDlls     { "Imported DLLs",      1024 };
+    FieldSketch importedFunctions{ "Imported functions", 4096 };
+
+    FieldSketch * fields[5] = { &machines, &subsystems, &sectionNames, &importedDlls, &importedFunctions };
+
+    CorpusStats() = default;
+    CorpusStats(const CorpusStats &) = delete;
+    CorpusStats & operator = (const CorpusStats &) = delete;
+
+    void addFile(const PEInfo & info)
+    {
+        ++filesParsed;
+        bytesParsed += info.fileSize;
+
+        machines.add(withId(fileHeaderMachine(info.machine), info.machine));
+        subsystems.add(withId(optionalHeaderSubsystem(info.subsystem), info.subsystem));
+
+        for (const auto & section : info.sections)
+        {
+            sectionNames.add(section.name);
+        }
+
+        for (const auto & module : info.imports.modules)
+        {
+            std::string dllName = module.dllName;
+            std::transform(dllName.begin(), dllName.end(), dllName.begin(),
+                           [](const char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+            importedDlls.add(dllName);
+
+            for (const auto & symbol : module.symbols)
+            {
+                importedFunctions.add(dllName + "!" + (symbol.byOrdinal ? "#" + std::to_string(symbol.ordinal) : symbol.name));
+            }
+        }
+    }
+
+    void merge(const CorpusStats & other)
+    {
+        filesParsed += other.filesParsed;
+        filesFailed += other.filesFailed;
+        bytesParsed += other.bytesParsed;
+        for (std::size_t f = 0; f < 5; ++f)
+        {
+            fields[f]->merge(*other.fields[f]);
+        }
+    }
+
+    void print(std::ostream & out, const std::size_t topK) const
+    {
+        out << "\n";
+        out << "Files parsed.......: " << filesParsed << "\n";
+        out << "Files failed.......: " << filesFailed << "\n";
+        out << "Bytes parsed.......: " << bytesParsed << "\n";
+        out << "\n";
+        for (const FieldSketch * field : fields)
+        {
+            field->print(out, topK);
+        }
+    }
+
+    bool save(const std::string & filename) const
+    {
+        std::ofstream out{ filename, std::ios::binary };
+        out.write(SketchFileMagic, sizeof(SketchFileMagic));
+        writePod(out, filesParsed);
+        writePod(out, filesFailed);
+        writePod(out, bytesParsed);
+        for (const FieldSketch * field : fields)
+        {
+            field->save(out);
+        }
+        return static_cast<bool>(out);
+    }
+
+    bool load(const std::string & filename)
+    {
+        std::ifstream in{ filename, std::ios::binary };
+        char magic[sizeof(SketchFileMagic)];
+        if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, SketchFileMagic, sizeof(magic)) != 0)
+        {
+            return false;
+        }
+        if (!readPod(in, filesParsed) || !readPod(in, filesFailed) || !readPod(in, bytesParsed))
+        {
+            return false;
+        }
+        for (FieldSketch * field : fields)
+        {
+            if (!field->load(in)) { return false; }
+        }
+        return true;
+    }
+
+private:
+    // "UNKNOWN" alone would lump all unrecognized ids together.
+    static std::string withId(const std::string & name, const std::uint32_t id)
+    {
+        if (name != "UNKNOWN")
+        {
+            return name;
+        }
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "UNKNOWN (0x%X)", id);
+        return buffer;
+    }
+};
+
+} // namespace {}
+
+int runAggregate(const ProgramFlags & prog)
+{
+    std::vector<std::string> files;
+    expandInputPaths(prog.inputPaths, files);
+
+    if (files.empty() && prog.sketchInputs.empty())
+    {
+        std::cerr << "No input files for --aggregate!\n";
+        return EXIT_FAILURE;
+    }
+
+    const unsigned numWorkers = batchWorkerCount(prog.numWorkers, files.size());
+
+    // Each worker fills its own sketches; no sharing, no locks.
+    std::vector<std::unique_ptr<CorpusStats>> workerStats;
+    for (unsigned w = 0; w < numWorkers; ++w)
+    {
+        workerStats.emplace_back(new CorpusStats{});
+    }
+
+    parallelForEach(files.size(), numWorkers,
+        [&files, &workerStats](const std::size_t i, const unsigned w)
+        {
+            PEInfo info;
+            std::ostringstream ignoredErrors;
+            if (parsePEFile(files[i].c_str(), ParseImports, info, ignoredErrors))
+            {
+                workerStats[w]->addFile(info);
+            }
+            else
+            {
+                ++workerStats[w]->filesFailed;
+            }
+        });
+
+    CorpusStats & total = *workerStats[0];
+    for (unsigned w = 1; w < numWorkers; ++w)
+    {
+        total.merge(*workerStats[w]);
+    }
+
+    // Shards produced elsewhere.
+    for (const auto & sketchFile : prog.sketchInputs)
+    {
+        std::unique_ptr<CorpusStats> shard{ new CorpusStats{} };
+        if (!shard->load(sketchFile))
+        {
+            std::cerr << "Unable to load sketch file \"" << sketchFile << "\"!\n";
+            return EXIT_FAILURE;
+        }
+        total.merge(*shard);
+    }
+
+    if (!prog.sketchOutput.empty() && !total.save(prog.sketchOutput))
+    {
+        std::cerr << "Unable to write sketch file \"" << prog.sketchOutput << "\"!\n";
+        return EXIT_FAILURE;
+    }
+
+    total.print(std::cout, prog.topK);
+    return EXIT_SUCCESS;
+}
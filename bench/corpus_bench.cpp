@@ -0,0 +1,479 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: corpus_bench.cpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: End-to-end benchmark of ppedump over a corpus, with a cold or warm page cache (Unix only).
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../portable_pe_dump.hpp"
+
+/*
+-------------------------------------
+Modes
+-------------------------------------
+
+single: One ppedump process per file, like a script calling the
+        tool in a loop. Latency is the process wall time, fork and
+        exec included; peak RSS is the largest of the processes.
+
+batch:  All the files dumped by one process, like the batch modes
+        do. The process is a fork of this one calling processFile()
+        with the output discarded, so that its peak RSS isn't mixed
+        with the other runs. Latency is per processFile() call.
+
+Cold runs evict the corpus from the page cache before each run with
+posix_fadvise(DONTNEED), which doesn't need root but only drops clean
+pages of those files. --drop-cmd runs a helper instead, for example
+bench/drop_caches.sh, which drops the whole cache with sudo. Warm
+runs are preceded by one unmeasured run to fill the cache.
+
+-------------------------------------
+*/
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchConfig
+{
+    std::string ppedumpPath{ "./ppedump" };
+    std::vector<std::string> dumpFlags{ "-a" };
+    std::vector<std::string> modes{ "single", "batch" };
+    std::vector<std::string> loaders{ "read", "mmap", "ondemand" };
+    std::vector<std::string> caches{ "warm", "cold" };
+    std::string dropCommand{};
+    unsigned    numRuns = 3;
+};
+
+struct RunResult
+{
+    std::vector<double> latencies{}; // Seconds, one per file
+    double      wallSecs  = 0.0;
+    long        peakRssKB = 0;
+    std::size_t failures  = 0;
+};
+
+class NullBuffer final : public std::streambuf
+{
+protected:
+    int_type overflow(int_type c) override { return c; }
+    std::streamsize xsputn(const char *, std::streamsize count) override { return count; }
+};
+
+double secondsSince(const Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+long maxRssKB(const struct rusage & usage)
+{
+#ifdef __APPLE__
+    return static_cast<long>(usage.ru_maxrss / 1024); // Bytes on macOS
+#else // !__APPLE__
+    return static_cast<long>(usage.ru_maxrss);
+#endif // __APPLE__
+}
+
+std::vector<std::string> splitWords(const std::string & str)
+{
+    std::vector<std::string> words;
+    std::istringstream in{ str };
+    for (std::string word; in >> word;)
+    {
+        words.push_back(word);
+    }
+    return words;
+}
+
+std::vector<std::string> splitList(const std::string & str, const char * all)
+{
+    if (str == "all")
+    {
+        return splitWords(all);
+    }
+    std::string spaced = str;
+    std::replace(spaced.begin(), spaced.end(), ',', ' ');
+    return splitWords(spaced);
+}
+
+// ========================================================
+// Page cache control
+// ========================================================
+
+bool evictFromPageCache(const std::vector<std::string> & files, const std::string & dropCommand)
+{
+    if (!dropCommand.empty())
+    {
+        return std::system(dropCommand.c_str()) == 0;
+    }
+
+#ifdef POSIX_FADV_DONTNEED
+    for (const auto & filename : files)
+    {
+        const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0)
+        {
+            ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            ::close(fd);
+        }
+    }
+    return true;
+#else // !POSIX_FADV_DONTNEED
+    (void)files;
+    std::cerr << "posix_fadvise() unavailable; use --drop-cmd for cold runs.\n";
+    return false;
+#endif // POSIX_FADV_DONTNEED
+}
+
+// ========================================================
+// Runs
+// ========================================================
+
+RunResult runSingle(const std::vector<std::string> & files, const std::string & loader, const BenchConfig & config)
+{
+    RunResult result;
+    const int devNull = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+    const auto runStart = Clock::now();
+
+    for (const auto & filename : files)
+    {
+        std::vector<const char *> args{ config.ppedumpPath.c_str(), filename.c_str() };
+        for (const auto & flag : config.dumpFlags)
+        {
+            args.push_back(flag.c_str());
+        }
+        args.push_back("--loader");
+        args.push_back(loader.c_str());
+        args.push_back(nullptr);
+
+        const auto start = Clock::now();
+        const pid_t pid = ::fork();
+        if (pid == 0)
+        {
+            ::dup2(devNull, STDOUT_FILENO);
+            ::dup2(devNull, STDERR_FILENO);
+            ::execv(args[0], const_cast<char * const *>(args.data()));
+            ::_exit(127);
+        }
+
+        int status = 0;
+        struct rusage usage;
+        if (pid < 0 || ::wait4(pid, &status, 0, &usage) != pid)
+        {
+            ++result.failures;
+            continue;
+        }
+
+        result.latencies.push_back(secondsSince(start));
+        result.peakRssKB = std::max(result.peakRssKB, maxRssKB(usage));
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            ++result.failures;
+        }
+    }
+
+    result.wallSecs = secondsSince(runStart);
+    ::close(devNull);
+    return result;
+}
+
+RunResult runBatch(const std::vector<std::string> & files, const std::string & loader, const BenchConfig & config)
+{
+    RunResult result;
+    int fds[2];
+    if (::pipe(fds) != 0)
+    {
+        result.failures = files.size();
+        return result;
+    }
+
+    const auto runStart = Clock::now();
+    const pid_t pid = ::fork();
+    if (pid == 0)
+    {
+        ::close(fds[0]);
+
+        std::vector<const char *> args{ config.ppedumpPath.c_str() };
+        for (const auto & flag : config.dumpFlags)
+        {
+            args.push_back(flag.c_str());
+        }
+        const ProgramFlags prog = processCmdLine(static_cast<int>(args.size()), args.data());
+
+        FileLoader fileLoader = FileLoader::Read;
+        parseFileLoader(loader.c_str(), fileLoader);
+        setFileLoader(fileLoader);
+
+        NullBuffer nullBuffer;
+        std::ostream nullStream{ &nullBuffer };
+
+        // One record per file: the latency, negative if it failed.
+        for (const auto & filename : files)
+        {
+            const auto start = Clock::now();
+            const bool ok = processFile(filename.c_str(), prog, nullStream, nullStream);
+            const double latency = ok ? secondsSince(start) : -1.0;
+            if (::write(fds[1], &latency, sizeof(latency)) != sizeof(latency))
+            {
+                ::_exit(1);
+            }
+        }
+        ::_exit(0);
+    }
+
+    ::close(fds[1]);
+    double latency = 0.0;
+    while (pid > 0 && ::read(fds[0], &latency, sizeof(latency)) == sizeof(latency))
+    {
+        if (latency < 0.0)
+        {
+            ++result.failures;
+        }
+        else
+        {
+            result.latencies.push_back(latency);
+        }
+    }
+    ::close(fds[0]);
+
+    int status = 0;
+    struct rusage usage;
+    if (pid > 0 && ::wait4(pid, &status, 0, &usage) == pid)
+    {
+        result.peakRssKB = maxRssKB(usage);
+    }
+    result.wallSecs = secondsSince(runStart);
+    result.failures += files.size() - std::min(files.size(), result.latencies.size() + result.failures);
+    return result;
+}
+
+// ========================================================
+// Report
+// ========================================================
+
+double percentile(std::vector<double> & sorted, const double p)
+{
+    if (sorted.empty())
+    {
+        return 0.0;
+    }
+    const auto index = static_cast<std::size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+void printHeader()
+{
+    std::cout << std::left
+              << std::setw(8)  << "mode"
+              << std::setw(10) << "loader"
+              << std::setw(6)  << "cache"
+              << std::right
+              << std::setw(8)  << "files"
+              << std::setw(11) << "files/s"
+              << std::setw(10) << "MB/s"
+              << std::setw(10) << "p50 ms"
+              << std::setw(10) << "p99 ms"
+              << std::setw(10) << "RSS MB"
+              << std::setw(7)  << "fails" << "\n";
+}
+
+void printRow(const std::string & mode, const std::string & loader, const std::string & cache,
+              const std::vector<RunResult> & runs, const std::uint64_t corpusBytes)
+{
+    std::vector<double> latencies;
+    double wallSecs = 0.0;
+    long peakRssKB = 0;
+    std::size_t failures = 0;
+    for (const auto & run : runs)
+    {
+        latencies.insert(latencies.end(), run.latencies.begin(), run.latencies.end());
+        wallSecs += run.wallSecs;
+        peakRssKB = std::max(peakRssKB, run.peakRssKB);
+        failures += run.failures;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    const double numRuns = static_cast<double>(runs.size());
+    const double files   = static_cast<double>(latencies.size() + failures) / numRuns;
+    const double secs    = std::max(wallSecs, 1e-9);
+
+    std::cout << std::left
+              << std::setw(8)  << mode
+              << std::setw(10) << loader
+              << std::setw(6)  << cache
+              << std::right << std::fixed
+              << std::setw(8)  << std::setprecision(0) << files
+              << std::setw(11) << std::setprecision(1) << files * numRuns / secs
+              << std::setw(10) << std::setprecision(1) << static_cast<double>(corpusBytes) * numRuns / secs / (1024.0 * 1024.0)
+              << std::setw(10) << std::setprecision(3) << percentile(latencies, 0.50) * 1000.0
+              << std::setw(10) << std::setprecision(3) << percentile(latencies, 0.99) * 1000.0
+              << std::setw(10) << std::setprecision(1) << static_cast<double>(peakRssKB) / 1024.0
+              << std::setw(7)  << failures << "\n";
+}
+
+void printHelpText(const char * progName)
+{
+    std::cout << "\n"
+        << "Usage:\n"
+        << " $ " << progName << " <files/dirs...> [options]\n"
+        << " Runs ppedump over the PEs found and prints throughput, per-file latency and peak RSS.\n"
+        << " Options are:\n"
+        << "  --ppedump <path>    The ppedump binary for the single mode (default ./ppedump).\n"
+        << "  --flags \"<flags>\"   Dump flags passed to ppedump (default \"-a\").\n"
+        << "  --mode <list>       single, batch or all (default).\n"
+        << "  --loader <list>     read, mmap, ondemand or all (default).\n"
+        << "  --cache <list>      warm, cold or all (default).\n"
+        << "  --runs <n>          Measured runs of each combination (default 3).\n"
+        << "  --drop-cmd <cmd>    Command that drops the page cache before cold runs,\n"
+        << "                      instead of evicting just the corpus files.\n"
+        << " Lists are comma separated, like --loader read,mmap.\n"
+        << "\n";
+}
+
+} // namespace {}
+
+int main(int argc, const char * argv[])
+{
+    BenchConfig config;
+    std::vector<std::string> inputPaths;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help")
+        {
+            printHelpText(argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if (arg[0] != '-')
+        {
+            inputPaths.push_back(arg);
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value for \"" << arg << "\"!\n";
+            return EXIT_FAILURE;
+        }
+
+        const std::string value = argv[++i];
+        if      (arg == "--ppedump")  { config.ppedumpPath = value; }
+        else if (arg == "--flags")    { config.dumpFlags   = splitWords(value); }
+        else if (arg == "--mode")     { config.modes       = splitList(value, "single batch"); }
+        else if (arg == "--loader")   { config.loaders     = splitList(value, "read mmap ondemand"); }
+        else if (arg == "--cache")    { config.caches      = splitList(value, "warm cold"); }
+        else if (arg == "--runs")     { config.numRuns     = std::max(1ul, std::strtoul(value.c_str(), nullptr, 10)); }
+        else if (arg == "--drop-cmd") { config.dropCommand = value; }
+        else
+        {
+            std::cerr << "Unknown option \"" << arg << "\"!\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (const auto & loader : config.loaders)
+    {
+        FileLoader unused;
+        if (!parseFileLoader(loader.c_str(), unused))
+        {
+            std::cerr << "Unknown loader \"" << loader << "\"!\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<std::string> files;
+    expandInputPaths(inputPaths, files);
+    std::sort(files.begin(), files.end());
+    if (files.empty())
+    {
+        printHelpText(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::uint64_t corpusBytes = 0;
+    for (const auto & filename : files)
+    {
+        struct stat st;
+        if (::stat(filename.c_str(), &st) == 0)
+        {
+            corpusBytes += static_cast<std::uint64_t>(st.st_size);
+        }
+    }
+
+    setColorPrintEnabled(false);
+    std::cout << files.size() << " files, " << std::fixed << std::setprecision(1)
+              << static_cast<double>(corpusBytes) / (1024.0 * 1024.0) << " MB, "
+              << config.numRuns << " runs each\n\n";
+    printHeader();
+
+    for (const auto & mode : config.modes)
+    {
+        const bool single = (mode == "single");
+        if (!single && mode != "batch")
+        {
+            std::cerr << "Unknown mode \"" << mode << "\"!\n";
+            return EXIT_FAILURE;
+        }
+
+        for (const auto & loader : config.loaders)
+        {
+            for (const auto & cache : config.caches)
+            {
+                const bool cold = (cache == "cold");
+                if (!cold && cache != "warm")
+                {
+                    std::cerr << "Unknown cache mode \"" << cache << "\"!\n";
+                    return EXIT_FAILURE;
+                }
+
+                if (!cold)
+                {
+                    single ? runSingle(files, loader, config) : runBatch(files, loader, config);
+                }
+
+                std::vector<RunResult> runs;
+                for (unsigned r = 0; r < config.numRuns; ++r)
+                {
+                    if (cold && !evictFromPageCache(files, config.dropCommand))
+                    {
+                        return EXIT_FAILURE;
+                    }
+                    runs.push_back(single ? runSingle(files, loader, config) : runBatch(files, loader, config));
+                }
+                printRow(mode, loader, cache, runs, corpusBytes);
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
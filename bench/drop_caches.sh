@@ -0,0 +1,11 @@
+#!/bin/sh
+# Drops the whole OS page cache, for the cold runs of ppecorpus:
+#   ./ppecorpus corpus/ --cache cold --drop-cmd bench/drop_caches.sh
+# Needs sudo. Without it, ppecorpus evicts just the corpus files.
+
+sync
+case "$(uname -s)" in
+    Linux)  echo 3 | sudo tee /proc/sys/vm/drop_caches > /dev/null ;;
+    Darwin) sudo purge ;;
+    *)      echo "drop_caches.sh: unsupported system $(uname -s)" >&2; exit 1 ;;
+esac
@@ -0,0 +1,968 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: micro_bench.cpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: Micro-benchmarks of the hot parsing primitives, reporting ns/op and allocations/op.
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+// The primitives are internal (static) to pe_image.cpp and portable_pe_dump.cpp,
+// so both are compiled right into this file, and so is the C API, to time it
+// with the same optimizations. The rest comes from libppedump.
+#include "../pe_image.cpp"
+#include "../portable_pe_dump.cpp"
+#include "../ppe_capi.cpp"
+
+// Both replace the global operator new.
+#ifdef PPEDUMP_TRACK_ALLOCS
+    #error "Build the micro-benchmarks without TRACK_ALLOCS"
+#endif // PPEDUMP_TRACK_ALLOCS
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <sstream>
+#include <streambuf>
+
+#include "synthetic_pe.hpp"
+
+/*
+-------------------------------------
+Methodology
+-------------------------------------
+
+Every benchmark body runs 'iterations' operations. The iteration count
+is first doubled until one sample takes at least the minimum sample time,
+then that many iterations are timed for a number of samples. Reported:
+
+  ns/op     median of the samples
+  +-        median absolute deviation of the samples, in % of the median
+  allocs/op heap allocations per operation (operator new calls)
+  bytes/op  heap bytes requested per operation
+
+The median and MAD are used rather than mean and standard deviation so
+that a sample hit by a context switch doesn't skew the result. Inputs
+come from the synthetic PE builder, so the numbers are comparable
+between revisions built and run on the same machine.
+
+-------------------------------------
+Regression gate
+-------------------------------------
+
+--json <file> saves the results. --compare <baseline> checks them
+against a saved run, bench/baseline.json by convention (make bench-check),
+and exits with 1 if any benchmark regressed:
+
+  time:   ns/op above the baseline by more than the benchmark's
+          tolerance, a fraction saved with each result;
+  allocs: allocs/op above the baseline by more than 1%, since the
+          allocation counts are deterministic.
+
+Refresh the baseline with --json bench/baseline.json on the reference
+machine whenever a change is meant to move the numbers.
+
+-------------------------------------
+*/
+
+// ========================================================
+// Allocation counting
+// ========================================================
+
+namespace benchalloc
+{
+    // The benchmarks are single threaded; plain counters are enough.
+    static bool          enabled    = false;
+    static std::uint64_t numAllocs  = 0;
+    static std::uint64_t numBytes   = 0;
+
+    // Out of line so that GCC doesn't pair the inlined malloc()
+    // with the operator delete overloads and warn of a mismatch.
+    #if defined(__GNUC__) || defined(__clang__)
+    __attribute__((noinline))
+    #endif // GCC/Clang
+    static void * allocate(const std::size_t size)
+    {
+        if (enabled)
+        {
+            ++numAllocs;
+            numBytes += size;
+        }
+        if (void * ptr = std::malloc(size != 0 ? size : 1))
+        {
+            return ptr;
+        }
+        throw std::bad_alloc{};
+    }
+
+    #if defined(__GNUC__) || defined(__clang__)
+    __attribute__((noinline))
+    #endif // GCC/Clang
+    static void release(void * ptr) noexcept
+    {
+        std::free(ptr);
+    }
+} // namespace benchalloc {}
+
+void * operator new(std::size_t size)
+{
+    return benchalloc::allocate(size);
+}
+
+void * operator new[](std::size_t size)
+{
+    return benchalloc::allocate(size);
+}
+
+void operator delete(void * ptr) noexcept
+{
+    benchalloc::release(ptr);
+}
+
+void operator delete[](void * ptr) noexcept
+{
+    benchalloc::release(ptr);
+}
+
+void operator delete(void * ptr, std::size_t) noexcept
+{
+    benchalloc::release(ptr);
+}
+
+void operator delete[](void * ptr, std::size_t) noexcept
+{
+    benchalloc::release(ptr);
+}
+
+namespace
+{
+
+// Keeps the compiler from optimizing away a result that is never used.
+template<class T>
+inline void doNotOptimize(const T & value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else // !GCC/Clang
+    static volatile const T * sink;
+    sink = &value;
+#endif // GCC/Clang
+}
+
+// Output stream that discards everything, for the dump functions.
+class NullBuffer final : public std::streambuf
+{
+protected:
+    int_type overflow(int_type c) override { return c; }
+    std::streamsize xsputn(const char *, std::streamsize count) override { return count; }
+};
+
+// ========================================================
+// Runner
+// ========================================================
+
+struct BenchResult
+{
+    std::string name{};
+    double      tolerance   = 0.0; // Allowed ns/op increase, as a fraction
+    double      nsPerOp     = 0.0;
+    double      madPercent  = 0.0;
+    double      allocsPerOp = 0.0;
+    double      bytesPerOp  = 0.0;
+    std::uint64_t iterations = 0;
+};
+
+struct BenchOptions
+{
+    unsigned numSamples    = 15;
+    double   minSampleSecs = 0.01;
+};
+
+using BenchBody = std::function<void(std::uint64_t iterations)>;
+
+double timeRun(const BenchBody & body, const std::uint64_t iterations)
+{
+    const auto start = std::chrono::steady_clock::now();
+    body(iterations);
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+// An aggregate (no member initializers) for the brace-initialized table in main().
+struct Benchmark
+{
+    std::string name;
+    double      tolerance; // See BenchResult::tolerance
+    BenchBody   body;
+};
+
+BenchResult runBenchmark(const Benchmark & bench, const BenchOptions & options)
+{
+    const BenchBody & body = bench.body;
+    BenchResult result;
+    result.name      = bench.name;
+    result.tolerance = bench.tolerance;
+
+    // Warm up and calibrate.
+    std::uint64_t iterations = 1;
+    while (timeRun(body, iterations) < options.minSampleSecs && iterations < (1ull << 40))
+    {
+        iterations *= 2;
+    }
+
+    std::vector<double> nsPerOp;
+    for (unsigned s = 0; s < options.numSamples; ++s)
+    {
+        nsPerOp.push_back(timeRun(body, iterations) * 1e9 / static_cast<double>(iterations));
+    }
+
+    std::sort(nsPerOp.begin(), nsPerOp.end());
+    const double median = nsPerOp[nsPerOp.size() / 2];
+
+    std::vector<double> deviations;
+    for (const double ns : nsPerOp)
+    {
+        deviations.push_back(std::fabs(ns - median));
+    }
+    std::sort(deviations.begin(), deviations.end());
+
+    // One separate, counted run. Counting is cheap, but it would
+    // still be noise in the timed samples.
+    benchalloc::numAllocs = 0;
+    benchalloc::numBytes  = 0;
+    benchalloc::enabled   = true;
+    body(iterations);
+    benchalloc::enabled   = false;
+
+    result.nsPerOp     = median;
+    result.madPercent  = (median > 0.0) ? deviations[deviations.size() / 2] * 100.0 / median : 0.0;
+    result.allocsPerOp = static_cast<double>(benchalloc::numAllocs) / static_cast<double>(iterations);
+    result.bytesPerOp  = static_cast<double>(benchalloc::numBytes)  / static_cast<double>(iterations);
+    result.iterations  = iterations;
+    return result;
+}
+
+void printResult(const BenchResult & r)
+{
+    std::cout << std::left  << std::setw(34) << r.name
+              << std::right << std::fixed
+              << std::setw(14) << std::setprecision(1) << r.nsPerOp << " ns/op"
+              << std::setw(7)  << std::setprecision(1) << r.madPercent << "%"
+              << std::setw(12) << std::setprecision(2) << r.allocsPerOp << " allocs/op"
+              << std::setw(14) << std::setprecision(1) << r.bytesPerOp << " B/op\n";
+}
+
+// ========================================================
+// Results file and the baseline comparison
+// ========================================================
+
+bool saveResults(const std::string & filename, const std::vector<BenchResult> & results)
+{
+    std::ofstream out{ filename };
+    out << "{\n  \"version\": 1,\n  \"benchmarks\": [\n";
+    for (std::size_t i = 0; i < results.size(); ++i)
+    {
+        const BenchResult & r = results[i];
+        out << std::fixed
+            << "    { \"name\": " << jsonString(r.name)
+            << ", \"ns_per_op\": "     << std::setprecision(2) << r.nsPerOp
+            << ", \"mad_percent\": "   << std::setprecision(2) << r.madPercent
+            << ", \"allocs_per_op\": " << std::setprecision(3) << r.allocsPerOp
+            << ", \"bytes_per_op\": "  << std::setprecision(1) << r.bytesPerOp
+            << ", \"tolerance\": "     << std::setprecision(2) << r.tolerance << " }"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+    return static_cast<bool>(out);
+}
+
+//
+// Just enough of a JSON reader for the results files: the "benchmarks"
+// array of flat objects with string and number values. Other keys and
+// values are skipped, so the file can be annotated by hand.
+//
+class ResultsReader
+{
+public:
+    explicit ResultsReader(const std::string & text) : text_{ text } { }
+
+    bool read(std::vector<BenchResult> & results)
+    {
+        return parseValue([&](const std::string & key) { return key == "benchmarks" ? &results : nullptr; }) && atEnd();
+    }
+
+private:
+    using ArrayFor = std::function<std::vector<BenchResult> * (const std::string &)>;
+
+    void skipSpaces()
+    {
+        while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_]))) { ++pos_; }
+    }
+    bool accept(const char c)
+    {
+        skipSpaces();
+        if (pos_ < text_.size() && text_[pos_] == c) { ++pos_; return true; }
+        return false;
+    }
+    bool atEnd()
+    {
+        skipSpaces();
+        return pos_ == text_.size();
+    }
+
+    bool parseString(std::string & str)
+    {
+        if (!accept('"')) { return false; }
+        str.clear();
+        while (pos_ < text_.size() && text_[pos_] != '"')
+        {
+            if (text_[pos_] == '\\' && pos_ + 1 < text_.size()) { ++pos_; } // Our names need no \u escapes
+            str += text_[pos_++];
+        }
+        return accept('"');
+    }
+
+    bool parseNumber(double & number)
+    {
+        skipSpaces();
+        const char * start = text_.c_str() + pos_;
+        char * end = nullptr;
+        number = std::strtod(start, &end);
+        pos_ += static_cast<std::size_t>(end - start);
+        return end != start;
+    }
+
+    // Objects fill 'result' if given; arrays of objects are read into
+    // the vector arrayFor() returns for their key, if any.
+    bool parseValue(const ArrayFor & arrayFor, BenchResult * result = nullptr, const std::string & key = "")
+    {
+        skipSpaces();
+        if (pos_ >= text_.size()) { return false; }
+
+        const char c = text_[pos_];
+        if (c == '{')
+        {
+            ++pos_;
+            if (accept('}')) { return true; }
+            do
+            {
+                std::string field;
+                if (!parseString(field) || !accept(':') || !parseMember(arrayFor, result, field)) { return false; }
+            } while (accept(','));
+            return accept('}');
+        }
+        if (c == '[')
+        {
+            ++pos_;
+            std::vector<BenchResult> * target = arrayFor(key);
+            if (accept(']')) { return true; }
+            do
+            {
+                BenchResult item;
+                if (!parseValue(arrayFor, &item)) { return false; }
+                if (target != nullptr) { target->push_back(item); }
+            } while (accept(','));
+            return accept(']');
+        }
+        if (c == '"')
+        {
+            std::string ignored;
+            return parseString(ignored);
+        }
+        if (std::isalpha(static_cast<unsigned char>(c))) // true, false, null
+        {
+            while (pos_ < text_.size() && std::isalpha(static_cast<unsigned char>(text_[pos_]))) { ++pos_; }
+            return true;
+        }
+        double ignored;
+        return parseNumber(ignored);
+    }
+
+    bool parseMember(const ArrayFor & arrayFor, BenchResult * result, const std::string & field)
+    {
+        if (result != nullptr)
+        {
+            double * number = nullptr;
+            if      (field == "name")          { return parseString(result->name); }
+            else if (field == "ns_per_op")     { number = &result->nsPerOp;     }
+            else if (field == "mad_percent")   { number = &result->madPercent;  }
+            else if (field == "allocs_per_op") { number = &result->allocsPerOp; }
+            else if (field == "bytes_per_op")  { number = &result->bytesPerOp;  }
+            else if (field == "tolerance")     { number = &result->tolerance;   }
+            if (number != nullptr) { return parseNumber(*number); }
+        }
+        return parseValue(arrayFor, nullptr, field);
+    }
+
+    const std::string & text_;
+    std::size_t pos_ = 0;
+};
+
+bool loadResults(const std::string & filename, std::vector<BenchResult> & results)
+{
+    std::ifstream in{ filename };
+    const std::string text{ std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+    return in.is_open() && ResultsReader{ text }.read(results);
+}
+
+// Prints a line per benchmark and returns the number of regressions.
+// A negative 'toleranceOverride' means use each baseline's own tolerance.
+int compareResults(const std::vector<BenchResult> & baseline, const std::vector<BenchResult> & current,
+                   const double toleranceOverride)
+{
+    std::cout << "\n" << std::left << std::setw(34) << "benchmark" << std::right
+              << std::setw(14) << "baseline ns" << std::setw(14) << "current ns"
+              << std::setw(10) << "change" << std::setw(8) << "limit" << "  result\n";
+
+    int numRegressions = 0;
+    for (const BenchResult & now : current)
+    {
+        const auto base = std::find_if(baseline.begin(), baseline.end(),
+                                       [&now](const BenchResult & b) { return b.name == now.name; });
+        std::cout << std::left << std::setw(34) << now.name << std::right << std::fixed << std::setprecision(1);
+        if (base == baseline.end())
+        {
+            std::cout << std::setw(14) << "-" << std::setw(14) << now.nsPerOp << std::setw(10) << "-"
+                      << std::setw(8) << "-" << "  new\n";
+            continue;
+        }
+
+        const double tolerance = (toleranceOverride >= 0.0) ? toleranceOverride : base->tolerance;
+        const double change = (base->nsPerOp > 0.0) ? (now.nsPerOp / base->nsPerOp - 1.0) : 0.0;
+        const bool slower = change > tolerance;
+        const bool moreAllocs = now.allocsPerOp > base->allocsPerOp * 1.01 + 0.005;
+
+        std::cout << std::setw(14) << base->nsPerOp << std::setw(14) << now.nsPerOp
+                  << std::setw(9) << std::showpos << change * 100.0 << "%"
+                  << std::setw(7) << std::setprecision(0) << tolerance * 100.0 << "%" << std::noshowpos << "  ";
+        if (slower || moreAllocs)
+        {
+            ++numRegressions;
+            std::cout << "REGRESSED" << (slower ? " (time)" : "");
+            if (moreAllocs)
+            {
+                std::cout << std::setprecision(2) << " (allocs/op " << base->allocsPerOp << " -> " << now.allocsPerOp << ")";
+            }
+            std::cout << "\n";
+        }
+        else
+        {
+            std::cout << ((change < -tolerance) ? "faster, update the baseline?" : "ok") << "\n";
+        }
+    }
+
+    std::cout << "\n" << numRegressions << " regression" << (numRegressions == 1 ? "" : "s") << "\n";
+    return numRegressions;
+}
+
+// ========================================================
+// Fixtures
+// ========================================================
+
+struct Fixture
+{
+    std::vector<std::uint8_t>  image{};
+    const pe::ImageDOSHeader * dosHeader = nullptr;
+    const pe::ImageNTHeader *  ntHeader  = nullptr;
+
+    Fixture() = default;
+    Fixture(const Fixture &) = delete;
+    Fixture & operator = (const Fixture &) = delete;
+
+    explicit Fixture(const SyntheticPEShape & shape)
+        : Fixture{ makeSyntheticPE(shape) }
+    { }
+
+    explicit Fixture(std::vector<std::uint8_t> && bytes)
+        : image{ std::move(bytes) }
+    {
+        std::ostringstream errors;
+        dosHeader = reinterpret_cast<const pe::ImageDOSHeader *>(image.data());
+        ntHeader  = validatePE(image.data(), image.size(), errors);
+        if (ntHeader == nullptr)
+        {
+            std::cerr << "Synthetic PE failed validation: " << errors.str() << "\n";
+            std::exit(EXIT_FAILURE);
+        }
+    }
+};
+
+// The fixture as the Windows loader maps it (PELayout::Mapped): the
+// headers, then each section's raw data at its RVA, zero padded.
+std::vector<std::uint8_t> mapSections(const Fixture & fixture)
+{
+    std::vector<std::uint8_t> mapped(fixture.ntHeader->optionalHeader.sizeOfImage);
+    layOutImage(fixture.image.data(), fixture.image.size(), fixture.ntHeader, mapped.data(), mapped.size(), std::cerr);
+    return mapped;
+}
+
+// The fixture written to a temporary file, for the benchmarks
+// that start from a path like the CLI does. Removed when done.
+class TempFile final
+{
+public:
+    TempFile(const Fixture & fixture, const std::string & name)
+    #ifdef PPEDUMP_POSIX
+        : path{ "/tmp/ppebench_" + std::to_string(getpid()) + "_" + name }
+    #else // !PPEDUMP_POSIX
+        : path{ "ppebench_" + name }
+    #endif // PPEDUMP_POSIX
+    {
+        std::ofstream file{ path, std::ios::binary };
+        file.write(reinterpret_cast<const char *>(fixture.image.data()), static_cast<std::streamsize>(fixture.image.size()));
+        if (!file)
+        {
+            std::cerr << "Unable to write \"" << path << "\"!\n";
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    ~TempFile() { std::remove(path.c_str()); }
+
+    TempFile(const TempFile &) = delete;
+    TempFile & operator = (const TempFile &) = delete;
+
+    const std::string path;
+};
+
+// Adds up the name lengths, like the C API benchmark does.
+class NameLengthVisitor final
+    : public PEVisitor
+{
+public:
+    void onImportSymbol(const ImportedDllRef &, const ImportedSymbolRef & symbol) override { total += symbol.name.length; }
+    void onExport(const ExportedSymbolRef & symbol) override { total += symbol.name.length; }
+
+    std::size_t total = 0;
+};
+
+// RVAs spread over all the sections, plus a few that hit none.
+std::vector<std::uint32_t> sampleRVAs(const Fixture & fixture, const std::size_t count)
+{
+    std::vector<std::uint32_t> rvas;
+    const std::uint32_t numSections = fixture.ntHeader->fileHeader.numberOfSections;
+    const pe::ImageSectionHeader * sections = getFirstSection(fixture.ntHeader);
+    std::uint32_t state = 12345;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        state = state * 1103515245u + 12345u;
+        if (i % 16 == 15)
+        {
+            rvas.push_back(0xFFFF0000u + (state & 0xFFFF)); // Miss
+            continue;
+        }
+        const pe::ImageSectionHeader & section = sections[(state >> 8) % numSections];
+        rvas.push_back(section.virtualAddress + (state >> 4) % std::max<std::uint32_t>(section.misc.virtualSize, 1));
+    }
+    return rvas;
+}
+
+} // namespace {}
+
+int main(int argc, const char * argv[])
+{
+    BenchOptions options;
+    std::string filter;
+    std::string jsonOutput;
+    std::string baselineInput;
+    double toleranceOverride = -1.0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+        {
+            filter = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+        {
+            options.numSamples = std::max(1u, static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10)));
+        }
+        else if (std::strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+        {
+            options.minSampleSecs = std::strtod(argv[++i], nullptr);
+        }
+        else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+        {
+            jsonOutput = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--compare") == 0 && i + 1 < argc)
+        {
+            baselineInput = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+        {
+            toleranceOverride = std::strtod(argv[++i], nullptr);
+        }
+        else
+        {
+            std::cout << "Usage: " << argv[0] << " [--filter <substring>] [--samples <n>] [--min-time <seconds>]\n"
+                      << "       [--json <results>] [--compare <baseline>] [--tolerance <fraction>]\n";
+            return (std::strcmp(argv[i], "-h") == 0 || std::strcmp(argv[i], "--help") == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    // Read first, so a bad path doesn't cost a whole run.
+    std::vector<BenchResult> baseline;
+    if (!baselineInput.empty() && !loadResults(baselineInput, baseline))
+    {
+        std::cerr << "Unable to read the baseline \"" << baselineInput << "\"!\n";
+        return EXIT_FAILURE;
+    }
+
+    setColorPrintEnabled(false);
+
+    SyntheticPEShape manySections;
+    manySections.numSections = 96;
+    const Fixture sectionsPE{ manySections };
+
+    SyntheticPEShape manyExports;
+    manyExports.numExports    = 100000;
+    manyExports.numForwarders = 100;
+    const Fixture exportsPE{ manyExports };
+    const TempFile exportsFile{ exportsPE, "exports.dll" };
+
+    // Same, with page aligned sections, which FileContents::loadImage() maps in place.
+    manyExports.fileAlignment = 0x1000;
+    const TempFile exportsAlignedFile{ Fixture{ manyExports }, "exports_aligned.dll" };
+
+    SyntheticPEShape manyImports;
+    manyImports.numImportDlls = 40;
+    manyImports.importsPerDll = 300;
+    const Fixture importsPE{ manyImports };
+    const Fixture importsMappedPE{ mapSections(importsPE) };
+
+    SyntheticPEShape manyRelocations;
+    manyRelocations.pe32Plus       = true;
+    manyRelocations.numRelocations = 100000;
+    const Fixture relocsPE{ manyRelocations };
+    std::vector<std::uint8_t> relocsImage(relocsPE.ntHeader->optionalHeader.sizeOfImage);
+    layOutImage(relocsPE.image.data(), relocsPE.image.size(), relocsPE.ntHeader, relocsImage.data(), relocsImage.size(), std::cerr);
+
+    // An import library for 60 DLLs of 1000 exports, under the 65535 members
+    // the sorted (second) linker member can index.
+    SyntheticPEShape libraryImports;
+    libraryImports.pe32Plus      = true;
+    libraryImports.numImportDlls = 60;
+    libraryImports.importsPerDll = 1000;
+    const std::vector<std::uint8_t> importLibrary = makeSyntheticImportLibrary(libraryImports);
+    const FileView importLibraryView{ importLibrary.data(), importLibrary.size() };
+    Archive importArchive;
+    readArchive(importLibraryView, importArchive, std::cerr);
+    std::vector<std::string> archiveNames;
+    for (std::size_t s = 0; s < importArchive.symbols.size(); s += importArchive.symbols.size() / 1024 + 1)
+    {
+        archiveNames.push_back(reinterpret_cast<const char *>(importLibrary.data() + importArchive.symbols[s].nameOffset));
+    }
+
+    // An object compiled with function-level linking: 20000 COMDAT sections
+    // of a function each, every one calling 8 of the 1000 imports.
+    SyntheticPEShape objectFunctions;
+    objectFunctions.pe32Plus       = true;
+    objectFunctions.numExports     = 20000;
+    objectFunctions.numImportDlls  = 10;
+    objectFunctions.importsPerDll  = 100;
+    objectFunctions.numRelocations = 8;
+    const std::vector<std::uint8_t> objectFile = makeSyntheticObject(objectFunctions);
+    const FileView objectView{ objectFile.data(), objectFile.size() };
+    CoffObject coffObject;
+    readCoffObject(objectView, coffObject, std::cerr);
+
+    SyntheticPEShape mixed;
+    mixed.numImportDlls = 10;
+    mixed.importsPerDll = 100;
+    mixed.numExports    = 2000;
+    const Fixture  mixedPE{ mixed };
+    const TempFile mixedFile{ mixedPE, "mixed.dll" };
+    PEImage mixedImage;
+    mixedImage.load(mixedFile.path.c_str(), std::cerr);
+
+    // What 'ppedump -a' does.
+    ProgramFlags dumpAll;
+    dumpAll.flagDumpNTHeaders      = true;
+    dumpAll.flagDumpSectionHeaders = true;
+    dumpAll.flagDumpDOSJunk        = true;
+    dumpAll.flagDumpExportsSection = true;
+    dumpAll.flagDumpImportsSection = true;
+
+    const std::vector<std::uint32_t> rvas96 = sampleRVAs(sectionsPE, 1024);
+
+    std::vector<std::string> mangledNames;
+    for (const auto & symbol : [&exportsPE]() {
+             PEExportTable table;
+             collectExports(exportsPE.dosHeader, exportsPE.ntHeader, exportsPE.image.size(), table);
+             return table.symbols;
+         }())
+    {
+        if (symbol.name[0] == '?' && mangledNames.size() < 1024) { mangledNames.push_back(symbol.name); }
+    }
+
+    PEExportTable exportsTable;
+    collectExports(exportsPE.dosHeader, exportsPE.ntHeader, exportsPE.image.size(), exportsTable);
+    PEImportTable importsTable;
+    collectImports(importsPE.dosHeader, importsPE.ntHeader, importsPE.image.size(), importsTable);
+
+    NullBuffer nullBuffer;
+    std::ostream nullStream{ &nullBuffer };
+
+    // Tolerances reflect how noisy each benchmark is run to run:
+    // the output formatters depend on iostream and the allocator.
+    const std::vector<Benchmark> benchmarks = {
+        { "findRVASection/96-sections", 0.15, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                doNotOptimize(findRVASection(rvas96[i & 1023], sectionsPE.ntHeader));
+            }
+        }},
+        { "offsetFromRVA/96-sections", 0.15, [&](const std::uint64_t n) {
+            std::uint32_t offset = 0;
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                doNotOptimize(offsetFromRVA(rvas96[i & 1023], sectionsPE.ntHeader, offset));
+            }
+        }},
+        { "collectExports/100k", 0.10, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                PEExportTable table;
+                collectExports(exportsPE.dosHeader, exportsPE.ntHeader, exportsPE.image.size(), table);
+                doNotOptimize(table.symbols.size());
+            }
+        }},
+        { "dumpExportsSection/100k", 0.20, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                dumpExportsSection(nullStream, exportsTable);
+            }
+        }},
+        { "collectImports/40x300", 0.10, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                PEImportTable table;
+                collectImports(importsPE.dosHeader, importsPE.ntHeader, importsPE.image.size(), table);
+                doNotOptimize(table.modules.size());
+            }
+        }},
+        { "collectImports/40x300/mapped", 0.10, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                // RVAs are the offsets: no section lookup per symbol.
+                PEImportTable table;
+                collectImports(importsMappedPE.dosHeader, importsMappedPE.ntHeader, importsMappedPE.image.size(), table, PELayout::Mapped);
+                doNotOptimize(table.modules.size());
+            }
+        }},
+        { "ImportRange/first-dll/40x300", 0.15, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                // Only decodes what's looked at: one DLL and its symbols, no copies.
+                const ImportRange imports{ importsPE.image.data(), importsPE.image.size(), importsPE.ntHeader };
+                std::size_t numSymbols = 0;
+                for (const auto & dll : imports)
+                {
+                    for (const auto & symbol : dll.symbols)
+                    {
+                        numSymbols += symbol.name.length;
+                    }
+                    break;
+                }
+                doNotOptimize(numSymbols);
+            }
+        }},
+        { "layOutImage/relocs100k", 0.15, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                doNotOptimize(layOutImage(relocsPE.image.data(), relocsPE.image.size(), relocsPE.ntHeader,
+                                          relocsImage.data(), relocsImage.size(), std::cerr));
+            }
+        }},
+        { "rebaseImage/dir64/100k", 0.15, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                // Back and forth, so every iteration has a delta to apply.
+                RebaseInfo info;
+                rebaseImage(relocsImage.data(), relocsImage.size(), (i & 1) ? 0x7FF700000000 : 0x180000000, info, std::cerr);
+                doNotOptimize(info.numRelocations);
+            }
+        }},
+        { "loadImage/copied/100k-exports", 0.20, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                FileContents image;
+                doNotOptimize(image.loadImage(exportsFile.path.c_str(), std::cerr));
+            }
+        }},
+        { "loadImage/mapped/100k-exports", 0.20, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                // Sections mapped copy-on-write, not copied.
+                FileContents image;
+                doNotOptimize(image.loadImage(exportsAlignedFile.path.c_str(), std::cerr));
+            }
+        }},
+        { "readArchive/60k-imports", 0.15, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                Archive archive;
+                readArchive(importLibraryView, archive, std::cerr);
+                doNotOptimize(archive.symbols.size());
+            }
+        }},
+        { "readArchiveImport/60k-imports", 0.15, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                ArchiveImport import;
+                std::size_t nameBytes = 0;
+                for (const auto & member : importArchive.members)
+                {
+                    readArchiveImport(importLibraryView, member, import);
+                    nameBytes += import.importName.size();
+                }
+                doNotOptimize(nameBytes);
+            }
+        }},
+        { "findArchiveSymbol/60k-imports", 0.15, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                doNotOptimize(findArchiveSymbol(importLibraryView, importArchive, archiveNames[i % archiveNames.size()].c_str()));
+            }
+        }},
+        { "readCoffObject+symbols/20k-functions", 0.15, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                CoffObject object;
+                readCoffObject(objectView, object, std::cerr);
+                CoffSymbol symbol;
+                std::size_t nameBytes = 0;
+                for (std::uint32_t s = 0; readCoffSymbol(objectView, object, s, symbol); s += 1 + symbol.numAuxSymbols)
+                {
+                    nameBytes += symbol.name.length;
+                }
+                doNotOptimize(nameBytes);
+            }
+        }},
+        { "coffRelocations/20k-functions", 0.15, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                // Each relocation with the name of its symbol, as --obj -r prints them.
+                CoffSymbol symbol;
+                std::size_t nameBytes = 0;
+                for (const auto & section : coffObject.sections)
+                {
+                    std::uint32_t count = 0;
+                    const pe::ImageRelocation * relocations = coffRelocations(objectView, section, count);
+                    for (std::uint32_t r = 0; relocations != nullptr && r < count; ++r)
+                    {
+                        readCoffSymbol(objectView, coffObject, relocations[r].symbolTableIndex, symbol);
+                        nameBytes += symbol.name.length;
+                    }
+                }
+                doNotOptimize(nameBytes);
+            }
+        }},
+        { "dumpImportsSection/40x300", 0.20, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                dumpImportsSection(nullStream, importsTable);
+            }
+        }},
+        { "demangle/msvc", 0.10, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                doNotOptimize(demangle(mangledNames[i % mangledNames.size()]));
+            }
+        }},
+        { "processFile/-a/mixed", 0.15, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                doNotOptimize(processFile(mixedFile.path.c_str(), dumpAll, nullStream, nullStream));
+            }
+        }},
+        { "PEImage/load+tables/mixed", 0.15, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                PEImage image;
+                image.load(mixedFile.path.c_str(), nullStream);
+                doNotOptimize(image.imports().modules.size() + image.exports().symbols.size());
+            }
+        }},
+        { "ppe_capi/open+tables/mixed", 0.15, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                // In memory already, so no load; the walks copy no names.
+                ppe_image * image = nullptr;
+                ppe_open_mem(mixedPE.image.data(), mixedPE.image.size(), nullptr, &image);
+                std::size_t numEntries = 0;
+                ppe_import_dll dll;
+                ppe_import_symbol importedSymbol;
+                ppe_imports_begin(image);
+                while (ppe_imports_next(image, &dll) == PPE_OK)
+                {
+                    while (ppe_import_symbols_next(image, &importedSymbol) == PPE_OK)
+                    {
+                        numEntries += importedSymbol.name.length;
+                    }
+                }
+                ppe_export exportedSymbol;
+                ppe_exports_begin(image, nullptr);
+                while (ppe_exports_next(image, &exportedSymbol) == PPE_OK)
+                {
+                    numEntries += exportedSymbol.name.length;
+                }
+                ppe_close(image);
+                doNotOptimize(numEntries);
+            }
+        }},
+        { "PEVisitor/tables/mixed", 0.20, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                // Loaded once; only the walk and the callbacks are timed.
+                NameLengthVisitor visitor;
+                mixedImage.visit(visitor);
+                doNotOptimize(visitor.total);
+            }
+        }},
+        { "toHexa", 0.15, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                doNotOptimize(toHexa(static_cast<std::uint32_t>(i * 2654435761u), 8));
+            }
+        }},
+        { "sectionCharacteristics", 0.15, [&](const std::uint64_t n) {
+            for (std::uint64_t i = 0; i < n; ++i)
+            {
+                doNotOptimize(sectionCharacteristics(static_cast<std::uint32_t>(i * 2654435761u)));
+            }
+        }}
+    };
+
+    std::vector<BenchResult> results;
+    for (const auto & bench : benchmarks)
+    {
+        if (filter.empty() || bench.name.find(filter) != std::string::npos)
+        {
+            results.push_back(runBenchmark(bench, options));
+            printResult(results.back());
+        }
+    }
+
+    if (!jsonOutput.empty() && !saveResults(jsonOutput, results))
+    {
+        std::cerr << "Unable to write \"" << jsonOutput << "\"!\n";
+        return EXIT_FAILURE;
+    }
+    if (!baselineInput.empty() && compareResults(baseline, results, toleranceOverride) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
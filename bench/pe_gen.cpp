@@ -0,0 +1,158 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: pe_gen.cpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: Generates synthetic PE32/PE32+ files of configurable shape, for benchmarks and scaling tests.
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "synthetic_pe.hpp"
+
+namespace
+{
+
+bool writePE(const std::string & filename, const SyntheticPEShape & shape)
+{
+    const std::vector<std::uint8_t> image = makeSyntheticPE(shape);
+    std::ofstream file{ filename, std::ios::binary };
+    file.write(reinterpret_cast<const char *>(image.data()), static_cast<std::streamsize>(image.size()));
+    return static_cast<bool>(file);
+}
+
+void printHelpText(const char * progName)
+{
+    std::cout << "\n"
+        << "Usage:\n"
+        << " $ " << progName << " <output.dll> [options]\n"
+        << " Writes one synthetic PE with the given shape. Options are:\n"
+        << "  --pe32plus          Writes a PE32+ (x64) file instead of PE32 (x86).\n"
+        << "  --sections <n>      Total number of sections (filler sections are added; max 96).\n"
+        << "  --import-dlls <n>   Number of imported DLLs (default 2).\n"
+        << "  --imports <n>       Imported functions per DLL (default 8).\n"
+        << "  --exports <n>       Number of exported functions.\n"
+        << "  --forwarders <n>    Number of forwarded exports.\n"
+        << "  --relocs <n>        Number of base relocations.\n"
+        << "  --resources <n>     Number of RT_RCDATA resources.\n"
+        << "  --mangled <pct>     Percentage of C++ decorated names (default 25).\n"
+        << "  --file-align <n>    FileAlignment, a power of two from 0x200 to 0x10000 (default 0x200).\n"
+        << "  --seed <n>          Seed for the names and sizes (default 1).\n"
+        << "\n"
+        << " $ " << progName << " --corpus <dir> --count <n> [--seed <n>]\n"
+        << " Writes <n> files of varied shapes into <dir>, which must exist.\n"
+        << "\n";
+}
+
+} // namespace {}
+
+int main(int argc, const char * argv[])
+{
+    if (argc <= 1)
+    {
+        printHelpText(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    SyntheticPEShape shape;
+    std::string output;
+    std::string corpusDir;
+    std::uint32_t corpusCount = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help")
+        {
+            printHelpText(argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if (arg == "--pe32plus")
+        {
+            shape.pe32Plus = true;
+            continue;
+        }
+        if (arg[0] != '-')
+        {
+            output = arg;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value for \"" << arg << "\"!\n";
+            return EXIT_FAILURE;
+        }
+
+        const char * value = argv[++i];
+        const auto number = static_cast<std::uint32_t>(std::strtoul(value, nullptr, 0));
+        if      (arg == "--sections")    { shape.numSections    = number; }
+        else if (arg == "--import-dlls") { shape.numImportDlls  = number; }
+        else if (arg == "--imports")     { shape.importsPerDll  = number; }
+        else if (arg == "--exports")     { shape.numExports     = number; }
+        else if (arg == "--forwarders")  { shape.numForwarders  = number; }
+        else if (arg == "--relocs")      { shape.numRelocations = number; }
+        else if (arg == "--resources")   { shape.numResources   = number; }
+        else if (arg == "--mangled")     { shape.mangledPercent = number; }
+        else if (arg == "--file-align")  { shape.fileAlignment  = number; }
+        else if (arg == "--seed")        { shape.seed           = number; }
+        else if (arg == "--corpus")      { corpusDir            = value;  }
+        else if (arg == "--count")       { corpusCount          = number; }
+        else
+        {
+            std::cerr << "Unknown option \"" << arg << "\"!\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (shape.fileAlignment < 0x200 || shape.fileAlignment > 0x10000 || (shape.fileAlignment & (shape.fileAlignment - 1)) != 0)
+    {
+        std::cerr << "Invalid --file-align " << shape.fileAlignment << "!\n";
+        return EXIT_FAILURE;
+    }
+
+    if (!corpusDir.empty())
+    {
+        std::mt19937 rng{ shape.seed };
+        for (std::uint32_t n = 0; n < corpusCount; ++n)
+        {
+            const SyntheticPEShape fileShape = randomSyntheticPEShape(rng, shape.seed + n);
+            char filename[64];
+            std::snprintf(filename, sizeof(filename), "/synth_%06u.%s", n, fileShape.numExports ? "dll" : "exe");
+            if (!writePE(corpusDir + filename, fileShape))
+            {
+                std::cerr << "Unable to write \"" << corpusDir << filename << "\"!\n";
+                return EXIT_FAILURE;
+            }
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (output.empty())
+    {
+        std::cerr << "No output file given!\n";
+        return EXIT_FAILURE;
+    }
+    if (!writePE(output, shape))
+    {
+        std::cerr << "Unable to write \"" << output << "\"!\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
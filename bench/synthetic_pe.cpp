@@ -0,0 +1,827 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: synthetic_pe.cpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: Builds synthetic PE32/PE32+ images (see synthetic_pe.hpp).
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "synthetic_pe.hpp"
+
+/*
+-------------------------------------
+Generated file layout
+-------------------------------------
+
+  headers    DOS header + stub, NT headers, section table
+  .text      One 'ret' per exported function
+  .rdata     Import descriptors/thunks/names, then the export directory
+  .rsrc      RT_RCDATA resources (optional)
+  .reloc     Base relocations (optional)
+  .sNNN      Filler sections, up to the requested section count
+
+The files are valid as far as the Windows loader rules for the
+structures the dumper reads are concerned (alignment, RVAs inside
+sections, sorted export names, forwarder strings inside the export
+directory range), but the code is never meant to run.
+
+Shapes are deterministic for a given set of options and --seed, so a
+corpus can be regenerated anywhere instead of being shared.
+
+-------------------------------------
+*/
+
+namespace
+{
+
+const std::uint32_t SectionAlignment = 0x1000;
+const std::uint32_t DOSHeaderSize    = 0x80; // Header + stub; e_lfanew
+const std::uint32_t MaxSections      = 96;   // Loader limit
+
+
+inline std::uint32_t alignUp(const std::uint32_t value, const std::uint32_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// ========================================================
+// Little-endian byte buffer
+// ========================================================
+
+class ByteBuffer
+{
+public:
+    std::vector<std::uint8_t> bytes{};
+
+    std::uint32_t size() const { return static_cast<std::uint32_t>(bytes.size()); }
+
+    void u8(const std::uint8_t v)   { bytes.push_back(v); }
+    void u16(const std::uint16_t v) { u8(v & 0xFF); u8(static_cast<std::uint8_t>(v >> 8)); }
+    void u32(const std::uint32_t v) { u16(v & 0xFFFF); u16(static_cast<std::uint16_t>(v >> 16)); }
+    void u64(const std::uint64_t v) { u32(v & 0xFFFFFFFF); u32(static_cast<std::uint32_t>(v >> 32)); }
+
+    void str(const std::string & s) { bytes.insert(bytes.end(), s.begin(), s.end()); u8(0); }
+    void pad(const std::uint32_t alignment) { while (size() % alignment) { u8(0); } }
+    void zeros(const std::uint32_t count) { bytes.resize(bytes.size() + count, 0); }
+
+    void patch32(const std::uint32_t offset, const std::uint32_t v)
+    {
+        for (int i = 0; i < 4; ++i) { bytes[offset + i] = static_cast<std::uint8_t>(v >> (i * 8)); }
+    }
+    void patch64(const std::uint32_t offset, const std::uint64_t v)
+    {
+        patch32(offset, static_cast<std::uint32_t>(v));
+        patch32(offset + 4, static_cast<std::uint32_t>(v >> 32));
+    }
+};
+
+struct Section
+{
+    std::string   name{};
+    std::uint32_t characteristics = 0;
+    std::uint32_t rva             = 0;
+    std::uint32_t virtualSize     = 0;
+    ByteBuffer    data{};
+};
+
+// Data directory entries filled while building the sections.
+struct DataDirs
+{
+    std::uint32_t rva[16]  = {};
+    std::uint32_t size[16] = {};
+};
+
+enum DirIndex { DirExports = 0, DirImports = 1, DirResources = 2, DirRelocations = 5, DirIAT = 12 };
+
+// ========================================================
+// Name generation
+// ========================================================
+
+class NameGen
+{
+public:
+    NameGen(const std::uint32_t seed, const std::uint32_t mangledPercent)
+        : rng_{ seed }
+        , mangledPercent_{ mangledPercent }
+    { }
+
+    // Unique for a given index; a share of them MSVC decorated.
+    std::string function(const std::uint32_t index)
+    {
+        static const char * verbs[] = { "Get", "Set", "Create", "Destroy", "Query", "Update", "Open", "Close" };
+        static const char * nouns[] = { "Buffer", "Device", "Handle", "Context", "Surface", "Stream", "Thread", "Value" };
+
+        const char * verb = verbs[rng_() % 8];
+        const char * noun = nouns[rng_() % 8];
+        const std::string base = std::string(verb) + noun + std::to_string(index);
+
+        if ((rng_() % 100) < mangledPercent_)
+        {
+            // ?Method@Class@@QAEXH@Z -> void Class::Method(int)
+            return "?" + base + "@C" + noun + "@@QAEXH@Z";
+        }
+        return base;
+    }
+
+    std::uint32_t next() { return rng_(); }
+
+private:
+    std::mt19937  rng_;
+    std::uint32_t mangledPercent_;
+};
+
+// ========================================================
+// Section builders
+// ========================================================
+
+void buildText(Section & text, const SyntheticPEShape & shape)
+{
+    text.name            = ".text";
+    text.characteristics = 0x60000020; // CODE | EXECUTE | READ
+    // One 'ret' per export, plus the entry point.
+    text.data.zeros(std::max<std::uint32_t>(shape.numExports, 1) + 1);
+    std::fill(text.data.bytes.begin(), text.data.bytes.end(), 0xC3);
+}
+
+void buildRData(Section & rdata, const SyntheticPEShape & shape, const std::uint32_t textRVA, NameGen & names, DataDirs & dirs)
+{
+    rdata.name            = ".rdata";
+    rdata.characteristics = 0x40000040; // INITIALIZED_DATA | READ
+    ByteBuffer & buf      = rdata.data;
+    const std::uint32_t base = rdata.rva;
+    const std::uint32_t thunkSize = shape.pe32Plus ? 8 : 4;
+
+    // --- Imports ---
+    if (shape.numImportDlls != 0)
+    {
+        // Descriptors (plus the null one), then all the ILTs, then all the
+        // IATs (one contiguous IAT directory), then the hint/names and DLL names.
+        const std::uint32_t count      = shape.importsPerDll;
+        const std::uint32_t thunksSize = (count + 1) * thunkSize;
+        const std::uint32_t descOffset = buf.size();
+        buf.zeros((shape.numImportDlls + 1) * 20);
+        buf.pad(8);
+        const std::uint32_t iltStart = buf.size();
+        buf.zeros(shape.numImportDlls * thunksSize);
+        const std::uint32_t iatStart = buf.size();
+        buf.zeros(shape.numImportDlls * thunksSize);
+        const std::uint32_t iatEnd = buf.size();
+
+        for (std::uint32_t d = 0; d < shape.numImportDlls; ++d)
+        {
+            const std::uint32_t iltOffset = iltStart + d * thunksSize;
+            const std::uint32_t iatOffset = iatStart + d * thunksSize;
+
+            for (std::uint32_t i = 0; i < count; ++i)
+            {
+                std::uint64_t thunk;
+                if (i % 16 == 15)
+                {
+                    // Every 16th import is by ordinal.
+                    thunk = (shape.pe32Plus ? (1ull << 63) : (1ull << 31)) | (i + 1);
+                }
+                else
+                {
+                    buf.pad(2);
+                    thunk = base + buf.size();
+                    buf.u16(static_cast<std::uint16_t>(i)); // Hint
+                    buf.str(names.function(d * 100000 + i));
+                }
+                if (shape.pe32Plus)
+                {
+                    buf.patch64(iltOffset + i * 8, thunk);
+                    buf.patch64(iatOffset + i * 8, thunk);
+                }
+                else
+                {
+                    buf.patch32(iltOffset + i * 4, static_cast<std::uint32_t>(thunk));
+                    buf.patch32(iatOffset + i * 4, static_cast<std::uint32_t>(thunk));
+                }
+            }
+
+            const std::uint32_t dllNameRVA = base + buf.size();
+            buf.str("synth" + std::to_string(d) + ".dll");
+
+            const std::uint32_t desc = descOffset + d * 20;
+            buf.patch32(desc + 0,  base + iltOffset); // OriginalFirstThunk
+            buf.patch32(desc + 12, dllNameRVA);
+            buf.patch32(desc + 16, base + iatOffset); // FirstThunk
+        }
+
+        dirs.rva[DirImports]  = base + descOffset;
+        dirs.size[DirImports] = (shape.numImportDlls + 1) * 20;
+        dirs.rva[DirIAT]      = base + iatStart;
+        dirs.size[DirIAT]     = iatEnd - iatStart;
+    }
+
+    // --- Exports ---
+    const std::uint32_t numFunctions = shape.numExports + shape.numForwarders;
+    if (numFunctions != 0)
+    {
+        buf.pad(8);
+        const std::uint32_t dirOffset = buf.size();
+        buf.zeros(40);
+
+        const std::uint32_t functionsOffset = buf.size();
+        buf.zeros(numFunctions * 4);
+
+        // Names must be sorted for the loader's binary search.
+        struct Named { std::string name; std::uint16_t ordinal; };
+        std::vector<Named> named;
+        // Name ordinals are 16 bits, so functions past 0xFFFF are exported by ordinal only.
+        for (std::uint32_t i = 0; i < shape.numExports; ++i)
+        {
+            if (i <= 0xFFFF)
+            {
+                named.push_back({ names.function(500000 + i), static_cast<std::uint16_t>(i) });
+            }
+            buf.patch32(functionsOffset + i * 4, textRVA + i);
+        }
+
+        // Forwarder strings live inside the export directory range.
+        for (std::uint32_t f = 0; f < shape.numForwarders; ++f)
+        {
+            const std::uint32_t index = shape.numExports + f;
+            buf.patch32(functionsOffset + index * 4, base + buf.size());
+            buf.str("synth" + std::to_string(f % std::max<std::uint32_t>(shape.numImportDlls, 1)) + ".Forwarded" + std::to_string(f));
+            if (index <= 0xFFFF)
+            {
+                named.push_back({ "Fwd" + std::to_string(f), static_cast<std::uint16_t>(index) });
+            }
+        }
+
+        std::sort(named.begin(), named.end(), [](const Named & a, const Named & b) { return a.name < b.name; });
+
+        buf.pad(4);
+        const std::uint32_t namesOffset = buf.size();
+        buf.zeros(static_cast<std::uint32_t>(named.size()) * 4);
+        const std::uint32_t ordinalsOffset = buf.size();
+        for (const Named & n : named) { buf.u16(n.ordinal); }
+
+        const std::uint32_t moduleNameRVA = base + buf.size();
+        buf.str("synthetic.dll");
+
+        for (std::size_t n = 0; n < named.size(); ++n)
+        {
+            buf.patch32(namesOffset + static_cast<std::uint32_t>(n) * 4, base + buf.size());
+            buf.str(named[n].name);
+        }
+
+        buf.patch32(dirOffset + 12, moduleNameRVA);
+        buf.patch32(dirOffset + 16, 1); // Ordinal base
+        buf.patch32(dirOffset + 20, numFunctions);
+        buf.patch32(dirOffset + 24, static_cast<std::uint32_t>(named.size()));
+        buf.patch32(dirOffset + 28, base + functionsOffset);
+        buf.patch32(dirOffset + 32, base + namesOffset);
+        buf.patch32(dirOffset + 36, base + ordinalsOffset);
+
+        dirs.rva[DirExports]  = base + dirOffset;
+        dirs.size[DirExports] = buf.size() - dirOffset;
+    }
+
+    if (buf.size() == 0)
+    {
+        buf.zeros(16);
+    }
+}
+
+void buildResources(Section & rsrc, const SyntheticPEShape & shape, NameGen & names, DataDirs & dirs)
+{
+    rsrc.name            = ".rsrc";
+    rsrc.characteristics = 0x40000040;
+    ByteBuffer & buf     = rsrc.data;
+    const std::uint32_t count = shape.numResources;
+
+    // IMAGE_RESOURCE_DIRECTORY: 16 bytes + 8 per entry.
+    auto directory = [&buf](const std::uint32_t numIdEntries)
+    {
+        buf.zeros(12);
+        buf.u16(0);                                       // Named entries
+        buf.u16(static_cast<std::uint16_t>(numIdEntries)); // Id entries
+    };
+
+    // Root -> RT_RCDATA -> N ids -> 1 language each -> data entry.
+    directory(1);
+    const std::uint32_t rootEntry = buf.size();
+    buf.zeros(8);
+
+    const std::uint32_t typeDir = buf.size();
+    directory(count);
+    const std::uint32_t typeEntries = buf.size();
+    buf.zeros(count * 8);
+
+    buf.patch32(rootEntry,     10);                      // RT_RCDATA
+    buf.patch32(rootEntry + 4, 0x80000000u | typeDir);  // Subdirectory
+
+    std::vector<std::uint32_t> dataEntryOffsets;
+    for (std::uint32_t r = 0; r < count; ++r)
+    {
+        const std::uint32_t langDir = buf.size();
+        directory(1);
+        buf.u32(0x409);                 // en-US
+        const std::uint32_t langEntryTarget = buf.size();
+        buf.u32(0);                     // Patched below
+        dataEntryOffsets.push_back(langEntryTarget);
+
+        buf.patch32(typeEntries + r * 8,     r + 1);
+        buf.patch32(typeEntries + r * 8 + 4, 0x80000000u | langDir);
+    }
+
+    // IMAGE_RESOURCE_DATA_ENTRY, then the payloads.
+    std::vector<std::uint32_t> dataEntries;
+    for (std::uint32_t r = 0; r < count; ++r)
+    {
+        buf.patch32(dataEntryOffsets[r], buf.size());
+        dataEntries.push_back(buf.size());
+        buf.zeros(16);
+    }
+    for (std::uint32_t r = 0; r < count; ++r)
+    {
+        buf.pad(8);
+        const std::uint32_t length = 16 + names.next() % 256;
+        buf.patch32(dataEntries[r],     rsrc.rva + buf.size());
+        buf.patch32(dataEntries[r] + 4, length);
+        for (std::uint32_t i = 0; i < length; ++i) { buf.u8(static_cast<std::uint8_t>(names.next())); }
+    }
+
+    dirs.rva[DirResources]  = rsrc.rva;
+    dirs.size[DirResources] = buf.size();
+}
+
+void buildRelocations(Section & reloc, const SyntheticPEShape & shape, const std::uint32_t textRVA, const std::uint32_t textSize, DataDirs & dirs)
+{
+    reloc.name            = ".reloc";
+    reloc.characteristics = 0x42000040; // INITIALIZED_DATA | DISCARDABLE | READ
+    ByteBuffer & buf      = reloc.data;
+
+    const std::uint16_t type = shape.pe32Plus ? 10 : 3; // DIR64 : HIGHLOW
+    const std::uint32_t perPage = 256;
+    const std::uint32_t numPages = std::max<std::uint32_t>(1, alignUp(textSize, 0x1000) / 0x1000);
+
+    for (std::uint32_t done = 0, block = 0; done < shape.numRelocations; ++block)
+    {
+        const std::uint32_t count = std::min(perPage, shape.numRelocations - done);
+        const std::uint32_t entries = alignUp(count, 2); // Blocks are 4-byte aligned
+        buf.u32(textRVA + (block % numPages) * 0x1000);
+        buf.u32(8 + entries * 2);
+        for (std::uint32_t i = 0; i < entries; ++i)
+        {
+            // Padding entries are IMAGE_REL_BASED_ABSOLUTE (type 0).
+            buf.u16(i < count ? static_cast<std::uint16_t>((type << 12) | ((i * 8) & 0xFFF)) : 0);
+        }
+        done += count;
+    }
+
+    dirs.rva[DirRelocations]  = reloc.rva;
+    dirs.size[DirRelocations] = buf.size();
+}
+
+} // namespace {}
+
+// ========================================================
+// File assembly
+// ========================================================
+
+std::vector<std::uint8_t> makeSyntheticPE(const SyntheticPEShape & shape)
+{
+    NameGen names{ shape.seed, shape.mangledPercent };
+
+    const std::uint32_t numDataSections = 2 + (shape.numResources != 0) + (shape.numRelocations != 0);
+    const std::uint32_t numSections = std::min(MaxSections, std::max(shape.numSections, numDataSections));
+
+    const std::uint32_t optionalHeaderSize = shape.pe32Plus ? 240 : 224;
+    const std::uint32_t headersSize = alignUp(DOSHeaderSize + 4 + 20 + optionalHeaderSize + numSections * 40, shape.fileAlignment);
+
+    std::vector<Section> sections(numSections);
+    DataDirs dirs;
+
+    // Each section only needs its own RVA and the .text RVA, so they are
+    // built in order, each one placed right after the previous.
+    std::uint32_t nextRVA = alignUp(headersSize, SectionAlignment);
+    auto place = [&nextRVA](Section & section)
+    {
+        section.virtualSize = section.data.size();
+        nextRVA = alignUp(section.rva + section.virtualSize, SectionAlignment);
+    };
+
+    std::uint32_t s = 0;
+    Section & text = sections[s++];
+    text.rva = nextRVA;
+    buildText(text, shape);
+    place(text);
+
+    Section & rdata = sections[s++];
+    rdata.rva = nextRVA;
+    buildRData(rdata, shape, text.rva, names, dirs);
+    place(rdata);
+
+    if (shape.numResources != 0)
+    {
+        Section & rsrc = sections[s++];
+        rsrc.rva = nextRVA;
+        buildResources(rsrc, shape, names, dirs);
+        place(rsrc);
+    }
+    if (shape.numRelocations != 0)
+    {
+        Section & reloc = sections[s++];
+        reloc.rva = nextRVA;
+        buildRelocations(reloc, shape, text.rva, text.virtualSize, dirs);
+        place(reloc);
+    }
+    for (std::uint32_t f = 0; s < numSections; ++s, ++f)
+    {
+        char name[9];
+        std::snprintf(name, sizeof(name), ".s%03u", f);
+        sections[s].name = name;
+        sections[s].characteristics = 0x40000040;
+        sections[s].rva = nextRVA;
+        sections[s].data.zeros(16);
+        place(sections[s]);
+    }
+    const std::uint32_t sizeOfImage = nextRVA;
+
+    // --- Headers ---
+    ByteBuffer out;
+    out.u16(0x5A4D);                 // "MZ"
+    out.zeros(0x3C - 2);
+    out.u32(DOSHeaderSize);          // e_lfanew
+    out.str("This program cannot be run in DOS mode.");
+    out.zeros(DOSHeaderSize - out.size());
+
+    const bool isDll = (shape.numExports + shape.numForwarders) != 0;
+    out.u32(0x00004550);             // "PE\0\0"
+    out.u16(shape.pe32Plus ? 0x8664 : 0x14C);
+    out.u16(static_cast<std::uint16_t>(numSections));
+    out.u32(0x5F5E1000 + shape.seed); // TimeDateStamp
+    out.u32(0);                      // PointerToSymbolTable
+    out.u32(0);                      // NumberOfSymbols
+    out.u16(static_cast<std::uint16_t>(optionalHeaderSize));
+    out.u16(static_cast<std::uint16_t>(0x0002 | (shape.pe32Plus ? 0x0020 : 0x0100) | (isDll ? 0x2000 : 0)));
+
+    out.u16(shape.pe32Plus ? 0x20B : 0x10B);
+    out.u8(14); out.u8(0);            // Linker version
+    out.u32(text.data.size());       // SizeOfCode
+    out.u32(0);                      // SizeOfInitializedData
+    out.u32(0);                      // SizeOfUninitializedData
+    out.u32(text.rva + text.virtualSize - 1); // Entry point: the last 'ret'
+    out.u32(text.rva);               // BaseOfCode
+    if (shape.pe32Plus)
+    {
+        out.u64(isDll ? 0x180000000ull : 0x140000000ull);
+    }
+    else
+    {
+        out.u32(rdata.rva);          // BaseOfData
+        out.u32(isDll ? 0x10000000 : 0x00400000);
+    }
+    out.u32(SectionAlignment);
+    out.u32(shape.fileAlignment);
+    out.u16(6); out.u16(0);           // OS version
+    out.u16(0); out.u16(0);           // Image version
+    out.u16(6); out.u16(0);           // Subsystem version
+    out.u32(0);                      // Win32VersionValue
+    out.u32(sizeOfImage);
+    out.u32(headersSize);
+    out.u32(0);                      // CheckSum
+    out.u16(3);                      // WINDOWS_CUI
+    out.u16(0x8140);                 // DYNAMIC_BASE | NX_COMPAT | TERMINAL_SERVER_AWARE
+    if (shape.pe32Plus)
+    {
+        out.u64(0x100000); out.u64(0x1000); out.u64(0x100000); out.u64(0x1000);
+    }
+    else
+    {
+        out.u32(0x100000); out.u32(0x1000); out.u32(0x100000); out.u32(0x1000);
+    }
+    out.u32(0);                      // LoaderFlags
+    out.u32(16);                     // NumberOfRvaAndSizes
+    for (int d = 0; d < 16; ++d)
+    {
+        out.u32(dirs.rva[d]);
+        out.u32(dirs.size[d]);
+    }
+
+    // Section table; raw data follows the headers in the same order.
+    std::uint32_t rawOffset = headersSize;
+    for (const Section & section : sections)
+    {
+        char name[8] = {};
+        std::memcpy(name, section.name.data(), std::min<std::size_t>(section.name.size(), 8));
+        out.bytes.insert(out.bytes.end(), name, name + 8);
+        out.u32(section.virtualSize);
+        out.u32(section.rva);
+        out.u32(alignUp(section.data.size(), shape.fileAlignment)); // SizeOfRawData
+        out.u32(rawOffset);
+        out.zeros(12);                   // Relocs/line numbers
+        out.u32(section.characteristics);
+        rawOffset += alignUp(section.data.size(), shape.fileAlignment);
+    }
+    out.pad(shape.fileAlignment);
+
+    for (const Section & section : sections)
+    {
+        out.bytes.insert(out.bytes.end(), section.data.bytes.begin(), section.data.bytes.end());
+        out.pad(shape.fileAlignment);
+    }
+
+    return std::move(out.bytes);
+}
+
+// ========================================================
+// Import library
+// ========================================================
+
+std::vector<std::uint8_t> makeSyntheticImportLibrary(const SyntheticPEShape & shape)
+{
+    NameGen names{ shape.seed, shape.mangledPercent };
+
+    // Members in file order, and each public symbol with its member.
+    std::vector<ByteBuffer> members;
+    std::vector<std::string> memberNames;
+    std::vector<std::pair<std::string, std::uint32_t>> symbols;
+    for (std::uint32_t d = 0; d < shape.numImportDlls; ++d)
+    {
+        const std::string dllName = "synth" + std::to_string(d) + ".dll";
+        for (std::uint32_t i = 0; i < shape.importsPerDll; ++i)
+        {
+            // Every 16th import is by ordinal, as in the PE. Plain x86 names have the
+            // C underscore, which the loader doesn't look up (IMPORT_OBJECT_NAME_NOPREFIX).
+            std::string symbol = names.function(d * 100000 + i);
+            int nameType = 1;
+            if (i % 16 == 15)
+            {
+                nameType = 0;
+            }
+            else if (!shape.pe32Plus && symbol[0] != '?')
+            {
+                symbol   = "_" + symbol;
+                nameType = 2;
+            }
+
+            ByteBuffer record;
+            record.u16(0);
+            record.u16(0xFFFF);
+            record.u16(0);
+            record.u16(shape.pe32Plus ? 0x8664 : 0x14C);
+            record.u32(0);
+            record.u32(static_cast<std::uint32_t>(symbol.size() + 1 + dllName.size() + 1));
+            record.u16(static_cast<std::uint16_t>(nameType == 0 ? i + 1 : i)); // Ordinal or hint
+            record.u16(static_cast<std::uint16_t>(nameType << 2)); // IMPORT_OBJECT_CODE
+            record.str(symbol);
+            record.str(dllName);
+
+            const auto member = static_cast<std::uint32_t>(members.size());
+            symbols.emplace_back(symbol, member);
+            symbols.emplace_back("__imp_" + symbol, member);
+            members.push_back(std::move(record));
+            memberNames.push_back(dllName + "/");
+        }
+    }
+
+    std::vector<std::pair<std::string, std::uint32_t>> sortedSymbols = symbols;
+    std::sort(sortedSymbols.begin(), sortedSymbols.end());
+    const bool secondLinker = members.size() <= 0xFFFF;
+
+    std::uint32_t namesSize = 0;
+    for (const auto & symbol : symbols)
+    {
+        namesSize += static_cast<std::uint32_t>(symbol.first.size() + 1);
+    }
+    const auto numMembers = static_cast<std::uint32_t>(members.size());
+    const auto numSymbols = static_cast<std::uint32_t>(symbols.size());
+    const std::uint32_t firstSize  = 4 + numSymbols * 4 + namesSize;
+    const std::uint32_t secondSize = 4 + numMembers * 4 + 4 + numSymbols * 2 + namesSize;
+
+    // Header offset of each member, after the signature and the linker members.
+    std::vector<std::uint32_t> offsets;
+    std::uint32_t offset = 8 + 60 + alignUp(firstSize, 2) + (secondLinker ? 60 + alignUp(secondSize, 2) : 0);
+    for (const auto & member : members)
+    {
+        offsets.push_back(offset);
+        offset += 60 + alignUp(member.size(), 2);
+    }
+
+    ByteBuffer out;
+    const auto memberHeader = [&out](const std::string & name, const std::uint32_t size)
+    {
+        char header[61];
+        std::snprintf(header, sizeof(header), "%-16s%-12s%-6s%-6s%-8s%-10u`\n", name.c_str(), "0", "", "", "0", size);
+        out.bytes.insert(out.bytes.end(), header, header + 60);
+    };
+    const auto bigEndian32 = [&out](const std::uint32_t v)
+    {
+        for (int i = 3; i >= 0; --i) { out.u8(static_cast<std::uint8_t>(v >> (i * 8))); }
+    };
+
+    static const char signature[] = "!<arch>\n";
+    out.bytes.assign(signature, signature + 8);
+
+    // First linker member: big-endian, in member order.
+    memberHeader("/", firstSize);
+    bigEndian32(numSymbols);
+    for (const auto & symbol : symbols)
+    {
+        bigEndian32(offsets[symbol.second]);
+    }
+    for (const auto & symbol : symbols)
+    {
+        out.str(symbol.first);
+    }
+    out.pad(2);
+
+    // Second linker member: little-endian, sorted, 1-based member numbers.
+    if (secondLinker)
+    {
+        memberHeader("/", secondSize);
+        out.u32(numMembers);
+        for (const std::uint32_t memberOffset : offsets)
+        {
+            out.u32(memberOffset);
+        }
+        out.u32(numSymbols);
+        for (const auto & symbol : sortedSymbols)
+        {
+            out.u16(static_cast<std::uint16_t>(symbol.second + 1));
+        }
+        for (const auto & symbol : sortedSymbols)
+        {
+            out.str(symbol.first);
+        }
+        out.pad(2);
+    }
+
+    for (std::size_t m = 0; m < members.size(); ++m)
+    {
+        memberHeader(memberNames[m], members[m].size());
+        out.bytes.insert(out.bytes.end(), members[m].bytes.begin(), members[m].bytes.end());
+        out.pad(2);
+    }
+    return std::move(out.bytes);
+}
+
+// ========================================================
+// COFF object
+// ========================================================
+
+std::vector<std::uint8_t> makeSyntheticObject(const SyntheticPEShape & shape)
+{
+    NameGen names{ shape.seed, shape.mangledPercent };
+
+    const std::uint32_t numFunctions  = std::min<std::uint32_t>(std::max<std::uint32_t>(shape.numExports, 1), 65279);
+    const std::uint32_t numImports    = shape.numImportDlls * shape.importsPerDll;
+    const std::uint32_t relocsPerFunc = (numImports != 0) ? shape.numRelocations : 0;
+    const std::uint32_t codeSize      = std::max<std::uint32_t>(16, relocsPerFunc * 8);
+    const std::uint32_t firstImport   = numFunctions * 3; // Symbol index: section, aux and function records come first
+
+    // Short names go in the record, NUL-padded; long ones in the string table.
+    ByteBuffer strings;
+    strings.u32(0); // Size, patched below
+    const auto symbolName = [&strings](ByteBuffer & out, const std::string & name)
+    {
+        if (name.size() <= 8)
+        {
+            out.bytes.insert(out.bytes.end(), name.begin(), name.end());
+            out.zeros(static_cast<std::uint32_t>(8 - name.size()));
+            return;
+        }
+        out.u32(0);
+        out.u32(strings.size());
+        strings.str(name);
+    };
+
+    // Header, section table, then the code and relocations of each section.
+    const std::uint32_t sectionsSize = numFunctions * 40;
+    const std::uint32_t perSection   = codeSize + relocsPerFunc * 10;
+    const std::uint32_t symbolsStart = 20 + sectionsSize + numFunctions * perSection;
+
+    ByteBuffer out;
+    out.u16(shape.pe32Plus ? 0x8664 : 0x14C);
+    out.u16(static_cast<std::uint16_t>(numFunctions));
+    out.u32(0);            // timeDateStamp
+    out.u32(symbolsStart); // pointerToSymbolTable
+    out.u32(firstImport + numImports);
+    out.u16(0);            // sizeOfOptionalHeader
+    out.u16(0);            // characteristics
+
+    for (std::uint32_t f = 0; f < numFunctions; ++f)
+    {
+        const std::uint32_t data = 20 + sectionsSize + f * perSection;
+        symbolName(out, ".text$mn");
+        out.u32(0);        // virtualSize
+        out.u32(0);        // virtualAddress
+        out.u32(codeSize);
+        out.u32(data);
+        out.u32(relocsPerFunc != 0 ? data + codeSize : 0);
+        out.u32(0);        // pointerToLinenumbers
+        out.u16(static_cast<std::uint16_t>(relocsPerFunc));
+        out.u16(0);
+        out.u32(0x60501020); // CODE | COMDAT | ALIGN_16BYTES | EXECUTE | READ
+    }
+
+    // 'call rel32' to a different import each time.
+    for (std::uint32_t f = 0; f < numFunctions; ++f)
+    {
+        const std::size_t code = out.bytes.size();
+        out.zeros(codeSize);
+        std::fill(out.bytes.begin() + code, out.bytes.end(), 0xCC);
+        for (std::uint32_t r = 0; r < relocsPerFunc; ++r)
+        {
+            out.u32(r * 8 + 1);
+            out.u32(firstImport + (f * relocsPerFunc + r) % numImports);
+            out.u16(shape.pe32Plus ? 0x4 : 0x14); // REL32
+        }
+    }
+
+    for (std::uint32_t f = 0; f < numFunctions; ++f)
+    {
+        const auto section = static_cast<std::uint16_t>(f + 1);
+
+        // Section symbol and its auxiliary record: length, relocations, line numbers,
+        // checksum, number, COMDAT selection (IMAGE_COMDAT_SELECT_NODUPLICATES).
+        symbolName(out, ".text$mn");
+        out.u32(0);
+        out.u16(section);
+        out.u16(0);
+        out.u8(3);  // STATIC
+        out.u8(1);
+        out.u32(codeSize);
+        out.u16(static_cast<std::uint16_t>(relocsPerFunc));
+        out.u16(0);
+        out.u32(0);
+        out.u16(section);
+        out.u8(1);
+        out.zeros(3);
+
+        symbolName(out, names.function(500000 + f));
+        out.u32(0);
+        out.u16(section);
+        out.u16(0x20); // Function
+        out.u8(2);     // EXTERNAL
+        out.u8(0);
+    }
+    for (std::uint32_t d = 0; d < shape.numImportDlls; ++d)
+    {
+        for (std::uint32_t i = 0; i < shape.importsPerDll; ++i)
+        {
+            symbolName(out, "__imp_" + names.function(d * 100000 + i));
+            out.u32(0);
+            out.u16(0);    // IMAGE_SYM_UNDEFINED
+            out.u16(0);
+            out.u8(2);     // EXTERNAL
+            out.u8(0);
+        }
+    }
+
+    strings.patch32(0, strings.size());
+    out.bytes.insert(out.bytes.end(), strings.bytes.begin(), strings.bytes.end());
+    return std::move(out.bytes);
+}
+
+// Mostly small executables and DLLs, some big DLLs, a few with forwarders.
+SyntheticPEShape randomSyntheticPEShape(std::mt19937 & rng, const std::uint32_t seed)
+{
+    SyntheticPEShape shape;
+    shape.seed           = seed;
+    shape.pe32Plus       = (rng() % 2) == 0;
+    shape.numSections    = 4 + rng() % 4;
+    shape.numImportDlls  = 1 + rng() % 12;
+    shape.importsPerDll  = 4 + rng() % 60;
+    shape.numRelocations = rng() % 2000;
+    shape.numResources   = rng() % 8;
+
+    const std::uint32_t kind = rng() % 100;
+    if (kind < 50)
+    {
+        shape.numExports = 0; // Executable
+    }
+    else if (kind < 90)
+    {
+        shape.numExports = 1 + rng() % 200;
+    }
+    else
+    {
+        shape.numExports    = 1000 + rng() % 5000;
+        shape.numForwarders = rng() % 200;
+    }
+    return shape;
+}
@@ -0,0 +1,58 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: synthetic_pe.hpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: Synthetic PE32/PE32+ images of configurable shape, for benchmarks and scaling tests.
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#ifndef SYNTHETIC_PE_HPP
+#define SYNTHETIC_PE_HPP
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+struct SyntheticPEShape
+{
+    bool          pe32Plus        = false;
+    std::uint32_t numSections     = 0; // Minimum; raised to fit the data sections
+    std::uint32_t numImportDlls   = 2;
+    std::uint32_t importsPerDll   = 8;
+    std::uint32_t numExports      = 0;
+    std::uint32_t numForwarders   = 0;
+    std::uint32_t numRelocations  = 0;
+    std::uint32_t numResources    = 0;
+    std::uint32_t mangledPercent  = 25; // Exports/imports with MSVC decorated names
+    std::uint32_t fileAlignment   = 0x200; // 0x1000 makes the sections mappable in place
+    std::uint32_t seed            = 1;
+};
+
+// Builds the image of a PE file with the given shape.
+std::vector<std::uint8_t> makeSyntheticPE(const SyntheticPEShape & shape);
+
+// Builds an import library (.lib) with a short import record for each import of
+// the shape, named like the PE's, and both linker members. The second one is left
+// out past the 65535 members it can number, as with GNU-style libraries.
+std::vector<std::uint8_t> makeSyntheticImportLibrary(const SyntheticPEShape & shape);
+
+// Builds a COFF object (.obj) compiled with function-level linking: a COMDAT .text
+// section for each export of the shape, with a relocation to each of numRelocations
+// per function imports, and the symbol table the compiler writes for it (a section
+// symbol and its auxiliary record, then the function, for each section, and the
+// imports, undefined). Decorated names go to the string table. Up to 65279 exports.
+std::vector<std::uint8_t> makeSyntheticObject(const SyntheticPEShape & shape);
+
+// A shape drawn from a mix loosely modeled on a Windows system directory.
+SyntheticPEShape randomSyntheticPEShape(std::mt19937 & rng, std::uint32_t seed);
+
+#endif // SYNTHETIC_PE_HPP
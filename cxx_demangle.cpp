@@ -16,10 +16,15 @@
 // ================================================================================================
 
 #include <cctype>
+#include <atomic>
 #include <string>
+#include <mutex>
 #include <algorithm>
+#include <functional>
 #include <unordered_map>
 
+#include "portable_pe_dump.hpp"
+
 /*
 -------------------------------------
 Portable C++ function name demangling
@@ -319,6 +324,8 @@ std::string demangle(const std::string & mangledName, const bool baseNameOnly)
         return mangledName;
     }
 
+    stats::count(stats::Counter::NamesDemangled);
+
     CStrRange rMangled{ mangledName.cbegin(), mangledName.cend() };
 
     // MSFT C++ names always start with a question mark.
@@ -370,3 +377,73 @@ std::string demangle(const std::string & mangledName, const bool baseNameOnly)
         return demangledName;
     }
 }
+
+// ========================================================
+// Demangled name cache
+//
+//  The same handful of names (CRT functions, Win32 APIs)
+//  shows up in almost every PE, so a long running process
+//  like the server mode can skip most of the demangling
+//  work by remembering previous results. The cache is split
+//  into independently locked shards to keep the worker
+//  threads from serializing on a single mutex.
+// ========================================================
+
+namespace
+{
+
+struct DemangleCacheShard
+{
+    std::mutex mutex{};
+    std::unordered_map<std::string, std::string> names{};
+};
+
+const std::size_t DemangleCacheShardCount = 16;
+
+// One set of shards for each value of 'baseNameOnly'.
+DemangleCacheShard demangleCacheShards[2][DemangleCacheShardCount];
+
+// Zero while the cache is disabled.
+std::atomic<std::size_t> demangleCacheMaxEntriesPerShard{ 0 };
+
+} // namespace {}
+
+void enableDemangleCache(const std::size_t maxEntries)
+{
+    const std::size_t perShard = maxEntries / DemangleCacheShardCount;
+    demangleCacheMaxEntriesPerShard = (perShard > 0) ? perShard : 1;
+}
+
+std::string demangleCached(const std::string & mangledName, const bool baseNameOnly)
+{
+    const std::size_t maxEntries = demangleCacheMaxEntriesPerShard;
+    if (maxEntries == 0)
+    {
+        return demangle(mangledName, baseNameOnly);
+    }
+
+    const std::size_t hash = std::hash<std::string>{}(mangledName);
+    DemangleCacheShard & shard = demangleCacheShards[baseNameOnly][hash % DemangleCacheShardCount];
+
+    {
+        std::lock_guard<std::mutex> lock{ shard.mutex };
+        auto iter = shard.names.find(mangledName);
+        if (iter != std::end(shard.names))
+        {
+            return iter->second;
+        }
+    }
+
+    // Demangle outside the lock. Two threads might occasionally
+    // do the same work, but the result is the same either way.
+    std::string demangledName = demangle(mangledName, baseNameOnly);
+
+    std::lock_guard<std::mutex> lock{ shard.mutex };
+    if (shard.names.size() >= maxEntries)
+    {
+        // Crude but bounded: start over once a shard fills up.
+        shard.names.clear();
+    }
+    shard.names.emplace(mangledName, demangledName);
+    return demangledName;
+}
@@ -0,0 +1,358 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: fuzz_pe.cpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: libFuzzer harness over the PE parsing entry points, flagging inputs that cost too much work per byte.
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+// The parsers and dumps are internal (static) to pe_image.cpp, portable_pe_dump.cpp and
+// minidump_mode.cpp, so they are compiled right into this file. The rest comes from libppedump.
+#include "../pe_image.cpp"
+#include "../portable_pe_dump.cpp"
+#include "../minidump_mode.cpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <streambuf>
+
+/*
+-------------------------------------
+Work budget
+-------------------------------------
+
+Crashing is not the only way a malformed PE can hurt: tables that point
+back into themselves can make a walk that is linear on well-formed files
+do quadratic work, or print far more than the file holds. Each input is
+run through the same steps as 'ppedump -a' (or, for archives, the
+member walk and import record decoding of 'ppedump --lib', for COFF
+objects, the section, relocation and symbol walks of 'ppedump --obj -a',
+and for minidumps, the module list and the dump of each module's image
+of 'ppedump --minidump -a') and the work it cost is measured in
+deterministic units, so the result doesn't depend on the machine or its
+load:
+
+  scans   section headers visited by RVA lookups (lookups x sections)
+  names   bytes of the symbol and module names the table walkers collected
+  output  bytes printed by the dumps
+
+An input is over budget when that work exceeds MaxWorkPerByte times its
+size, plus FixedWork for the headers, which are dumped whatever the size.
+Well-formed PEs stay below a tenth of it.
+
+Built with libFuzzer (make fuzz, needs clang), an input over budget
+aborts, so the fuzzer saves it like a crash. Without libFuzzer (make
+ppefuzz) a driver replays the files or directories it is given, prints
+the work and time per byte of each and exits with 1 if any is over budget.
+
+Inputs found over budget are minimized (-minimize_crash=1), fixed, then
+kept in fuzz/corpus/ as regression benchmarks: 'make fuzz-check' replays
+them and fails if one goes over budget again.
+
+-------------------------------------
+*/
+
+namespace
+{
+
+const std::uint64_t MaxWorkPerByte = 512;
+const std::uint64_t FixedWork      = 1 << 20;
+
+// Discards the output, counting its bytes.
+class CountingNullBuffer final : public std::streambuf
+{
+public:
+    std::uint64_t bytes() const { return bytes_; }
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        ++bytes_;
+        return c;
+    }
+    std::streamsize xsputn(const char *, std::streamsize count) override
+    {
+        bytes_ += static_cast<std::uint64_t>(count);
+        return count;
+    }
+
+private:
+    std::uint64_t bytes_ = 0;
+};
+
+struct Work
+{
+    std::uint64_t scans  = 0;
+    std::uint64_t names  = 0;
+    std::uint64_t output = 0;
+
+    std::uint64_t total() const { return scans + names + output; }
+};
+
+std::uint64_t workBudget(const std::size_t size)
+{
+    return static_cast<std::uint64_t>(size) * MaxWorkPerByte + FixedWork;
+}
+
+// Same steps as 'ppedump -a' on one in-memory file, with and without --mapped-image,
+// then the relocation pass of --rebase. Archives, objects and minidumps take the --lib, --obj
+// and --minidump steps instead.
+Work runInput(const std::uint8_t * data, const std::size_t size)
+{
+    CountingNullBuffer sink;
+    std::ostream out{ &sink };
+    Work work;
+
+    // Import and static libraries: the member headers, the symbol index and
+    // every member decoded as an import record, as with --lib.
+    const FileView file{ data, size };
+    Archive archive;
+    if (size >= pe::ImageArchiveStartSize && std::memcmp(data, pe::ImageArchiveStart, pe::ImageArchiveStartSize) == 0 &&
+        readArchive(file, archive, out))
+    {
+        ArchiveImport import;
+        for (const auto & member : archive.members)
+        {
+            work.names += member.name.size();
+            if (readArchiveImport(file, member, import))
+            {
+                work.names += import.symbol.size() + import.dllName.size() + import.importName.size();
+            }
+        }
+        work.output = sink.bytes();
+        return work;
+    }
+
+    // COFF objects: the section names, each relocation with the name of its
+    // symbol and the symbol table, as printed by --obj -s -r -t.
+    CoffObject object;
+    if ((objectFileHeader(file) != nullptr || bigObjHeader(file) != nullptr) && readCoffObject(file, object, out))
+    {
+        CoffSymbol symbol;
+        for (const auto & section : object.sections)
+        {
+            work.names += coffSectionName(file, object, section).length;
+
+            std::uint32_t count = 0;
+            const pe::ImageRelocation * relocations = coffRelocations(file, section, count);
+            for (std::uint32_t r = 0; relocations != nullptr && r < count; ++r)
+            {
+                work.names += readCoffSymbol(file, object, relocations[r].symbolTableIndex, symbol) ? symbol.name.length : 0;
+            }
+        }
+        for (std::uint32_t index = 0; readCoffSymbol(file, object, index, symbol); index += 1 + symbol.numAuxSymbols)
+        {
+            work.names += symbol.name.length;
+        }
+        work.output = sink.bytes();
+        return work;
+    }
+
+    // Minidumps: the module list and memory ranges, then the image of each
+    // module found in the dump, parsed and dumped as mapped, as with --minidump -a.
+    std::vector<DumpModule> modules;
+    std::vector<MemoryRange> ranges;
+    if (size >= sizeof(md::Signature) && std::memcmp(data, "MDMP", 4) == 0 && readMinidump(file, modules, ranges, out))
+    {
+        ProgramFlags prog;
+        prog.flagDumpNTHeaders      = true;
+        prog.flagDumpSectionHeaders = true;
+        prog.flagDumpDOSJunk        = true;
+        prog.flagDumpExportsSection = true;
+        prog.flagDumpImportsSection = true;
+
+        for (const auto & module : modules)
+        {
+            work.names += module.name.size() + module.pdbName.size();
+
+            FileContents contents;
+            locateImage(file, ranges, module, contents);
+            PEImage image;
+            if (contents.empty() || !image.open(std::move(contents), module.name.c_str(), out, PELayout::Mapped))
+            {
+                continue;
+            }
+            const std::uint64_t lookupsBefore = stats::total(stats::Counter::RVALookups);
+            dumpPEImage(image, prog, out);
+            work.scans += (stats::total(stats::Counter::RVALookups) - lookupsBefore) * image.info().sections.size();
+        }
+        work.output = sink.bytes();
+        return work;
+    }
+
+    const pe::ImageNTHeader * ntHeaderPtr = validatePE(data, size, out);
+    if (ntHeaderPtr == nullptr)
+    {
+        work.output = sink.bytes();
+        return work;
+    }
+
+    const auto dosHeaderPtr = reinterpret_cast<const pe::ImageDOSHeader *>(data);
+    const std::uint64_t lookupsBefore = stats::total(stats::Counter::RVALookups);
+
+    dumpNTHeaders(out, ntHeaderPtr);
+    dumpDOSJunk(out, dosHeaderPtr);
+    dumpSectionHeaders(out, ntHeaderPtr);
+
+    // The tables are read in both layouts, as a file and as a mapped image
+    // (--mapped-image), since the same bytes decode differently in each.
+    for (const PELayout layout : { PELayout::File, PELayout::Mapped })
+    {
+        PEExportTable exports;
+        collectExports(dosHeaderPtr, ntHeaderPtr, size, exports, layout);
+        dumpExportsSection(out, exports);
+
+        PEImportTable imports;
+        collectImports(dosHeaderPtr, ntHeaderPtr, size, imports, layout);
+        dumpImportsSection(out, imports);
+
+        work.names += exports.moduleName.size();
+        for (const auto & symbol : exports.symbols)
+        {
+            work.names += symbol.name.size();
+        }
+        for (const auto & module : imports.modules)
+        {
+            work.names += module.dllName.size();
+            for (const auto & symbol : module.symbols)
+            {
+                work.names += symbol.name.size();
+            }
+        }
+    }
+
+    // Relocating reads the input as a mapped image (--rebase --mapped-image):
+    // one pass over the relocation directory, which must be inside the input.
+    std::vector<std::uint8_t> image(data, data + size);
+    RebaseInfo rebase;
+    rebaseImage(image.data(), image.size(), 0x10000, rebase, out);
+
+    work.scans = (stats::total(stats::Counter::RVALookups) - lookupsBefore) * ntHeaderPtr->fileHeader.numberOfSections;
+    work.output = sink.bytes();
+    return work;
+}
+
+} // namespace {}
+
+// ========================================================
+// libFuzzer entry points
+// ========================================================
+
+extern "C" int LLVMFuzzerInitialize(int *, char ***)
+{
+    stats::enable(); // For the RVA lookup counter.
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t * data, const std::size_t size)
+{
+    const Work work = runInput(data, size);
+    if (work.total() > workBudget(size))
+    {
+        std::cerr << "Input of " << size << " bytes is over the work budget: "
+                  << work.scans << " scans, " << work.names << " name bytes, "
+                  << work.output << " output bytes (budget " << workBudget(size) << ").\n";
+        std::abort();
+    }
+    return 0;
+}
+
+// ========================================================
+// Standalone corpus replay
+// ========================================================
+
+#ifndef PPEDUMP_LIBFUZZER
+
+int main(int argc, char * argv[])
+{
+    if (argc <= 1)
+    {
+        std::cout << "\n"
+            << "Usage:\n"
+            << " $ " << argv[0] << " <files or directories...>\n"
+            << " Runs each file through the parsers and dumps, printing the work and\n"
+            << " time per input byte. Exits with 1 if any is over the work budget.\n"
+            << "\n";
+        return EXIT_FAILURE;
+    }
+
+    LLVMFuzzerInitialize(&argc, &argv);
+
+    // Every file of a directory is replayed, not just the PEs
+    // expandInputPaths() would keep: archives, objects and minidumps are inputs too.
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (isDirectory(argv[i]))
+        {
+            listFilesRecursive(argv[i], files);
+        }
+        else
+        {
+            files.push_back(argv[i]);
+        }
+    }
+    std::sort(std::begin(files), std::end(files));
+
+    std::cout << std::left << std::setw(36) << "input" << std::right
+              << std::setw(10) << "bytes"
+              << std::setw(12) << "scans"
+              << std::setw(12) << "names"
+              << std::setw(12) << "output"
+              << std::setw(11) << "work/byte"
+              << std::setw(10) << "ns/byte" << "  result\n";
+
+    int numOverBudget = 0;
+    int numFailed     = 0;
+    for (const auto & filename : files)
+    {
+        FileContents contents;
+        if (!contents.load(filename.c_str(), FileLoader::Read, std::cerr))
+        {
+            ++numFailed;
+            continue;
+        }
+
+        // Repeated until it took long enough to time.
+        const auto startTime = std::chrono::steady_clock::now();
+        Work work;
+        std::uint64_t runs = 0;
+        std::chrono::steady_clock::duration elapsed{};
+        do
+        {
+            work = runInput(contents.data(), contents.size());
+            ++runs;
+            elapsed = std::chrono::steady_clock::now() - startTime;
+        } while (elapsed < std::chrono::milliseconds(20) && runs < 1000);
+
+        const double bytes  = static_cast<double>(std::max<std::size_t>(contents.size(), 1));
+        const double nsRun  = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / runs;
+        const bool   overBudget = work.total() > workBudget(contents.size());
+        numOverBudget += overBudget ? 1 : 0;
+
+        const std::string name = filename.substr(filename.find_last_of('/') + 1);
+        std::cout << std::left << std::setw(36) << name << std::right
+                  << std::setw(10) << contents.size()
+                  << std::setw(12) << work.scans
+                  << std::setw(12) << work.names
+                  << std::setw(12) << work.output
+                  << std::setw(11) << std::fixed << std::setprecision(1) << (work.total() / bytes)
+                  << std::setw(10) << std::fixed << std::setprecision(1) << (nsRun / bytes)
+                  << "  " << (overBudget ? "OVER BUDGET" : "ok") << "\n";
+    }
+
+    std::cout << "\n" << files.size() << " inputs, " << numOverBudget << " over the budget of "
+              << MaxWorkPerByte << " work/byte + " << FixedWork << ".\n";
+    return (numOverBudget != 0 || numFailed != 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif // PPEDUMP_LIBFUZZER
@@ -0,0 +1,452 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: lib_mode.cpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: Library mode. Lists the import records and objects of .lib archives.
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "portable_pe_dump.hpp"
+
+/*
+-------------------------------------
+Library mode
+-------------------------------------
+
+'ppedump --lib <files/dirs...>' lists the members of import libraries
+and static libraries (.lib), the ar archives the MSVC linker reads.
+Import libraries hold a short import record for each export of their
+DLL. These are listed by DLL, like the imports of a PE: the hint (or
+ordinal), whether it is code, data or a constant, the public symbol,
+undecorated if possible, and the name looked up in the DLL when it is
+not the symbol's. COFF objects are listed with their machine, section
+and symbol counts and the public symbols the index has for them.
+
+With '--find <name>', the symbol index of the linker members is searched
+instead. The second linker member is sorted by name, so each lookup is a
+binary search, and only the member found is decoded.
+
+Members are decoded and their names demangled in parallel (--workers),
+in batches, and printed in file order. The archive is read through the
+--loader, so mmap keeps libraries of hundreds of megabytes off the heap.
+
+-------------------------------------
+*/
+
+namespace
+{
+
+// Members decoded per parallelForEach() item. Most are import records
+// of a few dozen bytes, too little work to hand out one at a time.
+const std::size_t MembersPerBatch = 256;
+
+enum class MemberKind
+{
+    Import,          // Short import record
+    Object,          // COFF object
+    AnonymousObject, // ANON_OBJECT_HEADER: /GL (LTCG) or /bigobj object
+    Other
+};
+
+struct LibMember
+{
+    MemberKind    kind = MemberKind::Other;
+    ArchiveImport import{};
+    std::string   line{};      // Printed for the import record, formatted by the workers
+
+    // Objects:
+    std::uint16_t machine     = 0;
+    std::uint32_t numSections = 0;
+    std::uint32_t numSymbols  = 0;
+    std::vector<std::string> publicSymbols{}; // From the index, demangled
+};
+
+std::string hexa(const std::uint32_t value, const int pad)
+{
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "0x%0*X", pad, value);
+    return buffer;
+}
+
+const char * importTypeName(const int type)
+{
+    switch (type)
+    {
+    case pe::ImportObjectCode  : return "CODE";
+    case pe::ImportObjectData  : return "DATA";
+    case pe::ImportObjectConst : return "CONST";
+    default                    : return "?";
+    } // switch (type)
+}
+
+// "  <hint>  <type>  <symbol>  (<name in the DLL>)\n". Built with appends, off the
+// output stream, since the decoding runs in parallel and the printing doesn't.
+void formatImportLine(const ArchiveImport & import, std::string & line)
+{
+    char hint[32];
+    std::snprintf(hint, sizeof(hint), "  0x%04X  %-5s  ", import.ordinalOrHint, importTypeName(import.type));
+
+    line += hint;
+    line += color::yellow();
+    line += demangleCached(import.symbol);
+    line += color::restore();
+    if (import.nameType == pe::ImportObjectOrdinal)
+    {
+        line += "  (by ordinal)";
+    }
+    else if (import.importName != import.symbol)
+    {
+        line += "  (";
+        line += color::red();
+        line += import.importName;
+        line += color::restore();
+        line += ")";
+    }
+    line += "\n";
+}
+
+// 'symbolNames' are the name offsets of the member's public symbols, 'numSymbolNames' of them.
+void decodeMember(const FileView & file, const ArchiveMember & member, const std::uint64_t * symbolNames,
+                  const std::uint32_t numSymbolNames, LibMember & decoded)
+{
+    if (readArchiveImport(file, member, decoded.import))
+    {
+        decoded.kind = MemberKind::Import;
+        formatImportLine(decoded.import, decoded.line);
+        return;
+    }
+
+    const auto sig = file.at<std::uint16_t>(member.dataOffset, 2);
+    const auto fileHeader = file.at<pe::ImageFileHeader>(member.dataOffset);
+    if (sig != nullptr && sig[0] == 0 && sig[1] == 0xFFFF)
+    {
+        decoded.kind = MemberKind::AnonymousObject;
+    }
+    else if (fileHeader != nullptr && member.size >= sizeof(pe::ImageFileHeader))
+    {
+        decoded.kind        = MemberKind::Object;
+        decoded.machine     = fileHeader->machine;
+        decoded.numSections = fileHeader->numberOfSections;
+        decoded.numSymbols  = fileHeader->numberOfSymbols;
+    }
+
+    std::string name;
+    for (std::uint32_t s = 0; s < numSymbolNames; ++s)
+    {
+        file.readString(symbolNames[s], name);
+        decoded.publicSymbols.push_back(demangleCached(name));
+    }
+}
+
+void printImports(const std::vector<ArchiveMember> & members, const std::vector<LibMember> & decoded, std::ostream & out)
+{
+    // Records grouped by DLL, in the order the DLLs first appear.
+    std::vector<std::string> dllNames;
+    std::unordered_map<std::string, std::vector<std::size_t>> recordsOf;
+    for (std::size_t m = 0; m < members.size(); ++m)
+    {
+        if (decoded[m].kind == MemberKind::Import)
+        {
+            auto & records = recordsOf[decoded[m].import.dllName];
+            if (records.empty())
+            {
+                dllNames.push_back(decoded[m].import.dllName);
+            }
+            records.push_back(m);
+        }
+    }
+    if (dllNames.empty())
+    {
+        return;
+    }
+
+    out << "\n";
+    out << color::yellow() << "------------------------------------------------------------\n";
+    out << color::yellow() << "            Import records" << "\n";
+    out << color::yellow() << "------------------------------------------------------------\n";
+    out << color::restore() << "\n";
+
+    out << "--------------------\n";
+    out << "  External modules\n";
+    out << "--------------------\n";
+
+    out << "\n";
+    for (const auto & dllName : dllNames)
+    {
+        out << color::cyan() << "  " << dllName << "\n";
+    }
+    out << color::restore() << "\n";
+
+    out << "------------------------------------------------\n";
+    out << "  Hint    Type   Func name   (Name in the DLL)\n";
+    out << "------------------------------------------------\n\n";
+
+    // The lines of each DLL go out in a single write.
+    std::size_t recordsTotal = 0;
+    std::string block;
+    for (const auto & dllName : dllNames)
+    {
+        const auto & records = recordsOf[dllName];
+        block.clear();
+        for (const std::size_t m : records)
+        {
+            block += decoded[m].line;
+        }
+        out << color::red() << dllName << color::restore() << "\n";
+        out.write(block.data(), static_cast<std::streamsize>(block.size()));
+        out << "\n";
+        recordsTotal += records.size();
+    }
+
+    out << recordsTotal << " import records for " << dllNames.size() << " DLLs.\n";
+}
+
+void printObjects(const std::vector<ArchiveMember> & members, const std::vector<LibMember> & decoded, std::ostream & out)
+{
+    std::size_t numObjects = 0;
+    for (std::size_t m = 0; m < members.size(); ++m)
+    {
+        if (decoded[m].kind == MemberKind::Import)
+        {
+            continue;
+        }
+        if (numObjects++ == 0)
+        {
+            out << "\n";
+            out << color::yellow() << "------------------------------------------------------------\n";
+            out << color::yellow() << "            Objects" << "\n";
+            out << color::yellow() << "------------------------------------------------------------\n";
+            out << color::restore() << "\n";
+        }
+
+        out << color::cyan() << members[m].name << color::restore() << "\n";
+        switch (decoded[m].kind)
+        {
+        case MemberKind::Object :
+            out << "  " << fileHeaderMachine(decoded[m].machine) << " (" << hexa(decoded[m].machine, 4) << "), "
+                << decoded[m].numSections << " sections, " << decoded[m].numSymbols << " symbols\n";
+            break;
+        case MemberKind::AnonymousObject :
+            out << "  Anonymous object (compiled with /GL or /bigobj)\n";
+            break;
+        default :
+            out << "  Not a COFF object (" << members[m].size << " bytes)\n";
+            break;
+        } // switch (decoded[m].kind)
+
+        for (const auto & symbol : decoded[m].publicSymbols)
+        {
+            out << "  " << color::yellow() << symbol << color::restore() << "\n";
+        }
+        out << "\n";
+    }
+
+    if (numObjects != 0)
+    {
+        out << numObjects << " objects.\n";
+    }
+}
+
+const char * indexName(const ArchiveIndex index)
+{
+    switch (index)
+    {
+    case ArchiveIndex::First  : return "first linker member";
+    case ArchiveIndex::Second : return "second linker member";
+    default                   : return "none";
+    } // switch (index)
+}
+
+// Decodes and prints every member.
+void dumpLibrary(const FileView & file, const Archive & archive, const ProgramFlags & prog, std::ostream & out)
+{
+    // Public symbols of each member, in name order, as the index has them: those
+    // of member m are symbolNames[firstName[m]] to symbolNames[firstName[m + 1]].
+    // Only the objects print theirs; an import record defines its symbol and "__imp_" one.
+    std::vector<std::uint32_t> firstName(archive.members.size() + 1, 0);
+    for (const auto & symbol : archive.symbols)
+    {
+        ++firstName[symbol.member + 1];
+    }
+    for (std::size_t m = 0; m < archive.members.size(); ++m)
+    {
+        firstName[m + 1] += firstName[m];
+    }
+    std::vector<std::uint64_t> symbolNames(archive.symbols.size());
+    std::vector<std::uint32_t> numNames(archive.members.size(), 0);
+    for (const auto & symbol : archive.symbols)
+    {
+        symbolNames[firstName[symbol.member] + numNames[symbol.member]++] = symbol.nameOffset;
+    }
+
+    std::vector<LibMember> decoded(archive.members.size());
+    const std::size_t numBatches = (archive.members.size() + MembersPerBatch - 1) / MembersPerBatch;
+    parallelForEach(numBatches, batchWorkerCount(prog.numWorkers, numBatches),
+        [&](const std::size_t batch, unsigned)
+        {
+            const std::size_t end = std::min(archive.members.size(), (batch + 1) * MembersPerBatch);
+            for (std::size_t m = batch * MembersPerBatch; m < end; ++m)
+            {
+                decodeMember(file, archive.members[m], symbolNames.data() + firstName[m], numNames[m], decoded[m]);
+            }
+        });
+
+    const std::size_t numImports = std::count_if(decoded.begin(), decoded.end(),
+        [](const LibMember & member) { return member.kind == MemberKind::Import; });
+    out << "Members..................: " << archive.members.size() << " (" << numImports << " import records, "
+        << (archive.members.size() - numImports) << " objects)\n";
+    out << "Symbol index.............: " << archive.symbols.size() << " symbols, " << indexName(archive.index) << "\n";
+
+    printImports(archive.members, decoded, out);
+    printObjects(archive.members, decoded, out);
+}
+
+// Looks the prog.findSymbols names up in the index. Returns how many were found.
+std::size_t findSymbols(const FileView & file, const Archive & archive, const ProgramFlags & prog, std::ostream & out)
+{
+    std::size_t numFound = 0;
+    for (const auto & name : prog.findSymbols)
+    {
+        const long m = findArchiveSymbol(file, archive, name.c_str());
+        if (m < 0)
+        {
+            out << "  " << name << ": " << color::yellow() << "not found" << color::restore() << "\n";
+            continue;
+        }
+
+        const ArchiveMember & member = archive.members[m];
+        ArchiveImport import;
+        out << "  " << name << ": ";
+        if (readArchiveImport(file, member, import))
+        {
+            out << color::red() << import.dllName << color::restore() << ", " << importTypeName(import.type)
+                << (import.nameType == pe::ImportObjectOrdinal ? " ordinal " : " hint ") << hexa(import.ordinalOrHint, 4);
+            if (!import.importName.empty() && import.importName != import.symbol)
+            {
+                out << ", imported as " << import.importName;
+            }
+        }
+        else
+        {
+            out << color::cyan() << member.name << color::restore();
+        }
+        out << "\n";
+        ++numFound;
+    }
+    return numFound;
+}
+
+bool isArchiveFile(const std::string & path)
+{
+    char magic[pe::ImageArchiveStartSize] = {};
+    std::FILE * fp = std::fopen(path.c_str(), "rb");
+    if (fp == nullptr)
+    {
+        return false;
+    }
+    const bool isArchive = std::fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+                           std::memcmp(magic, pe::ImageArchiveStart, sizeof(magic)) == 0;
+    std::fclose(fp);
+    return isArchive;
+}
+
+} // namespace {}
+
+// ========================================================
+// runLib()
+// ========================================================
+
+int runLib(const ProgramFlags & prog)
+{
+    // Directories are scanned for files with the '!<arch>' signature.
+    std::vector<std::string> files;
+    for (const auto & path : prog.inputPaths)
+    {
+        if (!isDirectory(path.c_str()))
+        {
+            files.push_back(path);
+            continue;
+        }
+
+        std::vector<std::string> dirFiles;
+        listFilesRecursive(path, dirFiles);
+        std::sort(dirFiles.begin(), dirFiles.end());
+        for (auto & file : dirFiles)
+        {
+            if (isArchiveFile(file))
+            {
+                files.push_back(std::move(file));
+            }
+        }
+    }
+    if (files.empty())
+    {
+        std::cerr << "No input files for --lib!\n";
+        return EXIT_FAILURE;
+    }
+
+    std::size_t failures = 0;
+    std::size_t numFound = 0;
+    for (const auto & file : files)
+    {
+        stats::FileScope statsFile{ file.c_str() };
+
+        FileContents contents;
+        if (!contents.load(file.c_str(), fileLoader(), std::cerr))
+        {
+            ++failures;
+            continue;
+        }
+
+        const FileView view{ contents.data(), contents.size() };
+        Archive archive;
+        std::cout << "\n";
+        std::cout << "Archive: " << file << "\n";
+        if (!readArchive(view, archive, std::cout))
+        {
+            ++failures;
+            continue;
+        }
+
+        if (!prog.findSymbols.empty())
+        {
+            numFound += findSymbols(view, archive, prog, std::cout);
+        }
+        else
+        {
+            dumpLibrary(view, archive, prog, std::cout);
+        }
+
+        if (archive.truncated)
+        {
+            std::cout << color::yellow() << "Archive is truncated! A member header is malformed or runs past the end of the file."
+                      << color::restore() << "\n";
+        }
+    }
+
+    if (!prog.findSymbols.empty() && numFound == 0)
+    {
+        return EXIT_FAILURE;
+    }
+    return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
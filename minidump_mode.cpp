@@ -0,0 +1,622 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: minidump_mode.cpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: Minidump mode. Lists the modules of .dmp files and parses their in-memory images.
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "portable_pe_dump.hpp"
+
+/*
+-------------------------------------
+Minidump mode
+-------------------------------------
+
+'ppedump --minidump <files/dirs...>' reads the module list of each minidump
+(MINIDUMP_MODULE_LIST) and prints, for every module, its address, size,
+timestamp and the debug ID and PDB name of its CodeView record, which is
+what a symbol server is queried with. The dump flags (-e, -i, -a, ...)
+add the same dumps 'ppedump' prints for a file, of the module's image as
+it was in the process memory (PELayout::Mapped).
+
+The images come from the memory lists (MINIDUMP_MEMORY_LIST and
+MINIDUMP_MEMORY64_LIST). A module inside a single memory range, which is
+the usual case of full-memory dumps, is parsed in place in the dump. One
+spread over several ranges is assembled in a zero-filled buffer, gaps
+included, unless most of it is missing. Nothing is written to disk. Dumps
+without the module's memory (plain minidumps) only print the module list.
+Modules past the end of the address space, or overlapping a module at a
+lower address, are not parsed: a process can't have them, and a dump
+listing one image many times would otherwise have it parsed each time.
+
+The modules of a dump are parsed in parallel (--workers), with the output
+buffered per module and printed in module list order.
+
+-------------------------------------
+*/
+
+namespace
+{
+
+// ========================================================
+// Minidump structures (minidumpapiset.h):
+// ========================================================
+
+namespace md
+{
+
+static const std::uint32_t Signature = 0x504D444D; // "MDMP"
+
+// MINIDUMP_STREAM_TYPE:
+static const std::uint32_t ModuleListStream   = 4;
+static const std::uint32_t MemoryListStream   = 5;
+static const std::uint32_t Memory64ListStream = 9;
+
+// CodeView record signatures:
+static const std::uint32_t CvSignatureRSDS = 0x53445352; // "RSDS", PDB 7.0
+static const std::uint32_t CvSignatureNB10 = 0x3031424E; // "NB10", PDB 2.0
+
+#pragma pack(push, 1)
+
+// AKA MINIDUMP_HEADER
+struct Header
+{
+    std::uint32_t signature;
+    std::uint32_t version;
+    std::uint32_t numberOfStreams;
+    std::uint32_t streamDirectoryRva;
+    std::uint32_t checkSum;
+    std::uint32_t timeDateStamp;
+    std::uint64_t flags;
+};
+
+// AKA MINIDUMP_LOCATION_DESCRIPTOR
+struct LocationDescriptor
+{
+    std::uint32_t dataSize;
+    std::uint32_t rva; // File offset
+};
+
+// AKA MINIDUMP_DIRECTORY
+struct Directory
+{
+    std::uint32_t      streamType;
+    LocationDescriptor location;
+};
+
+// AKA MINIDUMP_MODULE
+struct Module
+{
+    std::uint64_t      baseOfImage;
+    std::uint32_t      sizeOfImage;
+    std::uint32_t      checkSum;
+    std::uint32_t      timeDateStamp;
+    std::uint32_t      moduleNameRva; // MINIDUMP_STRING
+    std::uint32_t      versionInfo[13]; // VS_FIXEDFILEINFO
+    LocationDescriptor cvRecord;
+    LocationDescriptor miscRecord;
+    std::uint64_t      reserved0;
+    std::uint64_t      reserved1;
+};
+
+// AKA MINIDUMP_MEMORY_DESCRIPTOR
+struct MemoryDescriptor
+{
+    std::uint64_t      startOfMemoryRange;
+    LocationDescriptor memory;
+};
+
+// AKA MINIDUMP_MEMORY_DESCRIPTOR64. The data of all the
+// ranges follows baseRva back to back, in list order.
+struct MemoryDescriptor64
+{
+    std::uint64_t startOfMemoryRange;
+    std::uint64_t dataSize;
+};
+
+// AKA MINIDUMP_MEMORY64_LIST, without the trailing array
+struct Memory64List
+{
+    std::uint64_t numberOfMemoryRanges;
+    std::uint64_t baseRva;
+};
+
+// CV_INFO_PDB70, without the trailing PDB name
+struct CvInfoPdb70
+{
+    std::uint32_t signature;
+    std::uint32_t guidData1;
+    std::uint16_t guidData2;
+    std::uint16_t guidData3;
+    std::uint8_t  guidData4[8];
+    std::uint32_t age;
+};
+
+// CV_INFO_PDB20, without the trailing PDB name
+struct CvInfoPdb20
+{
+    std::uint32_t signature;
+    std::uint32_t offset;
+    std::uint32_t timeDateStamp;
+    std::uint32_t age;
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(Header) == 32, "MINIDUMP_HEADER layout");
+static_assert(sizeof(Module) == 108, "MINIDUMP_MODULE layout");
+static_assert(sizeof(MemoryDescriptor) == 16, "MINIDUMP_MEMORY_DESCRIPTOR layout");
+
+} // namespace md {}
+
+// ========================================================
+// Reading the dump:
+// ========================================================
+
+// A module of the list, with what the dump records about it.
+struct DumpModule
+{
+    std::string   name{};
+    std::uint64_t base = 0;
+    std::uint32_t size = 0;
+    std::uint32_t timeDateStamp = 0;
+    std::string   debugId{}; // Symbol server ID: GUID and age (or timestamp and age), hex
+    std::string   pdbName{};
+    bool          overlaps = false; // With a module at a lower address
+};
+
+// Process memory saved in the dump.
+struct MemoryRange
+{
+    std::uint64_t start;
+    std::uint64_t size;
+    std::uint64_t fileOffset;
+};
+
+// Images assembled from several ranges must be at least this much
+// in the dump, so a hostile module size can't make us allocate
+// more than a few times the dump size.
+const std::uint64_t MaxGapsPerByte = 4;
+const std::uint64_t MaxGapBytes    = 1024 * 1024;
+
+std::string hexa64(const std::uint64_t value, const int pad)
+{
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "0x%0*llX", pad, static_cast<unsigned long long>(value));
+    return buffer;
+}
+
+// MINIDUMP_STRING (a byte length, then UTF-16LE) to UTF-8.
+std::string readDumpString(const FileView & dump, const std::uint32_t rva)
+{
+    const auto length = dump.at<std::uint32_t>(rva);
+    if (length == nullptr)
+    {
+        return std::string{};
+    }
+    const std::uint32_t numUnits = std::min<std::uint32_t>(*length / 2, MaxSymbolNameLength);
+    const auto units = dump.at<std::uint16_t>(std::uint64_t{ rva } + 4, numUnits);
+    if (units == nullptr)
+    {
+        return std::string{};
+    }
+
+    std::string str;
+    for (std::uint32_t i = 0; i < numUnits; ++i)
+    {
+        std::uint32_t c = units[i];
+        if (c >= 0xD800 && c < 0xDC00 && i + 1 < numUnits && units[i + 1] >= 0xDC00 && units[i + 1] < 0xE000)
+        {
+            c = 0x10000 + ((c - 0xD800) << 10) + (units[++i] - 0xDC00);
+        }
+        else if (c >= 0xD800 && c < 0xE000)
+        {
+            c = 0xFFFD; // Unpaired surrogate
+        }
+
+        if (c < 0x80)
+        {
+            str += static_cast<char>(c);
+        }
+        else if (c < 0x800)
+        {
+            str += static_cast<char>(0xC0 | (c >> 6));
+            str += static_cast<char>(0x80 | (c & 0x3F));
+        }
+        else if (c < 0x10000)
+        {
+            str += static_cast<char>(0xE0 | (c >> 12));
+            str += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            str += static_cast<char>(0x80 | (c & 0x3F));
+        }
+        else
+        {
+            str += static_cast<char>(0xF0 | (c >> 18));
+            str += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+            str += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+            str += static_cast<char>(0x80 | (c & 0x3F));
+        }
+    }
+    return str;
+}
+
+// Debug ID and PDB name from the module's CodeView record, if it has one.
+void readCodeViewRecord(const FileView & dump, const md::LocationDescriptor & location, DumpModule & module)
+{
+    const auto signature = dump.at<std::uint32_t>(location.rva);
+    if (signature == nullptr || location.dataSize < sizeof(std::uint32_t))
+    {
+        return;
+    }
+
+    char buffer[64];
+    std::size_t nameOffset = 0;
+    if (*signature == md::CvSignatureRSDS && location.dataSize >= sizeof(md::CvInfoPdb70))
+    {
+        const auto cv = dump.at<md::CvInfoPdb70>(location.rva);
+        if (cv == nullptr)
+        {
+            return;
+        }
+        std::snprintf(buffer, sizeof(buffer), "%08X%04X%04X%02X%02X%02X%02X%02X%02X%02X%02X%X",
+                      cv->guidData1, cv->guidData2, cv->guidData3,
+                      cv->guidData4[0], cv->guidData4[1], cv->guidData4[2], cv->guidData4[3],
+                      cv->guidData4[4], cv->guidData4[5], cv->guidData4[6], cv->guidData4[7], cv->age);
+        nameOffset = sizeof(md::CvInfoPdb70);
+    }
+    else if (*signature == md::CvSignatureNB10 && location.dataSize >= sizeof(md::CvInfoPdb20))
+    {
+        const auto cv = dump.at<md::CvInfoPdb20>(location.rva);
+        if (cv == nullptr)
+        {
+            return;
+        }
+        std::snprintf(buffer, sizeof(buffer), "%08X%X", cv->timeDateStamp, cv->age);
+        nameOffset = sizeof(md::CvInfoPdb20);
+    }
+    else
+    {
+        return;
+    }
+
+    // The name is NUL-terminated, but cut it at the end of the record too.
+    std::size_t nameLength = 0;
+    const char * name = dump.string(std::uint64_t{ location.rva } + nameOffset, nameLength);
+    module.debugId = buffer;
+    module.pdbName.assign(name, std::min<std::size_t>(nameLength, location.dataSize - nameOffset));
+}
+
+// Validates the header and reads the module list and the memory ranges,
+// sorted by address. Everything is checked against the dump size.
+bool readMinidump(const FileView & dump, std::vector<DumpModule> & modules,
+                  std::vector<MemoryRange> & ranges, std::ostream & errOut)
+{
+    const auto header = dump.at<md::Header>(0);
+    if (header == nullptr || header->signature != md::Signature)
+    {
+        errOut << color::red() << "Not a minidump! Expected the 'MDMP' signature." << color::restore() << "\n";
+        return false;
+    }
+
+    const auto streams = dump.at<md::Directory>(header->streamDirectoryRva, header->numberOfStreams);
+    if (streams == nullptr)
+    {
+        errOut << color::red() << "Minidump stream directory is out of bounds!" << color::restore() << "\n";
+        return false;
+    }
+
+    for (std::uint32_t s = 0; s < header->numberOfStreams; ++s)
+    {
+        const md::LocationDescriptor & location = streams[s].location;
+        switch (streams[s].streamType)
+        {
+        case md::ModuleListStream :
+            {
+                const auto count = dump.at<std::uint32_t>(location.rva);
+                const auto list  = (count != nullptr) ? dump.at<md::Module>(std::uint64_t{ location.rva } + 4, *count) : nullptr;
+                if (list == nullptr)
+                {
+                    break;
+                }
+                for (std::uint32_t m = 0; m < *count; ++m)
+                {
+                    DumpModule module;
+                    module.name          = readDumpString(dump, list[m].moduleNameRva);
+                    module.base          = list[m].baseOfImage;
+                    module.size          = list[m].sizeOfImage;
+                    module.timeDateStamp = list[m].timeDateStamp;
+                    readCodeViewRecord(dump, list[m].cvRecord, module);
+                    modules.push_back(std::move(module));
+                }
+                break;
+            }
+        case md::MemoryListStream :
+            {
+                const auto count = dump.at<std::uint32_t>(location.rva);
+                const auto list  = (count != nullptr) ? dump.at<md::MemoryDescriptor>(std::uint64_t{ location.rva } + 4, *count) : nullptr;
+                if (list == nullptr)
+                {
+                    break;
+                }
+                for (std::uint32_t r = 0; r < *count; ++r)
+                {
+                    ranges.push_back({ list[r].startOfMemoryRange, list[r].memory.dataSize, list[r].memory.rva });
+                }
+                break;
+            }
+        case md::Memory64ListStream :
+            {
+                const auto list64 = dump.at<md::Memory64List>(location.rva);
+                const auto list   = (list64 != nullptr) ? dump.at<md::MemoryDescriptor64>(std::uint64_t{ location.rva } + sizeof(md::Memory64List), list64->numberOfMemoryRanges) : nullptr;
+                if (list == nullptr)
+                {
+                    break;
+                }
+                std::uint64_t fileOffset = std::min<std::uint64_t>(list64->baseRva, dump.size());
+                for (std::uint64_t r = 0; r < list64->numberOfMemoryRanges; ++r)
+                {
+                    ranges.push_back({ list[r].startOfMemoryRange, list[r].dataSize, fileOffset });
+                    fileOffset = std::min<std::uint64_t>(fileOffset + std::min<std::uint64_t>(list[r].dataSize, dump.size()), dump.size());
+                }
+                break;
+            }
+        default :
+            break;
+        }
+    }
+
+    // Ranges cut short by a truncated dump keep what's there. Ranges
+    // wrapping around the address space can't be real, so they are dropped.
+    for (auto & range : ranges)
+    {
+        const std::uint64_t inFile = (range.fileOffset < dump.size()) ? dump.size() - range.fileOffset : 0;
+        range.size = std::min(range.size, inFile);
+    }
+    ranges.erase(std::remove_if(ranges.begin(), ranges.end(), [](const MemoryRange & range) {
+                     return range.size == 0 || range.start > UINT64_MAX - range.size;
+                 }), ranges.end());
+    std::sort(ranges.begin(), ranges.end(), [](const MemoryRange & a, const MemoryRange & b) { return a.start < b.start; });
+
+    // The modules of a process never overlap. A list where they do would have the
+    // same bytes parsed once per module, so only the lowest of them is parsed.
+    std::vector<DumpModule *> byAddress;
+    byAddress.reserve(modules.size());
+    for (auto & module : modules)
+    {
+        byAddress.push_back(&module);
+    }
+    std::stable_sort(byAddress.begin(), byAddress.end(), [](const DumpModule * a, const DumpModule * b) { return a->base < b->base; });
+    std::uint64_t lowestFree = 0;
+    for (DumpModule * module : byAddress)
+    {
+        if (module->size == 0)
+        {
+            continue;
+        }
+        module->overlaps = (module->base < lowestFree);
+        lowestFree = std::max(lowestFree, module->base + std::min<std::uint64_t>(module->size, UINT64_MAX - module->base));
+    }
+    return true;
+}
+
+// ========================================================
+// Module images:
+// ========================================================
+
+// Points 'image' at the module's bytes in the dump, or assembles them from
+// the ranges that hold parts of it. Returns how the image was found.
+std::string locateImage(const FileView & dump, const std::vector<MemoryRange> & ranges,
+                        const DumpModule & module, FileContents & image)
+{
+    if (module.size == 0)
+    {
+        return "not in the dump";
+    }
+    if (module.base > UINT64_MAX - module.size)
+    {
+        return "past the end of the address space";
+    }
+    if (module.overlaps)
+    {
+        return "overlaps another module";
+    }
+    const std::uint64_t begin = module.base;
+    const std::uint64_t end   = module.base + module.size;
+
+    // The last range starting at or before the image, then the ones after it.
+    auto first = std::upper_bound(ranges.begin(), ranges.end(), begin,
+                                  [](const std::uint64_t address, const MemoryRange & range) { return address < range.start; });
+    if (first != ranges.begin())
+    {
+        --first;
+    }
+
+    // Whole in one range: parsed in place. readMinidump() cut the ranges
+    // to the dump, but that is checked again before pointing into it.
+    if (first != ranges.end() && first->start <= begin && begin - first->start <= first->size &&
+        module.size <= first->size - (begin - first->start))
+    {
+        const std::uint64_t offset = first->fileOffset + (begin - first->start);
+        if (offset <= dump.size() && module.size <= dump.size() - offset)
+        {
+            image.borrow(dump.data() + offset, module.size);
+            return "in place";
+        }
+        return "not in the dump";
+    }
+
+    std::uint64_t covered = 0;
+    std::uint64_t extent  = 0;
+    std::uint32_t pieces  = 0;
+    for (auto range = first; range != ranges.end() && range->start < end; ++range)
+    {
+        const std::uint64_t from = std::max(range->start, begin);
+        const std::uint64_t to   = std::min(range->start + range->size, end);
+        if (from < to)
+        {
+            covered += to - from;
+            extent   = std::max(extent, to - begin);
+            ++pieces;
+        }
+    }
+    if (covered == 0)
+    {
+        return "not in the dump";
+    }
+    if (extent > covered * MaxGapsPerByte + MaxGapBytes)
+    {
+        return "mostly missing (" + hexa64(covered, 8) + " of " + hexa64(module.size, 8) + " bytes)";
+    }
+
+    std::unique_ptr<std::uint8_t[]> buffer{ new std::uint8_t[extent]() };
+    for (auto range = first; range != ranges.end() && range->start < end; ++range)
+    {
+        const std::uint64_t from = std::max(range->start, begin);
+        const std::uint64_t to   = std::min(range->start + range->size, end);
+        if (from < to)
+        {
+            std::memcpy(buffer.get() + (from - begin), dump.data() + range->fileOffset + (from - range->start), to - from);
+        }
+    }
+    image.adopt(std::move(buffer), extent);
+
+    return "assembled from " + std::to_string(pieces) + " ranges (" +
+           hexa64(covered, 8) + " of " + hexa64(module.size, 8) + " bytes)";
+}
+
+void dumpModule(const FileView & dump, const std::vector<MemoryRange> & ranges, const DumpModule & module,
+                const ProgramFlags & prog, std::ostream & out)
+{
+    stats::FileScope statsFile{ module.name.c_str() };
+
+    out << "\n";
+    out << "Module: " << module.name << "\n";
+    out << "Base address.............: " << hexa64(module.base, 16) << "\n";
+    out << "Image size...............: " << hexa64(module.size, 8) << "\n";
+    out << "Timestamp................: " << hexa64(module.timeDateStamp, 8) << "\n";
+    out << "Debug ID.................: " << (module.debugId.empty() ? "none" : module.debugId) << "\n";
+    out << "PDB file.................: " << module.pdbName << "\n";
+
+    FileContents contents;
+    const std::string where = locateImage(dump, ranges, module, contents);
+    out << "Image....................: " << where << "\n";
+    if (contents.empty())
+    {
+        return;
+    }
+
+    PEImage image;
+    std::ostringstream errors;
+    if (!image.open(std::move(contents), module.name.c_str(), errors, PELayout::Mapped))
+    {
+        out << color::red() << "Image is not a valid PE: " << errors.str() << color::restore();
+        return;
+    }
+    dumpPEImage(image, prog, out);
+}
+
+} // namespace {}
+
+// ========================================================
+// runMinidump()
+// ========================================================
+
+int runMinidump(const ProgramFlags & prog)
+{
+    // Directories are scanned for files with the 'MDMP' signature.
+    std::vector<std::string> files;
+    for (const auto & path : prog.inputPaths)
+    {
+        if (!isDirectory(path.c_str()))
+        {
+            files.push_back(path);
+            continue;
+        }
+
+        std::vector<std::string> dirFiles;
+        listFilesRecursive(path, dirFiles);
+        std::sort(dirFiles.begin(), dirFiles.end());
+        for (auto & file : dirFiles)
+        {
+            char magic[4] = {};
+            std::FILE * fp = std::fopen(file.c_str(), "rb");
+            if (fp != nullptr)
+            {
+                const bool isDump = std::fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && std::memcmp(magic, "MDMP", 4) == 0;
+                std::fclose(fp);
+                if (isDump)
+                {
+                    files.push_back(std::move(file));
+                }
+            }
+        }
+    }
+    if (files.empty())
+    {
+        std::cerr << "No input files for --minidump!\n";
+        return EXIT_FAILURE;
+    }
+
+    std::size_t failures = 0;
+    for (const auto & file : files)
+    {
+        FileContents contents;
+        if (!contents.load(file.c_str(), fileLoader(), std::cerr))
+        {
+            ++failures;
+            continue;
+        }
+
+        const FileView dump{ contents.data(), contents.size() };
+        std::vector<DumpModule> modules;
+        std::vector<MemoryRange> ranges;
+        std::cout << "\n";
+        std::cout << "Minidump: " << file << "\n";
+        if (!readMinidump(dump, modules, ranges, std::cerr))
+        {
+            ++failures;
+            continue;
+        }
+        std::cout << "Modules: " << modules.size() << ", memory ranges: " << ranges.size() << "\n";
+
+        // Output is buffered per module and printed in module list order.
+        std::vector<std::string> outputs(modules.size());
+        parallelForEach(modules.size(), batchWorkerCount(prog.numWorkers, modules.size()),
+            [&](const std::size_t m, unsigned)
+            {
+                std::ostringstream out;
+                dumpModule(dump, ranges, modules[m], prog, out);
+                outputs[m] = out.str();
+            });
+
+        for (const auto & output : outputs)
+        {
+            std::cout << output;
+        }
+        std::cout << "\n";
+    }
+
+    return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,434 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: obj_mode.cpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: Object mode. Dumps the headers, sections, relocations and symbols of COFF objects.
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "portable_pe_dump.hpp"
+
+/*
+-------------------------------------
+Object mode
+-------------------------------------
+
+'ppedump --obj <files/dirs...>' reads COFF object files (.obj), what
+the compiler hands to the linker. They have no DOS or NT headers, so
+they are not PEs to the other modes, but they start with the same
+IMAGE_FILE_HEADER, and the section table follows it (readCoffObject()).
+Objects built with /bigobj are read too. Given a single object, plain
+'ppedump foo.obj' takes this mode as well.
+
+Each object gets a line with its machine and counts. The dump flags
+add the rest: -n the file header, -s the section table as for PEs,
+with the size and the relocation count of each section, -r the
+relocations of each section with the symbols they refer to, and -t
+the symbol table, C++ names undecorated.
+
+Directories are scanned for objects, a known machine and no optional
+header in their first bytes. The files are dumped on --workers threads,
+in rounds, the output buffered per file and printed in input order
+after each round, so whole build trees are listed at the rate PEs are
+and in bounded memory. Only the tables asked for are read: with
+'--loader ondemand', listing a tree touches little more than the headers.
+
+-------------------------------------
+*/
+
+namespace
+{
+
+// Files per parallelForEach() round. The output of a round is held until its last file is done.
+const std::size_t FilesPerRound = 512;
+
+std::string hexa(const std::uint32_t value, const int pad)
+{
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "0x%0*X", pad, value);
+    return buffer;
+}
+
+// IMAGE_REL_<machine>_* names, by type. Null for the gaps.
+const char * relocationTypeName(const std::uint16_t machine, const std::uint16_t type)
+{
+    static const char * const i386[] = {
+        "ABSOLUTE", "DIR16", "REL16", nullptr, nullptr, nullptr, "DIR32", "DIR32NB", nullptr, "SEG12",
+        "SECTION", "SECREL", "TOKEN", "SECREL7", nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, "REL32"
+    };
+    static const char * const amd64[] = {
+        "ABSOLUTE", "ADDR64", "ADDR32", "ADDR32NB", "REL32", "REL32_1", "REL32_2", "REL32_3", "REL32_4",
+        "REL32_5", "SECTION", "SECREL", "SECREL7", "TOKEN", "SREL32", "PAIR", "SSPAN32"
+    };
+    static const char * const arm[] = {
+        "ABSOLUTE", "ADDR32", "ADDR32NB", "BRANCH24", "BRANCH11", "TOKEN", nullptr, nullptr, "BLX24", "BLX11",
+        "REL32", nullptr, nullptr, nullptr, "SECTION", "SECREL", "MOV32", "THUMB_MOV32", "THUMB_BRANCH20",
+        nullptr, "THUMB_BRANCH24", "THUMB_BLX23", "PAIR"
+    };
+    static const char * const arm64[] = {
+        "ABSOLUTE", "ADDR32", "ADDR32NB", "BRANCH26", "PAGEBASE_REL21", "REL21", "PAGEOFFSET_12A",
+        "PAGEOFFSET_12L", "SECREL", "SECREL_LOW12A", "SECREL_HIGH12A", "SECREL_LOW12L", "TOKEN", "SECTION",
+        "ADDR64", "BRANCH19", "BRANCH14", "REL32"
+    };
+
+    #define RELOC_NAME(names) ((type < sizeof(names) / sizeof(names[0])) ? names[type] : nullptr)
+    const char * name = nullptr;
+    switch (machine)
+    {
+    case 0x014C : name = RELOC_NAME(i386);  break;
+    case 0x8664 : name = RELOC_NAME(amd64); break;
+    case 0x01C0 :
+    case 0x01C2 :
+    case 0x01C4 : name = RELOC_NAME(arm);   break;
+    case 0xA641 :
+    case 0xA64E :
+    case 0xAA64 : name = RELOC_NAME(arm64); break;
+    default     : break;
+    } // switch (machine)
+    #undef RELOC_NAME
+
+    return (name != nullptr) ? name : "?";
+}
+
+const char * storageClassName(const int storageClass)
+{
+    switch (storageClass)
+    {
+    case pe::ImageSymClassExternal     : return "EXTERNAL";
+    case pe::ImageSymClassStatic       : return "STATIC";
+    case pe::ImageSymClassLabel        : return "LABEL";
+    case pe::ImageSymClassFunction     : return "FUNCTION";
+    case pe::ImageSymClassFile         : return "FILE";
+    case pe::ImageSymClassSection      : return "SECTION";
+    case pe::ImageSymClassWeakExternal : return "WEAK_EXTERNAL";
+    case 0                             : return "NULL";
+    case 5                             : return "EXTERNAL_DEF";
+    case 100                           : return "BLOCK";
+    case 107                           : return "CLR_TOKEN";
+    case 0xFF                          : return "END_OF_FUNCTION";
+    default                            : return "?";
+    } // switch (storageClass)
+}
+
+std::string sectionNumberString(const CoffSymbol & symbol)
+{
+    switch (symbol.sectionNumber)
+    {
+    case pe::ImageSymUndefined :
+        // Undefined externals with a value are common data, allocated by the linker.
+        return (symbol.storageClass == pe::ImageSymClassExternal && symbol.value != 0) ? "COMMON" : "UNDEF";
+    case pe::ImageSymAbsolute : return "ABS";
+    case pe::ImageSymDebug    : return "DEBUG";
+    default                   : return std::to_string(symbol.sectionNumber);
+    } // switch (symbol.sectionNumber)
+}
+
+// MSVC C++ names start with '?'. Anything else is printed as is, section
+// and file names included, which demangle() would take for C functions.
+std::string symbolDisplayName(const PEStringRef & name)
+{
+    std::string str = name.str();
+    return (!str.empty() && str[0] == '?') ? demangleCached(str) : str;
+}
+
+void printBanner(std::ostream & out, const char * title)
+{
+    out << "\n";
+    out << color::yellow() << "------------------------------------------------------------\n";
+    out << color::yellow() << "            " << title << "\n";
+    out << color::yellow() << "------------------------------------------------------------\n";
+    out << color::restore() << "\n";
+}
+
+std::uint64_t totalRelocations(const FileView & file, const CoffObject & object)
+{
+    std::uint64_t total = 0;
+    for (const auto & section : object.sections)
+    {
+        std::uint32_t count = 0;
+        coffRelocations(file, section, count);
+        total += count;
+    }
+    return total;
+}
+
+void dumpFileHeader(std::ostream & out, const CoffObject & object)
+{
+    printBanner(out, object.bigObj ? "ANON_OBJECT_HEADER_BIGOBJ" : "IMAGE_FILE_HEADER");
+
+    const std::time_t timestamp = object.timeDateStamp;
+    out << "Machine architecture.....: " << fileHeaderMachine(object.machine) << "\n";
+    out << "Number of sections.......: " << object.sections.size() << "\n";
+    out << "Timestamp................: " << hexa(object.timeDateStamp, 0) << " => " << timestampString(timestamp); // ctime already terminated with a newline.
+    out << "Pointer to symbol table..: " << object.symbolsOffset << "\n";
+    out << "Number of symbols........: " << object.numSymbols << "\n";
+    out << "String table size........: " << object.stringsSize << "\n";
+    out << "Image characteristics....: " << fileHeaderCharacteristics(object.characteristics) << "\n";
+}
+
+void dumpSections(std::ostream & out, const FileView & file, const CoffObject & object)
+{
+    printBanner(out, "IMAGE_SECTION_HEADERS");
+
+    out << "Number       Name      Size         Relocs     Flags        Flag strings\n";
+    out << "------       ----      ----         ------     -----        ------------\n";
+
+    // Numbered from 1, as the symbols refer to them.
+    char line[256];
+    std::uint32_t number = 1;
+    for (const auto & section : object.sections)
+    {
+        std::uint32_t numRelocations = 0;
+        coffRelocations(file, section, numRelocations);
+        const std::string name = coffSectionName(file, object, section).str();
+        std::snprintf(line, sizeof(line), "Section %u: %s %-8s %s  0x%08X   %-9u  0x%08X  ( ", number++, color::red(),
+                      name.c_str(), color::restore(), section.sizeOfRawData, numRelocations, section.characteristics);
+        out << line << sectionCharacteristics(section.characteristics) << " )\n";
+    }
+
+    out << object.sections.size() << " sections listed.\n";
+}
+
+void dumpRelocations(std::ostream & out, const FileView & file, const CoffObject & object)
+{
+    printBanner(out, "Relocations");
+
+    // The lines of each section go out in a single write.
+    std::uint64_t total = 0;
+    std::uint32_t number = 1;
+    std::string block;
+    char line[128];
+    CoffSymbol symbol;
+    for (const auto & section : object.sections)
+    {
+        const std::uint32_t sectionNumber = number++;
+        std::uint32_t count = 0;
+        const pe::ImageRelocation * relocations = coffRelocations(file, section, count);
+        if (count == 0)
+        {
+            continue;
+        }
+
+        out << color::red() << coffSectionName(file, object, section).str() << color::restore()
+            << " (section " << sectionNumber << "), " << count << " relocations\n";
+        if (relocations == nullptr)
+        {
+            out << color::yellow() << "  Relocations run past the end of the file!" << color::restore() << "\n\n";
+            continue;
+        }
+
+        block.clear();
+        block += "  Offset      Type              Symbol\n";
+        for (std::uint32_t r = 0; r < count; ++r)
+        {
+            const pe::ImageRelocation & relocation = relocations[r];
+            std::snprintf(line, sizeof(line), "  0x%08X  %-16s  [%u] ", relocation.virtualAddress,
+                          relocationTypeName(object.machine, relocation.type), relocation.symbolTableIndex);
+            block += line;
+            if (readCoffSymbol(file, object, relocation.symbolTableIndex, symbol))
+            {
+                block += color::yellow();
+                block.append(symbol.name.data, symbol.name.length);
+                block += color::restore();
+            }
+            else
+            {
+                block += "(no such symbol)";
+            }
+            block += "\n";
+        }
+        out.write(block.data(), static_cast<std::streamsize>(block.size()));
+        out << "\n";
+        total += count;
+    }
+
+    out << total << " relocations listed.\n";
+}
+
+void dumpSymbols(std::ostream & out, const FileView & file, const CoffObject & object)
+{
+    printBanner(out, "Symbol table");
+
+    out << "  Index     Value       Section   Class            Name\n";
+
+    std::uint32_t numSymbols = 0;
+    std::string block;
+    char line[128];
+    CoffSymbol symbol;
+    for (std::uint32_t index = 0; readCoffSymbol(file, object, index, symbol); index += 1 + symbol.numAuxSymbols)
+    {
+        const std::string section = sectionNumberString(symbol);
+        std::snprintf(line, sizeof(line), "  %-8u  0x%08X  %-8s  %-15s  ", index, symbol.value,
+                      section.c_str(), storageClassName(symbol.storageClass));
+        block += line;
+
+        // FILE records have the source file name in their auxiliary records, NUL-padded.
+        std::string name;
+        if (symbol.storageClass == pe::ImageSymClassFile && symbol.numAuxSymbols != 0)
+        {
+            const std::uint64_t auxOffset = object.symbolsOffset + std::uint64_t(index + 1) * object.symbolSize;
+            const std::uint64_t auxSize   = std::uint64_t(std::min<std::uint32_t>(symbol.numAuxSymbols, object.numSymbols - index - 1)) * object.symbolSize;
+            const char * aux = file.at<char>(auxOffset, auxSize);
+            if (aux != nullptr)
+            {
+                const void * end = std::memchr(aux, '\0', static_cast<std::size_t>(auxSize));
+                name.assign(aux, (end != nullptr) ? static_cast<std::size_t>(static_cast<const char *>(end) - aux) : static_cast<std::size_t>(auxSize));
+            }
+        }
+        else
+        {
+            name = symbolDisplayName(symbol.name);
+        }
+
+        block += color::yellow();
+        block += name;
+        block += color::restore();
+        block += "\n";
+        ++numSymbols;
+    }
+    out.write(block.data(), static_cast<std::streamsize>(block.size()));
+
+    out << numSymbols << " symbols (" << object.numSymbols << " records).\n";
+}
+
+// Dumps one object, per the flags. False if the file isn't one.
+bool dumpObject(const std::string & filename, const ProgramFlags & prog, std::ostream & out, std::ostream & errOut)
+{
+    stats::FileScope statsFile{ filename.c_str() };
+
+    FileContents contents;
+    if (!contents.load(filename.c_str(), fileLoader(), errOut))
+    {
+        return false;
+    }
+
+    out << "\n";
+    out << "Object: " << filename << "\n";
+    out << "File size in bytes: " << contents.size() << "\n";
+
+    const FileView file{ contents.data(), contents.size() };
+    CoffObject object;
+    if (!readCoffObject(file, object, errOut))
+    {
+        return false;
+    }
+
+    out << "COFF object" << (object.bigObj ? " (/bigobj)" : "") << " for " << fileHeaderMachine(object.machine)
+        << " (" << hexa(object.machine, 4) << "): " << object.sections.size() << " sections, "
+        << object.numSymbols << " symbols, " << totalRelocations(file, object) << " relocations.\n";
+    if (object.truncated)
+    {
+        out << color::yellow() << "The symbol table is truncated! It runs past the end of the file." << color::restore() << "\n";
+    }
+
+    if (prog.flagDumpNTHeaders)
+    {
+        stats::Scope statsScope{ stats::Phase::NTHeaders };
+        dumpFileHeader(out, object);
+    }
+    if (prog.flagDumpSectionHeaders)
+    {
+        stats::Scope statsScope{ stats::Phase::Sections };
+        dumpSections(out, file, object);
+    }
+    if (prog.flagDumpRelocations)
+    {
+        stats::Scope statsScope{ stats::Phase::Relocations };
+        dumpRelocations(out, file, object);
+    }
+    if (prog.flagDumpSymbols)
+    {
+        stats::Scope statsScope{ stats::Phase::Symbols };
+        dumpSymbols(out, file, object);
+    }
+    return true;
+}
+
+} // namespace {}
+
+// ========================================================
+// runObj()
+// ========================================================
+
+int runObj(const ProgramFlags & prog)
+{
+    // Directories are scanned for files with an object header.
+    std::vector<std::string> files;
+    for (const auto & path : prog.inputPaths)
+    {
+        if (!isDirectory(path.c_str()))
+        {
+            files.push_back(path);
+            continue;
+        }
+
+        std::vector<std::string> dirFiles;
+        listFilesRecursive(path, dirFiles);
+        std::sort(dirFiles.begin(), dirFiles.end());
+        for (auto & file : dirFiles)
+        {
+            if (looksLikeCoffObject(file.c_str()))
+            {
+                files.push_back(std::move(file));
+            }
+        }
+    }
+    if (files.empty())
+    {
+        std::cerr << "No input files for --obj!\n";
+        return EXIT_FAILURE;
+    }
+
+    std::atomic<std::size_t> failures{ 0 };
+    std::vector<std::string> outputs;
+    std::vector<std::string> errors;
+    for (std::size_t first = 0; first < files.size(); first += FilesPerRound)
+    {
+        const std::size_t numFiles = std::min(FilesPerRound, files.size() - first);
+        outputs.assign(numFiles, std::string{});
+        errors.assign(numFiles, std::string{});
+
+        parallelForEach(numFiles, batchWorkerCount(prog.numWorkers, numFiles),
+            [&](const std::size_t i, unsigned)
+            {
+                std::ostringstream out;
+                std::ostringstream errOut;
+                if (!dumpObject(files[first + i], prog, out, errOut))
+                {
+                    ++failures;
+                }
+                outputs[i] = out.str();
+                errors[i]  = errOut.str();
+            });
+
+        for (std::size_t i = 0; i < numFiles; ++i)
+        {
+            std::cout << outputs[i];
+            std::cerr << errors[i];
+        }
+    }
+    std::cout << "\n";
+
+    return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,381 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: pe_diff.cpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: Structural diff of two PEs (or two directory trees of PEs).
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "portable_pe_dump.hpp"
+
+/*
+-------------------------------------
+Structural PE diff
+-------------------------------------
+
+Each side is reduced to four keyed sets: header fields, section table,
+imports and exports. Every entry has a key (field name, section name,
+"dll!symbol", export name) and a value (field value, section layout,
+export ordinal, ...). Entries are sorted by a 64-bit hash of the key,
+then both sides are walked in a single merge pass, so comparing two PEs
+with N and M entries costs O(N log N + M log M) with mostly integer
+compares, instead of O(N * M) string compares of the nested loop approach.
+
+Keys present on one side only are reported as added/removed, keys on both
+sides with different values as changed. Export RVAs and import hints are
+deliberately not compared, since they change with virtually every rebuild.
+
+-------------------------------------
+*/
+
+namespace
+{
+
+struct KeyedEntry
+{
+    std::uint64_t hash;
+    std::string   key;
+    std::string   value;
+};
+
+enum class Change
+{
+    Added,
+    Removed,
+    Changed
+};
+
+struct Difference
+{
+    Change      change;
+    std::string key;
+    std::string oldValue;
+    std::string newValue;
+};
+
+struct KeyedSet
+{
+    const char * title;
+    std::vector<KeyedEntry> entries;
+};
+
+std::string hexa(const std::uint64_t val, const int pad = 0)
+{
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "0x%0*llX", pad, static_cast<unsigned long long>(val));
+    return buffer;
+}
+
+std::string toLower(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(),
+                   [](const char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+    return str;
+}
+
+void addEntry(KeyedSet & set, std::string key, std::string value)
+{
+    const std::uint64_t hash = hashString(key);
+    set.entries.push_back(KeyedEntry{ hash, std::move(key), std::move(value) });
+}
+
+void sortEntries(KeyedSet & set)
+{
+    std::sort(set.entries.begin(), set.entries.end(),
+              [](const KeyedEntry & a, const KeyedEntry & b)
+              {
+                  return (a.hash != b.hash) ? (a.hash < b.hash) : (a.key < b.key);
+              });
+
+    // A key can legitimately repeat (e.g. a DLL imported twice); those are not interesting.
+    set.entries.erase(std::unique(set.entries.begin(), set.entries.end(),
+                                  [](const KeyedEntry & a, const KeyedEntry & b)
+                                  {
+                                      return a.hash == b.hash && a.key == b.key;
+                                  }),
+                      set.entries.end());
+}
+
+// Builds the header, sections, imports and exports keyed sets of a PE.
+std::vector<KeyedSet> buildKeyedSets(const PEInfo & info)
+{
+    std::vector<KeyedSet> sets;
+
+    KeyedSet headers{ "Headers", {} };
+    addEntry(headers, "Machine",             fileHeaderMachine(info.machine));
+    addEntry(headers, "Timestamp",           hexa(info.timeDateStamp));
+    addEntry(headers, "Characteristics",     hexa(info.fileCharacteristics, 4));
+    addEntry(headers, "Magic",               hexa(info.magic));
+    addEntry(headers, "Entry point",         hexa(info.addressOfEntryPoint));
+    addEntry(headers, "Image base",          hexa(info.imageBase));
+    addEntry(headers, "Image size",          hexa(info.sizeOfImage));
+    addEntry(headers, "Subsystem",           optionalHeaderSubsystem(info.subsystem));
+    addEntry(headers, "DLL characteristics", hexa(info.dllCharacteristics, 4));
+    addEntry(headers, "Number of sections",  std::to_string(info.sections.size()));
+    sets.push_back(std::move(headers));
+
+    // Section names can repeat, so the Nth section with
+    // a given name is keyed as "name#N" after the first one.
+    KeyedSet sections{ "Sections", {} };
+    std::unordered_map<std::string, int> nameCounts;
+    for (const auto & section : info.sections)
+    {
+        const int count = nameCounts[section.name]++;
+        addEntry(sections, (count == 0) ? section.name : (section.name + "#" + std::to_string(count)),
+                 "va="     + hexa(section.virtualAddress)   +
+                 " vsize=" + hexa(section.virtualSize)      +
+                 " raw="   + hexa(section.sizeOfRawData)    +
+                 " flags=" + hexa(section.characteristics, 8));
+    }
+    sets.push_back(std::move(sections));
+
+    // DLL names are case insensitive on Windows.
+    KeyedSet imports{ "Imports", {} };
+    for (const auto & module : info.imports.modules)
+    {
+        const std::string dllName = toLower(module.dllName);
+        for (const auto & symbol : module.symbols)
+        {
+            addEntry(imports, dllName + "!" + (symbol.byOrdinal ? ("#" + std::to_string(symbol.ordinal)) : symbol.name), "");
+        }
+    }
+    sets.push_back(std::move(imports));
+
+    // Forwarders are listed as separate entries sharing the ordinal of
+    // the named export, so join them back together by ordinal first.
+    KeyedSet exports{ "Exports", {} };
+    std::unordered_map<std::uint32_t, const PEExportedSymbol *> forwarders;
+    std::unordered_map<std::uint32_t, bool> namedOrdinals;
+    for (const auto & symbol : info.exports.symbols)
+    {
+        if (symbol.forwarder) { forwarders[symbol.ordinal] = &symbol; }
+        else                  { namedOrdinals[symbol.ordinal] = true; }
+    }
+    for (const auto & symbol : info.exports.symbols)
+    {
+        const auto fwd = forwarders.find(symbol.ordinal);
+        const std::string target = (fwd != forwarders.end()) ? (" -> " + fwd->second->name) : "";
+
+        if (!symbol.forwarder)
+        {
+            addEntry(exports, symbol.name, "ordinal " + hexa(symbol.ordinal, 3) + target);
+        }
+        else if (namedOrdinals.find(symbol.ordinal) == namedOrdinals.end())
+        {
+            addEntry(exports, "#" + std::to_string(symbol.ordinal), "forwarder" + target);
+        }
+    }
+    sets.push_back(std::move(exports));
+
+    for (auto & set : sets)
+    {
+        sortEntries(set);
+    }
+    return sets;
+}
+
+// Single pass over two hash-sorted sets.
+std::vector<Difference> mergeDiff(const KeyedSet & a, const KeyedSet & b)
+{
+    std::vector<Difference> diffs;
+
+    auto ia = a.entries.begin();
+    auto ib = b.entries.begin();
+    while (ia != a.entries.end() || ib != b.entries.end())
+    {
+        int order;
+        if      (ia == a.entries.end()) { order =  1; }
+        else if (ib == b.entries.end()) { order = -1; }
+        else if (ia->hash != ib->hash)  { order = (ia->hash < ib->hash) ? -1 : 1; }
+        else                            { order = ia->key.compare(ib->key); }
+
+        if (order < 0)
+        {
+            diffs.push_back(Difference{ Change::Removed, ia->key, ia->value, "" });
+            ++ia;
+        }
+        else if (order > 0)
+        {
+            diffs.push_back(Difference{ Change::Added, ib->key, "", ib->value });
+            ++ib;
+        }
+        else
+        {
+            if (ia->value != ib->value)
+            {
+                diffs.push_back(Difference{ Change::Changed, ia->key, ia->value, ib->value });
+            }
+            ++ia;
+            ++ib;
+        }
+    }
+
+    // Hash order is meaningless to a human reader.
+    std::sort(diffs.begin(), diffs.end(),
+              [](const Difference & x, const Difference & y) { return x.key < y.key; });
+    return diffs;
+}
+
+// Returns the number of differences found, or -1 if a file couldn't be parsed.
+long diffFiles(const std::string & pathA, const std::string & pathB, std::ostream & out)
+{
+    PEInfo infoA, infoB;
+    if (!parsePEFile(pathA.c_str(), ParseAll, infoA, std::cerr) ||
+        !parsePEFile(pathB.c_str(), ParseAll, infoB, std::cerr))
+    {
+        return -1;
+    }
+
+    const std::vector<KeyedSet> setsA = buildKeyedSets(infoA);
+    const std::vector<KeyedSet> setsB = buildKeyedSets(infoB);
+
+    long total = 0;
+    std::ostringstream report;
+    for (std::size_t s = 0; s < setsA.size(); ++s)
+    {
+        const std::vector<Difference> diffs = mergeDiff(setsA[s], setsB[s]);
+        if (diffs.empty())
+        {
+            continue;
+        }
+
+        report << setsA[s].title << ":\n";
+        for (const auto & diff : diffs)
+        {
+            switch (diff.change)
+            {
+            case Change::Added :
+                report << "  + " << diff.key << (diff.newValue.empty() ? "" : "  (" + diff.newValue + ")") << "\n";
+                break;
+            case Change::Removed :
+                report << "  - " << diff.key << (diff.oldValue.empty() ? "" : "  (" + diff.oldValue + ")") << "\n";
+                break;
+            case Change::Changed :
+                report << "  ~ " << diff.key << ": " << diff.oldValue << " => " << diff.newValue << "\n";
+                break;
+            } // switch (diff.change)
+        }
+        total += static_cast<long>(diffs.size());
+    }
+
+    if (total > 0)
+    {
+        out << "--- " << pathA << "\n";
+        out << "+++ " << pathB << "\n";
+        out << report.str();
+        out << total << " differences.\n\n";
+    }
+    return total;
+}
+
+// Pairs up the PEs in two directory trees by their path relative to each root.
+int diffDirectories(const std::string & rootA, const std::string & rootB, std::ostream & out)
+{
+    std::vector<std::string> filesA, filesB;
+    if (!listFilesRecursive(rootA, filesA) || !listFilesRecursive(rootB, filesB))
+    {
+        std::cerr << "Unable to list the files of \"" << rootA << "\" and \"" << rootB << "\"!\n";
+        return 2;
+    }
+
+    auto relativePEs = [](const std::string & root, const std::vector<std::string> & files)
+    {
+        std::vector<std::string> relative;
+        for (const auto & path : files)
+        {
+            if (looksLikePE(path.c_str()))
+            {
+                relative.push_back(path.substr(root.size() + 1));
+            }
+        }
+        std::sort(relative.begin(), relative.end());
+        return relative;
+    };
+
+    const std::vector<std::string> relA = relativePEs(rootA, filesA);
+    const std::vector<std::string> relB = relativePEs(rootB, filesB);
+
+    long changedFiles = 0, addedFiles = 0, removedFiles = 0, failedFiles = 0;
+    auto ia = relA.begin();
+    auto ib = relB.begin();
+    while (ia != relA.end() || ib != relB.end())
+    {
+        if (ib == relB.end() || (ia != relA.end() && *ia < *ib))
+        {
+            out << "Only in " << rootA << ": " << *ia++ << "\n\n";
+            ++removedFiles;
+        }
+        else if (ia == relA.end() || *ib < *ia)
+        {
+            out << "Only in " << rootB << ": " << *ib++ << "\n\n";
+            ++addedFiles;
+        }
+        else
+        {
+            const long result = diffFiles(rootA + "/" + *ia, rootB + "/" + *ib, out);
+            if (result < 0) { ++failedFiles;  }
+            if (result > 0) { ++changedFiles; }
+            ++ia;
+            ++ib;
+        }
+    }
+
+    out << changedFiles << " changed, " << addedFiles << " added, "
+        << removedFiles << " removed PEs";
+    if (failedFiles > 0)
+    {
+        out << ", " << failedFiles << " could not be parsed";
+    }
+    out << ".\n";
+
+    if (failedFiles > 0) { return 2; }
+    return (changedFiles + addedFiles + removedFiles > 0) ? 1 : 0;
+}
+
+std::string withoutTrailingSlashes(std::string path)
+{
+    while (path.size() > 1 && path.back() == '/')
+    {
+        path.pop_back();
+    }
+    return path;
+}
+
+} // namespace {}
+
+int runDiff(const char * pathA, const char * pathB)
+{
+    // Exit status follows diff(1): 0 = same, 1 = different, 2 = trouble.
+    if (isDirectory(pathA) && isDirectory(pathB))
+    {
+        return diffDirectories(withoutTrailingSlashes(pathA), withoutTrailingSlashes(pathB), std::cout);
+    }
+
+    const long result = diffFiles(pathA, pathB, std::cout);
+    if (result == 0)
+    {
+        std::cout << "No structural differences.\n";
+    }
+    return (result < 0) ? 2 : (result > 0) ? 1 : 0;
+}
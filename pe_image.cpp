@@ -0,0 +1,2136 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: pe_image.cpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: PE parsing for libppedump: loading, validation, the import/export table walkers and PEImage.
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "pe_image.hpp"
+#include "portable_pe_dump.hpp"
+
+// Memory mapped loaders.
+#ifdef PPEDUMP_POSIX
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif // PPEDUMP_POSIX
+
+// ========================================================
+// File loading:
+// ========================================================
+
+static bool queryFileSize(const char * filename, std::size_t & sizeInBytes, std::ostream & errOut)
+{
+    FILE * fileIn = std::fopen(filename, "rb");
+    if (fileIn == nullptr)
+    {
+        errOut << color::red() << "Unable to open \"" << filename
+               << "\": " << std::strerror(errno) << color::restore() << "\n";
+        return false;
+    }
+
+    // More or less portable way of getting the file size,
+    // but SEEK_END is not guaranteed to be supported everywhere.
+    // Realistically though, it is available on all mainstream platforms.
+    std::fseek(fileIn, 0, SEEK_END);
+    const long fileLength = std::ftell(fileIn);
+    if (fileLength < 0)
+    {
+        errOut << color::red() << "Unable to get length of file \""
+               << filename << "\"!" << color::restore() << "\n";
+        std::fclose(fileIn);
+        return false;
+    }
+
+    sizeInBytes = fileLength;
+    std::fclose(fileIn);
+    return true;
+}
+
+static std::unique_ptr<std::uint8_t[]> loadFile(const char * filename, std::size_t & sizeInBytes, std::ostream & errOut)
+{
+    std::size_t fileLength = 0;
+    if (!queryFileSize(filename, fileLength, errOut) || fileLength == 0)
+    {
+        return nullptr;
+    }
+
+    FILE * fileIn = std::fopen(filename, "rb");
+    if (fileIn == nullptr)
+    {
+        errOut << color::red() << "Unable to open \"" << filename << "\": "
+               << std::strerror(errno) << color::restore() << "\n";
+        return nullptr;
+    }
+
+    std::unique_ptr<std::uint8_t[]> data{ new std::uint8_t[fileLength] };
+    if (std::fread(data.get(), sizeof(std::uint8_t), fileLength, fileIn) != fileLength)
+    {
+        errOut << color::red() << "Partial fread() in loadFile()!" << color::restore() << "\n";
+        std::fclose(fileIn);
+        return nullptr;
+    }
+
+    sizeInBytes = fileLength;
+    std::fclose(fileIn);
+    return data;
+}
+
+// ========================================================
+// FileContents
+// ========================================================
+
+static FileLoader currentFileLoader = FileLoader::Read;
+
+void setFileLoader(const FileLoader loader)
+{
+    currentFileLoader = loader;
+}
+
+FileLoader fileLoader()
+{
+    return currentFileLoader;
+}
+
+bool parseFileLoader(const char * name, FileLoader & loader)
+{
+    if      (std::strcmp(name, "read")     == 0) { loader = FileLoader::Read;     }
+    else if (std::strcmp(name, "mmap")     == 0) { loader = FileLoader::Mmap;     }
+    else if (std::strcmp(name, "ondemand") == 0) { loader = FileLoader::OnDemand; }
+    else { return false; }
+    return true;
+}
+
+static PELayout currentImageLayout = PELayout::File;
+
+void setImageLayout(const PELayout layout)
+{
+    currentImageLayout = layout;
+}
+
+PELayout imageLayout()
+{
+    return currentImageLayout;
+}
+
+FileContents::FileContents(FileContents && other) noexcept
+    : buffer_{ std::move(other.buffer_) }
+    , data_{ other.data_ }
+    , size_{ other.size_ }
+    , sharedBytes_{ other.sharedBytes_ }
+    , mapped_{ other.mapped_ }
+    , writable_{ other.writable_ }
+{
+    other.data_        = nullptr;
+    other.size_        = 0;
+    other.sharedBytes_ = 0;
+    other.mapped_      = false;
+    other.writable_    = false;
+}
+
+FileContents & FileContents::operator = (FileContents && other) noexcept
+{
+    if (this != &other)
+    {
+        reset();
+        buffer_      = std::move(other.buffer_);
+        data_        = other.data_;
+        size_        = other.size_;
+        sharedBytes_ = other.sharedBytes_;
+        mapped_      = other.mapped_;
+        writable_    = other.writable_;
+        other.data_        = nullptr;
+        other.size_        = 0;
+        other.sharedBytes_ = 0;
+        other.mapped_      = false;
+        other.writable_    = false;
+    }
+    return *this;
+}
+
+FileContents::~FileContents()
+{
+    reset();
+}
+
+void FileContents::reset()
+{
+#ifdef PPEDUMP_POSIX
+    if (mapped_)
+    {
+        ::munmap(const_cast<std::uint8_t *>(data_), size_);
+    }
+#endif // PPEDUMP_POSIX
+    buffer_.reset();
+    data_        = nullptr;
+    size_        = 0;
+    sharedBytes_ = 0;
+    mapped_      = false;
+    writable_    = false;
+}
+
+void FileContents::borrow(const std::uint8_t * data, const std::size_t size)
+{
+    reset();
+    data_ = data;
+    size_ = size;
+}
+
+void FileContents::adopt(std::unique_ptr<std::uint8_t[]> buffer, const std::size_t size)
+{
+    reset();
+    buffer_   = std::move(buffer);
+    data_     = buffer_.get();
+    size_     = size;
+    writable_ = true;
+}
+
+bool FileContents::load(const char * filename, const FileLoader loader, std::ostream & errOut)
+{
+    stats::Scope statsScope{ stats::Phase::Load };
+    reset();
+
+#ifdef PPEDUMP_POSIX
+    // Note that a mapped file truncated by someone else while we
+    // read it raises SIGBUS. The default loader copies the file.
+    if (loader != FileLoader::Read)
+    {
+        const int fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || ::fstat(fd, &st) != 0)
+        {
+            errOut << color::red() << "Unable to open \"" << filename << "\": "
+                   << std::strerror(errno) << color::restore() << "\n";
+            if (fd >= 0) { ::close(fd); }
+            return false;
+        }
+
+        const auto fileLength = static_cast<std::size_t>(st.st_size);
+        if (fileLength == 0)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        int mapFlags = MAP_PRIVATE;
+        #ifdef MAP_POPULATE
+        if (loader == FileLoader::Mmap)
+        {
+            mapFlags |= MAP_POPULATE;
+        }
+        #endif // MAP_POPULATE
+
+        void * mapping = ::mmap(nullptr, fileLength, PROT_READ, mapFlags, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            errOut << color::red() << "Unable to map \"" << filename << "\": "
+                   << std::strerror(errno) << color::restore() << "\n";
+            return false;
+        }
+
+        // Read-ahead for the eager mapping; none for on-demand, which
+        // only wants the pages the parser actually touches.
+        ::madvise(mapping, fileLength, (loader == FileLoader::Mmap) ? MADV_WILLNEED : MADV_RANDOM);
+
+        data_   = static_cast<const std::uint8_t *>(mapping);
+        size_   = fileLength;
+        mapped_ = true;
+        stats::count(stats::Counter::BytesRead, size_);
+        return true;
+    }
+#else // !PPEDUMP_POSIX
+    (void)loader;
+#endif // PPEDUMP_POSIX
+
+    std::size_t fileLength = 0;
+    buffer_ = loadFile(filename, fileLength, errOut);
+    if (buffer_ == nullptr)
+    {
+        return false;
+    }
+
+    data_ = buffer_.get();
+    size_ = fileLength;
+    stats::count(stats::Counter::BytesRead, size_);
+    return true;
+}
+
+// ========================================================
+// RVA lookups:
+// ========================================================
+
+const pe::ImageSectionHeader * findRVASection(std::uint32_t rva, const pe::ImageNTHeader * ntHeaderPtr)
+{
+    stats::count(stats::Counter::RVALookups);
+
+    const pe::ImageSectionHeader * sectionPtr = getFirstSection(ntHeaderPtr);
+    const std::uint32_t numSections = ntHeaderPtr->fileHeader.numberOfSections;
+
+    for (std::uint32_t s = 0; s < numSections; ++s, ++sectionPtr)
+    {
+        // Is the RVA within this section?
+        if (rva >= sectionPtr->virtualAddress &&
+            rva < (sectionPtr->virtualAddress + sectionPtr->misc.virtualSize))
+        {
+            return sectionPtr;
+        }
+    }
+    return nullptr;
+}
+
+static inline std::string sectionHeaderName(const pe::ImageSectionHeader * sectHeader)
+{
+    if (sectHeader == nullptr)
+    {
+        return std::string{};
+    }
+
+    // Not necessarily NUL-terminated if the name uses all of the 8 chars.
+    const char * name = sectHeader->name;
+    return std::string(name, std::find(name, name + pe::ImageMaxSectionNameLength, '\0'));
+}
+
+bool offsetFromRVA(std::uint32_t rva, const pe::ImageNTHeader * ntHeaderPtr, std::uint32_t & offset)
+{
+    const auto sectHeader = findRVASection(rva, ntHeaderPtr);
+    if (sectHeader == nullptr)
+    {
+        return false;
+    }
+    offset = rva - (sectHeader->virtualAddress - sectHeader->pointerToRawData);
+    return true;
+}
+
+static inline bool isNullImportDescriptor(const pe::ImageImportDescriptor & impDesc)
+{
+    // An import descriptor with all fields set to zero terminates the array of ImageImportDescriptors.
+    // It would have been much simpler to just add a count field somewhere, wouldn't it?
+    // This layout was probably designed by a Microsoft intern :P
+    static const pe::ImageImportDescriptor nullImpDesc{};
+    return std::memcmp(&impDesc, &nullImpDesc, sizeof(nullImpDesc)) == 0;
+}
+
+// ========================================================
+// Virtual layout and rebasing:
+// ========================================================
+
+// The loader copies sizeOfRawData bytes, up to the virtual size; the
+// rest of the section is zeros, like the gaps between sections.
+static inline std::uint32_t sectionBytesInFile(const pe::ImageSectionHeader & section)
+{
+    return (section.misc.virtualSize != 0) ? std::min(section.sizeOfRawData, section.misc.virtualSize) : section.sizeOfRawData;
+}
+
+// layOutImage(), with the headers and sections copied by 'copy(imageOffset,
+// fileOffset, size)', which may fail after printing why. Images that start
+// out zeroed skip the zeroing.
+template<typename CopyFunc>
+static bool layOutSections(const std::size_t fileLength, const pe::ImageNTHeader * ntHeaderPtr,
+                           std::uint8_t * image, const std::size_t imageSize, const bool zeroed, CopyFunc && copy, std::ostream & errOut)
+{
+    const pe::ImageSectionHeader * sections = getFirstSection(ntHeaderPtr);
+    const std::uint32_t numSections = ntHeaderPtr->fileHeader.numberOfSections;
+
+    const std::size_t headerBytes = std::min<std::size_t>({ ntHeaderPtr->optionalHeader.sizeOfHeaders, fileLength, imageSize });
+    if (!copy(0, 0, headerBytes))
+    {
+        return false;
+    }
+
+    // Sections normally come in ascending RVA order without overlapping, so
+    // only the gaps between them are zeroed and each byte is written once.
+    // Anything else is zeroed whole first.
+    std::uint64_t filledEnd = headerBytes;
+    bool ascending = true;
+    for (std::uint32_t s = 0; s < numSections && ascending; ++s)
+    {
+        ascending = sections[s].virtualAddress >= filledEnd;
+        filledEnd = std::uint64_t{ sections[s].virtualAddress } + sectionBytesInFile(sections[s]);
+    }
+    if (!zeroed && !ascending)
+    {
+        std::memset(image + headerBytes, 0, imageSize - headerBytes);
+    }
+    const bool zeroGaps = !zeroed && ascending;
+
+    filledEnd = headerBytes;
+    for (std::uint32_t s = 0; s < numSections; ++s)
+    {
+        const pe::ImageSectionHeader & section = sections[s];
+        const std::uint32_t rawBytes = sectionBytesInFile(section);
+        const std::uint64_t rawEnd   = std::uint64_t{ section.pointerToRawData } + rawBytes;
+        const std::uint64_t imageEnd = std::uint64_t{ section.virtualAddress } + rawBytes;
+        if ((rawBytes != 0 && rawEnd > fileLength) || imageEnd > imageSize)
+        {
+            errOut << color::red() << "Section " << sectionHeaderName(&section) << " is out of bounds of the "
+                   << ((imageEnd > imageSize) ? "image size" : "file") << "!" << color::restore() << "\n";
+            return false;
+        }
+
+        if (zeroGaps)
+        {
+            std::memset(image + filledEnd, 0, section.virtualAddress - filledEnd);
+            filledEnd = imageEnd;
+        }
+        if (!copy(section.virtualAddress, section.pointerToRawData, rawBytes))
+        {
+            return false;
+        }
+    }
+    if (zeroGaps)
+    {
+        std::memset(image + filledEnd, 0, imageSize - filledEnd);
+    }
+    return true;
+}
+
+bool layOutImage(const std::uint8_t * fileContents, const std::size_t fileLength, const pe::ImageNTHeader * ntHeaderPtr,
+                 std::uint8_t * image, const std::size_t imageSize, std::ostream & errOut)
+{
+    return layOutSections(fileLength, ntHeaderPtr, image, imageSize, /* zeroed = */ false,
+        [image, fileContents](const std::uint64_t imageOffset, const std::uint64_t fileOffset, const std::size_t size)
+        {
+            std::memcpy(image + imageOffset, fileContents + fileOffset, size);
+            return true;
+        }, errOut);
+}
+
+bool FileContents::loadImage(const char * filename, std::ostream & errOut)
+{
+    stats::Scope statsScope{ stats::Phase::Load };
+    reset();
+
+#ifdef PPEDUMP_POSIX
+    const int fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) != 0)
+    {
+        errOut << color::red() << "Unable to open \"" << filename << "\": "
+               << std::strerror(errno) << color::restore() << "\n";
+        if (fd >= 0) { ::close(fd); }
+        return false;
+    }
+
+    const auto fileLength = static_cast<std::size_t>(st.st_size);
+    void * fileMapping = (fileLength != 0) ? ::mmap(nullptr, fileLength, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if (fileMapping == MAP_FAILED)
+    {
+        errOut << color::red() << "Unable to map \"" << filename << "\": "
+               << ((fileLength != 0) ? std::strerror(errno) : "File is empty") << color::restore() << "\n";
+        ::close(fd);
+        return false;
+    }
+
+    // The file is only read through 'fileContents' while laying it out; the
+    // image keeps its own copy-on-write mappings of the file's pages.
+    const auto fileContents = static_cast<const std::uint8_t *>(fileMapping);
+    const pe::ImageNTHeader * ntHeaderPtr = validatePE(fileContents, fileLength, errOut);
+    const std::size_t imageSize = (ntHeaderPtr != nullptr) ? ntHeaderPtr->optionalHeader.sizeOfImage : 0;
+
+    std::uint8_t * image = nullptr;
+    bool laidOut = false;
+    if (ntHeaderPtr != nullptr && imageSize == 0)
+    {
+        errOut << color::red() << "Image size (sizeOfImage) is zero!" << color::restore() << "\n";
+    }
+    else if (ntHeaderPtr != nullptr)
+    {
+        // Anonymous memory reads as zeros and takes no memory until written, so the gaps are free.
+        void * imageMapping = ::mmap(nullptr, imageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (imageMapping == MAP_FAILED)
+        {
+            errOut << color::red() << "Unable to map " << imageSize << " bytes for the image of \"" << filename << "\": "
+                   << std::strerror(errno) << color::restore() << "\n";
+        }
+        else
+        {
+            image = static_cast<std::uint8_t *>(imageMapping);
+            const auto pageSize = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+
+            // Whole pages that are page aligned in both the file and the image are
+            // mapped over the anonymous memory; the remainder, or all of a section
+            // that can't be mapped, is copied.
+            laidOut = layOutSections(fileLength, ntHeaderPtr, image, imageSize, /* zeroed = */ true,
+                [&](const std::uint64_t imageOffset, const std::uint64_t fileOffset, const std::size_t size)
+                {
+                    std::size_t shared = 0;
+                    if (imageOffset % pageSize == 0 && fileOffset % pageSize == 0 && size >= pageSize)
+                    {
+                        const auto pages = static_cast<std::size_t>(size - size % pageSize);
+                        if (::mmap(image + imageOffset, pages, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                                   fd, static_cast<off_t>(fileOffset)) != MAP_FAILED)
+                        {
+                            shared = pages;
+                        }
+                        else if (::mmap(image + imageOffset, pages, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS,
+                                        -1, 0) == MAP_FAILED)
+                        {
+                            // A failed MAP_FIXED may have unmapped the range; put memory back to copy into.
+                            errOut << color::red() << "Unable to remap the image of \"" << filename << "\": "
+                                   << std::strerror(errno) << color::restore() << "\n";
+                            return false;
+                        }
+                    }
+                    std::memcpy(image + imageOffset + shared, fileContents + fileOffset + shared, size - shared);
+                    sharedBytes_ += shared;
+                    return true;
+                }, errOut);
+
+            if (!laidOut)
+            {
+                ::munmap(image, imageSize);
+            }
+        }
+    }
+
+    ::munmap(fileMapping, fileLength);
+    ::close(fd);
+    if (!laidOut)
+    {
+        sharedBytes_ = 0;
+        return false;
+    }
+
+    data_     = image;
+    size_     = imageSize;
+    mapped_   = true;
+    writable_ = true;
+    stats::count(stats::Counter::BytesRead, fileLength);
+    return true;
+#else // !PPEDUMP_POSIX
+    FileContents file;
+    if (!file.load(filename, FileLoader::Read, errOut))
+    {
+        return false;
+    }
+    const pe::ImageNTHeader * ntHeaderPtr = validatePE(file.data(), file.size(), errOut);
+    if (ntHeaderPtr == nullptr)
+    {
+        return false;
+    }
+    const std::size_t imageSize = ntHeaderPtr->optionalHeader.sizeOfImage;
+    if (imageSize == 0)
+    {
+        errOut << color::red() << "Image size (sizeOfImage) is zero!" << color::restore() << "\n";
+        return false;
+    }
+
+    std::unique_ptr<std::uint8_t[]> image{ new (std::nothrow) std::uint8_t[imageSize] };
+    if (image == nullptr)
+    {
+        errOut << color::red() << "Unable to allocate " << imageSize << " bytes for the image of \"" << filename << "\"!"
+               << color::restore() << "\n";
+        return false;
+    }
+    if (!layOutImage(file.data(), file.size(), ntHeaderPtr, image.get(), imageSize, errOut))
+    {
+        return false;
+    }
+    adopt(std::move(image), imageSize);
+    return true;
+#endif // PPEDUMP_POSIX
+}
+
+namespace
+{
+
+// Base relocation entries only reach 4 KiB past their page, plus the width of the fixup.
+const std::uint32_t RelocationPageReach = 0x1000 + sizeof(std::uint64_t);
+
+template<typename T>
+inline void addAt(std::uint8_t * where, const T delta)
+{
+    // memcpy because fixups need not be aligned.
+    T value;
+    std::memcpy(&value, where, sizeof(T));
+    value = static_cast<T>(value + delta);
+    std::memcpy(where, &value, sizeof(T));
+}
+
+// Applies one IMAGE_BASE_RELOCATION block. Returns false on an unknown type,
+// setting 'badType', or on a fixup outside the image, setting it to -1. With
+// 'Checked' false the caller has already made sure the whole page is inside
+// the image, which is the common case, so the loop has no bounds checks.
+template<bool Checked>
+bool applyRelocationBlock(std::uint8_t * image, const std::size_t imageSize, const std::uint32_t pageRVA,
+                          const std::uint8_t * entries, const std::uint32_t numEntries, const std::uint64_t delta,
+                          std::uint64_t & numApplied, int & badType)
+{
+    std::uint8_t * page = image + pageRVA;
+    const std::uint64_t pageBytes = Checked ? ((pageRVA <= imageSize) ? imageSize - pageRVA : 0) : RelocationPageReach;
+
+    // Counted locally: the fixups are byte stores, which could alias 'numApplied'.
+    std::uint64_t applied = 0;
+    for (std::uint32_t e = 0; e < numEntries; ++e)
+    {
+        std::uint16_t entry;
+        std::memcpy(&entry, entries + e * 2, sizeof(entry));
+
+        const int type = entry >> 12;
+        const std::uint32_t offset = entry & 0xFFF;
+        switch (type)
+        {
+        case pe::ImageRelBasedAbsolute :
+            continue; // Padding
+        case pe::ImageRelBasedDir64 :
+            if (Checked && pageBytes < offset + 8) { break; }
+            addAt<std::uint64_t>(page + offset, delta);
+            ++applied;
+            continue;
+        case pe::ImageRelBasedHighLow :
+            if (Checked && pageBytes < offset + 4) { break; }
+            addAt<std::uint32_t>(page + offset, static_cast<std::uint32_t>(delta));
+            ++applied;
+            continue;
+        case pe::ImageRelBasedHigh :
+            if (Checked && pageBytes < offset + 2) { break; }
+            addAt<std::uint16_t>(page + offset, static_cast<std::uint16_t>(delta >> 16));
+            ++applied;
+            continue;
+        case pe::ImageRelBasedLow :
+            if (Checked && pageBytes < offset + 2) { break; }
+            addAt<std::uint16_t>(page + offset, static_cast<std::uint16_t>(delta));
+            ++applied;
+            continue;
+        case pe::ImageRelBasedHighAdj :
+            {
+                // The high half of a 32-bit value whose low half is in the next entry,
+                // rounded for the sign extension of the instruction that adds it.
+                if ((Checked && pageBytes < offset + 2) || ++e == numEntries) { break; }
+                std::uint16_t high, low;
+                std::memcpy(&high, page + offset, sizeof(high));
+                std::memcpy(&low, entries + e * 2, sizeof(low));
+                std::uint32_t value = (std::uint32_t{ high } << 16) + static_cast<std::uint32_t>(static_cast<std::int16_t>(low));
+                value += static_cast<std::uint32_t>(delta) + 0x8000;
+                high = static_cast<std::uint16_t>(value >> 16);
+                std::memcpy(page + offset, &high, sizeof(high));
+                ++applied;
+                continue;
+            }
+        default :
+            numApplied += applied;
+            badType = type;
+            return false;
+        } // switch (type)
+
+        // Out of bounds (or a HIGHADJ missing its second entry).
+        numApplied += applied;
+        badType = -1;
+        return false;
+    }
+    numApplied += applied;
+    return true;
+}
+
+} // namespace {}
+
+bool rebaseImage(std::uint8_t * image, const std::size_t imageSize, const std::uint64_t newBase,
+                 RebaseInfo & info, std::ostream & errOut)
+{
+    info = RebaseInfo{};
+
+    const pe::ImageNTHeader * ntHeaderPtr = validatePE(image, imageSize, errOut);
+    if (ntHeaderPtr == nullptr)
+    {
+        return false;
+    }
+
+    // imageBase and the data directories are the fields PE32+ moves.
+    const auto optionalOffset = static_cast<std::size_t>(reinterpret_cast<const std::uint8_t *>(&ntHeaderPtr->optionalHeader) - image);
+    const bool pe32Plus = (ntHeaderPtr->optionalHeader.magic == pe::ImageNTOptionalHeader64Magic);
+    if (pe32Plus && imageSize - optionalOffset < sizeof(pe::ImageOptionalHeader64))
+    {
+        errOut << color::red() << "PE32+ optional header is out of bounds!" << color::restore() << "\n";
+        return false;
+    }
+    auto optional64 = reinterpret_cast<pe::ImageOptionalHeader64 *>(image + optionalOffset);
+    auto optional32 = reinterpret_cast<pe::ImageOptionalHeader *>(image + optionalOffset);
+
+    const std::uint32_t numDirs = pe32Plus ? optional64->numberOfRvaAndSizes : optional32->numberOfRvaAndSizes;
+    const pe::ImageDataDirectory relocDir = (numDirs > pe::ImageDirectoryEntryBaseReloc)
+        ? (pe32Plus ? optional64->dataDirectory : optional32->dataDirectory)[pe::ImageDirectoryEntryBaseReloc]
+        : pe::ImageDataDirectory{ 0, 0 };
+
+    info.oldBase = pe32Plus ? optional64->imageBase : optional32->imageBase;
+    info.newBase = newBase;
+    if (!pe32Plus && newBase > UINT32_MAX)
+    {
+        errOut << color::red() << "A PE32 image can't be based above 4 GiB!" << color::restore() << "\n";
+        return false;
+    }
+
+    // Two's complement: moving down is adding a huge delta.
+    const std::uint64_t delta = newBase - info.oldBase;
+    if (delta != 0 && relocDir.sizeInBytes == 0 && (ntHeaderPtr->fileHeader.characteristics & pe::ImageFileRelocsStripped))
+    {
+        errOut << color::red() << "Relocations were stripped from this image; it can't be rebased!" << color::restore() << "\n";
+        return false;
+    }
+    if (std::uint64_t{ relocDir.virtualAddress } + relocDir.sizeInBytes > imageSize)
+    {
+        errOut << color::red() << "Base relocation directory is out of bounds!" << color::restore() << "\n";
+        return false;
+    }
+
+    std::uint64_t blockRVA = relocDir.virtualAddress;
+    const std::uint64_t dirEnd = blockRVA + relocDir.sizeInBytes;
+    while (delta != 0 && dirEnd - blockRVA >= sizeof(pe::ImageBaseRelocation))
+    {
+        pe::ImageBaseRelocation block;
+        std::memcpy(&block, image + blockRVA, sizeof(block));
+        if (block.sizeOfBlock < sizeof(block) || block.sizeOfBlock > dirEnd - blockRVA)
+        {
+            errOut << color::red() << "Malformed base relocation block at RVA " << blockRVA << "!" << color::restore() << "\n";
+            return false;
+        }
+
+        const std::uint8_t * entries = image + blockRVA + sizeof(block);
+        const std::uint32_t numEntries = (block.sizeOfBlock - sizeof(block)) / 2;
+        const bool pageInImage = (block.virtualAddress <= imageSize && imageSize - block.virtualAddress >= RelocationPageReach);
+
+        int badType = 0;
+        const bool applied = pageInImage
+            ? applyRelocationBlock<false>(image, imageSize, block.virtualAddress, entries, numEntries, delta, info.numRelocations, badType)
+            : applyRelocationBlock<true>(image, imageSize, block.virtualAddress, entries, numEntries, delta, info.numRelocations, badType);
+        if (!applied)
+        {
+            errOut << color::red();
+            if (badType < 0)
+            {
+                errOut << "Base relocation out of bounds in the block for RVA 0x" << std::hex << block.virtualAddress << std::dec << "!";
+            }
+            else
+            {
+                errOut << "Unsupported base relocation type " << badType << " in the block for RVA 0x" << std::hex << block.virtualAddress << std::dec << "!";
+            }
+            errOut << color::restore() << "\n";
+            return false;
+        }
+
+        ++info.numBlocks;
+        blockRVA += block.sizeOfBlock;
+    }
+
+    if (pe32Plus)
+    {
+        optional64->imageBase = newBase;
+    }
+    else
+    {
+        optional32->imageBase = static_cast<std::uint32_t>(newBase);
+    }
+    return true;
+}
+
+// ========================================================
+// Archives:
+// ========================================================
+
+namespace
+{
+
+// A decimal field of a member header: digits, then spaces.
+bool parseArchiveNumber(const char * field, const std::size_t width, std::uint64_t & value)
+{
+    value = 0;
+    std::size_t i = 0;
+    for (; i < width && field[i] >= '0' && field[i] <= '9'; ++i)
+    {
+        value = value * 10 + static_cast<std::uint64_t>(field[i] - '0');
+    }
+    if (i == 0)
+    {
+        return false;
+    }
+    for (; i < width; ++i)
+    {
+        if (field[i] != ' ')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::uint32_t bigEndian32(const std::uint8_t * bytes)
+{
+    return (std::uint32_t{ bytes[0] } << 24) | (std::uint32_t{ bytes[1] } << 16) |
+           (std::uint32_t{ bytes[2] } << 8)  |  std::uint32_t{ bytes[3] };
+}
+
+// "name/" in the header, or "/<offset>" into the long names member,
+// where names end with a NUL (Microsoft) or with "/\n" (GNU).
+std::string archiveMemberName(const FileView & file, const pe::ImageArchiveMemberHeader & header,
+                              const ArchiveMember * longNames)
+{
+    const char * field = header.name;
+    const std::size_t fieldLength = sizeof(header.name);
+
+    if (field[0] == '/' && longNames != nullptr)
+    {
+        std::uint64_t offset = 0;
+        for (std::size_t i = 1; i < fieldLength && field[i] >= '0' && field[i] <= '9'; ++i)
+        {
+            offset = offset * 10 + static_cast<std::uint64_t>(field[i] - '0');
+        }
+        if (offset >= longNames->size)
+        {
+            return std::string{};
+        }
+
+        const char * start = reinterpret_cast<const char *>(file.data() + longNames->dataOffset + offset);
+        const auto maxLength = static_cast<std::size_t>(std::min<std::uint64_t>(longNames->size - offset, MaxSymbolNameLength));
+        std::size_t length = 0;
+        while (length < maxLength && start[length] != '\0' && start[length] != '\n')
+        {
+            ++length;
+        }
+        if (length > 0 && start[length - 1] == '/')
+        {
+            --length;
+        }
+        return std::string(start, length);
+    }
+
+    std::size_t length = fieldLength;
+    while (length > 0 && field[length - 1] == ' ')
+    {
+        --length;
+    }
+    if (length > 1 && field[length - 1] == '/')
+    {
+        --length;
+    }
+    return std::string(field, length);
+}
+
+// Index of the member whose header is at 'headerOffset', or -1. The linker members
+// list the offsets mostly in file order, so 'hint', the last member found, and the
+// one after it are tried before searching.
+long archiveMemberAt(const Archive & archive, const std::uint64_t headerOffset, long & hint)
+{
+    const auto & members = archive.members;
+    for (long m = hint; m >= 0 && m <= hint + 1 && static_cast<std::size_t>(m) < members.size(); ++m)
+    {
+        if (members[m].headerOffset == headerOffset)
+        {
+            return hint = m;
+        }
+    }
+
+    const auto member = std::lower_bound(members.begin(), members.end(), headerOffset,
+        [](const ArchiveMember & m, const std::uint64_t offset) { return m.headerOffset < offset; });
+    if (member == members.end() || member->headerOffset != headerOffset)
+    {
+        return -1;
+    }
+    return hint = static_cast<long>(member - members.begin());
+}
+
+// Adds a symbol for each of the NUL-terminated names stored back to back at
+// 'namesOffset' of the linker member, up to 'numNames' or the end of the member.
+// memberOf(n) is the index of the member defining name n, or -1.
+template<typename MemberOf>
+void addArchiveSymbols(const ArchiveMember & linker, const FileView & data, std::uint64_t namesOffset,
+                       const std::uint32_t numNames, MemberOf && memberOf, Archive & archive)
+{
+    archive.symbols.reserve(numNames);
+    for (std::uint32_t n = 0; n < numNames && namesOffset < data.size(); ++n)
+    {
+        const char * start = reinterpret_cast<const char *>(data.data() + namesOffset);
+        const void * end = std::memchr(start, '\0', data.size() - namesOffset);
+        if (end == nullptr)
+        {
+            break;
+        }
+
+        const long member = memberOf(n);
+        if (member >= 0)
+        {
+            ArchiveSymbol symbol;
+            symbol.nameOffset = linker.dataOffset + namesOffset;
+            symbol.member     = static_cast<std::uint32_t>(member);
+            archive.symbols.push_back(symbol);
+        }
+        namesOffset += static_cast<std::uint64_t>(static_cast<const char *>(end) - start) + 1;
+    }
+}
+
+// Microsoft's linker member: the member offsets, then a 1-based member number for
+// each symbol and the names, sorted. Little-endian. False if it doesn't fit.
+bool readSecondLinkerMember(const FileView & file, const ArchiveMember & linker, Archive & archive)
+{
+    const FileView data{ file.data() + linker.dataOffset, static_cast<std::size_t>(linker.size) };
+    const auto numMembers = data.at<std::uint32_t>(0);
+    const auto offsets    = (numMembers != nullptr) ? data.at<std::uint32_t>(4, *numMembers) : nullptr;
+    if (offsets == nullptr)
+    {
+        return false;
+    }
+    const std::uint64_t countOffset = 4 + std::uint64_t{ *numMembers } * 4;
+    const auto numSymbols = data.at<std::uint32_t>(countOffset);
+    const auto indices    = (numSymbols != nullptr) ? data.at<std::uint16_t>(countOffset + 4, *numSymbols) : nullptr;
+    if (indices == nullptr)
+    {
+        return false;
+    }
+
+    // Each member offset is looked up once, not once per symbol.
+    std::vector<long> members(*numMembers);
+    long hint = 0;
+    for (std::uint32_t m = 0; m < *numMembers; ++m)
+    {
+        members[m] = archiveMemberAt(archive, offsets[m], hint);
+    }
+
+    addArchiveSymbols(linker, data, countOffset + 4 + std::uint64_t{ *numSymbols } * 2, *numSymbols,
+        [&](const std::uint32_t s) -> long
+        {
+            const std::uint32_t index = indices[s];
+            return (index >= 1 && index <= members.size()) ? members[index - 1] : -1;
+        },
+        archive);
+    return true;
+}
+
+// The System V (and first) linker member: the member offset of each symbol,
+// then the names, in member order. Big-endian. False if it doesn't fit.
+bool readFirstLinkerMember(const FileView & file, const ArchiveMember & linker, Archive & archive)
+{
+    const FileView data{ file.data() + linker.dataOffset, static_cast<std::size_t>(linker.size) };
+    const auto count = data.at<std::uint8_t>(0, 4);
+    if (count == nullptr)
+    {
+        return false;
+    }
+    const std::uint32_t numSymbols = bigEndian32(count);
+    const auto offsets = data.at<std::uint8_t>(4, std::uint64_t{ numSymbols } * 4);
+    if (offsets == nullptr)
+    {
+        return false;
+    }
+
+    long hint = 0;
+    addArchiveSymbols(linker, data, 4 + std::uint64_t{ numSymbols } * 4, numSymbols,
+        [&](const std::uint32_t s) -> long
+        {
+            return archiveMemberAt(archive, bigEndian32(offsets + std::size_t{ s } * 4), hint);
+        },
+        archive);
+    return true;
+}
+
+} // namespace {}
+
+bool readArchive(const FileView & file, Archive & archive, std::ostream & errOut)
+{
+    archive = Archive{};
+    if (file.size() < pe::ImageArchiveStartSize || std::memcmp(file.data(), pe::ImageArchiveStart, pe::ImageArchiveStartSize) != 0)
+    {
+        errOut << color::red() << "Not an archive! Expected the '!<arch>' signature." << color::restore() << "\n";
+        return false;
+    }
+
+    // The linker members come first, then the long names, then the rest. Only
+    // the headers are read here, so this touches one line per member.
+    ArchiveMember linkers[2];
+    ArchiveMember longNames;
+    unsigned numLinkers = 0;
+    bool hasLongNames = false;
+
+    std::uint64_t offset = pe::ImageArchiveStartSize;
+    while (offset < file.size())
+    {
+        ArchiveMember member;
+        const auto header = file.at<pe::ImageArchiveMemberHeader>(offset);
+        if (header == nullptr || header->endHeader[0] != '`' || header->endHeader[1] != '\n' ||
+            !parseArchiveNumber(header->size, sizeof(header->size), member.size) ||
+            member.size > file.size() - offset - sizeof(pe::ImageArchiveMemberHeader))
+        {
+            archive.truncated = true;
+            break;
+        }
+        member.headerOffset = offset;
+        member.dataOffset   = offset + sizeof(pe::ImageArchiveMemberHeader);
+        offset = member.dataOffset + member.size + (member.size & 1);
+
+        const char * name = header->name;
+        if (name[0] == '/' && name[1] == ' ')
+        {
+            if (numLinkers < 2)
+            {
+                linkers[numLinkers] = member;
+            }
+            ++numLinkers;
+        }
+        else if (name[0] == '/' && name[1] == '/' && name[2] == ' ')
+        {
+            longNames    = member;
+            hasLongNames = true;
+        }
+        else if (name[0] == '/' && (name[1] < '0' || name[1] > '9'))
+        {
+            // Other special members, like the "/<ECSYMBOLS>/" of ARM64EC libraries.
+        }
+        else
+        {
+            member.name = archiveMemberName(file, *header, hasLongNames ? &longNames : nullptr);
+            archive.members.push_back(std::move(member));
+        }
+    }
+
+    // The Microsoft index numbers members with 16 bits, so larger
+    // libraries (or a malformed one) fall back to the first.
+    if (numLinkers >= 2 && readSecondLinkerMember(file, linkers[1], archive))
+    {
+        archive.index = ArchiveIndex::Second;
+    }
+    else if (numLinkers >= 1)
+    {
+        archive.symbols.clear();
+        if (readFirstLinkerMember(file, linkers[0], archive))
+        {
+            archive.index = ArchiveIndex::First;
+        }
+    }
+
+    // Already sorted unless the first linker member was read, or the
+    // second one is malformed. The sort is stable, so the first member
+    // defining a name is the one found, as with the linker.
+    const auto symbolLess = [&file](const ArchiveSymbol & a, const ArchiveSymbol & b)
+    {
+        return std::strcmp(reinterpret_cast<const char *>(file.data() + a.nameOffset),
+                           reinterpret_cast<const char *>(file.data() + b.nameOffset)) < 0;
+    };
+    if (!std::is_sorted(archive.symbols.begin(), archive.symbols.end(), symbolLess))
+    {
+        std::stable_sort(archive.symbols.begin(), archive.symbols.end(), symbolLess);
+    }
+    if (archive.symbols.empty())
+    {
+        archive.index = ArchiveIndex::None;
+    }
+    return true;
+}
+
+long findArchiveSymbol(const FileView & file, const Archive & archive, const char * name)
+{
+    const auto symbol = std::lower_bound(archive.symbols.begin(), archive.symbols.end(), name,
+        [&file](const ArchiveSymbol & s, const char * n)
+        {
+            return std::strcmp(reinterpret_cast<const char *>(file.data() + s.nameOffset), n) < 0;
+        });
+    if (symbol == archive.symbols.end() || std::strcmp(reinterpret_cast<const char *>(file.data() + symbol->nameOffset), name) != 0)
+    {
+        return -1;
+    }
+    return static_cast<long>(symbol->member);
+}
+
+bool readArchiveImport(const FileView & file, const ArchiveMember & member, ArchiveImport & import)
+{
+    const auto header = file.at<pe::ImportObjectHeader>(member.dataOffset);
+    if (header == nullptr || member.size < sizeof(pe::ImportObjectHeader) || member.size > file.size() - member.dataOffset ||
+        header->sig1 != 0 || header->sig2 != 0xFFFF || header->version != 0)
+    {
+        return false;
+    }
+
+    // The names must end inside both the record and the member.
+    const std::uint64_t namesOffset = member.dataOffset + sizeof(pe::ImportObjectHeader);
+    const std::uint64_t namesSize   = std::min<std::uint64_t>(header->sizeOfData, member.size - sizeof(pe::ImportObjectHeader));
+    const FileView names{ file.data() + namesOffset, static_cast<std::size_t>(namesSize) };
+
+    std::size_t symbolLength = 0;
+    const char * symbol = names.string(0, symbolLength);
+    std::size_t dllLength = 0;
+    const char * dllName = names.string(symbolLength + 1, dllLength);
+    if (symbolLength + 1 + dllLength >= namesSize)
+    {
+        return false;
+    }
+
+    import.machine       = header->machine;
+    import.timeDateStamp = header->timeDateStamp;
+    import.ordinalOrHint = header->ordinalOrHint;
+    import.type          = header->typeInfo & 0x3;
+    import.nameType      = (header->typeInfo >> 2) & 0x7;
+    import.symbol.assign(symbol, symbolLength);
+    import.dllName.assign(dllName, dllLength);
+
+    switch (import.nameType)
+    {
+    case pe::ImportObjectOrdinal :
+        import.importName.clear();
+        break;
+    case pe::ImportObjectNameNoPrefix :
+    case pe::ImportObjectNameUndecorate :
+        {
+            std::size_t start = 0;
+            if (symbolLength > 0 && (symbol[0] == '?' || symbol[0] == '@' || symbol[0] == '_'))
+            {
+                start = 1;
+            }
+            std::size_t length = symbolLength - start;
+            if (import.nameType == pe::ImportObjectNameUndecorate)
+            {
+                const void * at = std::memchr(symbol + start, '@', length);
+                if (at != nullptr)
+                {
+                    length = static_cast<std::size_t>(static_cast<const char *>(at) - (symbol + start));
+                }
+            }
+            import.importName.assign(symbol + start, length);
+            break;
+        }
+    case pe::ImportObjectNameExportAs :
+        names.readString(symbolLength + 1 + dllLength + 1, import.importName);
+        break;
+    default :
+        import.importName = import.symbol;
+        break;
+    } // switch (import.nameType)
+    return true;
+}
+
+// ========================================================
+// Lazy ranges:
+// ========================================================
+
+static inline PEStringRef stringAt(const FileView & file, const std::uint64_t offset)
+{
+    PEStringRef str;
+    str.data = file.string(offset, str.length);
+    return str;
+}
+
+ImportRange::ImportRange(const std::uint8_t * fileData, const std::size_t fileLength, const pe::ImageNTHeader * ntHeaderPtr,
+                         const PELayout layout)
+    : file_{ fileData, fileLength }
+    , ntHeader_{ ntHeaderPtr }
+    , layout_{ layout }
+    , budget_{ fileLength }
+{
+    if (ntHeaderPtr == nullptr)
+    {
+        return;
+    }
+    if (!hasKnownOptionalHeader(ntHeaderPtr))
+    {
+        status_ = PETableStatus::Unsupported;
+        return;
+    }
+    pe32Plus_ = isPE32Plus(ntHeaderPtr);
+
+    // RVA = Relative Virtual Address
+    const auto importsStartRVA = getDataDirectory(ntHeaderPtr, pe::ImageDirectoryEntryImport).virtualAddress;
+
+    // Get the IMAGE_SECTION_HEADER that contains the imports.
+    // Usually the ".idata" section, but not necessarily.
+    section_ = findRVASection(importsStartRVA, ntHeaderPtr);
+
+    // Mapped: the descriptors and everything they point to are at their RVAs,
+    // and the section is only wanted for its name.
+    if (layout == PELayout::Mapped)
+    {
+        if (importsStartRVA != 0)
+        {
+            status_          = PETableStatus::Ok;
+            firstDescriptor_ = importsStartRVA;
+            lookupCost_      = 1;
+        }
+        return;
+    }
+
+    if (section_ == nullptr)
+    {
+        return;
+    }
+
+    status_          = PETableStatus::Ok;
+    delta_           = section_->virtualAddress - section_->pointerToRawData;
+    firstDescriptor_ = static_cast<std::uint32_t>(importsStartRVA - delta_);
+    lookupCost_      = ntHeaderPtr->fileHeader.numberOfSections + 1;
+}
+
+ImportDllIterator::ImportDllIterator(const ImportRange * range, const std::uint64_t descriptorOffset)
+    : TableIterator{ range, descriptorOffset }
+{
+    decode();
+}
+
+void ImportDllIterator::advance()
+{
+    position_ += sizeof(pe::ImageImportDescriptor);
+    decode();
+}
+
+void ImportDllIterator::decode()
+{
+    const FileView & file = table_->file_;
+    const auto importDesc = file.at<pe::ImageImportDescriptor>(position_);
+    if (importDesc == nullptr || !table_->budget_.spend(table_->lookupCost_))
+    {
+        finish(true);
+        return;
+    }
+    if (isNullImportDescriptor(*importDesc))
+    {
+        finish(false);
+        return;
+    }
+
+    current_.dllName = stringAt(file, importDesc->nameRVA - table_->delta_);
+    current_.status  = PEImportStatus::Ok;
+    current_.symbols = LazyRange<ImportThunkIterator>{};
+
+    std::uint32_t thunkRVA = importDesc->impByNameRVA;
+    if (thunkRVA == 0) // No impByNameRVA field?
+    {
+        // Must have a non-zero firstThunkRVA field then (IAT = Import Address Table).
+        thunkRVA = importDesc->firstThunkRVA;
+        if (thunkRVA == 0)
+        {
+            current_.status = PEImportStatus::BadIAT;
+            return;
+        }
+    }
+
+    // Adjust to where the tables are in the file:
+    std::uint32_t thunkOffset = 0;
+    if (!table_->offsetOf(thunkRVA, thunkOffset))
+    {
+        current_.status = PEImportStatus::MissingIAT;
+        return;
+    }
+    current_.symbols = LazyRange<ImportThunkIterator>{ table_, thunkOffset };
+}
+
+ImportThunkIterator::ImportThunkIterator(const ImportRange * range, const std::uint64_t thunkOffset)
+    : TableIterator{ range, thunkOffset }
+{
+    decode();
+}
+
+void ImportThunkIterator::advance()
+{
+    position_ += table_->pe32Plus_ ? sizeof(pe::ImageThunkData64) : sizeof(pe::ImageThunkData);
+    decode();
+}
+
+void ImportThunkIterator::decode()
+{
+    const FileView & file = table_->file_;
+
+    // PE32+ thunks are 64 bits, with the ordinal flag in the top bit.
+    // Either way, the low 31 bits are the RVA of the name, or the ordinal.
+    bool inFile = false;
+    std::uint64_t thunk = 0;
+    bool byOrdinal = false;
+    if (table_->pe32Plus_)
+    {
+        const auto thunk64 = file.at<pe::ImageThunkData64>(position_);
+        inFile    = (thunk64 != nullptr);
+        thunk     = inFile ? thunk64->u1.addressOfData : 0;
+        byOrdinal = (thunk & pe::ImageOrdinalFlag64) != 0;
+    }
+    else
+    {
+        const auto thunk32 = file.at<pe::ImageThunkData>(position_);
+        inFile    = (thunk32 != nullptr);
+        thunk     = inFile ? thunk32->u1.addressOfData : 0;
+        byOrdinal = (thunk & pe::ImageOrdinalFlag32) != 0;
+    }
+
+    // A zeroed-out thunk indicates the end of the list.
+    if (!inFile || !table_->budget_.spend(1))
+    {
+        finish(true);
+        return;
+    }
+    if (thunk == 0)
+    {
+        finish(false);
+        return;
+    }
+
+    if (byOrdinal)
+    {
+        // Name apparently not available...
+        // If we'd try to force reading addressOfData anyways,
+        // it would hit some invalid memory location.
+        current_.name      = PEStringRef{};
+        current_.ordinal   = static_cast<std::uint16_t>(thunk & 0xFFFF);
+        current_.byOrdinal = true;
+        return;
+    }
+
+    // IMAGE_IMPORT_BY_NAME is the 16-bit hint followed by the name.
+    std::uint32_t nameOffset = 0;
+    const std::uint16_t * hint = nullptr;
+    if (table_->offsetOf(static_cast<std::uint32_t>(thunk), nameOffset))
+    {
+        hint = file.at<std::uint16_t>(nameOffset);
+    }
+    if (hint == nullptr)
+    {
+        finish(true);
+        return;
+    }
+
+    current_.name      = stringAt(file, std::uint64_t{ nameOffset } + sizeof(std::uint16_t));
+    current_.ordinal   = *hint;
+    current_.byOrdinal = false;
+    if (!table_->budget_.spend(table_->lookupCost_ + current_.name.length))
+    {
+        finish(true);
+    }
+}
+
+ExportRange::ExportRange(const std::uint8_t * fileData, const std::size_t fileLength, const pe::ImageNTHeader * ntHeaderPtr,
+                         const PELayout layout)
+    : file_{ fileData, fileLength }
+    , budget_{ fileLength }
+{
+    //
+    // Following is based on 'impdef.c', which can be found here:
+    //   https://code.google.com/p/ulib-win/source/browse/trunk/demo/pe/impdef.c
+    //
+    // Also relevant:
+    //   http://stackoverflow.com/questions/2975639/resolving-rvas-for-import-and-export-tables-within-a-pe-file
+    //
+
+    if (ntHeaderPtr == nullptr)
+    {
+        return;
+    }
+    if (!hasKnownOptionalHeader(ntHeaderPtr))
+    {
+        status_ = PETableStatus::Unsupported;
+        return;
+    }
+    if (getNumberOfRvaAndSizes(ntHeaderPtr) == 0)
+    {
+        status_ = PETableStatus::NoDataDirectories;
+        return;
+    }
+
+    // RVA = Relative Virtual Address. The export directory is the same in PE32+.
+    const pe::ImageDataDirectory exportEntry = getDataDirectory(ntHeaderPtr, pe::ImageDirectoryEntryExport);
+    startRVA_ = exportEntry.virtualAddress;
+    endRVA_   = startRVA_ + exportEntry.sizeInBytes;
+
+    // Get the IMAGE_SECTION_HEADER that contains the exports.
+    // This is usually the ".edata" section, but doesn't have to be.
+    // Mapped: the section is only wanted for its name, the RVAs are the offsets.
+    section_ = findRVASection(startRVA_, ntHeaderPtr);
+    if (layout == PELayout::Mapped)
+    {
+        if (startRVA_ == 0)
+        {
+            return;
+        }
+    }
+    else
+    {
+        if (section_ == nullptr)
+        {
+            return;
+        }
+        delta_ = section_->virtualAddress - section_->pointerToRawData;
+    }
+
+    const auto exportDir = file_.at<pe::ImageExportDirectory>(startRVA_ - delta_);
+    if (exportDir == nullptr)
+    {
+        section_    = nullptr;
+        incomplete_ = true;
+        return;
+    }
+
+    // The arrays must fit in the file whole, which also bounds
+    // the number of entries walked by the file size.
+    ordinals_  = file_.at<std::uint16_t>(exportDir->addressOfNameOrdinals - delta_, exportDir->numberOfNames);
+    functions_ = file_.at<std::uint32_t>(exportDir->addressOfFunctions    - delta_, exportDir->numberOfFunctions);
+    names_     = file_.at<std::uint32_t>(exportDir->addressOfNames        - delta_, exportDir->numberOfNames);
+
+    numFunctions_ = (functions_ != nullptr) ? exportDir->numberOfFunctions : 0;
+    numNames_     = (ordinals_ != nullptr && names_ != nullptr) ? exportDir->numberOfNames : 0;
+
+    status_            = PETableStatus::Ok;
+    moduleName_        = stringAt(file_, exportDir->nameRVA - delta_);
+    numberOfFunctions_ = exportDir->numberOfFunctions;
+    numberOfNames_     = exportDir->numberOfNames;
+    ordinalBase_       = exportDir->ordinalBase;
+    incomplete_        = (numFunctions_ != numberOfFunctions_ || numNames_ != numberOfNames_);
+}
+
+ExportFunctionIterator::ExportFunctionIterator(const ExportRange * range, const std::uint64_t index)
+    : TableIterator{ range, index }
+{
+    decode();
+}
+
+void ExportFunctionIterator::advance()
+{
+    ++position_;
+    decode();
+}
+
+void ExportFunctionIterator::decode()
+{
+    // Skip over gaps in exported function ordinals
+    // (the entry-point is 0 for these functions).
+    while (position_ < table_->numFunctions_ && table_->functions_[position_] == 0)
+    {
+        ++position_;
+    }
+    if (position_ >= table_->numFunctions_)
+    {
+        finish(false);
+        return;
+    }
+
+    const auto entryPointRVA = table_->functions_[position_];
+    current_.ordinal = static_cast<std::uint32_t>(position_);
+    current_.rva     = entryPointRVA;
+
+    // Is it a forwarder? If so, the entry point RVA is inside the
+    // ".edata" section, and is an RVA to the DllName.EntryPointName
+    current_.forwarder = (entryPointRVA >= table_->startRVA_) && (entryPointRVA <= table_->endRVA_);
+    if (!current_.forwarder)
+    {
+        current_.forwarderName = PEStringRef{};
+        return;
+    }
+
+    current_.forwarderName = stringAt(table_->file_, entryPointRVA - table_->delta_);
+    if (!table_->budget_.spend(current_.forwarderName.length + 1))
+    {
+        finish(true);
+    }
+}
+
+ExportNameIterator::ExportNameIterator(const ExportRange * range, const std::uint64_t index)
+    : TableIterator{ range, index }
+{
+    decode();
+}
+
+void ExportNameIterator::advance()
+{
+    ++position_;
+    decode();
+}
+
+void ExportNameIterator::decode()
+{
+    if (position_ >= table_->numNames_)
+    {
+        finish(false);
+        return;
+    }
+
+    current_.name    = stringAt(table_->file_, table_->names_[position_] - table_->delta_);
+    current_.ordinal = table_->ordinals_[position_];
+    if (!table_->budget_.spend(current_.name.length + 1))
+    {
+        finish(true);
+    }
+}
+
+// ========================================================
+// COFF objects:
+// ========================================================
+
+namespace
+{
+
+// Machines objects are built for. Headers with any other are not taken
+// for objects, which keeps other files out of the --obj directory scans.
+bool isObjectMachine(const std::uint16_t machine)
+{
+    switch (machine)
+    {
+    case 0x014C : // I386
+    case 0x01C0 : // ARM
+    case 0x01C2 : // THUMB
+    case 0x01C4 : // ARMNT
+    case 0x0200 : // IA64
+    case 0x8664 : // AMD64
+    case 0xA641 : // ARM64EC
+    case 0xA64E : // ARM64X
+    case 0xAA64 : // ARM64
+        return true;
+    default :
+        return false;
+    } // switch (machine)
+}
+
+const pe::AnonObjectHeaderBigObj * bigObjHeader(const FileView & file)
+{
+    const auto header = file.at<pe::AnonObjectHeaderBigObj>(0);
+    if (header == nullptr || header->sig1 != 0 || header->sig2 != 0xFFFF || header->version < 2 ||
+        std::memcmp(header->classID, pe::AnonObjectBigObjClassID, sizeof(header->classID)) != 0)
+    {
+        return nullptr;
+    }
+    return header;
+}
+
+const pe::ImageFileHeader * objectFileHeader(const FileView & file)
+{
+    const auto header = file.at<pe::ImageFileHeader>(0);
+    if (header == nullptr || !isObjectMachine(header->machine) || header->sizeOfOptionalHeader != 0)
+    {
+        return nullptr;
+    }
+    return header;
+}
+
+// Offsets below 4 would be the size field, so no name has one.
+PEStringRef stringTableAt(const FileView & file, const CoffObject & object, const std::uint64_t offset)
+{
+    if (offset < sizeof(std::uint32_t) || offset >= object.stringsSize)
+    {
+        return PEStringRef{};
+    }
+    const FileView strings{ file.data() + object.stringsOffset, object.stringsSize };
+    return stringAt(strings, offset);
+}
+
+// Short names are NUL-padded in the record. Long ones are
+// 4 zero bytes, then their offset in the string table.
+PEStringRef symbolName(const FileView & file, const CoffObject & object, const char * name)
+{
+    if (name[0] == '\0' && name[1] == '\0' && name[2] == '\0' && name[3] == '\0')
+    {
+        std::uint32_t offset = 0;
+        std::memcpy(&offset, name + 4, sizeof(offset));
+        return stringTableAt(file, object, offset);
+    }
+
+    PEStringRef str;
+    const void * end = std::memchr(name, '\0', 8);
+    str.data   = name;
+    str.length = (end != nullptr) ? static_cast<std::size_t>(static_cast<const char *>(end) - name) : 8;
+    return str;
+}
+
+// pe::ImageSymbol and pe::ImageSymbolEx only differ in the width of sectionNumber.
+template<typename Record>
+bool decodeSymbol(const FileView & file, const CoffObject & object, const std::uint64_t offset, CoffSymbol & symbol)
+{
+    const auto record = file.at<Record>(offset);
+    if (record == nullptr)
+    {
+        return false;
+    }
+    symbol.name          = symbolName(file, object, record->name);
+    symbol.value         = record->value;
+    symbol.sectionNumber = record->sectionNumber;
+    symbol.type          = record->type;
+    symbol.storageClass  = record->storageClass;
+    symbol.numAuxSymbols = record->numberOfAuxSymbols;
+    return true;
+}
+
+} // namespace {}
+
+bool readCoffObject(const FileView & file, CoffObject & object, std::ostream & errOut)
+{
+    stats::Scope statsScope{ stats::Phase::Validate };
+
+    std::uint64_t sectionsOffset = 0;
+    std::uint32_t numSections    = 0;
+    std::uint64_t symbolsOffset  = 0;
+    std::uint32_t numSymbols     = 0;
+
+    object = CoffObject{};
+    if (const auto bigObj = bigObjHeader(file))
+    {
+        object.machine       = bigObj->machine;
+        object.timeDateStamp = bigObj->timeDateStamp;
+        object.bigObj        = true;
+        object.symbolSize    = sizeof(pe::ImageSymbolEx);
+        sectionsOffset       = sizeof(pe::AnonObjectHeaderBigObj);
+        numSections          = bigObj->numberOfSections;
+        symbolsOffset        = bigObj->pointerToSymbolTable;
+        numSymbols           = bigObj->numberOfSymbols;
+    }
+    else if (const auto header = objectFileHeader(file))
+    {
+        object.machine         = header->machine;
+        object.timeDateStamp   = header->timeDateStamp;
+        object.characteristics = header->characteristics;
+        object.symbolSize      = sizeof(pe::ImageSymbol);
+        sectionsOffset         = sizeof(pe::ImageFileHeader);
+        numSections            = header->numberOfSections;
+        symbolsOffset          = header->pointerToSymbolTable;
+        numSymbols             = header->numberOfSymbols;
+    }
+    else
+    {
+        const auto sig = file.at<std::uint16_t>(0, 2);
+        if (sig != nullptr && sig[0] == pe::DOSSignature)
+        {
+            errOut << color::red() << "File is a PE image, not an object!" << color::restore() << "\n";
+        }
+        else if (sig != nullptr && sig[0] == 0 && sig[1] == 0xFFFF)
+        {
+            errOut << color::red() << "Anonymous object (compiled with /GL) or import record, not a COFF object!" << color::restore() << "\n";
+        }
+        else
+        {
+            errOut << color::red() << "Not a COFF object! Unknown machine or an optional header." << color::restore() << "\n";
+        }
+        return false;
+    }
+
+    const auto sections = file.at<pe::ImageSectionHeader>(sectionsOffset, numSections);
+    if (sections == nullptr)
+    {
+        errOut << color::red() << "Section table runs past the end of the file!" << color::restore() << "\n";
+        return false;
+    }
+    object.sections = SectionRange{ sections, numSections };
+
+    // No symbol table at all is fine (pointerToSymbolTable = 0); one cut short is kept up to the end of the file.
+    if (symbolsOffset == 0)
+    {
+        return true;
+    }
+    const std::uint64_t symbolsFit = (symbolsOffset <= file.size()) ? (file.size() - symbolsOffset) / object.symbolSize : 0;
+    object.symbolsOffset = symbolsOffset;
+    object.numSymbols    = static_cast<std::uint32_t>(std::min<std::uint64_t>(numSymbols, symbolsFit));
+    if (object.numSymbols != numSymbols)
+    {
+        object.truncated = true;
+        return true;
+    }
+
+    object.stringsOffset = symbolsOffset + std::uint64_t(numSymbols) * object.symbolSize;
+    const auto stringsSize = file.at<std::uint32_t>(object.stringsOffset);
+    if (stringsSize != nullptr)
+    {
+        object.stringsSize = static_cast<std::uint32_t>(std::min<std::uint64_t>(*stringsSize, file.size() - object.stringsOffset));
+        object.truncated   = (object.stringsSize != *stringsSize);
+    }
+    return true;
+}
+
+bool readCoffSymbol(const FileView & file, const CoffObject & object, const std::uint32_t index, CoffSymbol & symbol)
+{
+    if (index >= object.numSymbols)
+    {
+        return false;
+    }
+    const std::uint64_t offset = object.symbolsOffset + std::uint64_t(index) * object.symbolSize;
+    return object.bigObj ? decodeSymbol<pe::ImageSymbolEx>(file, object, offset, symbol)
+                         : decodeSymbol<pe::ImageSymbol>(file, object, offset, symbol);
+}
+
+PEStringRef coffSectionName(const FileView & file, const CoffObject & object, const pe::ImageSectionHeader & section)
+{
+    PEStringRef str;
+    const void * end = std::memchr(section.name, '\0', pe::ImageMaxSectionNameLength);
+    str.data   = section.name;
+    str.length = (end != nullptr) ? static_cast<std::size_t>(static_cast<const char *>(end) - section.name) : pe::ImageMaxSectionNameLength;
+    if (str.length < 2 || str.data[0] != '/')
+    {
+        return str;
+    }
+
+    // "/1234567", or "//AAAAAA" in base64 for offsets of 10 million and up.
+    std::uint64_t offset = 0;
+    if (str.data[1] == '/')
+    {
+        for (std::size_t i = 2; i < str.length; ++i)
+        {
+            const char c = str.data[i];
+            int digit;
+            if      (c >= 'A' && c <= 'Z') { digit = c - 'A';      }
+            else if (c >= 'a' && c <= 'z') { digit = c - 'a' + 26; }
+            else if (c >= '0' && c <= '9') { digit = c - '0' + 52; }
+            else if (c == '+')             { digit = 62;           }
+            else if (c == '/')             { digit = 63;           }
+            else                           { return str;           }
+            offset = (offset * 64) + static_cast<std::uint64_t>(digit);
+        }
+    }
+    else
+    {
+        for (std::size_t i = 1; i < str.length; ++i)
+        {
+            if (str.data[i] < '0' || str.data[i] > '9')
+            {
+                return str;
+            }
+            offset = (offset * 10) + static_cast<std::uint64_t>(str.data[i] - '0');
+        }
+    }
+
+    const PEStringRef longName = stringTableAt(file, object, offset);
+    return (longName.length != 0) ? longName : str;
+}
+
+const pe::ImageRelocation * coffRelocations(const FileView & file, const pe::ImageSectionHeader & section, std::uint32_t & count)
+{
+    std::uint64_t offset = section.pointerToRelocations;
+    count = section.numberOfRelocations;
+    if (count == 0xFFFF && (section.characteristics & pe::ImageScnLnkNRelocOvfl) != 0)
+    {
+        const auto first = file.at<pe::ImageRelocation>(offset);
+        count = (first != nullptr && first->virtualAddress != 0) ? (first->virtualAddress - 1) : 0;
+        offset += sizeof(pe::ImageRelocation);
+    }
+    if (count == 0)
+    {
+        return nullptr;
+    }
+    return file.at<pe::ImageRelocation>(offset, count);
+}
+
+// ========================================================
+// Import and export tables:
+// ========================================================
+
+// Calls 'callback' with each export, by ordinal: the names of each function,
+// then its forwarder string if it has one. Shared by collectExports()
+// and PEImage::visit(), so both list the same entries in the same order.
+template<typename Callback>
+static void forEachExport(const ExportRange & exports, Callback && callback)
+{
+    // Sort the names by ordinal once, so matching names to functions
+    // is a single merge pass rather than a scan of all names per function,
+    // which was quadratic on DLLs with tens of thousands of exports.
+    struct NameByOrdinal
+    {
+        std::uint32_t ordinal;
+        std::uint32_t index;
+        PEStringRef   name;
+    };
+    std::vector<NameByOrdinal> namesByOrdinal;
+    namesByOrdinal.reserve(exports.nameCount());
+    for (const auto & name : exports.names())
+    {
+        namesByOrdinal.push_back({ name.ordinal, static_cast<std::uint32_t>(namesByOrdinal.size()), name.name });
+    }
+    std::sort(std::begin(namesByOrdinal), std::end(namesByOrdinal),
+              [](const NameByOrdinal & a, const NameByOrdinal & b)
+              {
+                  return (a.ordinal != b.ordinal) ? (a.ordinal < b.ordinal) : (a.index < b.index);
+              });
+
+    auto nextName = std::begin(namesByOrdinal);
+    ExportedSymbolRef symbol;
+
+    for (const auto & function : exports.functions())
+    {
+        // See if this function has associated names exported for it.
+        while (nextName != std::end(namesByOrdinal) && nextName->ordinal < function.ordinal)
+        {
+            ++nextName;
+        }
+        for (; nextName != std::end(namesByOrdinal) && nextName->ordinal == function.ordinal; ++nextName)
+        {
+            symbol.name      = nextName->name;
+            symbol.ordinal   = function.ordinal;
+            symbol.rva       = function.rva;
+            symbol.forwarder = false;
+            callback(symbol);
+        }
+
+        if (function.forwarder)
+        {
+            symbol.name      = function.forwarderName;
+            symbol.ordinal   = function.ordinal;
+            symbol.rva       = function.rva;
+            symbol.forwarder = true;
+            callback(symbol);
+        }
+    }
+}
+
+static void collectExports(const pe::ImageDOSHeader * dosHeaderPtr, const pe::ImageNTHeader * ntHeaderPtr,
+                           const std::size_t fileLength, PEExportTable & table, const PELayout layout = PELayout::File)
+{
+    const ExportRange exports{ reinterpret_cast<const std::uint8_t *>(dosHeaderPtr), fileLength, ntHeaderPtr, layout };
+    table.status = exports.status();
+    if (exports.status() != PETableStatus::Ok)
+    {
+        table.incomplete = exports.incomplete();
+        return;
+    }
+
+    table.sectionName       = sectionHeaderName(exports.section());
+    table.moduleName.assign(exports.moduleName().data, exports.moduleName().length);
+    table.numberOfFunctions = exports.numberOfFunctions();
+    table.numberOfNames     = exports.numberOfNames();
+    table.ordinalBase       = exports.ordinalBase();
+
+    forEachExport(exports, [&table](const ExportedSymbolRef & exported)
+    {
+        PEExportedSymbol symbol;
+        symbol.name.assign(exported.name.data, exported.name.length);
+        symbol.ordinal   = exported.ordinal;
+        symbol.rva       = exported.rva;
+        symbol.forwarder = exported.forwarder;
+        table.symbols.emplace_back(std::move(symbol));
+    });
+
+    table.incomplete = exports.incomplete();
+}
+
+static void collectImports(const pe::ImageDOSHeader * dosHeaderPtr, const pe::ImageNTHeader * ntHeaderPtr,
+                           const std::size_t fileLength, PEImportTable & table, const PELayout layout = PELayout::File)
+{
+    const ImportRange imports{ reinterpret_cast<const std::uint8_t *>(dosHeaderPtr), fileLength, ntHeaderPtr, layout };
+    table.status = imports.status();
+    if (imports.status() != PETableStatus::Ok)
+    {
+        return;
+    }
+
+    table.sectionName = sectionHeaderName(imports.section());
+
+    PEImportedSymbol symbol;
+    for (const auto & dll : imports)
+    {
+        table.modules.emplace_back();
+        PEImportedModule & module = table.modules.back();
+        module.dllName.assign(dll.dllName.data, dll.dllName.length);
+        module.status = dll.status;
+
+        for (const auto & imported : dll.symbols)
+        {
+            symbol.name.assign(imported.name.data, imported.name.length);
+            symbol.ordinal   = imported.ordinal;
+            symbol.byOrdinal = imported.byOrdinal;
+            module.symbols.push_back(symbol);
+        }
+    }
+
+    table.incomplete = imports.incomplete();
+}
+
+// ========================================================
+// Validation and PEImage:
+// ========================================================
+
+bool looksLikePE(const char * filename)
+{
+    FILE * fileIn = std::fopen(filename, "rb");
+    if (fileIn == nullptr)
+    {
+        return false;
+    }
+
+    std::uint16_t magic = 0;
+    const bool isPE = (std::fread(&magic, sizeof(magic), 1, fileIn) == 1 && magic == pe::DOSSignature);
+    std::fclose(fileIn);
+    return isPE;
+}
+
+bool looksLikeCoffObject(const char * filename)
+{
+    FILE * fileIn = std::fopen(filename, "rb");
+    if (fileIn == nullptr)
+    {
+        return false;
+    }
+
+    std::uint8_t header[sizeof(pe::AnonObjectHeaderBigObj)] = {};
+    const std::size_t size = std::fread(header, 1, sizeof(header), fileIn);
+    std::fclose(fileIn);
+
+    const FileView file{ header, size };
+    return bigObjHeader(file) != nullptr || objectFileHeader(file) != nullptr;
+}
+
+const pe::ImageNTHeader * validatePE(const std::uint8_t * fileContents, const std::size_t fileLength, std::ostream & errOut)
+{
+    stats::Scope statsScope{ stats::Phase::Validate };
+
+    if (fileLength < sizeof(pe::ImageDOSHeader))
+    {
+        errOut << color::red() << "File is too small to be a PE!" << color::restore() << "\n";
+        return nullptr;
+    }
+
+    const auto dosHeaderPtr =
+        reinterpret_cast<const pe::ImageDOSHeader *>(fileContents);
+
+    // Validate the DOS header, expected id='MZ'
+    if (dosHeaderPtr->e_magic != pe::DOSSignature)
+    {
+        union
+        {
+            std::uint16_t u16;
+            char c8[2];
+        } split;
+
+        split.u16 = dosHeaderPtr->e_magic;
+        const char sig[] = { split.c8[0], split.c8[1], '\0' };
+
+        errOut << color::red() << "Bad PE DOS signature! Expected \'MZ\', got \'"
+               << sig << "\'!" << color::restore() << "\n";
+        return nullptr;
+    }
+
+    // The signature and IMAGE_FILE_HEADER must at least be inside the file.
+    const std::size_t minNTHeaderSize = sizeof(std::uint32_t) + sizeof(pe::ImageFileHeader);
+    if (dosHeaderPtr->e_lfanew > fileLength || (fileLength - dosHeaderPtr->e_lfanew) < minNTHeaderSize)
+    {
+        errOut << color::red() << "NT headers offset is out of bounds! File is truncated or corrupted."
+               << color::restore() << "\n";
+        return nullptr;
+    }
+
+    const auto ntHeaderPtr =
+        reinterpret_cast<const pe::ImageNTHeader *>(fileContents + dosHeaderPtr->e_lfanew);
+
+    // Validate the NT header, expected id='PE'
+    if (ntHeaderPtr->signature != pe::NTSignature)
+    {
+        union
+        {
+            std::uint32_t u32;
+            char c8[4];
+        } split;
+
+        split.u32 = ntHeaderPtr->signature;
+        const char sig[] = { split.c8[0], split.c8[1], split.c8[2], split.c8[3], '\0' };
+
+        errOut << color::red() << "Bad PE NT signature! Expected \'PE\', got \'"
+               << sig << "\'!" << color::restore() << "\n";
+        return nullptr;
+    }
+
+    // The dumps read the whole IMAGE_NT_HEADERS and section table, so both must be inside the file.
+    const std::uint64_t sectionsOffset = reinterpret_cast<const std::uint8_t *>(getFirstSection(ntHeaderPtr)) - fileContents;
+    const std::uint64_t sectionsEnd    = sectionsOffset + std::uint64_t{ ntHeaderPtr->fileHeader.numberOfSections } * sizeof(pe::ImageSectionHeader);
+    if ((fileLength - dosHeaderPtr->e_lfanew) < sizeof(pe::ImageNTHeader) || sectionsEnd > fileLength)
+    {
+        errOut << color::red() << "NT headers or section table are out of bounds! File is truncated or corrupted."
+               << color::restore() << "\n";
+        return nullptr;
+    }
+
+    // The PE32+ optional header is 16 bytes longer; the data directories are read from its end.
+    const std::size_t ntHeader64Size = sizeof(std::uint32_t) + sizeof(pe::ImageFileHeader) + sizeof(pe::ImageOptionalHeader64);
+    if (isPE32Plus(ntHeaderPtr) && (fileLength - dosHeaderPtr->e_lfanew) < ntHeader64Size)
+    {
+        errOut << color::red() << "PE32+ optional header is out of bounds! File is truncated or corrupted."
+               << color::restore() << "\n";
+        return nullptr;
+    }
+
+    return ntHeaderPtr;
+}
+
+bool PEImage::load(const char * filename, std::ostream & errOut)
+{
+    FileContents contents;
+    if (!contents.load(filename, currentFileLoader, errOut))
+    {
+        *this = PEImage{};
+        return false;
+    }
+    return open(std::move(contents), filename, errOut);
+}
+
+bool PEImage::loadImage(const char * filename, std::ostream & errOut)
+{
+    FileContents contents;
+    if (!contents.loadImage(filename, errOut))
+    {
+        *this = PEImage{};
+        return false;
+    }
+    return open(std::move(contents), filename, errOut, PELayout::Mapped);
+}
+
+bool PEImage::open(FileContents && contents, const char * name, std::ostream & errOut, const PELayout layout)
+{
+    *this = PEImage{};
+
+    const std::size_t fileLength = contents.size();
+    const pe::ImageNTHeader * ntHeaderPtr = validatePE(contents.data(), fileLength, errOut);
+    if (ntHeaderPtr == nullptr)
+    {
+        return false;
+    }
+    contents_ = std::move(contents);
+    ntHeader_ = ntHeaderPtr;
+    layout_   = layout;
+    stats::count(stats::Counter::Files);
+
+    const auto & fileHeader     = ntHeaderPtr->fileHeader;
+    const auto & optionalHeader = ntHeaderPtr->optionalHeader;
+
+    info_.filename            = name;
+    info_.fileSize            = fileLength;
+    info_.machine             = fileHeader.machine;
+    info_.timeDateStamp       = fileHeader.timeDateStamp;
+    info_.fileCharacteristics = fileHeader.characteristics;
+    info_.magic               = optionalHeader.magic;
+    info_.addressOfEntryPoint = optionalHeader.addressOfEntryPoint;
+    info_.imageBase           = getImageBase(ntHeaderPtr);
+    info_.sizeOfImage         = optionalHeader.sizeOfImage;
+    info_.subsystem           = optionalHeader.subsystem;
+    info_.dllCharacteristics  = optionalHeader.dllCharacteristics;
+
+    const pe::ImageSectionHeader * sectionPtr = getFirstSection(ntHeaderPtr);
+    const std::uint32_t numSections = fileHeader.numberOfSections;
+
+    info_.sections.reserve(numSections);
+    for (std::uint32_t s = 0; s < numSections; ++s, ++sectionPtr)
+    {
+        PESectionInfo section;
+        section.name             = sectionHeaderName(sectionPtr);
+        section.virtualAddress   = sectionPtr->virtualAddress;
+        section.virtualSize      = sectionPtr->misc.virtualSize;
+        section.sizeOfRawData    = sectionPtr->sizeOfRawData;
+        section.pointerToRawData = sectionPtr->pointerToRawData;
+        section.characteristics  = sectionPtr->characteristics;
+        info_.sections.push_back(std::move(section));
+    }
+
+    return true;
+}
+
+const PEImportTable & PEImage::imports()
+{
+    if (!importsParsed_ && !contents_.empty())
+    {
+        stats::Scope statsScope{ stats::Phase::Imports };
+        collectImports(dosHeader(), ntHeader_, contents_.size(), info_.imports, layout_);
+        importsParsed_ = true;
+    }
+    return info_.imports;
+}
+
+const PEExportTable & PEImage::exports()
+{
+    if (!exportsParsed_ && !contents_.empty())
+    {
+        stats::Scope statsScope{ stats::Phase::Exports };
+        collectExports(dosHeader(), ntHeader_, contents_.size(), info_.exports, layout_);
+        exportsParsed_ = true;
+    }
+    return info_.exports;
+}
+
+ImportRange PEImage::importRange() const
+{
+    return ImportRange{ contents_.data(), contents_.size(), ntHeader_, layout_ };
+}
+
+ExportRange PEImage::exportRange() const
+{
+    return ExportRange{ contents_.data(), contents_.size(), ntHeader_, layout_ };
+}
+
+SectionRange PEImage::sectionRange() const
+{
+    return (ntHeader_ != nullptr) ? SectionRange{ getFirstSection(ntHeader_), ntHeader_->fileHeader.numberOfSections } : SectionRange{};
+}
+
+PEVisitor::~PEVisitor()
+{
+}
+
+void PEImage::visit(PEVisitor & visitor, const PEParseFlags flags) const
+{
+    for (const auto & section : sectionRange())
+    {
+        visitor.onSection(section);
+    }
+
+    if (flags & ParseImports)
+    {
+        const ImportRange imports = importRange();
+        for (const auto & dll : imports)
+        {
+            visitor.onImportDll(dll);
+            for (const auto & symbol : dll.symbols)
+            {
+                visitor.onImportSymbol(dll, symbol);
+            }
+        }
+        visitor.onImportsEnd(imports.status(), imports.incomplete());
+    }
+
+    if (flags & ParseExports)
+    {
+        const ExportRange exports = exportRange();
+        forEachExport(exports, [&visitor](const ExportedSymbolRef & symbol) { visitor.onExport(symbol); });
+        visitor.onExportsEnd(exports.status(), exports.incomplete());
+    }
+}
+
+const pe::ImageDOSHeader * PEImage::dosHeader() const
+{
+    return (ntHeader_ != nullptr) ? reinterpret_cast<const pe::ImageDOSHeader *>(contents_.data()) : nullptr;
+}
+
+const pe::ImageSectionHeader * PEImage::sectionHeaders() const
+{
+    return (ntHeader_ != nullptr) ? getFirstSection(ntHeader_) : nullptr;
+}
+
+PEInfo PEImage::releaseInfo()
+{
+    PEInfo info = std::move(info_);
+    *this = PEImage{};
+    return info;
+}
+
+bool parsePEFile(const char * filename, const unsigned parseFlags, PEInfo & info, std::ostream & errOut)
+{
+    stats::FileScope statsFile{ filename };
+    PEImage image;
+    if (!image.load(filename, errOut))
+    {
+        return false;
+    }
+
+    if (parseFlags & ParseImports)
+    {
+        image.imports();
+    }
+    if (parseFlags & ParseExports)
+    {
+        image.exports();
+    }
+
+    info = image.releaseInfo();
+    return true;
+}
+
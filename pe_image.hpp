@@ -0,0 +1,1378 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: pe_image.hpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: Parsing API of libppedump: the PE structures, file loading and PEImage.
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#ifndef PE_IMAGE_HPP
+#define PE_IMAGE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <iosfwd>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Memory mapping, Unix domain sockets, inotify and friends are only available on POSIX systems.
+#if defined(__APPLE__) || defined(__linux__) || defined(__unix__)
+    #define PPEDUMP_POSIX 1
+#endif // Apple/Linux/Unix
+
+// ========================================================
+//
+// Portable Executable file structures, adapted
+// from the originals found on the Window API / WinNT.h.
+//
+// SHOUT-CASE is a real eye sore, so I've renamed them and
+// commented the original names found on MS documentation
+// at the top of each structure.
+//
+// PE references/documentation:
+// - https://msdn.microsoft.com/en-us/library/ms809762.aspx
+// - https://en.wikipedia.org/wiki/Portable_Executable
+// - http://www.sunshine2k.de/reversing/tuts/tut_rvait.htm
+//
+// Source code of the original Win32 PEDUMP by Matt Pietrek:
+// - http://www.wheaty.net/downloads.htm
+//
+// ========================================================
+namespace pe
+{
+
+static const std::uint16_t DOSSignature = 0x5A4D;     // "MZ"
+static const std::uint32_t NTSignature  = 0x00004550; // "PE\0\0"
+
+static const std::uint32_t ImageMaxSectionNameLength = 8;
+static const std::uint32_t ImageMaxDirectoryEntries  = 16;
+
+// Indexes into ImageOptionalHeader::dataDirectory (IMAGE_DIRECTORY_ENTRY_*):
+static const int ImageDirectoryEntryExport = 0;
+static const int ImageDirectoryEntryImport = 1;
+static const int ImageDirectoryEntryBaseReloc = 5;
+
+// ImageOptionalHeader::magic (IMAGE_NT_OPTIONAL_HDR*_MAGIC):
+static const std::uint16_t ImageNTOptionalHeader32Magic = 0x10B; // PE32
+static const std::uint16_t ImageNTOptionalHeader64Magic = 0x20B; // PE32+
+
+// Set in an import thunk if it imports by ordinal (IMAGE_ORDINAL_FLAG32/64):
+static const std::uint32_t ImageOrdinalFlag32 = 0x80000000;
+static const std::uint64_t ImageOrdinalFlag64 = 0x8000000000000000ull;
+
+// ImageFileHeader::characteristics bits (IMAGE_FILE_*):
+static const std::uint16_t ImageFileRelocsStripped = 0x0001;
+
+// Base relocation types, the top 4 bits of each entry (IMAGE_REL_BASED_*):
+static const int ImageRelBasedAbsolute = 0;
+static const int ImageRelBasedHigh     = 1;
+static const int ImageRelBasedLow      = 2;
+static const int ImageRelBasedHighLow  = 3;
+static const int ImageRelBasedHighAdj  = 4;
+static const int ImageRelBasedDir64    = 10;
+
+// Import libraries and static libraries (.lib) are ar archives starting with this (IMAGE_ARCHIVE_START):
+static const char ImageArchiveStart[] = "!<arch>\n";
+static const std::size_t ImageArchiveStartSize = 8;
+
+// ImportObjectHeader::typeInfo, bits 0-1 (IMPORT_OBJECT_TYPE):
+static const int ImportObjectCode  = 0;
+static const int ImportObjectData  = 1;
+static const int ImportObjectConst = 2;
+
+// ImportObjectHeader::typeInfo, bits 2-4 (IMPORT_OBJECT_NAME_TYPE).
+// How the name looked up in the DLL derives from the symbol name:
+static const int ImportObjectOrdinal        = 0; // Imported by ordinal
+static const int ImportObjectName           = 1; // The symbol name
+static const int ImportObjectNameNoPrefix   = 2; // Without a leading '?', '@' or '_'
+static const int ImportObjectNameUndecorate = 3; // Same, and cut at the first '@'
+static const int ImportObjectNameExportAs   = 4; // A third string after the DLL name
+
+// AnonObjectHeaderBigObj::classID of /bigobj objects (ANON_OBJECT_HEADER_BIGOBJ),
+// {D1BAA1C7-BAEE-4BA9-AF20-FAF66AA4DCB8}, as stored:
+static const std::uint8_t AnonObjectBigObjClassID[16] = {
+    0xC7, 0xA1, 0xBA, 0xD1, 0xEE, 0xBA, 0xA9, 0x4B, 0xAF, 0x20, 0xFA, 0xF6, 0x6A, 0xA4, 0xDC, 0xB8
+};
+
+// ImageSectionHeader::characteristics bit (IMAGE_SCN_LNK_NRELOC_OVFL): a section of an
+// object with more than 0xFFFF relocations. The first one holds the count instead.
+static const std::uint32_t ImageScnLnkNRelocOvfl = 0x01000000;
+
+// ImageSymbol::sectionNumber special values (IMAGE_SYM_*):
+static const int ImageSymUndefined = 0;  // Defined in another object (or common data, if value != 0)
+static const int ImageSymAbsolute  = -1; // Value is a constant, not an address
+static const int ImageSymDebug     = -2; // Debugging information, like the FILE records
+
+// ImageSymbol::storageClass (IMAGE_SYM_CLASS_*), the common ones:
+static const int ImageSymClassExternal     = 2;
+static const int ImageSymClassStatic       = 3;
+static const int ImageSymClassLabel        = 6;
+static const int ImageSymClassFunction     = 101;
+static const int ImageSymClassFile         = 103; // Followed by the source file name in its auxiliary records
+static const int ImageSymClassSection      = 104;
+static const int ImageSymClassWeakExternal = 105;
+
+#pragma pack(push, 1)
+
+// AKA IMAGE_DATA_DIRECTORY
+struct ImageDataDirectory
+{
+    std::uint32_t virtualAddress;
+    std::uint32_t sizeInBytes;
+};
+
+// AKA IMAGE_FILE_HEADER
+struct ImageFileHeader
+{
+    std::uint16_t machine;
+    std::uint16_t numberOfSections;
+    std::uint32_t timeDateStamp;
+    std::uint32_t pointerToSymbolTable;
+    std::uint32_t numberOfSymbols;
+    std::uint16_t sizeOfOptionalHeader;
+    std::uint16_t characteristics;
+};
+
+// AKA IMAGE_OPTIONAL_HEADER
+struct ImageOptionalHeader
+{
+    // Standard fields
+    std::uint16_t magic;
+    std::uint8_t  majorLinkerVersion;
+    std::uint8_t  minorLinkerVersion;
+    std::uint32_t sizeOfCode;
+    std::uint32_t sizeOfInitializedData;
+    std::uint32_t sizeOfUninitializedData;
+    std::uint32_t addressOfEntryPoint;
+    std::uint32_t baseOfCode;
+    std::uint32_t baseOfData;
+
+    // NT additional fields
+    std::uint32_t imageBase;
+    std::uint32_t sectionAlignment;
+    std::uint32_t fileAlignment;
+    std::uint16_t majorOperatingSystemVersion;
+    std::uint16_t minorOperatingSystemVersion;
+    std::uint16_t majorImageVersion;
+    std::uint16_t minorImageVersion;
+    std::uint16_t majorSubsystemVersion;
+    std::uint16_t minorSubsystemVersion;
+    std::uint32_t reserved1;
+    std::uint32_t sizeOfImage;
+    std::uint32_t sizeOfHeaders;
+    std::uint32_t checksum;
+    std::uint16_t subsystem;
+    std::uint16_t dllCharacteristics;
+    std::uint32_t sizeOfStackReserve;
+    std::uint32_t sizeOfStackCommit;
+    std::uint32_t sizeOfHeapReserve;
+    std::uint32_t sizeOfHeapCommit;
+    std::uint32_t loaderFlags;
+    std::uint32_t numberOfRvaAndSizes;
+    ImageDataDirectory dataDirectory[ImageMaxDirectoryEntries];
+};
+
+// AKA IMAGE_OPTIONAL_HEADER64 (PE32+). The rest of the code reads the
+// PE32 layout above; only rebasing and the image base need the fields this one moves.
+struct ImageOptionalHeader64
+{
+    // Standard fields
+    std::uint16_t magic;
+    std::uint8_t  majorLinkerVersion;
+    std::uint8_t  minorLinkerVersion;
+    std::uint32_t sizeOfCode;
+    std::uint32_t sizeOfInitializedData;
+    std::uint32_t sizeOfUninitializedData;
+    std::uint32_t addressOfEntryPoint;
+    std::uint32_t baseOfCode;
+
+    // NT additional fields
+    std::uint64_t imageBase;
+    std::uint32_t sectionAlignment;
+    std::uint32_t fileAlignment;
+    std::uint16_t majorOperatingSystemVersion;
+    std::uint16_t minorOperatingSystemVersion;
+    std::uint16_t majorImageVersion;
+    std::uint16_t minorImageVersion;
+    std::uint16_t majorSubsystemVersion;
+    std::uint16_t minorSubsystemVersion;
+    std::uint32_t reserved1;
+    std::uint32_t sizeOfImage;
+    std::uint32_t sizeOfHeaders;
+    std::uint32_t checksum;
+    std::uint16_t subsystem;
+    std::uint16_t dllCharacteristics;
+    std::uint64_t sizeOfStackReserve;
+    std::uint64_t sizeOfStackCommit;
+    std::uint64_t sizeOfHeapReserve;
+    std::uint64_t sizeOfHeapCommit;
+    std::uint32_t loaderFlags;
+    std::uint32_t numberOfRvaAndSizes;
+    ImageDataDirectory dataDirectory[ImageMaxDirectoryEntries];
+};
+
+// AKA IMAGE_NT_HEADERS
+struct ImageNTHeader
+{
+    std::uint32_t       signature;
+    ImageFileHeader     fileHeader;
+    ImageOptionalHeader optionalHeader;
+};
+
+// AKA IMAGE_SECTION_HEADER
+struct ImageSectionHeader
+{
+    // Section name, like ".text"; NOT NUL-terminated!
+    char name[ImageMaxSectionNameLength];
+
+    union
+    {
+        std::uint32_t physicalAddress;
+        std::uint32_t virtualSize;
+    } misc;
+
+    std::uint32_t virtualAddress;
+    std::uint32_t sizeOfRawData;
+    std::uint32_t pointerToRawData;
+    std::uint32_t pointerToRelocations;
+    std::uint32_t pointerToLinenumbers;
+    std::uint16_t numberOfRelocations;
+    std::uint16_t numberOfLinenumbers;
+    std::uint32_t characteristics;
+};
+
+// AKA IMAGE_BASE_RELOCATION. Followed by (sizeOfBlock - 8) / 2 16-bit
+// entries: the type in the top 4 bits, the offset into the page below.
+struct ImageBaseRelocation
+{
+    std::uint32_t virtualAddress; // RVA of the 4 KiB page
+    std::uint32_t sizeOfBlock;    // Header included
+};
+
+// AKA IMAGE_EXPORT_DIRECTORY
+struct ImageExportDirectory
+{
+    std::uint32_t characteristics;
+    std::uint32_t timeDateStamp;
+    std::uint16_t majorVersion;
+    std::uint16_t minorVersion;
+    std::uint32_t nameRVA; // RVA to NUL-terminated name of the PE (like "KERNEL32.DLL")
+    std::uint32_t ordinalBase;
+    std::uint32_t numberOfFunctions;
+    std::uint32_t numberOfNames;
+
+    // Relative Virtual Addresses from base of image
+    std::uint32_t addressOfFunctions;
+    std::uint32_t addressOfNames;
+    std::uint32_t addressOfNameOrdinals;
+};
+
+// AKA IMAGE_IMPORT_DESCRIPTOR
+struct ImageImportDescriptor
+{
+    std::uint32_t impByNameRVA;   // RVA to the array of ImageImportByName entries for this DLL
+    std::uint32_t timeDateStamp;  // Timestamp of the whole file repeated here
+    std::uint32_t forwarderChain; // -1 if no forwarders
+    std::uint32_t nameRVA;        // RVA to a NUL-terminated ASCII string containing the imported DLL's name.
+    std::uint32_t firstThunkRVA;  // RVA to IAT (if bound this IAT has actual addresses)
+};
+
+// AKA IMAGE_THUNK_DATA
+struct ImageThunkData
+{
+    union
+    {
+        std::uint32_t forwarderString;
+        std::uint32_t function;
+        std::uint32_t ordinal;
+        std::uint32_t addressOfData;
+    } u1;
+};
+
+// AKA IMAGE_THUNK_DATA64 (PE32+)
+struct ImageThunkData64
+{
+    union
+    {
+        std::uint64_t forwarderString;
+        std::uint64_t function;
+        std::uint64_t ordinal;
+        std::uint64_t addressOfData;
+    } u1;
+};
+
+// AKA IMAGE_IMPORT_BY_NAME
+struct ImageImportByName
+{
+    std::uint16_t ordinalHint;
+    char funcName[1]; // Actually reinterpreted as a NUL-terminated string.
+};
+
+// AKA IMAGE_DOS_HEADER (DOS .EXE header kept for historical reasons; no longer used)
+struct ImageDOSHeader
+{
+    std::uint16_t e_magic;    // Magic number
+    std::uint16_t e_cblp;     // Bytes on last page of file
+    std::uint16_t e_cp;       // Pages in file
+    std::uint16_t e_crlc;     // Relocations
+    std::uint16_t e_cparhdr;  // Size of header in paragraphs
+    std::uint16_t e_minalloc; // Minimum extra paragraphs needed
+    std::uint16_t e_maxalloc; // Maximum extra paragraphs needed
+    std::uint16_t e_ss;       // Initial (relative) SS value
+    std::uint16_t e_sp;       // Initial SP value
+    std::uint16_t e_csum;     // Checksum
+    std::uint16_t e_ip;       // Initial IP value
+    std::uint16_t e_cs;       // Initial (relative) CS value
+    std::uint16_t e_lfarlc;   // File address of relocation table
+    std::uint16_t e_ovno;     // Overlay number
+    std::uint16_t e_res[4];   // Reserved words
+    std::uint16_t e_oemid;    // OEM identifier (for e_oeminfo)
+    std::uint16_t e_oeminfo;  // OEM information (e_oemid specific)
+    std::uint16_t e_res2[10]; // Reserved words
+    std::uint32_t e_lfanew;   // File address of new EXE header (IMAGE_NT_HEADERS)
+};
+
+// AKA IMAGE_ARCHIVE_MEMBER_HEADER. Every field is ASCII, padded with
+// spaces; the member data follows, padded to an even size.
+struct ImageArchiveMemberHeader
+{
+    char name[16]; // "name/", "/<offset into the long names>", or "/" and "//" for the special members
+    char date[12];
+    char userID[6];
+    char groupID[6];
+    char mode[8];
+    char size[10]; // Decimal, header excluded
+    char endHeader[2]; // "`\n"
+};
+
+// AKA IMPORT_OBJECT_HEADER, the short import record an import library has for each export
+// of the DLL. Followed by the NUL-terminated symbol and DLL names, sizeOfData bytes in all.
+struct ImportObjectHeader
+{
+    std::uint16_t sig1; // 0 (IMAGE_FILE_MACHINE_UNKNOWN)
+    std::uint16_t sig2; // 0xFFFF
+    std::uint16_t version;
+    std::uint16_t machine;
+    std::uint32_t timeDateStamp;
+    std::uint32_t sizeOfData;
+    std::uint16_t ordinalOrHint;
+    std::uint16_t typeInfo; // Type in bits 0-1, name type in bits 2-4
+};
+
+// AKA ANON_OBJECT_HEADER_BIGOBJ, the header of objects built with /bigobj, in place of the
+// ImageFileHeader. The section table follows it, and the symbols are ImageSymbolEx.
+struct AnonObjectHeaderBigObj
+{
+    std::uint16_t sig1;        // 0 (IMAGE_FILE_MACHINE_UNKNOWN)
+    std::uint16_t sig2;        // 0xFFFF
+    std::uint16_t version;     // 2
+    std::uint16_t machine;
+    std::uint32_t timeDateStamp;
+    std::uint8_t  classID[16]; // AnonObjectBigObjClassID
+    std::uint32_t sizeOfData;
+    std::uint32_t flags;
+    std::uint32_t metaDataSize;
+    std::uint32_t metaDataOffset;
+    std::uint32_t numberOfSections;
+    std::uint32_t pointerToSymbolTable;
+    std::uint32_t numberOfSymbols;
+};
+
+// AKA IMAGE_RELOCATION, an entry of the relocations of a section of an object.
+struct ImageRelocation
+{
+    std::uint32_t virtualAddress;   // Offset into the section (the count, in the first one, with ImageScnLnkNRelocOvfl)
+    std::uint32_t symbolTableIndex;
+    std::uint16_t type;             // IMAGE_REL_<machine>_*
+};
+
+// AKA IMAGE_SYMBOL, a record of the symbol table of an object. The string table follows
+// the last record: its size in a 32-bit value, the value included, then the long names.
+struct ImageSymbol
+{
+    char          name[8];            // NUL-padded, or 4 zero bytes and the offset of the name in the string table
+    std::uint32_t value;
+    std::int16_t  sectionNumber;      // 1-based, or ImageSymUndefined/Absolute/Debug
+    std::uint16_t type;               // 0x20 for functions
+    std::uint8_t  storageClass;       // ImageSymClass*
+    std::uint8_t  numberOfAuxSymbols; // Records of the same size that follow, for this symbol
+};
+
+// AKA IMAGE_SYMBOL_EX, the ImageSymbol of /bigobj objects, with 32-bit section numbers.
+struct ImageSymbolEx
+{
+    char          name[8];
+    std::uint32_t value;
+    std::int32_t  sectionNumber;
+    std::uint16_t type;
+    std::uint8_t  storageClass;
+    std::uint8_t  numberOfAuxSymbols;
+};
+
+#pragma pack(pop)
+
+} // namespace pe {}
+
+// The section table follows the optional header, which varies in size.
+inline const pe::ImageSectionHeader * getFirstSection(const pe::ImageNTHeader * ntheader)
+{
+    #define PE_FIELD_OFFSET(type, field) ((std::uintptr_t)&(((const type *)0)->field))
+    return reinterpret_cast<const pe::ImageSectionHeader *>(
+            reinterpret_cast<std::uintptr_t>(ntheader) +
+            PE_FIELD_OFFSET(pe::ImageNTHeader, optionalHeader) +
+            ntheader->fileHeader.sizeOfOptionalHeader);
+    #undef PE_FIELD_OFFSET
+}
+
+// PE32 and PE32+ are the layouts of the optional header read below. ROM images
+// and corrupted files have other magics, and their tables aren't read.
+inline bool isPE32Plus(const pe::ImageNTHeader * ntheader)
+{
+    return ntheader->optionalHeader.magic == pe::ImageNTOptionalHeader64Magic;
+}
+inline bool hasKnownOptionalHeader(const pe::ImageNTHeader * ntheader)
+{
+    return ntheader->optionalHeader.magic == pe::ImageNTOptionalHeader32Magic || isPE32Plus(ntheader);
+}
+
+// PE32+ widens imageBase to 64 bits, over the PE32 baseOfData. validatePE()
+// checks that the whole optional header, of either layout, is in the file.
+inline std::uint64_t getImageBase(const pe::ImageNTHeader * ntheader)
+{
+    if (isPE32Plus(ntheader))
+    {
+        return reinterpret_cast<const pe::ImageOptionalHeader64 *>(&ntheader->optionalHeader)->imageBase;
+    }
+    return ntheader->optionalHeader.imageBase;
+}
+
+// The data directories end the optional header, so PE32+ moves them 16 bytes on.
+inline std::uint32_t getNumberOfRvaAndSizes(const pe::ImageNTHeader * ntheader)
+{
+    if (isPE32Plus(ntheader))
+    {
+        return reinterpret_cast<const pe::ImageOptionalHeader64 *>(&ntheader->optionalHeader)->numberOfRvaAndSizes;
+    }
+    return ntheader->optionalHeader.numberOfRvaAndSizes;
+}
+
+// Directories past numberOfRvaAndSizes are empty.
+inline pe::ImageDataDirectory getDataDirectory(const pe::ImageNTHeader * ntheader, const int index)
+{
+    if (static_cast<std::uint32_t>(index) >= std::min(getNumberOfRvaAndSizes(ntheader), pe::ImageMaxDirectoryEntries))
+    {
+        return pe::ImageDataDirectory{ 0, 0 };
+    }
+    if (isPE32Plus(ntheader))
+    {
+        return reinterpret_cast<const pe::ImageOptionalHeader64 *>(&ntheader->optionalHeader)->dataDirectory[index];
+    }
+    return ntheader->optionalHeader.dataDirectory[index];
+}
+
+// ========================================================
+// File loading:
+// ========================================================
+
+// How the PE files are brought into memory (--loader):
+enum class FileLoader
+{
+    Read,    // Whole file read into a heap buffer (the default)
+    Mmap,    // Memory mapped, all pages faulted in up front
+    OnDemand // Memory mapped, pages faulted in as the parser touches them
+};
+
+//
+// The bytes of a whole file, read into a heap buffer or memory mapped
+// depending on the FileLoader. Mapping falls back to reading on non-POSIX
+// systems. Empty files fail to load.
+//
+class FileContents
+{
+public:
+    FileContents() = default;
+    FileContents(const FileContents &) = delete;
+    FileContents & operator = (const FileContents &) = delete;
+    FileContents(FileContents && other) noexcept;
+    FileContents & operator = (FileContents && other) noexcept;
+    ~FileContents();
+
+    // Errors are printed to 'errOut'.
+    bool load(const char * filename, FileLoader loader, std::ostream & errOut);
+    void reset();
+
+    // Contents that are not a file of their own, like an image inside a
+    // minidump: 'borrow' points at bytes the caller keeps alive for as long
+    // as this (and any PEImage opened over it) is in use; 'adopt' takes over
+    // a heap buffer. Both replace the current contents.
+    void borrow(const std::uint8_t * data, std::size_t size);
+    void adopt(std::unique_ptr<std::uint8_t[]> buffer, std::size_t size);
+
+    // 'filename' as the loader maps it (PELayout::Mapped): the headers and
+    // sections at their RVAs and zeros elsewhere, sizeOfImage bytes, like
+    // layOutImage(). On POSIX the image is a private mapping in which the
+    // whole pages of sections with page aligned file offsets and RVAs are
+    // mapped copy-on-write from the file: they are never copied, and stay
+    // shared with the page cache until written. The rest is copied, and the
+    // gaps are zero pages that cost nothing until touched. Elsewhere the
+    // whole image is copied. Fails like validatePE() and layOutImage().
+    bool loadImage(const char * filename, std::ostream & errOut);
+
+    // The contents, writable, if they are private to this object (loadImage()
+    // and adopt()), or null. Writes never reach the file.
+    std::uint8_t * writableData() { return writable_ ? const_cast<std::uint8_t *>(data_) : nullptr; }
+
+    const std::uint8_t * data() const { return data_; }
+    std::size_t size() const { return size_; }
+    bool empty() const { return data_ == nullptr; }
+
+    // Bytes of a loadImage() mapped from the file rather than copied.
+    std::size_t sharedBytes() const { return sharedBytes_; }
+
+private:
+    std::unique_ptr<std::uint8_t[]> buffer_{};
+    const std::uint8_t * data_ = nullptr;
+    std::size_t          size_ = 0;
+    std::size_t          sharedBytes_ = 0;
+    bool                 mapped_   = false;
+    bool                 writable_ = false;
+};
+
+// Loader used by PEImage, processFile() and the batch modes. Set it
+// once at startup; it is read without locking by the worker threads.
+void setFileLoader(FileLoader loader);
+FileLoader fileLoader();
+
+// "read", "mmap" or "ondemand". Returns false for anything else.
+bool parseFileLoader(const char * name, FileLoader & loader);
+
+// Where the sections are in the loaded bytes (--mapped-image):
+enum class PELayout
+{
+    File,  // As on disk, at their pointerToRawData (the default)
+    Mapped // As the Windows loader maps them, at their virtualAddress. Modules
+           // captured from a process are in this layout, and an RVA is the offset
+};
+
+// Layout PEImage::open() assumes when not given one. Like the
+// FileLoader, set once at startup and read without locking.
+void setImageLayout(PELayout layout);
+PELayout imageLayout();
+
+// ========================================================
+// Parsed PE data:
+// ========================================================
+
+enum class PETableStatus
+{
+    Ok,
+    NotFound,          // The data directory doesn't point inside any section
+    NoDataDirectories, // numberOfRvaAndSizes is zero
+    Unsupported        // The optional header is neither PE32 nor PE32+
+};
+
+enum class PEImportStatus
+{
+    Ok,
+    BadIAT,    // Both thunk RVAs are zero
+    MissingIAT // Thunk RVA not inside any section
+};
+
+struct PESectionInfo
+{
+    std::string   name{}; // Up to 8 chars, like ".text"
+    std::uint32_t virtualAddress   = 0;
+    std::uint32_t virtualSize      = 0;
+    std::uint32_t sizeOfRawData    = 0;
+    std::uint32_t pointerToRawData = 0;
+    std::uint32_t characteristics  = 0;
+};
+
+struct PEImportedSymbol
+{
+    std::string   name{};        // Mangled name. Empty if imported by ordinal.
+    std::uint16_t ordinal = 0;   // Ordinal if byOrdinal, otherwise the name hint.
+    bool          byOrdinal = false;
+};
+
+struct PEImportedModule
+{
+    std::string    dllName{};
+    PEImportStatus status = PEImportStatus::Ok;
+    std::vector<PEImportedSymbol> symbols{};
+};
+
+struct PEImportTable
+{
+    PETableStatus status = PETableStatus::NotFound;
+    std::string   sectionName{};
+    std::vector<PEImportedModule> modules{};
+    bool          incomplete = false; // Walk stopped early: entries outside the file or over the work budget.
+};
+
+struct PEExportedSymbol
+{
+    std::string   name{};        // Mangled name, or "DLL.Func" if a forwarder.
+    std::uint32_t ordinal = 0;   // Index into the functions table (not biased by ordinalBase).
+    std::uint32_t rva = 0;
+    bool          forwarder = false;
+};
+
+struct PEExportTable
+{
+    PETableStatus status = PETableStatus::NotFound;
+    std::string   sectionName{};
+    std::string   moduleName{}; // Name the PE was linked as, like "KERNEL32.dll"
+    std::uint32_t numberOfFunctions = 0;
+    std::uint32_t numberOfNames     = 0;
+    std::uint32_t ordinalBase       = 0;
+    std::vector<PEExportedSymbol> symbols{};
+    bool          incomplete = false; // Walk stopped early: entries outside the file or over the work budget.
+};
+
+struct PEInfo
+{
+    std::string   filename{};
+    std::size_t   fileSize = 0;
+
+    // From the IMAGE_FILE_HEADER:
+    std::uint16_t machine             = 0;
+    std::uint32_t timeDateStamp       = 0;
+    std::uint16_t fileCharacteristics = 0;
+
+    // From the IMAGE_OPTIONAL_HEADER:
+    std::uint16_t magic               = 0;
+    std::uint32_t addressOfEntryPoint = 0;
+    std::uint64_t imageBase           = 0; // 64 bits for PE32+
+    std::uint32_t sizeOfImage         = 0;
+    std::uint16_t subsystem           = 0;
+    std::uint16_t dllCharacteristics  = 0;
+
+    std::vector<PESectionInfo> sections{};
+    PEImportTable imports{}; // Only if parsed with ParseImports
+    PEExportTable exports{}; // Only if parsed with ParseExports
+};
+
+// Headers and sections are always parsed. The import and export
+// tables are the expensive part, so they are opt-in.
+enum PEParseFlags
+{
+    ParseHeaders = 0,
+    ParseImports = 1 << 0,
+    ParseExports = 1 << 1,
+    ParseAll     = ParseImports | ParseExports
+};
+
+// ========================================================
+// Table walking:
+// ========================================================
+
+// Every RVA in the export and import tables comes from the file itself, so
+// the walkers (the ranges below and the C API in ppe_capi.cpp) read through
+// a FileView, which refuses anything outside the file, and charge their work
+// to a WalkBudget, which is linear in the file size. Names are cut at 4096
+// chars, the MSVC limit for decorated names.
+const std::size_t MaxSymbolNameLength = 4096;
+
+class FileView final
+{
+public:
+    FileView(const void * data, const std::size_t size)
+        : base_{ static_cast<const std::uint8_t *>(data) }
+        , size_{ size }
+    { }
+
+    FileView(const FileView &) = default;
+    FileView & operator = (const FileView &) = default;
+
+    // Pointer to 'count' Ts at file 'offset', or null if they don't all fit in the file.
+    template<typename T>
+    const T * at(const std::uint64_t offset, const std::uint64_t count = 1) const
+    {
+        if (offset > size_ || count > (size_ - offset) / sizeof(T))
+        {
+            return nullptr;
+        }
+        return reinterpret_cast<const T *>(base_ + offset);
+    }
+
+    // The NUL-terminated string at 'offset', in place, and its length without
+    // the NUL, cut at the end of the file or at MaxSymbolNameLength. Empty if
+    // 'offset' is outside the file.
+    const char * string(const std::uint64_t offset, std::size_t & length) const
+    {
+        if (offset >= size_)
+        {
+            length = 0;
+            return "";
+        }
+        const char * start = reinterpret_cast<const char *>(base_ + offset);
+        const auto maxLength = static_cast<std::size_t>(std::min<std::uint64_t>(size_ - offset, MaxSymbolNameLength));
+        const void * end = std::memchr(start, '\0', maxLength);
+        length = (end != nullptr) ? static_cast<std::size_t>(static_cast<const char *>(end) - start) : maxLength;
+        return start;
+    }
+
+    // Same, assigned to 'str'. Assigning rather than returning reuses
+    // the capacity of 'str' in the walk loops.
+    void readString(const std::uint64_t offset, std::string & str) const
+    {
+        std::size_t length = 0;
+        const char * start = string(offset, length);
+        str.assign(start, length);
+    }
+
+    const std::uint8_t * data() const { return base_; }
+    std::size_t size() const { return size_; }
+
+private:
+    const std::uint8_t * base_;
+    std::size_t          size_;
+};
+
+// Units of work (table entries read, name bytes copied, section headers
+// scanned) that one walk may spend. Well-formed PEs spend a few units per
+// byte at most, since their tables and names are stored without overlap.
+class WalkBudget final
+{
+public:
+    static const std::uint64_t WorkPerByte = 16;
+    static const std::uint64_t FixedWork   = 1 << 16;
+
+    explicit WalkBudget(const std::size_t fileLength)
+        : remaining_{ static_cast<std::uint64_t>(fileLength) * WorkPerByte + FixedWork }
+    { }
+
+    // False once the budget is exhausted.
+    bool spend(const std::uint64_t units)
+    {
+        if (units > remaining_)
+        {
+            remaining_ = 0;
+            return false;
+        }
+        remaining_ -= units;
+        return true;
+    }
+
+private:
+    std::uint64_t remaining_;
+};
+
+// Checks the DOS and NT headers, printing the reason to 'errOut' if they are
+// invalid. On success, the NT headers and the whole section table are inside
+// the file.
+const pe::ImageNTHeader * validatePE(const std::uint8_t * fileContents, std::size_t fileLength, std::ostream & errOut);
+
+// Section whose virtual range holds 'rva', or null.
+const pe::ImageSectionHeader * findRVASection(std::uint32_t rva, const pe::ImageNTHeader * ntHeaderPtr);
+
+// File offset of 'rva', per the section that contains it. False if no section does.
+bool offsetFromRVA(std::uint32_t rva, const pe::ImageNTHeader * ntHeaderPtr, std::uint32_t & offset);
+
+// ========================================================
+// Virtual layout and rebasing:
+// ========================================================
+
+// Copies the headers and sections of a validated PE in file layout to their
+// RVAs in 'image', as the loader does, and zeroes the rest. 'imageSize' is
+// normally optionalHeader.sizeOfImage. Fails, printing to 'errOut', if a
+// section's data is outside the file or doesn't fit in the image.
+bool layOutImage(const std::uint8_t * fileContents, std::size_t fileLength, const pe::ImageNTHeader * ntHeaderPtr,
+                 std::uint8_t * image, std::size_t imageSize, std::ostream & errOut);
+
+struct RebaseInfo
+{
+    std::uint64_t oldBase        = 0;
+    std::uint64_t newBase        = 0;
+    std::uint64_t numBlocks      = 0; // IMAGE_BASE_RELOCATION blocks
+    std::uint64_t numRelocations = 0; // Entries applied, IMAGE_REL_BASED_ABSOLUTE padding excluded
+};
+
+// Applies the base relocations of a PE in mapped layout (PE32 or PE32+) as
+// if it was loaded at 'newBase', and sets its imageBase to that. Fails,
+// printing to 'errOut', on stripped or malformed relocations, relocation
+// types of other machines than x86/x64, or a PE32 base over 4 GiB. The image
+// may be partially relocated then.
+bool rebaseImage(std::uint8_t * image, std::size_t imageSize, std::uint64_t newBase,
+                 RebaseInfo & info, std::ostream & errOut);
+
+// ========================================================
+// Archives:
+// ========================================================
+
+// A member of an archive, as located by readArchive().
+struct ArchiveMember
+{
+    std::string   name{};           // Long names resolved, without the trailing '/'
+    std::uint64_t headerOffset = 0; // Of its ImageArchiveMemberHeader
+    std::uint64_t dataOffset   = 0;
+    std::uint64_t size         = 0;
+};
+
+// A name of the archive's symbol index and the member that defines it.
+struct ArchiveSymbol
+{
+    std::uint64_t nameOffset = 0; // NUL-terminated, in the linker member
+    std::uint32_t member     = 0; // Index into Archive::members
+};
+
+enum class ArchiveIndex
+{
+    None,   // No linker member, or an empty one
+    First,  // The first linker member (big-endian, in member order), sorted by readArchive()
+    Second  // The second linker member (Microsoft), already sorted by the linker
+};
+
+// The members of an import or static library (.lib) and its symbol index.
+struct Archive
+{
+    std::vector<ArchiveMember> members{}; // In file order. The linker and long names members are left out
+    std::vector<ArchiveSymbol> symbols{}; // Sorted by name
+    ArchiveIndex               index = ArchiveIndex::None;
+    bool                       truncated = false; // A member header is malformed or runs past the end of the file
+};
+
+// Reads the member headers and the symbol index of an archive. Fails,
+// printing to 'errOut', if 'file' doesn't start with "!<arch>\n". The
+// members before a malformed header are kept, with 'truncated' set.
+bool readArchive(const FileView & file, Archive & archive, std::ostream & errOut);
+
+// Binary search of the symbol index. Returns the index into archive.members
+// of the member defining 'name', or -1 if no member does.
+long findArchiveSymbol(const FileView & file, const Archive & archive, const char * name);
+
+// The fields of a short import record (pe::ImportObjectHeader).
+struct ArchiveImport
+{
+    std::uint16_t machine       = 0;
+    std::uint32_t timeDateStamp = 0;
+    std::uint16_t ordinalOrHint = 0; // Ordinal with pe::ImportObjectOrdinal, a hint into the export names otherwise
+    int           type          = 0; // pe::ImportObjectCode/Data/Const
+    int           nameType      = 0; // pe::ImportObjectOrdinal/Name/...
+    std::string   symbol{};          // Public symbol, like "_CreateFileW@28"
+    std::string   dllName{};
+    std::string   importName{};      // Name looked up in the DLL's exports. Empty for ordinals
+};
+
+// Decodes 'member' if it is a short import record. False if it isn't or if it is cut short.
+bool readArchiveImport(const FileView & file, const ArchiveMember & member, ArchiveImport & import);
+
+// ========================================================
+// Lazy ranges:
+// ========================================================
+
+//
+// Forward ranges over the tables that decode one entry per increment, straight
+// from the file, so a caller after the first few imports or a single section
+// stops there, and none of PEImportTable/PEExportTable is built. They compose
+// with the standard algorithms like any other range.
+//
+// Decoding goes through the FileView and WalkBudget of the ImportRange or
+// ExportRange the iterators come from: on malformed tables the walk ends
+// early and incomplete() is set, telling it apart from the real end of the
+// table. The iterators point to their range, which must outlive them, and
+// the names point into the file.
+//
+
+// A name in place in the file. Not NUL-terminated.
+struct PEStringRef
+{
+    const char * data   = "";
+    std::size_t  length = 0;
+
+    std::string str() const { return std::string(data, length); }
+
+    bool operator == (const char * other) const
+    {
+        return std::strncmp(data, other, length) == 0 && other[length] == '\0';
+    }
+    bool operator != (const char * other) const { return !(*this == other); }
+};
+
+// Sub-range whose begin() decodes the first entry, so
+// one that is never iterated costs nothing.
+template<typename Iterator>
+class LazyRange final
+{
+public:
+    typedef typename Iterator::Table Table;
+
+    LazyRange() = default;
+    LazyRange(const Table * table, const std::uint64_t start)
+        : table_{ table }
+        , start_{ start }
+    { }
+
+    LazyRange(const LazyRange &) = default;
+    LazyRange & operator = (const LazyRange &) = default;
+
+    Iterator begin() const { return (table_ != nullptr) ? Iterator{ table_, start_ } : Iterator{}; }
+    Iterator end() const { return Iterator{}; }
+    bool empty() const { return begin() == end(); }
+
+private:
+    const Table * table_ = nullptr;
+    std::uint64_t start_ = 0;
+};
+
+// Iterator state shared by the ranges below. The iterators' decode() reads
+// the entry at position_, or calls finish() at the end of the table.
+template<typename TableType, typename ValueType>
+class TableIterator
+{
+public:
+    typedef TableType                 Table;
+    typedef std::forward_iterator_tag iterator_category;
+    typedef ValueType                 value_type;
+    typedef std::ptrdiff_t            difference_type;
+    typedef const ValueType *         pointer;
+    typedef const ValueType &         reference;
+
+    reference operator * () const { return current_; }
+    pointer operator -> () const { return &current_; }
+
+    // Iterators at the end have no table, wherever they came from.
+    bool operator == (const TableIterator & other) const { return table_ == other.table_ && position_ == other.position_; }
+    bool operator != (const TableIterator & other) const { return !(*this == other); }
+
+    // At the end, true if this walk was cut short (and the range
+    // is incomplete) rather than reaching the end of the table.
+    bool stoppedEarly() const { return stoppedEarly_; }
+
+protected:
+    TableIterator() = default;
+    TableIterator(const Table * table, const std::uint64_t position)
+        : table_{ table }
+        , position_{ position }
+    { }
+
+    TableIterator(const TableIterator &) = default;
+    TableIterator & operator = (const TableIterator &) = default;
+
+    // 'early' if the table was cut short, rather than properly terminated.
+    void finish(bool early);
+
+    const Table * table_        = nullptr;
+    std::uint64_t position_     = 0;
+    ValueType     current_{};
+    bool          stoppedEarly_ = false;
+};
+
+// Sections are a plain array, so the range is a pair of pointers.
+class SectionRange final
+{
+public:
+    SectionRange() = default;
+    SectionRange(const pe::ImageSectionHeader * first, const std::uint32_t count)
+        : begin_{ first }
+        , end_{ first + count }
+    { }
+
+    SectionRange(const SectionRange &) = default;
+    SectionRange & operator = (const SectionRange &) = default;
+
+    const pe::ImageSectionHeader * begin() const { return begin_; }
+    const pe::ImageSectionHeader * end() const { return end_; }
+    std::size_t size() const { return static_cast<std::size_t>(end_ - begin_); }
+
+private:
+    const pe::ImageSectionHeader * begin_ = nullptr;
+    const pe::ImageSectionHeader * end_   = nullptr;
+};
+
+// Imports (import descriptors, then the thunks of each):
+
+class ImportRange;
+
+struct ImportedSymbolRef
+{
+    PEStringRef   name{};        // Empty if imported by ordinal.
+    std::uint16_t ordinal = 0;   // Ordinal if byOrdinal, otherwise the name hint.
+    bool          byOrdinal = false;
+};
+
+class ImportThunkIterator final
+    : public TableIterator<ImportRange, ImportedSymbolRef>
+{
+public:
+    ImportThunkIterator() = default; // End
+    ImportThunkIterator(const ImportRange * range, std::uint64_t thunkOffset);
+
+    ImportThunkIterator & operator ++ () { advance(); return *this; }
+    ImportThunkIterator operator ++ (int) { ImportThunkIterator it{ *this }; advance(); return it; }
+
+private:
+    void advance();
+    void decode();
+};
+
+struct ImportedDllRef
+{
+    PEStringRef    dllName{};
+    PEImportStatus status = PEImportStatus::Ok;
+    LazyRange<ImportThunkIterator> symbols{}; // Empty unless status is Ok
+};
+
+class ImportDllIterator final
+    : public TableIterator<ImportRange, ImportedDllRef>
+{
+public:
+    ImportDllIterator() = default; // End
+    ImportDllIterator(const ImportRange * range, std::uint64_t descriptorOffset);
+
+    ImportDllIterator & operator ++ () { advance(); return *this; }
+    ImportDllIterator operator ++ (int) { ImportDllIterator it{ *this }; advance(); return it; }
+
+private:
+    void advance();
+    void decode();
+};
+
+class ImportRange final
+{
+public:
+    // 'fileData' holds the whole file, 'ntHeaderPtr' validated by validatePE() (or null).
+    ImportRange(const std::uint8_t * fileData, std::size_t fileLength, const pe::ImageNTHeader * ntHeaderPtr,
+                PELayout layout = PELayout::File);
+
+    ImportRange(const ImportRange &) = default;
+    ImportRange & operator = (const ImportRange &) = default;
+
+    PETableStatus status() const { return status_; }
+    // Holding the table. Null if NotFound, or in a mapped image if no section does.
+    const pe::ImageSectionHeader * section() const { return section_; }
+
+    ImportDllIterator begin() const { return (status_ == PETableStatus::Ok) ? ImportDllIterator{ this, firstDescriptor_ } : ImportDllIterator{}; }
+    ImportDllIterator end() const { return ImportDllIterator{}; }
+
+    // Set once a walk ended early. Stays set.
+    bool incomplete() const { return incomplete_; }
+
+private:
+    friend class ImportDllIterator;
+    friend class ImportThunkIterator;
+    friend class TableIterator<ImportRange, ImportedDllRef>;
+    friend class TableIterator<ImportRange, ImportedSymbolRef>;
+
+    // File offset of an RVA the table points to. No lookup in a mapped image.
+    bool offsetOf(const std::uint32_t rva, std::uint32_t & offset) const
+    {
+        if (layout_ == PELayout::Mapped)
+        {
+            offset = rva;
+            return true;
+        }
+        return offsetFromRVA(rva, ntHeader_, offset);
+    }
+
+    FileView                       file_;
+    const pe::ImageNTHeader *      ntHeader_;
+    PELayout                       layout_;
+    const pe::ImageSectionHeader * section_ = nullptr;
+    PETableStatus                  status_  = PETableStatus::NotFound;
+    std::uint32_t                  delta_   = 0; // RVA minus file offset in the section
+    std::uint64_t                  firstDescriptor_ = 0;
+    std::uint64_t                  lookupCost_      = 0; // Each offsetFromRVA() scans the section table
+    bool                           pe32Plus_        = false; // 64-bit thunks
+    mutable WalkBudget             budget_;
+    mutable bool                   incomplete_ = false;
+};
+
+// Exports (by ordinal, or by name):
+
+class ExportRange;
+
+struct ExportedFunctionRef
+{
+    std::uint32_t ordinal = 0;   // Index into the functions table (not biased by ordinalBase).
+    std::uint32_t rva = 0;
+    bool          forwarder = false;
+    PEStringRef   forwarderName{}; // "DLL.Func", if a forwarder.
+};
+
+struct ExportedNameRef
+{
+    PEStringRef   name{};        // Mangled name.
+    std::uint32_t ordinal = 0;   // Index into the functions table.
+};
+
+// Functions in ordinal order, skipping the gaps.
+class ExportFunctionIterator final
+    : public TableIterator<ExportRange, ExportedFunctionRef>
+{
+public:
+    ExportFunctionIterator() = default; // End
+    ExportFunctionIterator(const ExportRange * range, std::uint64_t index);
+
+    ExportFunctionIterator & operator ++ () { advance(); return *this; }
+    ExportFunctionIterator operator ++ (int) { ExportFunctionIterator it{ *this }; advance(); return it; }
+
+private:
+    void advance();
+    void decode();
+};
+
+// Names in the order of the name table, which is sorted for binary search.
+class ExportNameIterator final
+    : public TableIterator<ExportRange, ExportedNameRef>
+{
+public:
+    ExportNameIterator() = default; // End
+    ExportNameIterator(const ExportRange * range, std::uint64_t index);
+
+    ExportNameIterator & operator ++ () { advance(); return *this; }
+    ExportNameIterator operator ++ (int) { ExportNameIterator it{ *this }; advance(); return it; }
+
+private:
+    void advance();
+    void decode();
+};
+
+class ExportRange final
+{
+public:
+    // 'fileData' holds the whole file, 'ntHeaderPtr' validated by validatePE() (or null).
+    ExportRange(const std::uint8_t * fileData, std::size_t fileLength, const pe::ImageNTHeader * ntHeaderPtr,
+                PELayout layout = PELayout::File);
+
+    ExportRange(const ExportRange &) = default;
+    ExportRange & operator = (const ExportRange &) = default;
+
+    PETableStatus status() const { return status_; }
+    // Holding the table. Null if NotFound, or in a mapped image if no section does.
+    const pe::ImageSectionHeader * section() const { return section_; }
+
+    // From the export directory.
+    PEStringRef   moduleName()        const { return moduleName_; }
+    std::uint32_t numberOfFunctions() const { return numberOfFunctions_; }
+    std::uint32_t numberOfNames()     const { return numberOfNames_; }
+    std::uint32_t ordinalBase()       const { return ordinalBase_; }
+
+    // Lengths of the arrays behind the ranges below: the counts
+    // above, or zero for an array that doesn't fit in the file.
+    std::uint32_t functionCount() const { return numFunctions_; }
+    std::uint32_t nameCount()     const { return numNames_; }
+
+    LazyRange<ExportFunctionIterator> functions() const { return LazyRange<ExportFunctionIterator>{ this, 0 }; }
+    LazyRange<ExportNameIterator> names() const { return LazyRange<ExportNameIterator>{ this, 0 }; }
+
+    // Set if the arrays don't fit in the file, or once a walk ended early. Stays set.
+    bool incomplete() const { return incomplete_; }
+
+private:
+    friend class ExportFunctionIterator;
+    friend class ExportNameIterator;
+    friend class TableIterator<ExportRange, ExportedFunctionRef>;
+    friend class TableIterator<ExportRange, ExportedNameRef>;
+
+    FileView                       file_;
+    const pe::ImageSectionHeader * section_   = nullptr;
+    PETableStatus                  status_    = PETableStatus::NotFound;
+    std::uint32_t                  delta_     = 0; // RVA minus file offset in the section
+    std::uint32_t                  startRVA_  = 0; // Forwarders point inside the directory
+    std::uint32_t                  endRVA_    = 0;
+    const std::uint32_t *          functions_ = nullptr;
+    const std::uint32_t *          names_     = nullptr;
+    const std::uint16_t *          ordinals_  = nullptr;
+    std::uint32_t                  numFunctions_ = 0; // Entries of the arrays inside the file
+    std::uint32_t                  numNames_     = 0;
+    PEStringRef                    moduleName_{};
+    std::uint32_t                  numberOfFunctions_ = 0;
+    std::uint32_t                  numberOfNames_     = 0;
+    std::uint32_t                  ordinalBase_       = 0;
+    mutable WalkBudget             budget_;
+    mutable bool                   incomplete_ = false;
+};
+
+template<typename TableType, typename ValueType>
+void TableIterator<TableType, ValueType>::finish(const bool early)
+{
+    if (early)
+    {
+        table_->incomplete_ = true;
+    }
+    table_        = nullptr;
+    position_     = 0;
+    current_      = ValueType{};
+    stoppedEarly_ = early;
+}
+
+// ========================================================
+// COFF objects:
+// ========================================================
+
+// An object file (.obj) is a pe::ImageFileHeader without an optional header,
+// then the section table, then the raw data and relocations of each section
+// and the symbol table, all at file offsets. Objects built with /bigobj start
+// with a pe::AnonObjectHeaderBigObj instead. readCoffObject() reads either.
+struct CoffObject
+{
+    std::uint16_t machine         = 0;
+    std::uint32_t timeDateStamp   = 0;
+    std::uint16_t characteristics = 0;     // None in /bigobj objects
+    bool          bigObj          = false;
+    SectionRange  sections{};              // Inside the file
+    std::uint64_t symbolsOffset   = 0;
+    std::uint32_t numSymbols      = 0;     // Records, auxiliary ones included
+    std::uint32_t symbolSize      = 0;     // sizeof(pe::ImageSymbol), or of pe::ImageSymbolEx
+    std::uint64_t stringsOffset   = 0;     // The string table, after the last symbol record
+    std::uint32_t stringsSize     = 0;     // Its size field included. 0 if there is none
+    bool          truncated       = false; // The symbol or string table runs past the end of the file
+};
+
+// A record of the symbol table, as decoded by readCoffSymbol().
+struct CoffSymbol
+{
+    PEStringRef   name{};            // In the record, or in the string table
+    std::uint32_t value         = 0; // Offset into the section, for most
+    std::int32_t  sectionNumber = 0; // 1-based, or pe::ImageSymUndefined/Absolute/Debug
+    std::uint16_t type          = 0;
+    std::uint8_t  storageClass  = 0;
+    std::uint8_t  numAuxSymbols = 0; // Records after this one that belong to it
+};
+
+// Reads the header of an object file and locates its tables. Fails, printing the
+// reason to 'errOut', if it isn't one: an unknown machine, an optional header or a
+// section table past the end of the file. Symbol and string tables cut short are
+// kept up to the end of the file, with 'truncated' set.
+bool readCoffObject(const FileView & file, CoffObject & object, std::ostream & errOut);
+
+// Decodes the symbol record at 'index'. False if it is past the end of the table.
+bool readCoffSymbol(const FileView & file, const CoffObject & object, std::uint32_t index, CoffSymbol & symbol);
+
+// Name of a section of the object. Names longer than 8 chars are "/<offset>"
+// (or "//<base64 offset>") into the string table, and are looked up there.
+PEStringRef coffSectionName(const FileView & file, const CoffObject & object, const pe::ImageSectionHeader & section);
+
+// The relocations of a section of the object, in place, and their number in 'count'. Null if
+// there are none, or if they run past the end of the file, with 'count' still the declared one.
+// With pe::ImageScnLnkNRelocOvfl, the first relocation holds the count and is skipped.
+const pe::ImageRelocation * coffRelocations(const FileView & file, const pe::ImageSectionHeader & section, std::uint32_t & count);
+
+// ========================================================
+// Visitor:
+// ========================================================
+
+// One entry of the export listing: a function under one of its
+// names, or under its forwarder string, like PEExportedSymbol.
+struct ExportedSymbolRef
+{
+    PEStringRef   name{};
+    std::uint32_t ordinal   = 0;
+    std::uint32_t rva       = 0;
+    bool          forwarder = false;
+};
+
+//
+// Streaming alternative to PEInfo: PEImage::visit() calls back for each
+// section and table entry as the ranges above decode it, in the order of
+// the dumps, and builds no tables, so a sink with its own format or that
+// only counts pays for just the walk. Override the callbacks of interest;
+// the others do nothing. The references are only valid during the call.
+//
+class PEVisitor
+{
+public:
+    virtual ~PEVisitor();
+
+    virtual void onSection(const pe::ImageSectionHeader & /* section */) { }
+
+    virtual void onImportDll(const ImportedDllRef & /* dll */) { }
+    virtual void onImportSymbol(const ImportedDllRef & /* dll */, const ImportedSymbolRef & /* symbol */) { }
+    virtual void onImportsEnd(PETableStatus /* status */, bool /* incomplete */) { }
+
+    // Exports come by ordinal, the names of each function in name table order.
+    virtual void onExport(const ExportedSymbolRef & /* symbol */) { }
+    virtual void onExportsEnd(PETableStatus /* status */, bool /* incomplete */) { }
+};
+
+// ========================================================
+// PEImage:
+// ========================================================
+
+//
+// A PE loaded in memory and validated. Opening it parses the headers and the
+// section table; the import and export tables are parsed the first time they
+// are asked for, so callers that may not need them don't pay for them.
+// The raw headers stay available for callers that need every field.
+//
+class PEImage
+{
+public:
+    PEImage() = default;
+    PEImage(const PEImage &) = delete;
+    PEImage & operator = (const PEImage &) = delete;
+    PEImage(PEImage &&) = default;
+    PEImage & operator = (PEImage &&) = default;
+
+    // Loads 'filename' with the current FileLoader and opens it in the current
+    // image layout. Errors are printed to 'errOut'.
+    bool load(const char * filename, std::ostream & errOut);
+
+    // Loads 'filename' laid out as the loader maps it (FileContents::loadImage())
+    // and opens it in PELayout::Mapped, so that an RVA is an offset into contents().
+    bool loadImage(const char * filename, std::ostream & errOut);
+
+    // Takes over contents loaded by the caller. 'name' is only recorded in the info.
+    bool open(FileContents && contents, const char * name, std::ostream & errOut, PELayout layout = imageLayout());
+
+    // Headers, sections and the tables parsed so far.
+    const PEInfo & info() const { return info_; }
+
+    const PEImportTable & imports();
+    const PEExportTable & exports();
+
+    // Lazy alternatives to the above, decoding the entries as they are iterated.
+    ImportRange importRange() const;
+    ExportRange exportRange() const;
+    SectionRange sectionRange() const;
+
+    // Sections, then the tables selected by 'flags', streamed to 'visitor'.
+    void visit(PEVisitor & visitor, PEParseFlags flags = ParseAll) const;
+
+    // The headers as found in the file. Null if nothing is open.
+    const pe::ImageDOSHeader * dosHeader() const;
+    const pe::ImageNTHeader * ntHeader() const { return ntHeader_; }
+    const pe::ImageSectionHeader * sectionHeaders() const;
+
+    const FileContents & contents() const { return contents_; }
+    PELayout layout() const { return layout_; }
+
+    // Moves the parsed data out and unloads the file.
+    PEInfo releaseInfo();
+
+private:
+    FileContents              contents_{};
+    const pe::ImageNTHeader * ntHeader_ = nullptr;
+    PELayout                  layout_   = PELayout::File;
+    PEInfo                    info_{};
+    bool                      importsParsed_ = false;
+    bool                      exportsParsed_ = false;
+};
+
+// Loads and validates a PE, filling 'info'. Errors are printed to 'errOut'.
+bool parsePEFile(const char * filename, unsigned parseFlags, PEInfo & info, std::ostream & errOut);
+
+// Only checks for the 'MZ' signature, without loading the whole file.
+bool looksLikePE(const char * filename);
+
+// Only checks the first bytes for the header of an object file: a known machine
+// and no optional header, or the /bigobj header. 'MZ' files are not objects.
+bool looksLikeCoffObject(const char * filename);
+
+#endif // PE_IMAGE_HPP
@@ -0,0 +1,483 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: pe_summary.cpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: Writer and memory mapped reader of the binary corpus summaries (see pe_summary.hpp).
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "portable_pe_dump.hpp"
+#include "pe_summary.hpp"
+
+#ifdef PPEDUMP_POSIX
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif // PPEDUMP_POSIX
+
+// The tables are read in place, so the record layouts are part of the file format.
+static_assert(sizeof(PESummaryHeader)  == 120, "PESummaryHeader layout changed; bump PESummaryVersion");
+static_assert(sizeof(PESummaryFile)    == 72,  "PESummaryFile layout changed; bump PESummaryVersion");
+static_assert(sizeof(PESummarySection) == 24,  "PESummarySection layout changed; bump PESummaryVersion");
+static_assert(sizeof(PESummaryModule)  == 16,  "PESummaryModule layout changed; bump PESummaryVersion");
+static_assert(sizeof(PESummaryImport)  == 8,   "PESummaryImport layout changed; bump PESummaryVersion");
+static_assert(sizeof(PESummaryExport)  == 16,  "PESummaryExport layout changed; bump PESummaryVersion");
+
+static const char SummaryFileMagic[8] = { 'P', 'P', 'E', 'S', 'U', 'M', '\0', '\0' };
+
+// ========================================================
+// PESummaryWriter
+// ========================================================
+
+std::uint32_t PESummaryWriter::intern(const std::string & str)
+{
+    auto iter = internedStrings_.find(str);
+    if (iter != internedStrings_.end())
+    {
+        return iter->second;
+    }
+
+    const auto offset = static_cast<std::uint32_t>(strings_.size());
+    strings_.append(str.c_str(), str.size() + 1); // Keep the NUL
+    internedStrings_.emplace(str, offset);
+    return offset;
+}
+
+void PESummaryWriter::addFile(const PEInfo & info)
+{
+    PESummaryFile file{};
+    file.path                = intern(info.filename);
+    file.exportedModuleName  = intern(info.exports.moduleName);
+    file.fileSize            = info.fileSize;
+    file.machine             = info.machine;
+    file.fileCharacteristics = info.fileCharacteristics;
+    file.timeDateStamp       = info.timeDateStamp;
+    file.magic               = info.magic;
+    file.subsystem           = info.subsystem;
+    file.dllCharacteristics  = info.dllCharacteristics;
+    file.addressOfEntryPoint = info.addressOfEntryPoint;
+    file.imageBase           = info.imageBase;
+    file.sizeOfImage         = info.sizeOfImage;
+
+    file.firstSection = static_cast<std::uint32_t>(sections_.size());
+    file.numSections  = static_cast<std::uint32_t>(info.sections.size());
+    for (const auto & section : info.sections)
+    {
+        PESummarySection rec{};
+        rec.name             = intern(section.name);
+        rec.virtualAddress   = section.virtualAddress;
+        rec.virtualSize      = section.virtualSize;
+        rec.sizeOfRawData    = section.sizeOfRawData;
+        rec.pointerToRawData = section.pointerToRawData;
+        rec.characteristics  = section.characteristics;
+        sections_.push_back(rec);
+    }
+
+    file.firstModule = static_cast<std::uint32_t>(modules_.size());
+    file.numModules  = static_cast<std::uint32_t>(info.imports.modules.size());
+    for (const auto & module : info.imports.modules)
+    {
+        PESummaryModule rec{};
+        rec.dllName     = intern(module.dllName);
+        rec.status      = static_cast<std::uint32_t>(module.status);
+        rec.firstImport = static_cast<std::uint32_t>(imports_.size());
+        rec.numImports  = static_cast<std::uint32_t>(module.symbols.size());
+        modules_.push_back(rec);
+
+        for (const auto & symbol : module.symbols)
+        {
+            PESummaryImport imp{};
+            imp.name      = intern(symbol.name);
+            imp.ordinal   = symbol.ordinal;
+            imp.byOrdinal = symbol.byOrdinal;
+            imports_.push_back(imp);
+        }
+    }
+
+    file.firstExport = static_cast<std::uint32_t>(exports_.size());
+    file.numExports  = static_cast<std::uint32_t>(info.exports.symbols.size());
+    for (const auto & symbol : info.exports.symbols)
+    {
+        PESummaryExport rec{};
+        rec.name      = intern(symbol.name);
+        rec.ordinal   = symbol.ordinal;
+        rec.rva       = symbol.rva;
+        rec.forwarder = symbol.forwarder;
+        exports_.push_back(rec);
+    }
+
+    files_.push_back(file);
+}
+
+void PESummaryWriter::append(const PESummaryWriter & other)
+{
+    // Rebase the record indexes and re-intern the strings of 'other'.
+    const auto sectionBase = static_cast<std::uint32_t>(sections_.size());
+    const auto moduleBase  = static_cast<std::uint32_t>(modules_.size());
+    const auto importBase  = static_cast<std::uint32_t>(imports_.size());
+    const auto exportBase  = static_cast<std::uint32_t>(exports_.size());
+
+    auto reintern = [this, &other](const std::uint32_t offset)
+    {
+        return intern(other.strings_.c_str() + offset);
+    };
+
+    for (PESummaryFile file : other.files_)
+    {
+        file.path               = reintern(file.path);
+        file.exportedModuleName = reintern(file.exportedModuleName);
+        file.firstSection      += sectionBase;
+        file.firstModule       += moduleBase;
+        file.firstExport       += exportBase;
+        files_.push_back(file);
+    }
+    for (PESummarySection section : other.sections_)
+    {
+        section.name = reintern(section.name);
+        sections_.push_back(section);
+    }
+    for (PESummaryModule module : other.modules_)
+    {
+        module.dllName      = reintern(module.dllName);
+        module.firstImport += importBase;
+        modules_.push_back(module);
+    }
+    for (PESummaryImport imp : other.imports_)
+    {
+        imp.name = reintern(imp.name);
+        imports_.push_back(imp);
+    }
+    for (PESummaryExport exp : other.exports_)
+    {
+        exp.name = reintern(exp.name);
+        exports_.push_back(exp);
+    }
+}
+
+bool PESummaryWriter::write(const char * filename, std::ostream & errOut) const
+{
+    if (strings_.size() > UINT32_MAX)
+    {
+        errOut << "Too many strings for a summary file (" << strings_.size() << " bytes)!\n";
+        return false;
+    }
+
+    auto align8 = [](const std::uint64_t offset) { return (offset + 7) & ~std::uint64_t{ 7 }; };
+
+    PESummaryHeader header{};
+    std::memcpy(header.magic, SummaryFileMagic, sizeof(header.magic));
+    header.version        = PESummaryVersion;
+    header.headerSize     = sizeof(PESummaryHeader);
+    header.numFiles       = files_.size();
+    header.numSections    = sections_.size();
+    header.numModules     = modules_.size();
+    header.numImports     = imports_.size();
+    header.numExports     = exports_.size();
+    header.filesOffset    = sizeof(PESummaryHeader);
+    header.sectionsOffset = header.filesOffset    + files_.size()    * sizeof(PESummaryFile);
+    header.modulesOffset  = header.sectionsOffset + sections_.size() * sizeof(PESummarySection);
+    header.importsOffset  = header.modulesOffset  + modules_.size()  * sizeof(PESummaryModule);
+    header.exportsOffset  = header.importsOffset  + imports_.size()  * sizeof(PESummaryImport);
+    header.stringsOffset  = header.exportsOffset  + exports_.size()  * sizeof(PESummaryExport);
+    header.stringsSize    = strings_.size();
+    header.totalSize      = align8(header.stringsOffset + header.stringsSize);
+
+    std::ofstream out{ filename, std::ios::binary };
+    auto writeTable = [&out](const void * data, const std::size_t bytes)
+    {
+        out.write(static_cast<const char *>(data), static_cast<std::streamsize>(bytes));
+    };
+
+    writeTable(&header, sizeof(header));
+    writeTable(files_.data(),    files_.size()    * sizeof(PESummaryFile));
+    writeTable(sections_.data(), sections_.size() * sizeof(PESummarySection));
+    writeTable(modules_.data(),  modules_.size()  * sizeof(PESummaryModule));
+    writeTable(imports_.data(),  imports_.size()  * sizeof(PESummaryImport));
+    writeTable(exports_.data(),  exports_.size()  * sizeof(PESummaryExport));
+    writeTable(strings_.data(),  strings_.size());
+
+    const char padding[8] = {};
+    writeTable(padding, header.totalSize - (header.stringsOffset + header.stringsSize));
+
+    if (!out)
+    {
+        errOut << "Unable to write summary file \"" << filename << "\"!\n";
+        return false;
+    }
+    return true;
+}
+
+// ========================================================
+// PESummaryReader
+// ========================================================
+
+PESummaryReader::~PESummaryReader()
+{
+    close();
+}
+
+bool PESummaryReader::open(const char * filename, std::ostream & errOut)
+{
+    close();
+
+#ifdef PPEDUMP_POSIX
+    const int fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) != 0)
+    {
+        errOut << "Unable to open summary file \"" << filename << "\": " << std::strerror(errno) << "\n";
+        if (fd >= 0) { ::close(fd); }
+        return false;
+    }
+
+    size_ = static_cast<std::size_t>(st.st_size);
+    if (size_ != 0)
+    {
+        void * mapping = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            mapping_ = mapping;
+            data_    = static_cast<const std::uint8_t *>(mapping);
+        }
+    }
+    ::close(fd);
+#endif // PPEDUMP_POSIX
+
+    if (data_ == nullptr)
+    {
+        std::ifstream in{ filename, std::ios::binary };
+        contents_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        data_ = contents_.data();
+        size_ = contents_.size();
+    }
+
+    // Everything the accessors rely on is checked here once.
+    header_ = reinterpret_cast<const PESummaryHeader *>(data_);
+    const char * problem = nullptr;
+
+    if (size_ < sizeof(PESummaryHeader) || std::memcmp(header_->magic, SummaryFileMagic, sizeof(SummaryFileMagic)) != 0)
+    {
+        problem = "not a summary file";
+    }
+    else if (header_->version != PESummaryVersion || header_->headerSize != sizeof(PESummaryHeader))
+    {
+        problem = "unsupported version";
+    }
+    else if (header_->totalSize != size_)
+    {
+        problem = "file is truncated";
+    }
+    else
+    {
+        const struct { std::uint64_t offset, count, recordSize; } tables[] = {
+            { header_->filesOffset,    header_->numFiles,    sizeof(PESummaryFile)    },
+            { header_->sectionsOffset, header_->numSections, sizeof(PESummarySection) },
+            { header_->modulesOffset,  header_->numModules,  sizeof(PESummaryModule)  },
+            { header_->importsOffset,  header_->numImports,  sizeof(PESummaryImport)  },
+            { header_->exportsOffset,  header_->numExports,  sizeof(PESummaryExport)  },
+            { header_->stringsOffset,  header_->stringsSize, 1                        }
+        };
+        for (const auto & t : tables)
+        {
+            if ((t.offset % 8) != 0 || t.offset > size_ || t.count > (size_ - t.offset) / t.recordSize)
+            {
+                problem = "table out of bounds";
+                break;
+            }
+        }
+        if (problem == nullptr && header_->stringsSize != 0 && data_[header_->stringsOffset + header_->stringsSize - 1] != '\0')
+        {
+            problem = "unterminated string table";
+        }
+    }
+
+    if (problem != nullptr)
+    {
+        errOut << "Invalid summary file \"" << filename << "\": " << problem << ".\n";
+        close();
+        return false;
+    }
+    return true;
+}
+
+void PESummaryReader::close()
+{
+#ifdef PPEDUMP_POSIX
+    if (mapping_ != nullptr)
+    {
+        ::munmap(mapping_, size_);
+    }
+#endif // PPEDUMP_POSIX
+
+    mapping_ = nullptr;
+    data_    = nullptr;
+    header_  = nullptr;
+    size_    = 0;
+    contents_.clear();
+}
+
+template<class T>
+PESummaryReader::Range<T> PESummaryReader::table(const std::uint64_t offset, const std::uint64_t tableSize,
+                                                 const std::uint64_t first, const std::uint64_t count) const
+{
+    if (data_ == nullptr || first > tableSize || count > tableSize - first)
+    {
+        return { nullptr, 0 };
+    }
+    return { reinterpret_cast<const T *>(data_ + offset) + first, static_cast<std::size_t>(count) };
+}
+
+PESummaryReader::Range<PESummaryFile> PESummaryReader::files() const
+{
+    return (header_ != nullptr) ? table<PESummaryFile>(header_->filesOffset, header_->numFiles, 0, header_->numFiles)
+                                : Range<PESummaryFile>{ nullptr, 0 };
+}
+
+PESummaryReader::Range<PESummarySection> PESummaryReader::sections(const PESummaryFile & file) const
+{
+    return table<PESummarySection>(header_->sectionsOffset, header_->numSections, file.firstSection, file.numSections);
+}
+
+PESummaryReader::Range<PESummaryModule> PESummaryReader::modules(const PESummaryFile & file) const
+{
+    return table<PESummaryModule>(header_->modulesOffset, header_->numModules, file.firstModule, file.numModules);
+}
+
+PESummaryReader::Range<PESummaryImport> PESummaryReader::imports(const PESummaryModule & module) const
+{
+    return table<PESummaryImport>(header_->importsOffset, header_->numImports, module.firstImport, module.numImports);
+}
+
+PESummaryReader::Range<PESummaryExport> PESummaryReader::exports(const PESummaryFile & file) const
+{
+    return table<PESummaryExport>(header_->exportsOffset, header_->numExports, file.firstExport, file.numExports);
+}
+
+const char * PESummaryReader::string(const std::uint32_t offset) const
+{
+    // The blob ends with a NUL (checked by open), so any offset inside it is a valid string.
+    if (header_ == nullptr || offset >= header_->stringsSize)
+    {
+        return "";
+    }
+    return reinterpret_cast<const char *>(data_ + header_->stringsOffset + offset);
+}
+
+// ========================================================
+// Command line front-end
+// ========================================================
+
+namespace
+{
+
+int writeSummary(const ProgramFlags & prog)
+{
+    std::vector<std::string> files;
+    expandInputPaths(prog.inputPaths, files);
+    if (files.empty())
+    {
+        std::cerr << "No input files for --summary-out!\n";
+        return EXIT_FAILURE;
+    }
+
+    const unsigned numWorkers = batchWorkerCount(prog.numWorkers, files.size());
+    std::vector<std::unique_ptr<PESummaryWriter>> writers;
+    std::vector<std::size_t> failures(numWorkers, 0);
+    for (unsigned w = 0; w < numWorkers; ++w)
+    {
+        writers.emplace_back(new PESummaryWriter{});
+    }
+
+    parallelForEach(files.size(), numWorkers,
+        [&files, &writers, &failures](const std::size_t i, const unsigned w)
+        {
+            PEInfo info;
+            std::ostringstream ignoredErrors;
+            if (parsePEFile(files[i].c_str(), ParseAll, info, ignoredErrors))
+            {
+                writers[w]->addFile(info);
+            }
+            else
+            {
+                ++failures[w];
+            }
+        });
+
+    std::size_t totalFailures = failures[0];
+    for (unsigned w = 1; w < numWorkers; ++w)
+    {
+        writers[0]->append(*writers[w]);
+        totalFailures += failures[w];
+    }
+
+    if (!writers[0]->write(prog.summaryOutput.c_str(), std::cerr))
+    {
+        return EXIT_FAILURE;
+    }
+
+    std::cerr << "Summarized " << (files.size() - totalFailures) << " files ("
+              << totalFailures << " failed to parse).\n";
+    return EXIT_SUCCESS;
+}
+
+int printSummary(const ProgramFlags & prog)
+{
+    PESummaryReader reader;
+    if (!reader.open(prog.summaryInput.c_str(), std::cerr))
+    {
+        return EXIT_FAILURE;
+    }
+
+    for (const PESummaryFile & file : reader.files())
+    {
+        std::size_t numImports = 0;
+        for (const PESummaryModule & module : reader.modules(file))
+        {
+            numImports += module.numImports;
+        }
+
+        std::cout << reader.string(file.path) << "\t"
+                  << fileHeaderMachine(file.machine) << "\t"
+                  << optionalHeaderSubsystem(file.subsystem) << "\t"
+                  << "sections=" << file.numSections << "\t"
+                  << "dlls="     << file.numModules  << "\t"
+                  << "imports="  << numImports       << "\t"
+                  << "exports="  << file.numExports  << "\n";
+    }
+    return EXIT_SUCCESS;
+}
+
+} // namespace {}
+
+int runSummary(const ProgramFlags & prog)
+{
+    if (!prog.summaryOutput.empty())
+    {
+        return writeSummary(prog);
+    }
+    return printSummary(prog);
+}
@@ -0,0 +1,226 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: pe_summary.hpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: Compact binary summary of a PE corpus, readable in place from a memory mapped file.
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#ifndef PE_SUMMARY_HPP
+#define PE_SUMMARY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+-------------------------------------
+Summary file layout
+-------------------------------------
+
+  PESummaryHeader
+  PESummaryFile    [numFiles]
+  PESummarySection [numSections]
+  PESummaryModule  [numModules]
+  PESummaryImport  [numImports]
+  PESummaryExport  [numExports]
+  string blob (NUL terminated strings, each stored once)
+
+Every table starts at an 8-byte aligned offset from the start of the
+file, and all the records are plain structs of fixed size, so the file
+can be mapped into memory and used as it is. Records refer to each other
+by index (PESummaryFile::firstSection, ...) and to strings by offset into
+the blob, never by pointer. Integers are in the native byte order of the
+machine that wrote the file.
+
+The version is bumped whenever a record changes; readers refuse files of
+other versions rather than misreading them.
+
+-------------------------------------
+*/
+
+static const std::uint32_t PESummaryVersion = 2;
+
+struct PESummaryHeader
+{
+    char          magic[8];      // "PPESUM\0\0"
+    std::uint32_t version;       // PESummaryVersion
+    std::uint32_t headerSize;    // sizeof(PESummaryHeader)
+    std::uint64_t totalSize;     // Size of the whole file, in bytes
+    std::uint64_t numFiles;
+    std::uint64_t numSections;
+    std::uint64_t numModules;
+    std::uint64_t numImports;
+    std::uint64_t numExports;
+    std::uint64_t filesOffset;   // Offsets from the start of the file
+    std::uint64_t sectionsOffset;
+    std::uint64_t modulesOffset;
+    std::uint64_t importsOffset;
+    std::uint64_t exportsOffset;
+    std::uint64_t stringsOffset;
+    std::uint64_t stringsSize;
+};
+
+struct PESummaryFile
+{
+    std::uint32_t path;          // String offset
+    std::uint32_t exportedModuleName; // String offset, "" if no exports
+    std::uint64_t fileSize;
+
+    std::uint16_t machine;
+    std::uint16_t fileCharacteristics;
+    std::uint32_t timeDateStamp;
+
+    std::uint16_t magic;
+    std::uint16_t subsystem;
+    std::uint16_t dllCharacteristics;
+    std::uint16_t reserved1;
+
+    std::uint32_t addressOfEntryPoint;
+    std::uint32_t sizeOfImage;
+    std::uint64_t imageBase;     // 64 bits for PE32+
+
+    std::uint32_t firstSection, numSections;
+    std::uint32_t firstModule,  numModules;
+    std::uint32_t firstExport,  numExports;
+};
+
+struct PESummarySection
+{
+    std::uint32_t name;          // String offset
+    std::uint32_t virtualAddress;
+    std::uint32_t virtualSize;
+    std::uint32_t sizeOfRawData;
+    std::uint32_t pointerToRawData;
+    std::uint32_t characteristics;
+};
+
+struct PESummaryModule
+{
+    std::uint32_t dllName;       // String offset
+    std::uint32_t status;        // PEImportStatus
+    std::uint32_t firstImport, numImports;
+};
+
+struct PESummaryImport
+{
+    std::uint32_t name;          // String offset, "" if imported by ordinal
+    std::uint16_t ordinal;       // Ordinal if byOrdinal, otherwise the name hint
+    std::uint16_t byOrdinal;
+};
+
+struct PESummaryExport
+{
+    std::uint32_t name;          // String offset; "DLL.Func" if a forwarder
+    std::uint32_t ordinal;       // Not biased by the ordinal base
+    std::uint32_t rva;
+    std::uint32_t forwarder;
+};
+
+// ========================================================
+// PESummaryReader
+// ========================================================
+
+//
+// Read-only view of a summary file. open() maps the file (reads it
+// into memory on systems without mmap) and checks the header and the
+// table bounds; nothing is deserialized. Accessors that follow an index
+// from one record to another return empty ranges if the index is out of
+// bounds, so a corrupted file can't make them read outside of it.
+//
+class PESummaryReader
+{
+public:
+    template<class T>
+    struct Range
+    {
+        const T * first;
+        std::size_t count;
+
+        const T * begin() const { return first; }
+        const T * end()   const { return first + count; }
+        std::size_t size() const { return count; }
+        const T & operator[](std::size_t i) const { return first[i]; }
+    };
+
+    PESummaryReader() = default;
+    ~PESummaryReader();
+
+    PESummaryReader(const PESummaryReader &) = delete;
+    PESummaryReader & operator = (const PESummaryReader &) = delete;
+
+    // Errors are printed to 'errOut'.
+    bool open(const char * filename, std::ostream & errOut);
+    void close();
+
+    Range<PESummaryFile>    files() const;
+    Range<PESummarySection> sections(const PESummaryFile & file) const;
+    Range<PESummaryModule>  modules(const PESummaryFile & file) const;
+    Range<PESummaryImport>  imports(const PESummaryModule & module) const;
+    Range<PESummaryExport>  exports(const PESummaryFile & file) const;
+
+    // Returns "" for invalid offsets.
+    const char * string(std::uint32_t offset) const;
+
+private:
+    template<class T>
+    Range<T> table(std::uint64_t offset, std::uint64_t tableSize, std::uint64_t first, std::uint64_t count) const;
+
+    const std::uint8_t *      data_     = nullptr;
+    std::size_t               size_     = 0;
+    const PESummaryHeader *   header_   = nullptr;
+    void *                    mapping_  = nullptr; // Non-null if data_ is mmapped
+    std::vector<std::uint8_t> contents_ {};        // Used when mmap is not available
+};
+
+struct PEInfo;
+
+// ========================================================
+// PESummaryWriter
+// ========================================================
+
+//
+// Accumulates the summaries of parsed files and writes them out as one
+// summary file. Strings are interned, so names shared by many files
+// (DLL and API names, mostly) are stored once.
+//
+class PESummaryWriter
+{
+public:
+    PESummaryWriter() = default;
+
+    PESummaryWriter(const PESummaryWriter &) = delete;
+    PESummaryWriter & operator = (const PESummaryWriter &) = delete;
+
+    void addFile(const PEInfo & info);
+
+    // Appends all the files of 'other' (built by another thread, for instance).
+    void append(const PESummaryWriter & other);
+
+    bool write(const char * filename, std::ostream & errOut) const;
+
+private:
+    std::uint32_t intern(const std::string & str);
+
+    std::vector<PESummaryFile>    files_    {};
+    std::vector<PESummarySection> sections_ {};
+    std::vector<PESummaryModule>  modules_  {};
+    std::vector<PESummaryImport>  imports_  {};
+    std::vector<PESummaryExport>  exports_  {};
+    std::string                   strings_  {};
+    std::unordered_map<std::string, std::uint32_t> internedStrings_{};
+};
+
+#endif // PE_SUMMARY_HPP
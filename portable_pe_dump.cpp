@@ -23,12 +23,19 @@
 #include <ctime>
 
 #include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <iomanip>
 #include <memory>
 #include <string>
 #include <vector>
 #include <utility>
+#include <mutex>
+#include <thread>
+
+#include "portable_pe_dump.hpp"
 
 // isatty() only needed if colored text output is desired.
 #ifdef COLOR_PRINT
@@ -47,302 +54,99 @@
     #endif // Apple/Win/Linux
 #endif // COLOR_PRINT
 
-// ========================================================
-//
-// Portable Executable file structures, adapted
-// from the originals found on the Window API / WinNT.h.
-//
-// SHOUT-CASE is a real eye sore, so I've renamed them and
-// commented the original names found on MS documentation
-// at the top of each structure.
-//
-// PE references/documentation:
-// - https://msdn.microsoft.com/en-us/library/ms809762.aspx
-// - https://en.wikipedia.org/wiki/Portable_Executable
-// - http://www.sunshine2k.de/reversing/tuts/tut_rvait.htm
-//
-// Source code of the original Win32 PEDUMP by Matt Pietrek:
-// - http://www.wheaty.net/downloads.htm
-//
-// ========================================================
-namespace pe
-{
-
-static const std::uint16_t DOSSignature = 0x5A4D;     // "MZ"
-static const std::uint32_t NTSignature  = 0x00004550; // "PE\0\0"
-
-static const std::uint32_t ImageMaxSectionNameLength = 8;
-static const std::uint32_t ImageMaxDirectoryEntries  = 16;
-
-#pragma pack(push, 1)
-
-// AKA IMAGE_DATA_DIRECTORY
-struct ImageDataDirectory
-{
-    std::uint32_t virtualAddress;
-    std::uint32_t sizeInBytes;
-};
-
-// AKA IMAGE_FILE_HEADER
-struct ImageFileHeader
-{
-    std::uint16_t machine;
-    std::uint16_t numberOfSections;
-    std::uint32_t timeDateStamp;
-    std::uint32_t pointerToSymbolTable;
-    std::uint32_t numberOfSymbols;
-    std::uint16_t sizeOfOptionalHeader;
-    std::uint16_t characteristics;
-};
-
-// AKA IMAGE_OPTIONAL_HEADER
-struct ImageOptionalHeader
-{
-    // Standard fields
-    std::uint16_t magic;
-    std::uint8_t  majorLinkerVersion;
-    std::uint8_t  minorLinkerVersion;
-    std::uint32_t sizeOfCode;
-    std::uint32_t sizeOfInitializedData;
-    std::uint32_t sizeOfUninitializedData;
-    std::uint32_t addressOfEntryPoint;
-    std::uint32_t baseOfCode;
-    std::uint32_t baseOfData;
-
-    // NT additional fields
-    std::uint32_t imageBase;
-    std::uint32_t sectionAlignment;
-    std::uint32_t fileAlignment;
-    std::uint16_t majorOperatingSystemVersion;
-    std::uint16_t minorOperatingSystemVersion;
-    std::uint16_t majorImageVersion;
-    std::uint16_t minorImageVersion;
-    std::uint16_t majorSubsystemVersion;
-    std::uint16_t minorSubsystemVersion;
-    std::uint32_t reserved1;
-    std::uint32_t sizeOfImage;
-    std::uint32_t sizeOfHeaders;
-    std::uint32_t checksum;
-    std::uint16_t subsystem;
-    std::uint16_t dllCharacteristics;
-    std::uint32_t sizeOfStackReserve;
-    std::uint32_t sizeOfStackCommit;
-    std::uint32_t sizeOfHeapReserve;
-    std::uint32_t sizeOfHeapCommit;
-    std::uint32_t loaderFlags;
-    std::uint32_t numberOfRvaAndSizes;
-    ImageDataDirectory dataDirectory[ImageMaxDirectoryEntries];
-};
-
-// AKA IMAGE_NT_HEADERS
-struct ImageNTHeader
-{
-    std::uint32_t       signature;
-    ImageFileHeader     fileHeader;
-    ImageOptionalHeader optionalHeader;
-};
-
-// AKA IMAGE_SECTION_HEADER
-struct ImageSectionHeader
-{
-    // Section name, like ".text"; NOT NUL-terminated!
-    char name[ImageMaxSectionNameLength];
-
-    union
-    {
-        std::uint32_t physicalAddress;
-        std::uint32_t virtualSize;
-    } misc;
-
-    std::uint32_t virtualAddress;
-    std::uint32_t sizeOfRawData;
-    std::uint32_t pointerToRawData;
-    std::uint32_t pointerToRelocations;
-    std::uint32_t pointerToLinenumbers;
-    std::uint16_t numberOfRelocations;
-    std::uint16_t numberOfLinenumbers;
-    std::uint32_t characteristics;
-};
-
-// AKA IMAGE_EXPORT_DIRECTORY
-struct ImageExportDirectory
-{
-    std::uint32_t characteristics;
-    std::uint32_t timeDateStamp;
-    std::uint16_t majorVersion;
-    std::uint16_t minorVersion;
-    std::uint32_t nameRVA; // RVA to NUL-terminated name of the PE (like "KERNEL32.DLL")
-    std::uint32_t ordinalBase;
-    std::uint32_t numberOfFunctions;
-    std::uint32_t numberOfNames;
-
-    // Relative Virtual Addresses from base of image
-    std::uint32_t addressOfFunctions;
-    std::uint32_t addressOfNames;
-    std::uint32_t addressOfNameOrdinals;
-};
-
-// AKA IMAGE_IMPORT_DESCRIPTOR
-struct ImageImportDescriptor
-{
-    std::uint32_t impByNameRVA;   // RVA to the array of ImageImportByName entries for this DLL
-    std::uint32_t timeDateStamp;  // Timestamp of the whole file repeated here
-    std::uint32_t forwarderChain; // -1 if no forwarders
-    std::uint32_t nameRVA;        // RVA to a NUL-terminated ASCII string containing the imported DLL's name.
-    std::uint32_t firstThunkRVA;  // RVA to IAT (if bound this IAT has actual addresses)
-};
-
-// AKA IMAGE_THUNK_DATA
-struct ImageThunkData
-{
-    union
-    {
-        std::uint32_t forwarderString;
-        std::uint32_t function;
-        std::uint32_t ordinal;
-        std::uint32_t addressOfData;
-    } u1;
-};
-
-// AKA IMAGE_IMPORT_BY_NAME
-struct ImageImportByName
-{
-    std::uint16_t ordinalHint;
-    char funcName[1]; // Actually reinterpreted as a NUL-terminated string.
-};
-
-// AKA IMAGE_DOS_HEADER (DOS .EXE header kept for historical reasons; no longer used)
-struct ImageDOSHeader
-{
-    std::uint16_t e_magic;    // Magic number
-    std::uint16_t e_cblp;     // Bytes on last page of file
-    std::uint16_t e_cp;       // Pages in file
-    std::uint16_t e_crlc;     // Relocations
-    std::uint16_t e_cparhdr;  // Size of header in paragraphs
-    std::uint16_t e_minalloc; // Minimum extra paragraphs needed
-    std::uint16_t e_maxalloc; // Maximum extra paragraphs needed
-    std::uint16_t e_ss;       // Initial (relative) SS value
-    std::uint16_t e_sp;       // Initial SP value
-    std::uint16_t e_csum;     // Checksum
-    std::uint16_t e_ip;       // Initial IP value
-    std::uint16_t e_cs;       // Initial (relative) CS value
-    std::uint16_t e_lfarlc;   // File address of relocation table
-    std::uint16_t e_ovno;     // Overlay number
-    std::uint16_t e_res[4];   // Reserved words
-    std::uint16_t e_oemid;    // OEM identifier (for e_oeminfo)
-    std::uint16_t e_oeminfo;  // OEM information (e_oemid specific)
-    std::uint16_t e_res2[10]; // Reserved words
-    std::uint32_t e_lfanew;   // File address of new EXE header (IMAGE_NT_HEADERS)
-};
-
-#pragma pack(pop)
-
-} // namespace pe {}
+// Directory listing for the batch modes.
+#ifdef PPEDUMP_POSIX
+    #include <dirent.h>
+    #include <sys/stat.h>
+#endif // PPEDUMP_POSIX
 
 // ========================================================
 // Colored text printing on the terminal:
 // ========================================================
 
-namespace color
-{
+// Cleared when output goes somewhere other than stdout (i.e. the server mode).
+static bool colorPrintEnabled = true;
 
-static inline bool canColorPrint()
+bool color::canColorPrint()
 {
 #ifdef COLOR_PRINT
-    return isatty(fileno(stdout));
+    return colorPrintEnabled && isatty(fileno(stdout));
 #else // !COLOR_PRINT
     return false;
 #endif // COLOR_PRINT
 }
 
-// ANSI color codes:
-static inline const char * restore() { return canColorPrint() ? "\033[0;1m"  : ""; }
-static inline const char * red()     { return canColorPrint() ? "\033[31;1m" : ""; }
-static inline const char * green()   { return canColorPrint() ? "\033[32;1m" : ""; }
-static inline const char * yellow()  { return canColorPrint() ? "\033[33;1m" : ""; }
-static inline const char * blue()    { return canColorPrint() ? "\033[34;1m" : ""; }
-static inline const char * magenta() { return canColorPrint() ? "\033[35;1m" : ""; }
-static inline const char * cyan()    { return canColorPrint() ? "\033[36;1m" : ""; }
-static inline const char * white()   { return canColorPrint() ? "\033[37;1m" : ""; }
-
-} // namespace color {}
-
-// ========================================================
-
-// Defined in cxx_demangle.cpp
-std::string demangle(const std::string & mangledName, bool baseNameOnly = true);
+void setColorPrintEnabled(const bool enabled)
+{
+    colorPrintEnabled = enabled;
+}
 
 // ========================================================
 
-static bool queryFileSize(const char * filename, std::size_t & sizeInBytes)
+static inline std::string toHexa(std::uint32_t val, int pad = 0)
 {
-    FILE * fileIn = std::fopen(filename, "rb");
-    if (fileIn == nullptr)
+    char buffer[128];
+    if (pad > 0)
     {
-        std::cerr << color::red() << "Unable to open \"" << filename
-                  << "\": " << std::strerror(errno) << color::restore() << "\n";
-        return false;
+        std::snprintf(buffer, sizeof(buffer), "0x%0*X", pad, val);
     }
-
-    // More or less portable way of getting the file size,
-    // but SEEK_END is not guaranteed to be supported everywhere.
-    // Realistically though, it is available on all mainstream platforms.
-    std::fseek(fileIn, 0, SEEK_END);
-    const long fileLength = std::ftell(fileIn);
-    if (fileLength < 0)
+    else
     {
-        std::cerr << color::red() << "Unable to get length of file \""
-                  << filename << "\"!" << color::restore() << "\n";
-        std::fclose(fileIn);
-        return false;
+        std::snprintf(buffer, sizeof(buffer), "0x%X", val);
     }
-
-    sizeInBytes = fileLength;
-    std::fclose(fileIn);
-    return true;
+    return buffer;
 }
 
-static std::unique_ptr<std::uint8_t[]> loadFile(const char * filename, std::size_t & sizeInBytes)
+std::uint64_t hashString(const std::string & str)
 {
-    std::size_t fileLength = 0;
-    if (!queryFileSize(filename, fileLength) || fileLength == 0)
-    {
-        return nullptr;
-    }
-
-    FILE * fileIn = std::fopen(filename, "rb");
-    if (fileIn == nullptr)
+    std::uint64_t hash = 0xCBF29CE484222325ull;
+    for (const char c : str)
     {
-        std::cerr << color::red() << "Unable to open \"" << filename << "\": "
-                  << std::strerror(errno) << color::restore() << "\n";
-        return nullptr;
-    }
-
-    std::unique_ptr<std::uint8_t[]> data{ new std::uint8_t[fileLength] };
-    if (std::fread(data.get(), sizeof(std::uint8_t), fileLength, fileIn) != fileLength)
-    {
-        std::cerr << color::red() << "Partial fread() in loadFile()!" << color::restore() << "\n";
-        std::fclose(fileIn);
-        return nullptr;
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001B3ull;
     }
+    return hash;
+}
 
-    sizeInBytes = fileLength;
-    std::fclose(fileIn);
-    return data;
+std::uint64_t mixHash(std::uint64_t x)
+{
+    // Finalizer of SplitMix64.
+    x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27; x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return x;
 }
 
-static inline std::string toHexa(std::uint32_t val, int pad = 0)
+std::string jsonString(const std::string & str)
 {
-    char buffer[128];
-    if (pad > 0)
+    std::string json;
+    json.reserve(str.length() + 2);
+    json += '"';
+    for (const char c : str)
     {
-        std::snprintf(buffer, sizeof(buffer), "0x%0*X", pad, val);
-    }
-    else
-    {
-        std::snprintf(buffer, sizeof(buffer), "0x%X", val);
+        switch (c)
+        {
+        case '"'  : json += "\\\""; break;
+        case '\\' : json += "\\\\"; break;
+        case '\n' : json += "\\n";  break;
+        case '\r' : json += "\\r";  break;
+        case '\t' : json += "\\t";  break;
+        default :
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char buffer[8];
+                std::snprintf(buffer, sizeof(buffer), "\\u%04X", static_cast<unsigned>(c));
+                json += buffer;
+            }
+            else
+            {
+                json += c;
+            }
+            break;
+        } // switch (c)
     }
-    return buffer;
+    json += '"';
+    return json;
 }
 
 static inline std::string sectionName(const char * name)
@@ -363,91 +167,36 @@ static inline std::string truncate(std::string str, std::size_t maxLen = 60)
     return str;
 }
 
-static inline const pe::ImageSectionHeader * getFirstSection(const pe::ImageNTHeader * ntheader)
+static void dumpExportsSection(std::ostream & out, const PEExportTable & table)
 {
-    #define PE_FIELD_OFFSET(type, field) ((std::uintptr_t)&(((const type *)0)->field))
-    return reinterpret_cast<const pe::ImageSectionHeader *>(
-            reinterpret_cast<std::uintptr_t>(ntheader) +
-            PE_FIELD_OFFSET(pe::ImageNTHeader, optionalHeader) +
-            ntheader->fileHeader.sizeOfOptionalHeader);
-    #undef PE_FIELD_OFFSET
-}
-
-static const pe::ImageSectionHeader * findRVASection(std::uint32_t rva, const pe::ImageNTHeader * ntHeaderPtr)
-{
-    const pe::ImageSectionHeader * sectionPtr = getFirstSection(ntHeaderPtr);
-    const std::uint32_t numSections = ntHeaderPtr->fileHeader.numberOfSections;
-
-    for (std::uint32_t s = 0; s < numSections; ++s, ++sectionPtr)
+    if (table.status == PETableStatus::NoDataDirectories)
     {
-        // Is the RVA within this section?
-        if (rva >= sectionPtr->virtualAddress &&
-            rva < (sectionPtr->virtualAddress + sectionPtr->misc.virtualSize))
-        {
-            return sectionPtr;
-        }
+        out << "\n" << color::yellow() << "Can't list exports! Number of RVAs is zero. "
+            << "PE is probably corrupted!" << color::restore() << "\n";
+        return;
     }
-    return nullptr;
-}
-
-static void dumpExportsSection(const pe::ImageDOSHeader * dosHeaderPtr, const pe::ImageNTHeader * ntHeaderPtr)
-{
-    //
-    // Following is based on 'impdef.c', which can be found here:
-    //   https://code.google.com/p/ulib-win/source/browse/trunk/demo/pe/impdef.c
-    //
-    // Also relevant:
-    //   http://stackoverflow.com/questions/2975639/resolving-rvas-for-import-and-export-tables-within-a-pe-file
-    //
-
-    // 64bit PEs are a whole different story. I don't support them at the moment.
-    if (ntHeaderPtr->optionalHeader.numberOfRvaAndSizes == 0)
+    if (table.status == PETableStatus::Unsupported)
     {
-        std::cout << "\n" << color::yellow() << "Can't list exports! Number of RVAs is zero. "
-                  << "PE is either corrupted or this is an unsupported 64-bits PE!"
-                  << color::restore() << "\n";
+        out << "\n" << color::yellow() << "Can't list exports! Optional header is neither PE32 nor PE32+."
+            << color::restore() << "\n";
         return;
     }
-
-    // Index of the exports directory (first one):
-    const int DirEntryExports = 0;
-    const pe::ImageDataDirectory * dataDirs = ntHeaderPtr->optionalHeader.dataDirectory;
-
-    // RVA = Relative Virtual Address
-    const auto exportsStartRVA = dataDirs[DirEntryExports].virtualAddress;
-    const auto exportsEndRVA   = exportsStartRVA + dataDirs[DirEntryExports].sizeInBytes;
-
-    // Get the IMAGE_SECTION_HEADER that contains the exports.
-    // This is usually the ".edata" section, but doesn't have to be.
-    const pe::ImageSectionHeader * sectHeader = findRVASection(exportsStartRVA, ntHeaderPtr);
-    if (sectHeader == nullptr)
+    if (table.status == PETableStatus::NotFound)
     {
-        std::cout << "\n" << color::yellow() << "No exports found." << color::restore() << "\n";
+        out << "\n" << color::yellow() << "No exports found." << color::restore() << "\n";
         return;
     }
 
-    const auto delta     = sectHeader->virtualAddress - sectHeader->pointerToRawData;
-    const auto base      = reinterpret_cast<std::uintptr_t>(dosHeaderPtr);
-    const auto exportDir = reinterpret_cast<const pe::ImageExportDirectory *>(base + (exportsStartRVA - delta));
-
-    const std::uintptr_t addrOrdinals  = base + (exportDir->addressOfNameOrdinals - delta);
-    const std::uintptr_t addrFunctions = base + (exportDir->addressOfFunctions    - delta);
-    const std::uintptr_t addrNames     = base + (exportDir->addressOfNames        - delta);
-
-    const auto ordinals  = reinterpret_cast<const std::uint16_t *>(addrOrdinals);
-    const auto functions = reinterpret_cast<const std::uint32_t *>(addrFunctions);
-    const auto names     = reinterpret_cast<const std::uint32_t *>(addrNames);
-
-    std::cout << "\n";
-    std::cout << color::yellow() << "------------------------------------------------------------\n";
-    std::cout << color::yellow() << "            Listing exports from " << sectionName(sectHeader->name) << "\n";
-    std::cout << color::yellow() << "------------------------------------------------------------\n";
-    std::cout << "\n" << color::restore();
-    std::cout << "PE Name...........: " << reinterpret_cast<const char *>(base + (exportDir->nameRVA - delta)) << "\n";
-    std::cout << "Num of functions..: " << exportDir->numberOfFunctions << "\n";
-    std::cout << "Num of names......: " << exportDir->numberOfNames << "\n";
-    std::cout << "Ordinal base......: " << exportDir->ordinalBase << "\n";
-    std::cout << "\n";
+    out << "\n";
+    out << color::yellow() << "------------------------------------------------------------\n";
+    out << color::yellow() << "            Listing exports from " << sectionName(table.sectionName.c_str()) << "\n";
+    out << color::yellow() << "------------------------------------------------------------\n";
+    out << "\n" << color::restore();
+    out << "PE Name...........: " << table.moduleName << "\n";
+    out << "Num of functions..: " << table.numberOfFunctions << "\n";
+    out << "Num of names......: " << table.numberOfNames << "\n";
+    out << "Ordinal base......: " << table.ordinalBase << "\n";
+    out << "\n";
 
     struct FName
     {
@@ -459,40 +208,14 @@ static void dumpExportsSection(const pe::ImageDOSHeader * dosHeaderPtr, const pe
     // We store the names first, then sort and print.
     FName tempName;
     std::vector<FName> funcNames;
+    funcNames.reserve(table.symbols.size());
 
-    for (std::uint32_t i = 0; i < exportDir->numberOfFunctions; ++i)
+    for (const auto & symbol : table.symbols)
     {
-        const auto entryPointRVA = functions[i];
-        if (entryPointRVA == 0)
-        {
-            // Skip over gaps in exported function ordinals
-            // (the entry-point is 0 for these functions).
-            continue;
-        }
-
-        // See if this function has an associated name exported for it.
-        for (std::uint32_t j = 0; j < exportDir->numberOfNames; ++j)
-        {
-            if (ordinals[j] == i)
-            {
-                std::string mangledName = reinterpret_cast<const char *>(base + (names[j] - delta));
-                tempName.ord = toHexa(ordinals[j], 3) + " ";
-                tempName.mangled = truncate(mangledName);
-                tempName.demangled = demangle(mangledName);
-                funcNames.emplace_back(std::move(tempName));
-            }
-        }
-
-        // Is it a forwarder? If so, the entry point RVA is inside the
-        // ".edata" section, and is an RVA to the DllName.EntryPointName
-        if ((entryPointRVA >= exportsStartRVA) && (entryPointRVA <= exportsEndRVA))
-        {
-            std::string mangledName = reinterpret_cast<const char *>(base + (entryPointRVA - delta));
-            tempName.ord = "FWD ";
-            tempName.mangled = truncate(mangledName);
-            tempName.demangled = demangle(mangledName);
-            funcNames.emplace_back(std::move(tempName));
-        }
+        tempName.ord = symbol.forwarder ? "FWD " : (toHexa(symbol.ordinal, 3) + " ");
+        tempName.mangled = truncate(symbol.name);
+        tempName.demangled = demangleCached(symbol.name);
+        funcNames.emplace_back(std::move(tempName));
     }
 
     // Sort alphabetically by the demangle name.
@@ -503,193 +226,138 @@ static void dumpExportsSection(const pe::ImageDOSHeader * dosHeaderPtr, const pe
         }
     );
 
-    // Find padding needed to align the first name column:
+    // Find padding needed to align the first name column. Capped, since every
+    // line is padded to it: one very long name would otherwise add kilobytes
+    // of spaces to each line of a large table. Longer names overflow the column.
+    const std::size_t MaxNameColumnWidth = 128;
     std::size_t longestName = 1;
     for (const auto & fn : funcNames)
     {
         if (fn.demangled.length() > longestName)
         {
-            longestName = fn.demangled.length();
+            longestName = std::min(fn.demangled.length(), MaxNameColumnWidth);
         }
     }
 
     // Print three columns, first with the ordinal, second
     // with the demangled name, third with the mangled value.
-    std::cout << std::left << std::setw(longestName / 3 + 3) << "Ordn. ";
-    std::cout << std::left << std::setw(longestName) << "Func name ";
-    std::cout << std::left << std::setw(1) << "Mangled name ";
-    std::cout << "\n";
-    std::cout << std::left << std::setw(longestName / 3 + 3) << "----- ";
-    std::cout << std::left << std::setw(longestName) << "--------- ";
-    std::cout << std::left << std::setw(1) << "------------ ";
-    std::cout << "\n";
+    out << std::left << std::setw(longestName / 3 + 3) << "Ordn. ";
+    out << std::left << std::setw(longestName) << "Func name ";
+    out << std::left << std::setw(1) << "Mangled name ";
+    out << "\n";
+    out << std::left << std::setw(longestName / 3 + 3) << "----- ";
+    out << std::left << std::setw(longestName) << "--------- ";
+    out << std::left << std::setw(1) << "------------ ";
+    out << "\n";
 
     for (const auto & fn : funcNames)
     {
         // Ordn.
         // -----
-        std::cout << fn.ord << " ";
+        out << fn.ord << " ";
 
         // Func Name
         // ---------
-        std::cout << color::yellow();
-        std::cout << std::left << std::setw(longestName);
-        std::cout << fn.demangled << "  ";
+        out << color::yellow();
+        out << std::left << std::setw(longestName);
+        out << fn.demangled << "  ";
 
         // Mangled name
         // ------------
-        std::cout << color::red() << fn.mangled << color::restore() << "\n";
+        out << color::red() << fn.mangled << color::restore() << "\n";
     }
 
-    std::cout << funcNames.size() << " exports located and resolved.\n";
-}
-
-static inline std::uintptr_t addrFromRVA(std::uint32_t rva, const pe::ImageNTHeader * pNTHeader, std::uintptr_t imageBase)
-{
-    const auto sectHeader = findRVASection(rva, pNTHeader);
-    if (sectHeader == nullptr)
+    out << funcNames.size() << " exports located and resolved.\n";
+    if (table.incomplete)
     {
-        return 0;
+        out << color::yellow() << "Export table is incomplete! It points outside the file or is too large for it."
+            << color::restore() << "\n";
     }
-    const auto delta = (sectHeader->virtualAddress - sectHeader->pointerToRawData);
-    return imageBase + rva - delta;
-}
-
-static inline const pe::ImageThunkData * toThunkPtr(std::uintptr_t ptr)
-{
-    return reinterpret_cast<const pe::ImageThunkData *>(ptr);
 }
 
-static inline bool isNullImportDescriptor(const pe::ImageImportDescriptor & impDesc)
+static void dumpImportsSection(std::ostream & out, const PEImportTable & table)
 {
-    // An import descriptor with all fields set to zero terminates the array of ImageImportDescriptors.
-    // It would have been much simpler to just add a count field somewhere, wouldn't it?
-    // This layout was probably designed by a Microsoft intern :P
-    static const pe::ImageImportDescriptor nullImpDesc{};
-    return std::memcmp(&impDesc, &nullImpDesc, sizeof(nullImpDesc)) == 0;
-}
-
-static void dumpImportsSection(const pe::ImageDOSHeader * dosHeaderPtr, const pe::ImageNTHeader * ntHeaderPtr)
-{
-    // Index of the imports directory (second one):
-    const int DirEntryImports = 1;
-    const pe::ImageDataDirectory * dataDirs = ntHeaderPtr->optionalHeader.dataDirectory;
-
-    // RVA = Relative Virtual Address
-    const auto importsStartRVA = dataDirs[DirEntryImports].virtualAddress;
-
-    // Get the IMAGE_SECTION_HEADER that contains the imports.
-    // Usually the ".idata" section, but not necessarily.
-    const pe::ImageSectionHeader * sectHeader = findRVASection(importsStartRVA, ntHeaderPtr);
-    if (sectHeader == nullptr)
+    if (table.status == PETableStatus::Unsupported)
     {
-        std::cout << "\n" << color::yellow() << "No imports found." << color::restore() << "\n";
+        out << "\n" << color::yellow() << "Can't list imports! Optional header is neither PE32 nor PE32+."
+            << color::restore() << "\n";
+        return;
+    }
+    if (table.status != PETableStatus::Ok)
+    {
+        out << "\n" << color::yellow() << "No imports found." << color::restore() << "\n";
         return;
     }
 
-    const auto delta = sectHeader->virtualAddress - sectHeader->pointerToRawData;
-    const auto base = reinterpret_cast<std::uintptr_t>(dosHeaderPtr);
-    const auto importDesc = reinterpret_cast<const pe::ImageImportDescriptor *>(base + (importsStartRVA - delta));
-
-    std::cout << "\n";
-    std::cout << color::yellow() << "------------------------------------------------------------\n";
-    std::cout << color::yellow() << "            Listing imports from " << sectionName(sectHeader->name) << "\n";
-    std::cout << color::yellow() << "------------------------------------------------------------\n";
-    std::cout << color::restore() << "\n";
+    out << "\n";
+    out << color::yellow() << "------------------------------------------------------------\n";
+    out << color::yellow() << "            Listing imports from " << sectionName(table.sectionName.c_str()) << "\n";
+    out << color::yellow() << "------------------------------------------------------------\n";
+    out << color::restore() << "\n";
 
     //
     // List of all DLLs for quick conference:
     //
-    std::cout << "--------------------\n";
-    std::cout << "  External modules\n";
-    std::cout << "--------------------\n";
+    out << "--------------------\n";
+    out << "  External modules\n";
+    out << "--------------------\n";
 
-    int i;
-    std::cout << "\n";
-    for (i = 0; !isNullImportDescriptor(importDesc[i]); ++i)
+    out << "\n";
+    for (const auto & module : table.modules)
     {
-        const char * dllName = reinterpret_cast<const char *>(base + (importDesc[i].nameRVA - delta));
-        std::cout << color::cyan() << "  " << dllName << "\n";
+        out << color::cyan() << "  " << module.dllName << "\n";
     }
-    std::cout << color::restore() << "\n";
+    out << color::restore() << "\n";
 
-    std::cout << "---------------------\n";
-    std::cout << "  Ordn.   Func name\n";
-    std::cout << "---------------------\n\n";
+    out << "---------------------\n";
+    out << "  Ordn.   Func name\n";
+    out << "---------------------\n\n";
 
     //
     // Print each module name again followed
     // by its referenced symbols/functions
     //
-    int symbolsTotal = 0;
-    for (i = 0; !isNullImportDescriptor(importDesc[i]); ++i)
+    std::size_t symbolsTotal = 0;
+    for (const auto & module : table.modules)
     {
-        const char * dllName = reinterpret_cast<const char *>(base + (importDesc[i].nameRVA - delta));
-        std::cout << color::red() << dllName << color::restore() << "\n";
+        out << color::red() << module.dllName << color::restore() << "\n";
 
-        std::uintptr_t thunk    = importDesc[i].impByNameRVA;
-        std::uintptr_t thunkIAT = importDesc[i].firstThunkRVA; // IAT = Import Address Table
-
-        if (thunk == 0) // No impByNameRVA field?
+        if (module.status == PEImportStatus::BadIAT)
         {
-            // Must have a non-zero firstThunkRVA field then.
-            thunk = thunkIAT;
-            if (thunk == 0)
-            {
-                std::cout << "Bad IAT! Skipping imports for " << dllName << "...\n";
-                continue;
-            }
+            out << "Bad IAT! Skipping imports for " << module.dllName << "...\n";
+            continue;
         }
-
-        // Adjust the pointer to where the tables are in memory:
-        thunk = addrFromRVA(thunk, ntHeaderPtr, base);
-        if (thunk == 0)
+        if (module.status == PEImportStatus::MissingIAT)
         {
-            std::cout << "Can't find IAT! Skipping imports for " << dllName << "...\n";
+            out << "Can't find IAT! Skipping imports for " << module.dllName << "...\n";
             continue;
         }
 
-        thunkIAT = addrFromRVA(thunkIAT, ntHeaderPtr, base);
-
-        // A zeroed-out thunk indicates the end of the list.
-        for (;;)
+        for (const auto & symbol : module.symbols)
         {
-            if (toThunkPtr(thunk)->u1.addressOfData == 0)
-            {
-                break;
-            }
-
-            if (toThunkPtr(thunk)->u1.ordinal & 0x80000000) // IMAGE_ORDINAL_FLAG
+            out << "  " << toHexa(symbol.ordinal, 4);
+            if (symbol.byOrdinal)
             {
-                std::cout << "  " << toHexa(toThunkPtr(thunk)->u1.ordinal & 0xFFFF, 4);
-                std::cout << color::yellow() << "  ???" << color::restore();
-                // Name apparently not available...
-                // If we'd try to force printing addressOfData anyways,
-                // it would hit some invalid memory location.
+                out << color::yellow() << "  ???" << color::restore();
             }
             else
             {
-                const auto addrImportName = addrFromRVA(toThunkPtr(thunk)->u1.addressOfData, ntHeaderPtr, base);
-                const auto importNamePtr  = reinterpret_cast<const pe::ImageImportByName *>(addrImportName);
-
-                std::cout << "  " << toHexa(importNamePtr->ordinalHint, 4);
-                std::cout << "  " << color::yellow() << demangle(importNamePtr->funcName) << color::restore();
+                out << "  " << color::yellow() << demangleCached(symbol.name) << color::restore();
             }
-
-            std::cout << "\n";
-
-            // Advance to next thunk
-            thunk    += sizeof(pe::ImageThunkData);
-            thunkIAT += sizeof(pe::ImageThunkData);
-
-            ++symbolsTotal;
+            out << "\n";
         }
 
-        std::cout << "\n";
+        symbolsTotal += module.symbols.size();
+        out << "\n";
     }
 
-    std::cout << i << " dependencies located and resolved, with "
-              << symbolsTotal << " symbols total.\n";
+    out << table.modules.size() << " dependencies located and resolved, with "
+        << symbolsTotal << " symbols total.\n";
+    if (table.incomplete)
+    {
+        out << color::yellow() << "Import table is incomplete! It points outside the file or is too large for it."
+            << color::restore() << "\n";
+    }
 }
 
 static inline std::string hexDWord(std::uint32_t dw)
@@ -713,7 +381,7 @@ static inline std::string hexDWord(std::uint32_t dw)
     return buffer;
 }
 
-static void dumpDOSJunk(const pe::ImageDOSHeader * dosHeaderPtr)
+static void dumpDOSJunk(std::ostream & out, const pe::ImageDOSHeader * dosHeaderPtr)
 {
     // From 0 to the start of the new header.
     const auto dosStubSizeInBytes  = dosHeaderPtr->e_lfanew;
@@ -722,11 +390,11 @@ static void dumpDOSJunk(const pe::ImageDOSHeader * dosHeaderPtr)
     auto asciiPtr = reinterpret_cast<const char *>(dosHeaderPtr);
     auto dwordPtr = reinterpret_cast<const std::uint32_t *>(dosHeaderPtr);
 
-    std::cout << "\n";
-    std::cout << color::yellow() << "------------------------------------------------------------\n";
-    std::cout << color::yellow() << "            IMAGE_DOS_HEADER and DOS stub" << "\n";
-    std::cout << color::yellow() << "------------------------------------------------------------\n";
-    std::cout << color::restore() << "\n";
+    out << "\n";
+    out << color::yellow() << "------------------------------------------------------------\n";
+    out << color::yellow() << "            IMAGE_DOS_HEADER and DOS stub" << "\n";
+    out << color::yellow() << "------------------------------------------------------------\n";
+    out << color::restore() << "\n";
 
     //
     // Simple hexadecimal dump of the header + DOS stub data,
@@ -739,41 +407,43 @@ static void dumpDOSJunk(const pe::ImageDOSHeader * dosHeaderPtr)
     {
         if (j == MaxCols)
         {
-            std::cout << color::cyan() << "| ";
+            out << color::cyan() << "| ";
             for (std::uint32_t k = 0; k < j * 4; ++k, ++asciiPtr)
             {
-                std::cout << (std::isprint(*asciiPtr) ? *asciiPtr : ' ');
+                out << (std::isprint(*asciiPtr) ? *asciiPtr : ' ');
             }
-            std::cout << " |\n" << color::restore();
+            out << " |\n" << color::restore();
             j = 0;
         }
-        std::cout << hexDWord(*dwordPtr);
+        out << hexDWord(*dwordPtr);
     }
 
     if (j <= MaxCols) // Last residual line
     {
         for (i = j; i < MaxCols; ++i) // Pad with blank spaces to fill a row
         {
-            std::cout << "         ";
+            out << "         ";
         }
 
-        std::cout << color::cyan() << "| ";
+        out << color::cyan() << "| ";
         for (std::uint32_t k = 0; k < j * 4; ++k, ++asciiPtr)
         {
-            std::cout << (std::isprint(*asciiPtr) ? *asciiPtr : ' ');
+            out << (std::isprint(*asciiPtr) ? *asciiPtr : ' ');
         }
         int diff = (MaxCols - j) * 4;
         if (diff > 0)
         {
-            while (diff--) { std::cout << ' '; } // Pad the ascii block to the right
+            while (diff--) { out << ' '; } // Pad the ascii block to the right
         }
-        std::cout << " |\n" << color::restore();
+        out << " |\n" << color::restore();
     }
 }
 
-static std::string sectionCharacteristics(std::uint32_t characteristics)
+std::string sectionCharacteristics(std::uint32_t characteristics)
 {
+    // Room for every flag and the colors, so that the string is allocated once.
     std::string str;
+    str.reserve(256);
 
     // This tests just a small subset of the large group of flag described by MSDN:
     //  https://msdn.microsoft.com/en-us/library/windows/desktop/ms680341(v=vs.85).aspx
@@ -796,6 +466,32 @@ static std::string sectionCharacteristics(std::uint32_t characteristics)
         if (!str.empty()) { str += " | "; }
         str += "LINKER_INFO"; // IMAGE_SCN_LNK_INFO
     }
+    if (characteristics & 0x00000800)
+    {
+        if (!str.empty()) { str += " | "; }
+        str += "LINKER_REMOVE"; // IMAGE_SCN_LNK_REMOVE, objects only
+    }
+    if (characteristics & 0x00001000)
+    {
+        if (!str.empty()) { str += " | "; }
+        str += "COMDAT"; // IMAGE_SCN_LNK_COMDAT, objects only
+    }
+    if (characteristics & 0x00F00000)
+    {
+        // IMAGE_SCN_ALIGN_*, objects only: 1 for 1 byte, 2 for 2 bytes... up to 14 for 8192 bytes.
+        static const char * const alignNames[] = {
+            "ALIGN_1BYTES",   "ALIGN_2BYTES",   "ALIGN_4BYTES",    "ALIGN_8BYTES",   "ALIGN_16BYTES",
+            "ALIGN_32BYTES",  "ALIGN_64BYTES",  "ALIGN_128BYTES",  "ALIGN_256BYTES", "ALIGN_512BYTES",
+            "ALIGN_1024BYTES", "ALIGN_2048BYTES", "ALIGN_4096BYTES", "ALIGN_8192BYTES", "ALIGN_?"
+        };
+        if (!str.empty()) { str += " | "; }
+        str += alignNames[((characteristics >> 20) & 0xF) - 1];
+    }
+    if (characteristics & 0x01000000)
+    {
+        if (!str.empty()) { str += " | "; }
+        str += "NRELOC_OVFL"; // IMAGE_SCN_LNK_NRELOC_OVFL, objects only
+    }
     if (characteristics & 0x02000000)
     {
         if (!str.empty()) { str += " | "; }
@@ -825,10 +521,12 @@ static std::string sectionCharacteristics(std::uint32_t characteristics)
     if (str.empty()) { str += "0"; }
 
     // Pain the flags string as magenta if printing to a terminal.
-    return color::magenta() + str + color::restore();
+    str.insert(0, color::magenta());
+    str += color::restore();
+    return str;
 }
 
-static void dumpSectionHeaders(const pe::ImageNTHeader * ntHeaderPtr)
+static void dumpSectionHeaders(std::ostream & out, const pe::ImageNTHeader * ntHeaderPtr)
 {
     //
     // Common section names:
@@ -844,28 +542,28 @@ static void dumpSectionHeaders(const pe::ImageNTHeader * ntHeaderPtr)
     //  .reloc -> relocation table if the loaded needs to fixup the base addr
     //
 
-    std::cout << "\n";
-    std::cout << color::yellow() << "------------------------------------------------------------\n";
-    std::cout << color::yellow() << "            IMAGE_SECTION_HEADERS" << "\n";
-    std::cout << color::yellow() << "------------------------------------------------------------\n";
-    std::cout << color::restore() << "\n";
+    out << "\n";
+    out << color::yellow() << "------------------------------------------------------------\n";
+    out << color::yellow() << "            IMAGE_SECTION_HEADERS" << "\n";
+    out << color::yellow() << "------------------------------------------------------------\n";
+    out << color::restore() << "\n";
 
     const pe::ImageSectionHeader * sectionPtr = getFirstSection(ntHeaderPtr);
     const std::uint32_t numSections = ntHeaderPtr->fileHeader.numberOfSections;
 
-    std::cout << "Number       Name       Flags        Flag strings\n";
-    std::cout << "------       ----       -----        ------------\n";
+    out << "Number       Name       Flags        Flag strings\n";
+    out << "------       ----       -----        ------------\n";
     for (std::uint32_t s = 0; s < numSections; ++s, ++sectionPtr)
     {
-        std::cout << "Section " << s << ": " << sectionName(sectionPtr->name)
-                  << toHexa(sectionPtr->characteristics) << "  ( "
-                  << sectionCharacteristics(sectionPtr->characteristics) << " )" << "\n";
+        out << "Section " << s << ": " << sectionName(sectionPtr->name)
+            << toHexa(sectionPtr->characteristics) << "  ( "
+            << sectionCharacteristics(sectionPtr->characteristics) << " )" << "\n";
     }
 
-    std::cout << numSections << " sections listed.\n";
+    out << numSections << " sections listed.\n";
 }
 
-static std::string fileHeaderMachine(std::uint32_t id)
+std::string fileHeaderMachine(std::uint32_t id)
 {
     // Value found on MSDN: https://msdn.microsoft.com/en-us/library/ms809762.aspx
     switch (id)
@@ -876,11 +574,13 @@ static std::string fileHeaderMachine(std::uint32_t id)
     case 0x166  : return "MIPS R4000";
     case 0x183  : return "DEC_ALPHA_AXP";
     case 0x8664 : return "WIN_64"; // Partially supported by this tool.
+    case 0x1C4  : return "ARMNT";  // Objects only.
+    case 0xAA64 : return "ARM64";  // Objects only.
     default     : return "UNKNOWN";
     } // switch (id)
 }
 
-static std::string fileHeaderCharacteristics(std::uint32_t characteristics)
+std::string fileHeaderCharacteristics(std::uint32_t characteristics)
 {
     std::string str;
     if (characteristics & 0x0001)
@@ -898,7 +598,7 @@ static std::string fileHeaderCharacteristics(std::uint32_t characteristics)
     return !str.empty() ? str : str += "0";
 }
 
-static std::string optionalHeaderSubsystem(std::uint32_t subsystem)
+std::string optionalHeaderSubsystem(std::uint32_t subsystem)
 {
     switch (subsystem)
     {
@@ -941,13 +641,24 @@ static std::string optionalHeaderDLLCharacteristics(std::uint32_t characteristic
     return !str.empty() ? str : str += "0";
 }
 
-static void dumpNTHeaders(const pe::ImageNTHeader * ntHeaderPtr)
+std::string timestampString(const std::time_t timestamp)
+{
+    // ctime() returns a pointer to a shared static buffer, so serialize
+    // access to it. The server mode dumps files from several threads.
+    static std::mutex ctimeMutex;
+    std::lock_guard<std::mutex> lock{ ctimeMutex };
+
+    const char * str = std::ctime(&timestamp);
+    return (str != nullptr) ? str : "???\n";
+}
+
+static void dumpNTHeaders(std::ostream & out, const pe::ImageNTHeader * ntHeaderPtr)
 {
-    std::cout << "\n";
-    std::cout << color::yellow() << "------------------------------------------------------------\n";
-    std::cout << color::yellow() << "            NT Headers" << "\n";
-    std::cout << color::yellow() << "------------------------------------------------------------\n";
-    std::cout << color::restore() << "\n";
+    out << "\n";
+    out << color::yellow() << "------------------------------------------------------------\n";
+    out << color::yellow() << "            NT Headers" << "\n";
+    out << color::yellow() << "------------------------------------------------------------\n";
+    out << color::restore() << "\n";
 
     const auto & fileHeader     = ntHeaderPtr->fileHeader;
     const auto & optionalHeader = ntHeaderPtr->optionalHeader;
@@ -956,55 +667,50 @@ static void dumpNTHeaders(const pe::ImageNTHeader * ntHeaderPtr)
     // so it is should be compatible with time_t. Might be off by a few hours, but what of it...
     const std::time_t timestamp = fileHeader.timeDateStamp;
 
-    std::cout << "---- IMAGE_FILE_HEADER ----" << "\n";
-    std::cout << "Machine architecture.....: " << fileHeaderMachine(fileHeader.machine) << "\n";
-    std::cout << "Number of sections.......: " << fileHeader.numberOfSections << "\n";
-    std::cout << "Timestamp................: " << toHexa(timestamp) << " => " << std::ctime(&timestamp); // ctime already terminated with a newline.
-    std::cout << "Pointer to symbol table..: " << fileHeader.pointerToSymbolTable << "\n";
-    std::cout << "Number of symbols........: " << fileHeader.numberOfSymbols << "\n";
-    std::cout << "Optional header size.....: " << fileHeader.sizeOfOptionalHeader << "\n";
-    std::cout << "Image characteristics....: " << fileHeaderCharacteristics(fileHeader.characteristics) << "\n";
-    std::cout << "\n";
-    std::cout << "---- IMAGE_OPTIONAL_HEADER ----" << "\n";
-    std::cout << "Magic....................: " << toHexa(optionalHeader.magic) << "\n";
-    std::cout << "Code size................: " << optionalHeader.sizeOfCode << "\n";
-    std::cout << "Initialized data size....: " << optionalHeader.sizeOfInitializedData << "\n";
-    std::cout << "Uninitialized data size..: " << optionalHeader.sizeOfUninitializedData << "\n";
-    std::cout << "Number of RVAs and sizes.: " << optionalHeader.numberOfRvaAndSizes << "\n";
-    std::cout << "Address of entry point...: " << toHexa(optionalHeader.addressOfEntryPoint) << "\n";
-    std::cout << "Subsystem................: " << optionalHeaderSubsystem(optionalHeader.subsystem) << "\n";
-    std::cout << "DLL Characteristics......: " << optionalHeaderDLLCharacteristics(optionalHeader.dllCharacteristics) << "\n";
+    out << "---- IMAGE_FILE_HEADER ----" << "\n";
+    out << "Machine architecture.....: " << fileHeaderMachine(fileHeader.machine) << "\n";
+    out << "Number of sections.......: " << fileHeader.numberOfSections << "\n";
+    out << "Timestamp................: " << toHexa(timestamp) << " => " << timestampString(timestamp); // ctime already terminated with a newline.
+    out << "Pointer to symbol table..: " << fileHeader.pointerToSymbolTable << "\n";
+    out << "Number of symbols........: " << fileHeader.numberOfSymbols << "\n";
+    out << "Optional header size.....: " << fileHeader.sizeOfOptionalHeader << "\n";
+    out << "Image characteristics....: " << fileHeaderCharacteristics(fileHeader.characteristics) << "\n";
+    out << "\n";
+    out << "---- IMAGE_OPTIONAL_HEADER ----" << "\n";
+    out << "Magic....................: " << toHexa(optionalHeader.magic) << "\n";
+    out << "Code size................: " << optionalHeader.sizeOfCode << "\n";
+    out << "Initialized data size....: " << optionalHeader.sizeOfInitializedData << "\n";
+    out << "Uninitialized data size..: " << optionalHeader.sizeOfUninitializedData << "\n";
+    out << "Number of RVAs and sizes.: " << getNumberOfRvaAndSizes(ntHeaderPtr) << "\n";
+    out << "Address of entry point...: " << toHexa(optionalHeader.addressOfEntryPoint) << "\n";
+    out << "Subsystem................: " << optionalHeaderSubsystem(optionalHeader.subsystem) << "\n";
+    out << "DLL Characteristics......: " << optionalHeaderDLLCharacteristics(optionalHeader.dllCharacteristics) << "\n";
 }
 
-struct ProgramFlags
+// Fetches the value of a flag like "--serve <socket>", advancing the argument index.
+static const char * flagValue(int argc, const char * argv[], int & i, ProgramFlags & prog)
 {
-    bool printHelpAndExit       = false; // -h/--help
-    bool flagDumpNTHeaders      = false; // -n/--nthdr
-    bool flagDumpSectionHeaders = false; // -s/--sections
-    bool flagDumpDOSJunk        = false; // -d/--doshdr
-    bool flagDumpExportsSection = false; // -e/--exports
-    bool flagDumpImportsSection = false; // -i/--imports
-
-    bool anyFlagSet() const
+    if ((i + 1) >= argc)
     {
-        return (printHelpAndExit       ||
-                flagDumpNTHeaders      ||
-                flagDumpSectionHeaders ||
-                flagDumpDOSJunk        ||
-                flagDumpExportsSection ||
-                flagDumpImportsSection);
+        std::cerr << color::red() << "Missing value for command line flag \""
+                  << argv[i] << "\"!" << color::restore() << "\n";
+        prog.invalidCmdLine = true;
+        return "";
     }
-};
+    return argv[++i];
+}
 
-static ProgramFlags processCmdLine(int argc, const char * argv[])
+ProgramFlags processCmdLine(int argc, const char * argv[])
 {
     ProgramFlags prog;
+    prog.progName = argv[0];
 
     // argv[0] is the program name and argv[1] should be the PE file or a -h/--help flag.
     for (int i = 1; i < argc; ++i)
     {
         if (argv[i][0] != '-')
         {
+            prog.inputPaths.push_back(argv[i]);
             continue; // Not a flag.
         }
 
@@ -1023,7 +729,9 @@ static ProgramFlags processCmdLine(int argc, const char * argv[])
             prog.flagDumpDOSJunk        = true;
             prog.flagDumpExportsSection = true;
             prog.flagDumpImportsSection = true;
-            break;
+            prog.flagDumpRelocations    = true;
+            prog.flagDumpSymbols        = true;
+            continue;
         }
 
         // These are all optional:
@@ -1047,131 +755,323 @@ static ProgramFlags processCmdLine(int argc, const char * argv[])
         {
             prog.flagDumpImportsSection = true;
         }
+        else if (std::strcmp(argv[i], "-r") == 0 || std::strcmp(argv[i], "--relocs") == 0)
+        {
+            prog.flagDumpRelocations = true;
+        }
+        else if (std::strcmp(argv[i], "-t") == 0 || std::strcmp(argv[i], "--symbols") == 0)
+        {
+            prog.flagDumpSymbols = true;
+        }
+        else if (std::strcmp(argv[i], "--serve") == 0)
+        {
+            prog.serveSocketPath = flagValue(argc, argv, i, prog);
+        }
+        else if (std::strcmp(argv[i], "--client") == 0)
+        {
+            prog.clientSocketPath = flagValue(argc, argv, i, prog);
+        }
+        else if (std::strcmp(argv[i], "--workers") == 0)
+        {
+            prog.numWorkers = static_cast<unsigned>(std::strtoul(flagValue(argc, argv, i, prog), nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--watch") == 0)
+        {
+            prog.watchDir = flagValue(argc, argv, i, prog);
+        }
+        else if (std::strcmp(argv[i], "--debounce") == 0)
+        {
+            prog.debounceMs = static_cast<unsigned>(std::strtoul(flagValue(argc, argv, i, prog), nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--aggregate") == 0)
+        {
+            prog.aggregate = true;
+        }
+        else if (std::strcmp(argv[i], "--sketch-out") == 0)
+        {
+            prog.sketchOutput = flagValue(argc, argv, i, prog);
+        }
+        else if (std::strcmp(argv[i], "--sketch-in") == 0)
+        {
+            prog.sketchInputs.push_back(flagValue(argc, argv, i, prog));
+        }
+        else if (std::strcmp(argv[i], "--top") == 0)
+        {
+            prog.topK = static_cast<unsigned>(std::strtoul(flagValue(argc, argv, i, prog), nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--index-out") == 0)
+        {
+            prog.indexOutput = flagValue(argc, argv, i, prog);
+        }
+        else if (std::strcmp(argv[i], "--index") == 0)
+        {
+            prog.indexInput = flagValue(argc, argv, i, prog);
+        }
+        else if (std::strcmp(argv[i], "--find") == 0)
+        {
+            prog.findSymbols.push_back(flagValue(argc, argv, i, prog));
+        }
+        else if (std::strcmp(argv[i], "--no-verify") == 0)
+        {
+            prog.skipVerify = true;
+        }
+        else if (std::strcmp(argv[i], "--summary-out") == 0)
+        {
+            prog.summaryOutput = flagValue(argc, argv, i, prog);
+        }
+        else if (std::strcmp(argv[i], "--summary") == 0)
+        {
+            prog.summaryInput = flagValue(argc, argv, i, prog);
+        }
+        else if (std::strcmp(argv[i], "--where") == 0)
+        {
+            prog.whereExpression = flagValue(argc, argv, i, prog);
+        }
+        else if (std::strcmp(argv[i], "--stats") == 0)
+        {
+            prog.printStats = true;
+        }
+        else if (std::strcmp(argv[i], "--stats-json") == 0)
+        {
+            prog.statsJsonOutput = flagValue(argc, argv, i, prog);
+        }
+        else if (std::strcmp(argv[i], "--trace") == 0)
+        {
+            prog.traceOutput = flagValue(argc, argv, i, prog);
+        }
+        else if (std::strcmp(argv[i], "--loader") == 0)
+        {
+            const char * name = flagValue(argc, argv, i, prog);
+            if (*name != '\0' && !parseFileLoader(name, prog.loader))
+            {
+                std::cerr << color::red() << "Unknown loader \"" << name << "\"! Expected read, mmap or ondemand."
+                          << color::restore() << "\n";
+                prog.invalidCmdLine = true;
+            }
+        }
+        else if (std::strcmp(argv[i], "--mapped-image") == 0)
+        {
+            prog.mappedImage = true;
+        }
+        else if (std::strcmp(argv[i], "--minidump") == 0)
+        {
+            prog.minidump = true;
+        }
+        else if (std::strcmp(argv[i], "--lib") == 0)
+        {
+            prog.lib = true;
+        }
+        else if (std::strcmp(argv[i], "--obj") == 0)
+        {
+            prog.obj = true;
+        }
+        else if (std::strcmp(argv[i], "--rebase") == 0)
+        {
+            const char * address = flagValue(argc, argv, i, prog);
+            char * end = nullptr;
+            prog.rebase = true;
+            prog.rebaseAddress = std::strtoull(address, &end, 0);
+            if (*address != '\0' && *end != '\0')
+            {
+                std::cerr << color::red() << "Invalid --rebase address \"" << address << "\"!"
+                          << color::restore() << "\n";
+                prog.invalidCmdLine = true;
+            }
+            else if ((prog.rebaseAddress & 0xFFFF) != 0)
+            {
+                // The Windows loader only maps images at multiples of the allocation granularity.
+                std::cerr << color::red() << "Invalid --rebase address \"" << address << "\"! It must be 64 KiB aligned."
+                          << color::restore() << "\n";
+                prog.invalidCmdLine = true;
+            }
+        }
+        else if (std::strcmp(argv[i], "-o") == 0 || std::strcmp(argv[i], "--output") == 0)
+        {
+            prog.outputPath = flagValue(argc, argv, i, prog);
+        }
     }
 
     return prog;
 }
 
-static void printHelpText(const char * progName)
-{
-    std::cout << "\n"
-        << "Usage:\n"
-        << " $ " << progName << " <filename> [options]\n"
-        << " Prints information about a Win32 Portable Executable (PE) file.\n"
-        << " PE files are usually ended with the extensions: DLL, EXE, SYS, EFI, among others.\n"
-        << " Options are:\n"
-        << "  -h, --help      Prints this message and exits.\n"
-        << "  -n, --nthdr     Prints the IMAGE_FILE_HEADER and IMAGE_OPTIONAL_HEADER.\n"
-        << "  -d, --doshdr    Prints the IMAGE_DOS_HEADER and an hexadecimal dump of the DOS stub.\n"
-        << "  -s, --sections  Prints a short summary of each PE section.\n"
-        << "  -e, --exports   Prints a list of all exported symbols. Names undecorated if possible.\n"
-        << "  -i, --imports   Prints a list of all imported dependencies. Names undecorated if possible.\n"
-        << "  -a, --all       Shorthand option to enable all of the above (except -h/--help, of course).\n"
-        << "\n"
-        << "Created by Guilherme R. Lampert, " << __DATE__ << ".\n";
-}
+#ifdef PPEDUMP_POSIX
 
-int main(int argc, const char * argv[])
+bool listFilesRecursive(const std::string & dir, std::vector<std::string> & files)
 {
-    if (argc <= 1)
+    DIR * dirHandle = ::opendir(dir.c_str());
+    if (dirHandle == nullptr)
     {
-        printHelpText(argv[0]);
-        return EXIT_FAILURE;
+        return false;
     }
 
-    const ProgramFlags prog = processCmdLine(argc, argv);
-    if (prog.printHelpAndExit)
+    while (const dirent * entry = ::readdir(dirHandle))
     {
-        printHelpText(argv[0]);
-        return EXIT_SUCCESS; // Just -h/--help is fine and not an error.
-    }
+        if (std::strcmp(entry->d_name, ".") == 0 || std::strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
 
-    const char * filename = argv[1];
-    if (*filename == '\0' || *filename == '-') // Check for a flag in the wrong place/empty string...
-    {
-        std::cerr << color::red() << "Invalid filename \""
-                  << filename << "\"!" << color::restore() << "\n";
-        return EXIT_FAILURE;
+        const std::string path = dir + "/" + entry->d_name;
+        struct stat st;
+        if (::lstat(path.c_str(), &st) != 0)
+        {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode))
+        {
+            listFilesRecursive(path, files);
+        }
+        else if (S_ISREG(st.st_mode))
+        {
+            files.push_back(path);
+        }
     }
 
-    std::size_t fileLength = 0;
-    auto fileContents = loadFile(filename, fileLength);
-    if (fileContents == nullptr)
-    {
-        return EXIT_FAILURE;
-    }
+    ::closedir(dirHandle);
+    return true;
+}
 
-    std::cout << "\n";
-    std::cout << "PE: " << filename << "\n";
-    std::cout << "File size in bytes: " << fileLength << "\n";
+bool isDirectory(const char * path)
+{
+    struct stat st;
+    return ::stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
 
-    const auto dosHeaderPtr =
-        reinterpret_cast<const pe::ImageDOSHeader *>(fileContents.get());
+#else // !PPEDUMP_POSIX
 
-    const auto ntHeaderPtr =
-        reinterpret_cast<const pe::ImageNTHeader *>(fileContents.get() + dosHeaderPtr->e_lfanew);
+bool listFilesRecursive(const std::string &, std::vector<std::string> &)
+{
+    return false; // Not implemented.
+}
 
-    // Validate the DOS header, expected id='MZ'
-    if (dosHeaderPtr->e_magic != pe::DOSSignature)
+bool isDirectory(const char *)
+{
+    return false; // Not implemented.
+}
+
+#endif // PPEDUMP_POSIX
+
+void expandInputPaths(const std::vector<std::string> & inputPaths, std::vector<std::string> & files)
+{
+    for (const auto & input : inputPaths)
     {
-        union
+        if (isDirectory(input.c_str()))
         {
-            std::uint16_t u16;
-            char c8[2];
-        } split;
-
-        split.u16 = dosHeaderPtr->e_magic;
-        const char sig[] = { split.c8[0], split.c8[1], '\0' };
+            std::vector<std::string> listed;
+            listFilesRecursive(input, listed);
+            for (auto & path : listed)
+            {
+                if (looksLikePE(path.c_str())) { files.push_back(std::move(path)); }
+            }
+        }
+        else
+        {
+            files.push_back(input);
+        }
+    }
+}
 
-        std::cerr << color::red() << "Bad PE DOS signature! Expected \'MZ\', got \'"
-                  << sig << "\'!" << color::restore() << "\n";
-        return EXIT_FAILURE;
+unsigned batchWorkerCount(const unsigned requested, const std::size_t numItems)
+{
+    unsigned numWorkers = requested;
+    if (numWorkers == 0)
+    {
+        numWorkers = std::max(1u, std::thread::hardware_concurrency());
     }
+    return static_cast<unsigned>(std::max<std::size_t>(1, std::min<std::size_t>(numWorkers, numItems)));
+}
 
-    // Validate the NT header, expected id='PE'
-    if (ntHeaderPtr->signature != pe::NTSignature)
+void parallelForEach(const std::size_t numItems, const unsigned numWorkers,
+                     const std::function<void(std::size_t item, unsigned worker)> & body)
+{
+    // Items are handed out one at a time, so a few huge
+    // files don't leave the other workers idle at the end.
+    std::atomic<std::size_t> nextItem{ 0 };
+    auto worker = [numItems, &nextItem, &body](const unsigned w)
     {
-        union
+        for (std::size_t i = nextItem++; i < numItems; i = nextItem++)
         {
-            std::uint32_t u32;
-            char c8[4];
-        } split;
-
-        split.u32 = ntHeaderPtr->signature;
-        const char sig[] = { split.c8[0], split.c8[1], split.c8[2], split.c8[3], '\0' };
+            body(i, w);
+        }
+    };
 
-        std::cerr << color::red() << "Bad PE NT signature! Expected \'PE\', got \'"
-                  << sig << "\'!" << color::restore() << "\n";
-        return EXIT_FAILURE;
+    std::vector<std::thread> threads;
+    for (unsigned w = 1; w < numWorkers; ++w)
+    {
+        threads.emplace_back(worker, w);
     }
-
-    std::cout << "File is a valid Windows Portable Executable!\n";
-
-    if (!prog.anyFlagSet())
+    worker(0); // The calling thread is worker 0.
+    for (auto & thread : threads)
     {
-        std::cout << "Run " << argv[0] << " again with -h or --help to get a list of available options.\n";
+        thread.join();
     }
+}
 
+void dumpPEImage(PEImage & image, const ProgramFlags & prog, std::ostream & out)
+{
     if (prog.flagDumpNTHeaders)
     {
-        dumpNTHeaders(ntHeaderPtr);
+        stats::Scope statsScope{ stats::Phase::NTHeaders };
+        dumpNTHeaders(out, image.ntHeader());
     }
     if (prog.flagDumpDOSJunk)
     {
-        dumpDOSJunk(dosHeaderPtr);
+        stats::Scope statsScope{ stats::Phase::DOSHeader };
+        dumpDOSJunk(out, image.dosHeader());
     }
     if (prog.flagDumpSectionHeaders)
     {
-        dumpSectionHeaders(ntHeaderPtr);
+        stats::Scope statsScope{ stats::Phase::Sections };
+        dumpSectionHeaders(out, image.ntHeader());
     }
     if (prog.flagDumpExportsSection)
     {
-        dumpExportsSection(dosHeaderPtr, ntHeaderPtr);
+        stats::Scope statsScope{ stats::Phase::Exports };
+        dumpExportsSection(out, image.exports());
     }
     if (prog.flagDumpImportsSection)
     {
-        dumpImportsSection(dosHeaderPtr, ntHeaderPtr);
+        stats::Scope statsScope{ stats::Phase::Imports };
+        dumpImportsSection(out, image.imports());
+    }
+}
+
+bool processFile(const char * filename, const ProgramFlags & prog, std::ostream & out, std::ostream & errOut)
+{
+    if (*filename == '\0' || *filename == '-') // Check for a flag in the wrong place/empty string...
+    {
+        errOut << color::red() << "Invalid filename \""
+               << filename << "\"!" << color::restore() << "\n";
+        return false;
+    }
+
+    stats::FileScope statsFile{ filename };
+    FileContents fileContents;
+    if (!fileContents.load(filename, fileLoader(), errOut))
+    {
+        return false;
+    }
+
+    out << "\n";
+    out << "PE: " << filename << "\n";
+    out << "File size in bytes: " << fileContents.size() << "\n";
+
+    PEImage image;
+    if (!image.open(std::move(fileContents), filename, errOut))
+    {
+        return false;
     }
 
-    std::cout << "\n";
+    out << "File is a valid Windows Portable Executable!\n";
+
+    if (!prog.anyFlagSet())
+    {
+        out << "Run " << prog.progName << " again with -h or --help to get a list of available options.\n";
+    }
+
+    dumpPEImage(image, prog, out);
+
+    out << "\n";
+    return true;
 }
+
@@ -0,0 +1,433 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: portable_pe_dump.hpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: Declarations shared between the source files of the ppedump tool.
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#ifndef PORTABLE_PE_DUMP_HPP
+#define PORTABLE_PE_DUMP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pe_image.hpp"
+
+// ========================================================
+// Command line flags:
+// ========================================================
+
+struct ProgramFlags
+{
+    bool printHelpAndExit       = false; // -h/--help
+    bool flagDumpNTHeaders      = false; // -n/--nthdr
+    bool flagDumpSectionHeaders = false; // -s/--sections
+    bool flagDumpDOSJunk        = false; // -d/--doshdr
+    bool flagDumpExportsSection = false; // -e/--exports
+    bool flagDumpImportsSection = false; // -i/--imports
+    bool flagDumpRelocations    = false; // -r/--relocs, objects only
+    bool flagDumpSymbols        = false; // -t/--symbols, objects only
+
+    // argv[0], for the messages.
+    std::string progName{};
+
+    // Set if a flag that takes a value was given without one.
+    bool invalidCmdLine = false;
+
+    // Daemon mode (server side and client side):
+    std::string serveSocketPath{};  // --serve <socket>
+    std::string clientSocketPath{}; // --client <socket>
+    unsigned    numWorkers = 0;     // --workers <n>, 0 = one per hardware thread
+
+    // Watch mode:
+    std::string watchDir{};         // --watch <dir>
+    unsigned    debounceMs = 250;   // --debounce <ms>
+
+    // Aggregate statistics mode:
+    bool        aggregate = false;  // --aggregate
+    std::string sketchOutput{};     // --sketch-out <file>
+    std::vector<std::string> sketchInputs{}; // --sketch-in <file>, repeatable
+    unsigned    topK = 20;          // --top <k>
+
+    // Symbol index (Bloom filter prefilter):
+    std::string indexOutput{};      // --index-out <file>
+    std::string indexInput{};       // --index <file>
+    std::vector<std::string> findSymbols{}; // --find <name>, repeatable
+    bool        skipVerify = false; // --no-verify
+
+    // Binary summaries (see pe_summary.hpp):
+    std::string summaryOutput{};    // --summary-out <file>
+    std::string summaryInput{};     // --summary <file>
+
+    // Filter expression (see where_filter.cpp):
+    std::string whereExpression{};  // --where <expr>
+
+    // Minidump mode (see minidump_mode.cpp):
+    bool        minidump = false;   // --minidump
+
+    // Library mode (see lib_mode.cpp):
+    bool        lib = false;        // --lib, takes --find too
+
+    // Object mode (see obj_mode.cpp):
+    bool        obj = false;        // --obj
+
+    // Rebasing (see rebase_mode.cpp):
+    bool          rebase = false;       // --rebase <addr>
+    std::uint64_t rebaseAddress = 0;
+    std::string   outputPath{};         // -o <file>
+
+    FileLoader  loader = FileLoader::Read; // --loader read|mmap|ondemand
+    bool        mappedImage = false;           // --mapped-image, inputs in PELayout::Mapped
+
+    // Phase timings and counters, printed to stderr at exit (see run_stats.cpp):
+    bool        printStats = false; // --stats
+    std::string statsJsonOutput{};  // --stats-json <file>
+    std::string traceOutput{};      // --trace <file>, Chrome trace-event JSON
+
+    // Arguments that are not flags or flag values (files/directories).
+    std::vector<std::string> inputPaths{};
+
+    bool anyFlagSet() const
+    {
+        return (printHelpAndExit       ||
+                flagDumpNTHeaders      ||
+                flagDumpSectionHeaders ||
+                flagDumpDOSJunk        ||
+                flagDumpExportsSection ||
+                flagDumpImportsSection ||
+                flagDumpRelocations    ||
+                flagDumpSymbols);
+    }
+};
+
+// ========================================================
+// Defined in portable_pe_dump.cpp
+// ========================================================
+
+// Appends the path of every regular file under 'dir', recursing into
+// subdirectories. Returns false if 'dir' can't be opened or on non-POSIX systems.
+bool listFilesRecursive(const std::string & dir, std::vector<std::string> & files);
+bool isDirectory(const char * path);
+
+// Replaces each directory in 'inputPaths' by the PEs ('MZ' files) found
+// under it and appends the result to 'files'. Plain files are kept as given.
+void expandInputPaths(const std::vector<std::string> & inputPaths, std::vector<std::string> & files);
+
+// Number of threads for a batch of 'numItems': 'requested' (--workers),
+// or one per hardware thread if zero, but never more than the items.
+unsigned batchWorkerCount(unsigned requested, std::size_t numItems);
+
+// Calls body(item, worker) for every item in [0, numItems) on 'numWorkers'
+// threads, the calling thread included. Worker indexes are in [0, numWorkers),
+// so per-worker state can be kept in a plain array and merged afterwards.
+void parallelForEach(std::size_t numItems, unsigned numWorkers,
+                     const std::function<void(std::size_t item, unsigned worker)> & body);
+
+// Human readable names of header fields.
+std::string fileHeaderMachine(std::uint32_t id);
+std::string fileHeaderCharacteristics(std::uint32_t characteristics);
+std::string optionalHeaderSubsystem(std::uint32_t subsystem);
+std::string sectionCharacteristics(std::uint32_t characteristics); // Painted magenta
+std::string timestampString(std::time_t timestamp);                // ctime() format, with the newline
+
+// 64-bit FNV-1a hash of a string.
+std::uint64_t hashString(const std::string & str);
+
+// SplitMix64 finalizer. FNV alone mixes the high bits poorly for short
+// strings, which matters when the hash bits are used directly.
+std::uint64_t mixHash(std::uint64_t x);
+
+// Quoted and escaped JSON string literal.
+std::string jsonString(const std::string & str);
+
+// Parses argv[1..argc-1]. Non-flag arguments are ignored.
+ProgramFlags processCmdLine(int argc, const char * argv[]);
+
+// Loads, validates and dumps a single PE file according to the flags.
+// Normal output goes to 'out', error messages to 'errOut'. Safe to call
+// concurrently from multiple threads with different output streams.
+bool processFile(const char * filename, const ProgramFlags & prog,
+                 std::ostream & out, std::ostream & errOut);
+
+// The dumps selected by the flags, of an image already open. What processFile()
+// prints after the file header lines, for PEs that don't come from a file.
+void dumpPEImage(PEImage & image, const ProgramFlags & prog, std::ostream & out);
+
+// Colored output is also disabled if stdout is not a terminal.
+void setColorPrintEnabled(bool enabled);
+
+namespace color
+{
+
+// False if built without COLOR_PRINT, if stdout is not
+// a terminal or after setColorPrintEnabled(false).
+bool canColorPrint();
+
+// ANSI color codes:
+inline const char * restore() { return canColorPrint() ? "\033[0;1m"  : ""; }
+inline const char * red()     { return canColorPrint() ? "\033[31;1m" : ""; }
+inline const char * green()   { return canColorPrint() ? "\033[32;1m" : ""; }
+inline const char * yellow()  { return canColorPrint() ? "\033[33;1m" : ""; }
+inline const char * blue()    { return canColorPrint() ? "\033[34;1m" : ""; }
+inline const char * magenta() { return canColorPrint() ? "\033[35;1m" : ""; }
+inline const char * cyan()    { return canColorPrint() ? "\033[36;1m" : ""; }
+inline const char * white()   { return canColorPrint() ? "\033[37;1m" : ""; }
+
+} // namespace color {}
+
+// ========================================================
+// Defined in cxx_demangle.cpp
+// ========================================================
+
+std::string demangle(const std::string & mangledName, bool baseNameOnly = true);
+
+// Memoizing front-end to demangle(). It is a plain pass-through until
+// enableDemangleCache() is called. Safe to call from multiple threads.
+std::string demangleCached(const std::string & mangledName, bool baseNameOnly = true);
+void enableDemangleCache(std::size_t maxEntries);
+
+// ========================================================
+// Defined in server_mode.cpp
+// ========================================================
+
+// Runs the request loop until SIGINT/SIGTERM. Returns the process exit code.
+int runServer(const ProgramFlags & prog);
+
+// Forwards the remaining command line to a running server and
+// prints its reply. Returns the process exit code.
+int runClient(const ProgramFlags & prog, int argc, const char * argv[]);
+
+// ========================================================
+// Defined in watch_mode.cpp
+// ========================================================
+
+// Prints NDJSON records for the PEs under prog.watchDir, then for every
+// change to them until SIGINT/SIGTERM. Returns the process exit code.
+int runWatch(const ProgramFlags & prog);
+
+// ========================================================
+// Defined in pe_diff.cpp
+// ========================================================
+
+// Prints the structural differences between two PEs, or between
+// the PEs of two directory trees. Returns 0/1/2 like diff(1).
+int runDiff(const char * pathA, const char * pathB);
+
+// ========================================================
+// Defined in aggregate_mode.cpp
+// ========================================================
+
+// Gathers corpus-wide statistics over prog.inputPaths (files or directories)
+// and merges in the --sketch-in files. Returns the process exit code.
+int runAggregate(const ProgramFlags & prog);
+
+// ========================================================
+// Defined in symbol_index.cpp
+// ========================================================
+
+// Builds a --index-out file from prog.inputPaths, or queries an --index
+// file for the prog.findSymbols names. Returns the process exit code.
+int runSymbolIndex(const ProgramFlags & prog);
+
+// ========================================================
+// Defined in pe_summary.cpp
+// ========================================================
+
+// Writes the --summary-out file for prog.inputPaths, or lists
+// the files of a --summary file. Returns the process exit code.
+int runSummary(const ProgramFlags & prog);
+
+// ========================================================
+// Defined in where_filter.cpp
+// ========================================================
+
+// Prints the files of prog.inputPaths that match prog.whereExpression,
+// or dumps them if any dump flag is set. Returns the process exit code.
+int runWhere(const ProgramFlags & prog);
+
+// ========================================================
+// Defined in minidump_mode.cpp
+// ========================================================
+
+// Lists the modules of the minidumps in prog.inputPaths and dumps each
+// module's in-memory image with the dump flags. Returns the process exit code.
+int runMinidump(const ProgramFlags & prog);
+
+// ========================================================
+// Defined in lib_mode.cpp
+// ========================================================
+
+// Lists the import records and objects of the archives (.lib) in prog.inputPaths,
+// or looks the prog.findSymbols names up in their index. Returns the process exit code.
+int runLib(const ProgramFlags & prog);
+
+// ========================================================
+// Defined in obj_mode.cpp
+// ========================================================
+
+// Dumps the COFF object files (.obj) in prog.inputPaths: the headers, and the
+// sections, relocations and symbols the flags ask for. Returns the process exit code.
+int runObj(const ProgramFlags & prog);
+
+// ========================================================
+// Defined in rebase_mode.cpp
+// ========================================================
+
+// Lays out the input PE as the loader would, relocates it to prog.rebaseAddress
+// and writes the image to prog.outputPath. Returns the process exit code.
+int runRebase(const ProgramFlags & prog);
+
+// ========================================================
+// Defined in run_stats.cpp
+// ========================================================
+
+//
+// Per-phase timing and event counters for --stats. Everything is a
+// no-op behind a single branch until enable() is called, which must
+// happen before any worker thread starts. Each thread accumulates into
+// its own block, merged by report() once the workers are done.
+//
+// Builds with PPEDUMP_TRACK_ALLOCS (make TRACK_ALLOCS=1) also replace
+// the global operator new/delete to count the heap allocations of each
+// phase, and record the heap peak and the process peak RSS of each file.
+//
+// The same scopes feed --trace: with enableTrace(), every phase and file
+// becomes a span in a per-thread ring buffer, written out by writeTrace()
+// in the Chrome trace-event format.
+//
+namespace stats
+{
+
+enum class Phase
+{
+    Load,        // Reading or mapping the file
+    Validate,    // DOS/NT header checks and the section table
+    NTHeaders,   // -n
+    DOSHeader,   // -d
+    Sections,    // -s
+    Exports,     // Export table walk and -e
+    Imports,     // Import table walk and -i
+    Relocations, // -r, objects
+    Symbols,     // -t, objects
+    Flush,       // Flushing stdout at exit
+    Count
+};
+
+enum class Counter
+{
+    Files,          // Files loaded successfully
+    BytesRead,      // Size of the files loaded (mapped bytes included)
+    RVALookups,     // Calls to findRVASection()
+    NamesDemangled, // Names run through demangle(), not counting cache hits
+    BytesWritten,   // Bytes written to stdout
+    Count
+};
+
+extern bool enabled;
+extern bool tracing;
+
+void enable();
+void addCount(Counter counter, std::uint64_t amount);
+
+// Sum of 'counter' over all threads so far.
+std::uint64_t total(Counter counter);
+
+inline void count(const Counter counter, const std::uint64_t amount = 1)
+{
+    if (enabled)
+    {
+        addCount(counter, amount);
+    }
+}
+
+// Times the enclosing block as 'phase', wall and thread CPU time. A scope nested
+// in another of the same phase (a PEImage table parsed lazily inside the dump
+// that asked for it) counts toward the outer one.
+class Scope
+{
+public:
+    explicit Scope(const Phase phase)
+        : phase_{ phase }
+    {
+        if (enabled || tracing) { active_ = begin(); }
+    }
+    ~Scope()
+    {
+        if (active_) { end(); }
+    }
+
+    Scope(const Scope &) = delete;
+    Scope & operator = (const Scope &) = delete;
+
+private:
+    bool begin(); // False if nested
+    void end();
+
+    const Phase   phase_;
+    bool          active_      = false;
+    int           outerPhase_  = -1; // For attributing allocations
+    std::uint64_t wallStartNs_ = 0;
+    std::uint64_t cpuStartNs_  = 0;
+};
+
+// Marks the processing of one file: a span of the trace and, in
+// PPEDUMP_TRACK_ALLOCS builds, a line of the per-file allocation report.
+// A scope nested in another (a file dumped by --where) counts toward the outer one.
+class FileScope
+{
+public:
+    explicit FileScope(const char * filename)
+        : filename_{ filename }
+    {
+        if (enabled || tracing) { active_ = begin(); }
+    }
+    ~FileScope()
+    {
+        if (active_) { end(); }
+    }
+
+    FileScope(const FileScope &) = delete;
+    FileScope & operator = (const FileScope &) = delete;
+
+private:
+    bool begin(); // False if nested
+    void end();
+
+    const char *  filename_;
+    bool          active_      = false;
+    std::uint64_t wallStartNs_ = 0;
+};
+
+// Starts recording spans, keeping up to 'eventsPerThread' of the latest
+// ones for each thread. Must be called before any worker thread starts.
+void enableTrace(std::size_t eventsPerThread);
+
+// Writes the spans recorded so far as a Chrome trace-event JSON file,
+// viewable in chrome://tracing or Perfetto. Errors are printed to 'errOut'.
+bool writeTrace(const std::string & filename, std::ostream & errOut);
+
+// Wraps std::cout so that the bytes written are counted. Call once, after enable().
+void countStdoutBytes();
+
+// Human readable table, or a JSON object if 'json' is set.
+void report(std::ostream & out, bool json);
+
+} // namespace stats {}
+
+#endif // PORTABLE_PE_DUMP_HPP
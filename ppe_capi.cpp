@@ -0,0 +1,398 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: ppe_capi.cpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: The C API of ppedump.h, walking the tables in place in the caller's buffer.
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <new>
+#include <ostream>
+
+#include "ppedump.h"
+#include "portable_pe_dump.hpp"
+
+static_assert(sizeof(ppe_section) == sizeof(pe::ImageSectionHeader), "ppe_section must match IMAGE_SECTION_HEADER!");
+static_assert(offsetof(ppe_section, characteristics) == offsetof(pe::ImageSectionHeader, characteristics),
+              "ppe_section must match IMAGE_SECTION_HEADER!");
+
+namespace
+{
+
+void * mallocHook(void *, const std::size_t size)
+{
+    return std::malloc(size);
+}
+
+void freeHook(void *, void * ptr, std::size_t)
+{
+    std::free(ptr);
+}
+
+inline ppe_string toCString(const PEStringRef & str)
+{
+    ppe_string cstr;
+    cstr.data   = str.data;
+    cstr.length = str.length;
+    return cstr;
+}
+
+} // namespace {}
+
+// The walks are the ImportRange and ExportRange of pe_image.hpp,
+// with the iterators kept here between calls.
+struct ppe_image
+{
+    // Export names sorted by ordinal, like collectExports() does.
+    struct NameByOrdinal
+    {
+        std::uint32_t ordinal;
+        std::uint32_t index;
+        PEStringRef   name;
+    };
+
+    ppe_image(const ppe_allocator & alloc, const void * data, const std::size_t size, const pe::ImageNTHeader * nt)
+        : allocator{ alloc }
+        , fileData{ static_cast<const std::uint8_t *>(data) }
+        , fileLength{ size }
+        , ntHeader{ nt }
+    { }
+
+    ppe_image(const ppe_image &) = delete;
+    ppe_image & operator = (const ppe_image &) = delete;
+
+    void freeExportIndex()
+    {
+        if (exportNames != nullptr)
+        {
+            allocator.free(allocator.user, exportNames, numExportNames * sizeof(NameByOrdinal));
+            exportNames    = nullptr;
+            numExportNames = 0;
+        }
+    }
+
+    ppe_allocator             allocator;
+    const std::uint8_t *      fileData;
+    std::size_t               fileLength;
+    const pe::ImageNTHeader * ntHeader;
+
+    // Import walk. The first next() takes the entry begin() decoded.
+    ImportRange               imports{ nullptr, 0, nullptr };
+    ImportDllIterator         importDll{};
+    ImportThunkIterator       importThunk{};
+    bool                      importsBegun      = false;
+    bool                      importDllPending  = false;
+    bool                      importThunkPending = false;
+
+    // Export walk: functions in ordinal order, each followed by its names and its forwarder.
+    ExportRange               exports{ nullptr, 0, nullptr };
+    ExportFunctionIterator    exportFunction{};
+    NameByOrdinal *           exportNames    = nullptr; // From 'allocator'
+    std::uint32_t             numExportNames = 0;
+    std::uint32_t             nextExportName = 0;
+    bool                      exportsBegun   = false;
+    bool                      forwarderDone  = false;
+};
+
+// ========================================================
+// Image:
+// ========================================================
+
+uint32_t ppe_abi_version(void)
+{
+    return PPE_ABI_VERSION;
+}
+
+ppe_status ppe_open_mem(const void * data, const size_t size, const ppe_allocator * allocator, ppe_image ** image)
+{
+    if (image == nullptr)
+    {
+        return PPE_ERR_ARGUMENT;
+    }
+    *image = nullptr;
+    if (data == nullptr || (allocator != nullptr && (allocator->alloc == nullptr || allocator->free == nullptr)))
+    {
+        return PPE_ERR_ARGUMENT;
+    }
+
+    // Embedders get a status code, not the messages.
+    std::ostream discardErrors{ nullptr };
+    const pe::ImageNTHeader * ntHeaderPtr = validatePE(static_cast<const std::uint8_t *>(data), size, discardErrors);
+    if (ntHeaderPtr == nullptr)
+    {
+        return PPE_ERR_NOT_PE;
+    }
+
+    ppe_allocator alloc{ mallocHook, freeHook, nullptr };
+    if (allocator != nullptr)
+    {
+        alloc = *allocator;
+    }
+
+    void * memory = alloc.alloc(alloc.user, sizeof(ppe_image));
+    if (memory == nullptr)
+    {
+        return PPE_ERR_NO_MEMORY;
+    }
+
+    *image = new (memory) ppe_image{ alloc, data, size, ntHeaderPtr };
+    stats::count(stats::Counter::Files);
+    return PPE_OK;
+}
+
+void ppe_close(ppe_image * image)
+{
+    if (image == nullptr)
+    {
+        return;
+    }
+    image->freeExportIndex();
+    const ppe_allocator alloc = image->allocator;
+    image->~ppe_image();
+    alloc.free(alloc.user, image, sizeof(ppe_image));
+}
+
+// ========================================================
+// Headers and sections:
+// ========================================================
+
+ppe_status ppe_header(const ppe_image * image, ppe_header_info * info)
+{
+    if (image == nullptr || info == nullptr)
+    {
+        return PPE_ERR_ARGUMENT;
+    }
+
+    const auto & fileHeader     = image->ntHeader->fileHeader;
+    const auto & optionalHeader = image->ntHeader->optionalHeader;
+
+    info->machine                = fileHeader.machine;
+    info->number_of_sections     = fileHeader.numberOfSections;
+    info->time_date_stamp        = fileHeader.timeDateStamp;
+    info->characteristics        = fileHeader.characteristics;
+    info->magic                  = optionalHeader.magic;
+    info->address_of_entry_point = optionalHeader.addressOfEntryPoint;
+    info->image_base             = getImageBase(image->ntHeader);
+    info->size_of_image          = optionalHeader.sizeOfImage;
+    info->subsystem              = optionalHeader.subsystem;
+    info->dll_characteristics    = optionalHeader.dllCharacteristics;
+    return PPE_OK;
+}
+
+const ppe_section * ppe_sections(const ppe_image * image, uint32_t * count)
+{
+    if (image == nullptr)
+    {
+        if (count != nullptr) { *count = 0; }
+        return nullptr;
+    }
+    // validatePE() checked that the whole table is inside the buffer.
+    if (count != nullptr)
+    {
+        *count = image->ntHeader->fileHeader.numberOfSections;
+    }
+    return reinterpret_cast<const ppe_section *>(getFirstSection(image->ntHeader));
+}
+
+// ========================================================
+// Imports:
+// ========================================================
+
+ppe_status ppe_imports_begin(ppe_image * image)
+{
+    if (image == nullptr)
+    {
+        return PPE_ERR_ARGUMENT;
+    }
+
+    image->imports      = ImportRange{ image->fileData, image->fileLength, image->ntHeader };
+    image->importDll    = ImportDllIterator{};
+    image->importThunk  = ImportThunkIterator{};
+    image->importsBegun = (image->imports.status() == PETableStatus::Ok);
+    if (!image->importsBegun)
+    {
+        return (image->imports.status() == PETableStatus::Unsupported) ? PPE_ERR_UNSUPPORTED : PPE_ERR_NOT_FOUND;
+    }
+
+    image->importDll          = image->imports.begin();
+    image->importDllPending   = true;
+    image->importThunkPending = false;
+    return PPE_OK;
+}
+
+ppe_status ppe_imports_next(ppe_image * image, ppe_import_dll * dll)
+{
+    if (image == nullptr || dll == nullptr || !image->importsBegun)
+    {
+        return PPE_ERR_ARGUMENT;
+    }
+
+    if (!image->importDllPending && image->importDll != image->imports.end())
+    {
+        ++image->importDll;
+    }
+    image->importDllPending   = false;
+    image->importThunk        = ImportThunkIterator{};
+    image->importThunkPending = false;
+
+    if (image->importDll == image->imports.end())
+    {
+        return image->importDll.stoppedEarly() ? PPE_ERR_INCOMPLETE : PPE_END;
+    }
+
+    dll->name = toCString(image->importDll->dllName);
+    switch (image->importDll->status)
+    {
+    case PEImportStatus::BadIAT     : dll->status = PPE_IMPORT_BAD_IAT;     break;
+    case PEImportStatus::MissingIAT : dll->status = PPE_IMPORT_MISSING_IAT; break;
+    default                         : dll->status = PPE_IMPORT_OK;          break;
+    }
+
+    image->importThunk        = image->importDll->symbols.begin();
+    image->importThunkPending = true;
+    return PPE_OK;
+}
+
+ppe_status ppe_import_symbols_next(ppe_image * image, ppe_import_symbol * symbol)
+{
+    if (image == nullptr || symbol == nullptr || !image->importsBegun)
+    {
+        return PPE_ERR_ARGUMENT;
+    }
+
+    const ImportThunkIterator end{};
+    if (!image->importThunkPending && image->importThunk != end)
+    {
+        ++image->importThunk;
+    }
+    image->importThunkPending = false;
+
+    if (image->importThunk == end)
+    {
+        return image->importThunk.stoppedEarly() ? PPE_ERR_INCOMPLETE : PPE_END;
+    }
+
+    symbol->name       = toCString(image->importThunk->name);
+    symbol->ordinal    = image->importThunk->ordinal;
+    symbol->by_ordinal = image->importThunk->byOrdinal ? 1 : 0;
+    return PPE_OK;
+}
+
+// ========================================================
+// Exports:
+// ========================================================
+
+ppe_status ppe_exports_begin(ppe_image * image, ppe_export_dir * dir)
+{
+    if (image == nullptr)
+    {
+        return PPE_ERR_ARGUMENT;
+    }
+
+    image->freeExportIndex();
+    image->exports        = ExportRange{ image->fileData, image->fileLength, image->ntHeader };
+    image->exportFunction = ExportFunctionIterator{};
+    image->nextExportName = 0;
+    image->forwarderDone  = false;
+    image->exportsBegun   = false;
+    if (image->exports.status() != PETableStatus::Ok)
+    {
+        return (image->exports.status() == PETableStatus::Unsupported) ? PPE_ERR_UNSUPPORTED : PPE_ERR_NOT_FOUND;
+    }
+
+    const std::uint32_t maxNames = image->exports.nameCount();
+    if (maxNames != 0)
+    {
+        auto names = static_cast<ppe_image::NameByOrdinal *>(image->allocator.alloc(image->allocator.user, maxNames * sizeof(ppe_image::NameByOrdinal)));
+        if (names == nullptr)
+        {
+            return PPE_ERR_NO_MEMORY;
+        }
+
+        std::uint32_t numNames = 0;
+        for (const auto & name : image->exports.names())
+        {
+            names[numNames].ordinal = name.ordinal;
+            names[numNames].index   = numNames;
+            names[numNames].name    = name.name;
+            ++numNames;
+        }
+        std::sort(names, names + numNames, [](const ppe_image::NameByOrdinal & a, const ppe_image::NameByOrdinal & b) {
+            return (a.ordinal != b.ordinal) ? (a.ordinal < b.ordinal) : (a.index < b.index);
+        });
+
+        // Freed with the size it was allocated with.
+        image->exportNames    = names;
+        image->numExportNames = maxNames;
+        while (numNames < maxNames)
+        {
+            names[numNames++].ordinal = UINT32_MAX; // Never matched.
+        }
+    }
+
+    image->exportFunction = image->exports.functions().begin();
+    image->exportsBegun   = true;
+
+    if (dir != nullptr)
+    {
+        dir->module_name         = toCString(image->exports.moduleName());
+        dir->number_of_functions = image->exports.numberOfFunctions();
+        dir->number_of_names     = image->exports.numberOfNames();
+        dir->ordinal_base        = image->exports.ordinalBase();
+    }
+    return PPE_OK;
+}
+
+ppe_status ppe_exports_next(ppe_image * image, ppe_export * symbol)
+{
+    if (image == nullptr || symbol == nullptr || !image->exportsBegun)
+    {
+        return PPE_ERR_ARGUMENT;
+    }
+
+    const ExportFunctionIterator end{};
+    for (; image->exportFunction != end; ++image->exportFunction, image->forwarderDone = false)
+    {
+        const ExportedFunctionRef & function = *image->exportFunction;
+
+        // Names exported for this function, then the forwarder string if it has one.
+        while (image->nextExportName < image->numExportNames && image->exportNames[image->nextExportName].ordinal < function.ordinal)
+        {
+            ++image->nextExportName;
+        }
+        if (image->nextExportName < image->numExportNames && image->exportNames[image->nextExportName].ordinal == function.ordinal)
+        {
+            symbol->name      = toCString(image->exportNames[image->nextExportName++].name);
+            symbol->ordinal   = function.ordinal;
+            symbol->rva       = function.rva;
+            symbol->forwarder = 0;
+            return PPE_OK;
+        }
+        if (function.forwarder && !image->forwarderDone)
+        {
+            image->forwarderDone = true;
+            symbol->name      = toCString(function.forwarderName);
+            symbol->ordinal   = function.ordinal;
+            symbol->rva       = function.rva;
+            symbol->forwarder = 1;
+            return PPE_OK;
+        }
+    }
+
+    return image->exports.incomplete() ? PPE_ERR_INCOMPLETE : PPE_END;
+}
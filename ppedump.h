@@ -0,0 +1,221 @@
+
+// ================================================================================================
+// -*- C -*-
+// File: ppedump.h
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: C API of libppedump, for parsing PEs held in memory by the caller (C99 or C++).
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#ifndef PPEDUMP_H
+#define PPEDUMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+/*
+-------------------------------------
+Usage
+-------------------------------------
+
+The parser works on the caller's buffer in place: nothing is copied, and
+the names handed out point into the buffer, so it must outlive the image.
+The only memory the library allocates is the ppe_image itself and, while
+the exports are walked, an index with one small entry per exported name,
+both from the ppe_allocator given to ppe_open_mem(). The tables are decoded one
+entry per call, so a caller that only wants the first few stops there.
+
+    ppe_image * image;
+    if (ppe_open_mem(data, size, NULL, &image) == PPE_OK)
+    {
+        ppe_import_dll    dll;
+        ppe_import_symbol sym;
+        if (ppe_imports_begin(image) == PPE_OK)
+        {
+            while (ppe_imports_next(image, &dll) == PPE_OK)
+            {
+                while (ppe_import_symbols_next(image, &sym) == PPE_OK) { ... }
+            }
+        }
+        ppe_close(image);
+    }
+
+An image holds one walk of each table at a time; opening the same buffer
+twice is cheap, for walking a table from two places at once. Different
+images can be used from different threads. Entries are checked against
+the buffer bounds and every walk stops after a work budget linear in the
+buffer size, returning PPE_ERR_INCOMPLETE, so malformed or hostile input
+costs no more than a well-formed file of the same size.
+
+The ABI is stable within a PPE_ABI_VERSION: the structs below don't
+change layout and functions are not removed or changed, only added.
+
+-------------------------------------
+*/
+
+#define PPE_ABI_VERSION 1
+
+// PPE_ABI_VERSION of the library linked in.
+uint32_t ppe_abi_version(void);
+
+typedef enum ppe_status
+{
+    PPE_OK             =  0,
+    PPE_END            =  1, // No more entries
+    PPE_ERR_ARGUMENT   = -1, // Null pointer, or next() without a begin()
+    PPE_ERR_NO_MEMORY  = -2, // The allocator returned null
+    PPE_ERR_NOT_PE     = -3, // Bad DOS/NT headers, or they don't fit in the buffer
+    PPE_ERR_NOT_FOUND  = -4, // The table's data directory is not inside any section
+    PPE_ERR_INCOMPLETE = -5, // Walk stopped: entries outside the buffer or over the work budget
+    PPE_ERR_UNSUPPORTED = -6 // The optional header is neither PE32 nor PE32+, so its tables can't be read
+} ppe_status;
+
+// Allocation hooks. 'alloc' must return memory aligned for any type,
+// like malloc(). 'free' gets the size passed to 'alloc'.
+typedef struct ppe_allocator
+{
+    void * (*alloc)(void * user, size_t size);
+    void   (*free)(void * user, void * ptr, size_t size);
+    void *   user;
+} ppe_allocator;
+
+// Not NUL-terminated. Points into the caller's buffer.
+typedef struct ppe_string
+{
+    const char * data;
+    size_t       length;
+} ppe_string;
+
+typedef struct ppe_image ppe_image;
+
+// Validates the headers and the section table in 'data' and creates an image over
+// it, without copying. 'allocator' may be null for malloc()/free(). On failure
+// '*image' is set to null.
+ppe_status ppe_open_mem(const void * data, size_t size, const ppe_allocator * allocator, ppe_image ** image);
+
+// Frees the image and its walk state. Null is ignored.
+void ppe_close(ppe_image * image);
+
+// ========================================================
+// Headers and sections
+// ========================================================
+
+typedef struct ppe_header_info
+{
+    // IMAGE_FILE_HEADER:
+    uint16_t machine;
+    uint16_t number_of_sections;
+    uint32_t time_date_stamp;
+    uint16_t characteristics;
+
+    // IMAGE_OPTIONAL_HEADER:
+    uint16_t magic;
+    uint32_t address_of_entry_point;
+    uint64_t image_base; // 64 bits for PE32+
+    uint32_t size_of_image;
+    uint16_t subsystem;
+    uint16_t dll_characteristics;
+} ppe_header_info;
+
+ppe_status ppe_header(const ppe_image * image, ppe_header_info * info);
+
+// Same layout as IMAGE_SECTION_HEADER.
+typedef struct ppe_section
+{
+    char     name[8]; // Not NUL-terminated if all 8 chars are used
+    uint32_t virtual_size;
+    uint32_t virtual_address;
+    uint32_t size_of_raw_data;
+    uint32_t pointer_to_raw_data;
+    uint32_t pointer_to_relocations;
+    uint32_t pointer_to_linenumbers;
+    uint16_t number_of_relocations;
+    uint16_t number_of_linenumbers;
+    uint32_t characteristics;
+} ppe_section;
+
+// The section table, in place in the caller's buffer, and its length in '*count'.
+const ppe_section * ppe_sections(const ppe_image * image, uint32_t * count);
+
+// ========================================================
+// Imports
+// ========================================================
+
+typedef enum ppe_import_status
+{
+    PPE_IMPORT_OK          = 0,
+    PPE_IMPORT_BAD_IAT     = 1, // Both thunk RVAs are zero
+    PPE_IMPORT_MISSING_IAT = 2  // Thunk RVA not inside any section
+} ppe_import_status;
+
+typedef struct ppe_import_dll
+{
+    ppe_string        name;
+    ppe_import_status status; // No symbols unless PPE_IMPORT_OK
+} ppe_import_dll;
+
+typedef struct ppe_import_symbol
+{
+    ppe_string name;       // Empty if imported by ordinal
+    uint16_t   ordinal;    // Ordinal if by_ordinal, otherwise the name hint
+    uint8_t    by_ordinal;
+} ppe_import_symbol;
+
+// Starts (or restarts) the import walk. PPE_ERR_NOT_FOUND if there's no import
+// table, PPE_ERR_UNSUPPORTED if the optional header is neither PE32 nor PE32+.
+ppe_status ppe_imports_begin(ppe_image * image);
+
+// Next imported DLL, skipping what's left of the symbols of the previous one.
+// PPE_END after the last, PPE_ERR_INCOMPLETE if the descriptors stopped early.
+ppe_status ppe_imports_next(ppe_image * image, ppe_import_dll * dll);
+
+// Next symbol imported from the current DLL. PPE_END after the last,
+// PPE_ERR_INCOMPLETE if its thunks stopped early.
+ppe_status ppe_import_symbols_next(ppe_image * image, ppe_import_symbol * symbol);
+
+// ========================================================
+// Exports
+// ========================================================
+
+typedef struct ppe_export_dir
+{
+    ppe_string module_name; // Name the PE was linked as, like "KERNEL32.dll"
+    uint32_t   number_of_functions;
+    uint32_t   number_of_names;
+    uint32_t   ordinal_base;
+} ppe_export_dir;
+
+typedef struct ppe_export
+{
+    ppe_string name;      // Mangled name, or "DLL.Func" if a forwarder
+    uint32_t   ordinal;   // Index into the functions table (not biased by ordinal_base)
+    uint32_t   rva;
+    uint8_t    forwarder;
+} ppe_export;
+
+// Starts (or restarts) the export walk and fills 'dir', which may be null.
+// PPE_ERR_NOT_FOUND if there's no export table, PPE_ERR_UNSUPPORTED if the optional
+// header is neither PE32 nor PE32+.
+ppe_status ppe_exports_begin(ppe_image * image, ppe_export_dir * dir);
+
+// Next export, by ordinal. A function exported under several names comes once per
+// name. PPE_END after the last, PPE_ERR_INCOMPLETE if the tables stopped early.
+ppe_status ppe_exports_next(ppe_image * image, ppe_export * symbol);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+
+#endif // PPEDUMP_H
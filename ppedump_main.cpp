@@ -0,0 +1,258 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: ppedump_main.cpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: Entry point of the ppedump command line tool. Everything else is in libppedump.
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#include <cstdlib>
+#include <cstring>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "portable_pe_dump.hpp"
+
+static void printHelpText(const char * progName)
+{
+    std::cout << "\n"
+        << "Usage:\n"
+        << " $ " << progName << " <filename> [options]\n"
+        << " Prints information about a Win32 Portable Executable (PE) file.\n"
+        << " PE files are usually ended with the extensions: DLL, EXE, SYS, EFI, among others.\n"
+        << " Options are:\n"
+        << "  -h, --help      Prints this message and exits.\n"
+        << "  -n, --nthdr     Prints the IMAGE_FILE_HEADER and IMAGE_OPTIONAL_HEADER.\n"
+        << "  -d, --doshdr    Prints the IMAGE_DOS_HEADER and an hexadecimal dump of the DOS stub.\n"
+        << "  -s, --sections  Prints a short summary of each PE section.\n"
+        << "  -e, --exports   Prints a list of all exported symbols. Names undecorated if possible.\n"
+        << "  -i, --imports   Prints a list of all imported dependencies. Names undecorated if possible.\n"
+        << "  -r, --relocs    Prints the relocations of each section of a COFF object (see --obj).\n"
+        << "  -t, --symbols   Prints the symbol table of a COFF object. Names undecorated if possible.\n"
+        << "  -a, --all       Shorthand option to enable all of the above (except -h/--help, of course).\n"
+        << "  --loader <how>  How files are brought into memory: read (the default) reads them whole,\n"
+        << "                  mmap maps and prefaults them, ondemand maps them and faults pages as\n"
+        << "                  they are touched. Both mappings fall back to read outside Unix.\n"
+        << "  --mapped-image  The inputs are images as mapped in memory (e.g. modules dumped from a\n"
+        << "                  process), with each section at its RVA instead of its file offset.\n"
+        << "  --stats         Prints the time spent in each phase (load, validate, each dump, flush)\n"
+        << "                  and counters (bytes read, RVA lookups, names demangled, bytes written)\n"
+        << "                  to stderr at exit. --stats-json <file> writes them as JSON instead.\n"
+        << "  --trace <file>  Writes a span for each file and phase of each thread to <file>, in the\n"
+        << "                  Chrome trace-event format (chrome://tracing, ui.perfetto.dev).\n"
+        << "\n"
+        << " Daemon mode (Unix only):\n"
+        << " $ " << progName << " --serve <socket> [--workers <n>]\n"
+        << "  Listens on a Unix domain socket and dumps the files requested by clients,\n"
+        << "  keeping the process and its caches warm between requests.\n"
+        << " $ " << progName << " --client <socket> <filename> [options]\n"
+        << "  Same as a normal run, but the work is done by the server listening on <socket>.\n"
+        << "\n"
+        << " Structural diff:\n"
+        << " $ " << progName << " diff <a.dll> <b.dll>\n"
+        << "  Prints added, removed and changed header fields, sections, imports and exports.\n"
+        << "  If both arguments are directories, PEs with the same relative path are compared.\n"
+        << "\n"
+        << " Aggregate statistics:\n"
+        << " $ " << progName << " --aggregate <files/dirs...> [--workers <n>] [--top <k>]\n"
+        << "                 [--sketch-out <file>] [--sketch-in <file>]...\n"
+        << "  Prints the most common machines, subsystems, section names and imports of a corpus,\n"
+        << "  using fixed-size sketches. --sketch-out saves them and --sketch-in merges saved ones,\n"
+        << "  so statistics of separate shards can be combined.\n"
+        << "\n"
+        << " Symbol index:\n"
+        << " $ " << progName << " --index-out <index> <files/dirs...> [--workers <n>]\n"
+        << "  Stores a small Bloom filter of the imported/exported names of each file.\n"
+        << " $ " << progName << " --index <index> --find <name> [--find <name>]... [--no-verify]\n"
+        << "  Prints the files that import or export all the names (symbols or DLLs), checking\n"
+        << "  only the filters and then re-parsing the candidates to drop false positives.\n"
+        << "\n"
+        << " Binary summaries:\n"
+        << " $ " << progName << " --summary-out <summary> <files/dirs...> [--workers <n>]\n"
+        << "  Writes the headers, sections, imports and exports of all the files into one compact\n"
+        << "  binary file that can be memory mapped and read in place (see pe_summary.hpp).\n"
+        << " $ " << progName << " --summary <summary>\n"
+        << "  Lists the files of a summary, one per line.\n"
+        << "\n"
+        << " Filtering:\n"
+        << " $ " << progName << " <files/dirs...> --where <expr> [options]\n"
+        << "  Prints the files matching <expr>, or dumps them if options are given. For example:\n"
+        << "  --where 'machine == AMD64 && imports has \"ws2_32.dll\" && exports > 100'\n"
+        << "  Fields: size timestamp entrypoint imagebase sizeofimage characteristics dllcharacteristics\n"
+        << "  machine subsystem sections dll dlls imports exports. Operators: == != < <= > >= has ! && ||\n"
+        << "\n"
+        << " Minidump modules:\n"
+        << " $ " << progName << " --minidump <files/dirs...> [options] [--workers <n>]\n"
+        << "  Lists the modules of each minidump (.dmp) with their address, size and debug ID, and\n"
+        << "  dumps the image of each module saved in the dump as it was in memory, if options are given.\n"
+        << "\n"
+        << " Libraries:\n"
+        << " $ " << progName << " --lib <files/dirs...> [--workers <n>]\n"
+        << "  Lists the import records of import libraries (.lib) by DLL, and the objects of static\n"
+        << "  libraries with the public symbols of each. Names undecorated if possible.\n"
+        << " $ " << progName << " --lib <files/dirs...> --find <name> [--find <name>]...\n"
+        << "  Looks the names up in the symbol index of each library and prints the DLL that\n"
+        << "  imports them, or the object that defines them.\n"
+        << "\n"
+        << " Objects:\n"
+        << " $ " << progName << " --obj <files/dirs...> [-n] [-s] [-r] [-t] [--workers <n>]\n"
+        << "  Dumps COFF object files (.obj): machine, section and symbol counts, and the file header,\n"
+        << "  section table, relocations and symbol table if asked. A single object needs no --obj.\n"
+        << "\n"
+        << " Rebasing:\n"
+        << " $ " << progName << " <filename> --rebase <address> -o <output> [--mapped-image]\n"
+        << "  Lays the PE out as the loader maps it, applies its base relocations for <address>\n"
+        << "  and writes the relocated image, in the mapped layout, to <output>. <address> must\n"
+        << "  be 64 KiB aligned, as the loader only maps images there.\n"
+        << "\n"
+        << " Watch mode (Linux only):\n"
+        << " $ " << progName << " --watch <dir> [--debounce <ms>]\n"
+        << "  Prints a JSON line for each PE under <dir>, then a new line whenever one is created,\n"
+        << "  modified or deleted. Files are parsed after <ms> without changes (default 250).\n"
+        << "\n"
+        << "Created by Guilherme R. Lampert, " << __DATE__ << ".\n";
+}
+
+// Latest spans kept per thread by --trace. Under 64 bytes each, allocated as needed.
+static constexpr std::size_t TraceEventsPerThread = 1 << 18;
+
+// Runs the mode selected by the command line. Returns the process exit code.
+static int runMode(const ProgramFlags & prog, int argc, const char * argv[])
+{
+    if (!prog.serveSocketPath.empty())
+    {
+        return runServer(prog);
+    }
+    if (!prog.clientSocketPath.empty())
+    {
+        return runClient(prog, argc, argv);
+    }
+    if (!prog.watchDir.empty())
+    {
+        return runWatch(prog);
+    }
+    if (prog.aggregate)
+    {
+        return runAggregate(prog);
+    }
+    if (!prog.indexOutput.empty() || !prog.indexInput.empty())
+    {
+        return runSymbolIndex(prog);
+    }
+    if (!prog.summaryOutput.empty() || !prog.summaryInput.empty())
+    {
+        return runSummary(prog);
+    }
+    if (prog.rebase)
+    {
+        return runRebase(prog);
+    }
+    if (prog.minidump)
+    {
+        return runMinidump(prog);
+    }
+    if (prog.lib)
+    {
+        return runLib(prog);
+    }
+    if (prog.obj)
+    {
+        return runObj(prog);
+    }
+    if (!prog.whereExpression.empty())
+    {
+        return runWhere(prog);
+    }
+
+    // Objects start with the IMAGE_FILE_HEADER of a PE, without the 'MZ' header before it.
+    const char * filename = argv[1];
+    if (looksLikeCoffObject(filename))
+    {
+        return runObj(prog);
+    }
+    return processFile(filename, prog, std::cout, std::cerr) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, const char * argv[])
+{
+    if (argc <= 1)
+    {
+        printHelpText(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (std::strcmp(argv[1], "diff") == 0)
+    {
+        if (argc != 4)
+        {
+            std::cerr << "Usage: " << argv[0] << " diff <a.dll> <b.dll>\n";
+            return 2;
+        }
+        return runDiff(argv[2], argv[3]);
+    }
+
+    const ProgramFlags prog = processCmdLine(argc, argv);
+    if (prog.printHelpAndExit)
+    {
+        printHelpText(argv[0]);
+        return EXIT_SUCCESS; // Just -h/--help is fine and not an error.
+    }
+    if (prog.invalidCmdLine)
+    {
+        return EXIT_FAILURE;
+    }
+
+    setFileLoader(prog.loader);
+    setImageLayout(prog.mappedImage ? PELayout::Mapped : PELayout::File);
+
+    if (prog.printStats || !prog.statsJsonOutput.empty())
+    {
+        stats::enable();
+        stats::countStdoutBytes();
+    }
+    if (!prog.traceOutput.empty())
+    {
+        stats::enableTrace(TraceEventsPerThread);
+    }
+
+    const int exitCode = runMode(prog, argc, argv);
+
+    if (stats::enabled || stats::tracing)
+    {
+        stats::Scope statsScope{ stats::Phase::Flush };
+        std::cout.flush();
+    }
+    if (stats::tracing && !stats::writeTrace(prog.traceOutput, std::cerr))
+    {
+        return EXIT_FAILURE;
+    }
+    if (stats::enabled)
+    {
+        if (prog.printStats)
+        {
+            stats::report(std::cerr, /* json = */ false);
+        }
+        if (!prog.statsJsonOutput.empty())
+        {
+            std::ofstream jsonFile{ prog.statsJsonOutput };
+            stats::report(jsonFile, /* json = */ true);
+            if (!jsonFile)
+            {
+                std::cerr << color::red() << "Unable to write \"" << prog.statsJsonOutput << "\"!" << color::restore() << "\n";
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    return exitCode;
+}
@@ -0,0 +1,639 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: run_stats.cpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: Per-phase timing and event counters for --stats, and the --trace spans.
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "portable_pe_dump.hpp"
+
+#if defined(PPEDUMP_TRACK_ALLOCS) && defined(PPEDUMP_POSIX)
+    #include <sys/resource.h>
+#endif // PPEDUMP_TRACK_ALLOCS && PPEDUMP_POSIX
+
+namespace stats
+{
+
+bool enabled = false;
+bool tracing = false;
+
+namespace
+{
+
+constexpr int NumPhases = static_cast<int>(Phase::Count);
+
+// Allocations outside of any phase go to the extra slot at the end.
+constexpr int OtherPhase = NumPhases;
+
+struct FileRecord
+{
+    std::string   filename{};
+    std::uint64_t allocs    = 0;
+    std::uint64_t bytes     = 0;
+    std::uint64_t peakHeap  = 0; // Largest heap growth while processing the file
+    long          peakRssKB = 0; // Process peak RSS when the file was done
+};
+
+// One complete ("X") event of the trace.
+struct TraceEvent
+{
+    std::uint64_t startNs = 0;
+    std::uint64_t durNs   = 0;
+    int           phase   = 0; // OtherPhase for a file span
+    std::string   file{};      // Reuses its capacity when the ring wraps
+};
+
+struct ThreadBlock
+{
+    unsigned      threadIndex = 0; // Trace 'tid', in order of first use
+    std::uint64_t calls[NumPhases]       = {};
+    std::uint64_t wallNs[NumPhases]      = {};
+    std::uint64_t cpuNs[NumPhases]       = {};
+    std::uint64_t allocs[NumPhases + 1]  = {};
+    std::uint64_t allocBytes[NumPhases + 1] = {};
+    std::uint64_t counts[static_cast<int>(Counter::Count)] = {};
+    std::vector<FileRecord> files{};
+
+    // Ring of the latest trace events; grows up to the capacity, then wraps.
+    std::vector<TraceEvent> trace{};
+    std::uint64_t numTraceEvents = 0;
+};
+
+std::size_t   traceCapacity = 0;
+std::uint64_t traceStartNs  = 0;
+
+// Set between FileScope::begin() and end(), for the nesting check.
+thread_local bool inFile = false;
+
+// One bit per Phase with a Scope open on this thread, for the same check.
+thread_local unsigned openPhases = 0;
+
+#ifdef PPEDUMP_TRACK_ALLOCS
+// Set while the tracker itself allocates, so that it doesn't recurse.
+thread_local bool insideHook = false;
+#endif // PPEDUMP_TRACK_ALLOCS
+
+// Blocks of all the threads that ever recorded something. They outlive
+// their threads, so the totals can be summed up once the workers are joined.
+std::mutex blocksMutex;
+std::vector<std::unique_ptr<ThreadBlock>> allBlocks;
+
+ThreadBlock & threadBlock()
+{
+    thread_local ThreadBlock * block = nullptr;
+    if (block == nullptr)
+    {
+    #ifdef PPEDUMP_TRACK_ALLOCS
+        const bool wasInsideHook = insideHook;
+        insideHook = true;
+    #endif // PPEDUMP_TRACK_ALLOCS
+
+        std::lock_guard<std::mutex> lock{ blocksMutex };
+        allBlocks.emplace_back(new ThreadBlock{});
+        block = allBlocks.back().get();
+        block->threadIndex = static_cast<unsigned>(allBlocks.size() - 1);
+
+    #ifdef PPEDUMP_TRACK_ALLOCS
+        insideHook = wasInsideHook;
+    #endif // PPEDUMP_TRACK_ALLOCS
+    }
+    return *block;
+}
+
+std::uint64_t wallTimeNs()
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+std::uint64_t cpuTimeNs()
+{
+#ifdef PPEDUMP_POSIX
+    struct timespec ts;
+    ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<std::uint64_t>(ts.tv_nsec);
+#else // !PPEDUMP_POSIX
+    // Process time, so only meaningful for single threaded runs.
+    return static_cast<std::uint64_t>(std::clock()) * (1000000000ull / CLOCKS_PER_SEC);
+#endif // PPEDUMP_POSIX
+}
+
+void recordTraceEvent(const int phase, const std::uint64_t startNs, const std::uint64_t endNs, const char * file)
+{
+    ThreadBlock & block = threadBlock();
+    TraceEvent * event;
+    if (block.trace.size() < traceCapacity)
+    {
+        block.trace.emplace_back();
+        event = &block.trace.back();
+    }
+    else
+    {
+        event = &block.trace[block.numTraceEvents % traceCapacity];
+    }
+
+    event->startNs = startNs;
+    event->durNs   = endNs - startNs;
+    event->phase   = phase;
+    if (file != nullptr)
+    {
+        event->file = file;
+    }
+    ++block.numTraceEvents;
+}
+
+#ifdef PPEDUMP_TRACK_ALLOCS
+
+// Per-thread allocation state. All plain values, so using them
+// from operator new doesn't itself allocate.
+thread_local int currentPhase = OtherPhase;
+
+// Bytes allocated minus bytes freed by this thread. Blocks freed by another
+// thread than the one that allocated them skew it, which the parser never does.
+thread_local std::int64_t liveBytes = 0;
+
+thread_local std::int64_t  fileStartLive = 0;
+thread_local std::int64_t  filePeakLive  = 0;
+thread_local std::uint64_t fileAllocs    = 0;
+thread_local std::uint64_t fileBytes     = 0;
+
+void trackAlloc(const std::size_t size)
+{
+    liveBytes += static_cast<std::int64_t>(size);
+    if (!enabled || insideHook)
+    {
+        return;
+    }
+
+    insideHook = true;
+    ThreadBlock & block = threadBlock();
+    block.allocs[currentPhase]     += 1;
+    block.allocBytes[currentPhase] += size;
+    insideHook = false;
+
+    if (inFile)
+    {
+        fileAllocs += 1;
+        fileBytes  += size;
+        filePeakLive = std::max(filePeakLive, liveBytes);
+    }
+}
+
+void trackFree(const std::size_t size)
+{
+    liveBytes -= static_cast<std::int64_t>(size);
+}
+
+long processPeakRssKB()
+{
+#ifdef PPEDUMP_POSIX
+    struct rusage usage;
+    if (::getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        #ifdef __APPLE__
+        return static_cast<long>(usage.ru_maxrss / 1024); // Bytes on macOS
+        #else // !__APPLE__
+        return static_cast<long>(usage.ru_maxrss);
+        #endif // __APPLE__
+    }
+#endif // PPEDUMP_POSIX
+    return 0;
+}
+
+#endif // PPEDUMP_TRACK_ALLOCS
+
+const char * const phaseNames[] = {
+    "load", "validate", "nt_headers", "dos_header", "sections", "exports", "imports", "relocations", "symbols", "flush"
+};
+const char * const counterNames[] = {
+    "files", "bytes_read", "rva_lookups", "names_demangled", "bytes_written"
+};
+static_assert(sizeof(phaseNames)   / sizeof(phaseNames[0])   == static_cast<int>(Phase::Count),   "Update phaseNames");
+static_assert(sizeof(counterNames) / sizeof(counterNames[0]) == static_cast<int>(Counter::Count), "Update counterNames");
+
+// Forwards to the real stdout buffer, counting the bytes on the way.
+class CountingBuffer final : public std::streambuf
+{
+public:
+    explicit CountingBuffer(std::streambuf * target) : target_{ target } { }
+    CountingBuffer(const CountingBuffer &) = delete;
+    CountingBuffer & operator = (const CountingBuffer &) = delete;
+
+protected:
+    int_type overflow(const int_type c) override
+    {
+        if (traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            return traits_type::not_eof(c);
+        }
+        addCount(Counter::BytesWritten, 1);
+        return target_->sputc(traits_type::to_char_type(c));
+    }
+    std::streamsize xsputn(const char * str, const std::streamsize count) override
+    {
+        addCount(Counter::BytesWritten, static_cast<std::uint64_t>(count));
+        return target_->sputn(str, count);
+    }
+    int sync() override
+    {
+        return target_->pubsync();
+    }
+
+private:
+    std::streambuf * target_;
+};
+
+} // namespace {}
+
+void enable()
+{
+    enabled = true;
+}
+
+void addCount(const Counter counter, const std::uint64_t amount)
+{
+    threadBlock().counts[static_cast<int>(counter)] += amount;
+}
+
+std::uint64_t total(const Counter counter)
+{
+    std::uint64_t sum = 0;
+    std::lock_guard<std::mutex> lock{ blocksMutex };
+    for (const auto & block : allBlocks)
+    {
+        sum += block->counts[static_cast<int>(counter)];
+    }
+    return sum;
+}
+
+bool Scope::begin()
+{
+    const unsigned bit = 1u << static_cast<unsigned>(phase_);
+    if (openPhases & bit)
+    {
+        return false;
+    }
+
+    openPhases |= bit;
+#ifdef PPEDUMP_TRACK_ALLOCS
+    outerPhase_  = currentPhase;
+    currentPhase = static_cast<int>(phase_);
+#endif // PPEDUMP_TRACK_ALLOCS
+    wallStartNs_ = wallTimeNs();
+    cpuStartNs_  = enabled ? cpuTimeNs() : 0;
+    return true;
+}
+
+void Scope::end()
+{
+    const std::uint64_t wallEndNs = wallTimeNs();
+    const int p = static_cast<int>(phase_);
+    openPhases &= ~(1u << p);
+    if (enabled)
+    {
+        ThreadBlock & block = threadBlock();
+        block.calls[p]  += 1;
+        block.wallNs[p] += wallEndNs - wallStartNs_;
+        block.cpuNs[p]  += cpuTimeNs() - cpuStartNs_;
+    }
+    if (tracing)
+    {
+        recordTraceEvent(p, wallStartNs_, wallEndNs, nullptr);
+    }
+#ifdef PPEDUMP_TRACK_ALLOCS
+    currentPhase = outerPhase_;
+#endif // PPEDUMP_TRACK_ALLOCS
+}
+
+bool FileScope::begin()
+{
+    if (inFile)
+    {
+        return false;
+    }
+
+    inFile       = true;
+    wallStartNs_ = wallTimeNs();
+#ifdef PPEDUMP_TRACK_ALLOCS
+    fileStartLive = liveBytes;
+    filePeakLive  = liveBytes;
+    fileAllocs    = 0;
+    fileBytes     = 0;
+#endif // PPEDUMP_TRACK_ALLOCS
+    return true;
+}
+
+void FileScope::end()
+{
+    inFile = false;
+    if (tracing)
+    {
+        recordTraceEvent(OtherPhase, wallStartNs_, wallTimeNs(), filename_);
+    }
+
+#ifdef PPEDUMP_TRACK_ALLOCS
+    if (!enabled)
+    {
+        return;
+    }
+
+    FileRecord record;
+    record.allocs    = fileAllocs;
+    record.bytes     = fileBytes;
+    record.peakHeap  = static_cast<std::uint64_t>(filePeakLive - fileStartLive);
+    record.peakRssKB = processPeakRssKB();
+
+    insideHook = true; // Don't count the bookkeeping itself
+    record.filename = filename_;
+    threadBlock().files.push_back(std::move(record));
+    insideHook = false;
+#endif // PPEDUMP_TRACK_ALLOCS
+}
+
+void countStdoutBytes()
+{
+    // Lives until exit, as std::cout may still be flushed by then.
+    static CountingBuffer countingBuffer{ std::cout.rdbuf() };
+    std::cout.rdbuf(&countingBuffer);
+}
+
+void report(std::ostream & out, const bool json)
+{
+    ThreadBlock total;
+    std::size_t numThreads = 0;
+    {
+        std::lock_guard<std::mutex> lock{ blocksMutex };
+        for (const auto & block : allBlocks)
+        {
+            for (int p = 0; p < NumPhases; ++p)
+            {
+                total.calls[p]  += block->calls[p];
+                total.wallNs[p] += block->wallNs[p];
+                total.cpuNs[p]  += block->cpuNs[p];
+            }
+            for (int p = 0; p <= NumPhases; ++p)
+            {
+                total.allocs[p]     += block->allocs[p];
+                total.allocBytes[p] += block->allocBytes[p];
+            }
+            total.files.insert(total.files.end(), block->files.begin(), block->files.end());
+            for (int c = 0; c < static_cast<int>(Counter::Count); ++c)
+            {
+                total.counts[c] += block->counts[c];
+            }
+        }
+        numThreads = allBlocks.size();
+    }
+
+    if (json)
+    {
+        out << "{\"threads\":" << numThreads << ",\"phases\":{";
+        for (int p = 0; p < static_cast<int>(Phase::Count); ++p)
+        {
+            out << (p ? "," : "") << "\"" << phaseNames[p] << "\":{"
+                << "\"calls\":"   << total.calls[p]
+                << ",\"wall_ns\":" << total.wallNs[p]
+                << ",\"cpu_ns\":"  << total.cpuNs[p];
+        #ifdef PPEDUMP_TRACK_ALLOCS
+            out << ",\"allocs\":" << total.allocs[p] << ",\"alloc_bytes\":" << total.allocBytes[p];
+        #endif // PPEDUMP_TRACK_ALLOCS
+            out << "}";
+        }
+    #ifdef PPEDUMP_TRACK_ALLOCS
+        out << ",\"other\":{\"allocs\":" << total.allocs[OtherPhase]
+            << ",\"alloc_bytes\":" << total.allocBytes[OtherPhase] << "}";
+    #endif // PPEDUMP_TRACK_ALLOCS
+        out << "},\"counters\":{";
+        for (int c = 0; c < static_cast<int>(Counter::Count); ++c)
+        {
+            out << (c ? "," : "") << "\"" << counterNames[c] << "\":" << total.counts[c];
+        }
+        out << "}";
+    #ifdef PPEDUMP_TRACK_ALLOCS
+        out << ",\"files\":[";
+        for (std::size_t f = 0; f < total.files.size(); ++f)
+        {
+            const FileRecord & record = total.files[f];
+            out << (f ? "," : "") << "{\"path\":" << jsonString(record.filename)
+                << ",\"allocs\":" << record.allocs << ",\"alloc_bytes\":" << record.bytes
+                << ",\"peak_heap\":" << record.peakHeap << ",\"peak_rss_kb\":" << record.peakRssKB << "}";
+        }
+        out << "]";
+    #endif // PPEDUMP_TRACK_ALLOCS
+        out << "}\n";
+        return;
+    }
+
+    // Wall times of parallel runs are summed over the threads, like the CPU times.
+    out << "\nStats (" << numThreads << " thread" << (numThreads == 1 ? "" : "s") << "):\n"
+        << std::left << std::setw(14) << "phase" << std::right
+        << std::setw(10) << "calls" << std::setw(14) << "wall ms" << std::setw(14) << "cpu ms";
+#ifdef PPEDUMP_TRACK_ALLOCS
+    out << std::setw(12) << "allocs" << std::setw(14) << "alloc KB";
+#endif // PPEDUMP_TRACK_ALLOCS
+    out << "\n";
+    for (int p = 0; p < NumPhases; ++p)
+    {
+        out << std::left << std::setw(14) << phaseNames[p] << std::right << std::fixed << std::setprecision(3)
+            << std::setw(10) << total.calls[p]
+            << std::setw(14) << static_cast<double>(total.wallNs[p]) / 1e6
+            << std::setw(14) << static_cast<double>(total.cpuNs[p])  / 1e6;
+    #ifdef PPEDUMP_TRACK_ALLOCS
+        out << std::setw(12) << total.allocs[p] << std::setw(14) << std::setprecision(1)
+            << static_cast<double>(total.allocBytes[p]) / 1024.0;
+    #endif // PPEDUMP_TRACK_ALLOCS
+        out << "\n";
+    }
+#ifdef PPEDUMP_TRACK_ALLOCS
+    out << std::left << std::setw(52) << "other" << std::right
+        << std::setw(12) << total.allocs[OtherPhase] << std::setw(14) << std::setprecision(1)
+        << static_cast<double>(total.allocBytes[OtherPhase]) / 1024.0 << "\n";
+#endif // PPEDUMP_TRACK_ALLOCS
+    out << "\n";
+    for (int c = 0; c < static_cast<int>(Counter::Count); ++c)
+    {
+        out << std::left << std::setw(24) << counterNames[c] << std::right << std::setw(14) << total.counts[c] << "\n";
+    }
+
+#ifdef PPEDUMP_TRACK_ALLOCS
+    // The files that grew the heap the most; --stats-json lists all of them.
+    std::sort(total.files.begin(), total.files.end(),
+              [](const FileRecord & a, const FileRecord & b) { return a.peakHeap > b.peakHeap; });
+    if (!total.files.empty())
+    {
+        out << "\n" << std::setw(12) << "peak heap KB" << std::setw(12) << "allocs"
+            << std::setw(14) << "alloc KB" << std::setw(12) << "RSS KB" << "  file\n";
+    }
+    for (std::size_t f = 0; f < total.files.size() && f < 10; ++f)
+    {
+        const FileRecord & record = total.files[f];
+        out << std::setprecision(1)
+            << std::setw(12) << static_cast<double>(record.peakHeap) / 1024.0
+            << std::setw(12) << record.allocs
+            << std::setw(14) << static_cast<double>(record.bytes) / 1024.0
+            << std::setw(12) << record.peakRssKB << "  " << record.filename << "\n";
+    }
+#endif // PPEDUMP_TRACK_ALLOCS
+}
+
+// ========================================================
+// Trace output
+// ========================================================
+
+void enableTrace(const std::size_t eventsPerThread)
+{
+    traceCapacity = std::max<std::size_t>(eventsPerThread, 1);
+    traceStartNs  = wallTimeNs();
+    tracing       = true;
+}
+
+bool writeTrace(const std::string & filename, std::ostream & errOut)
+{
+    std::ofstream out{ filename };
+    if (!out)
+    {
+        errOut << "Unable to open \"" << filename << "\" for writing!\n";
+        return false;
+    }
+
+    // Timestamps are in microseconds since enableTrace(). Phase spans are
+    // named after the phase; file spans after the file, with the full path
+    // as an argument.
+    std::uint64_t numDropped = 0;
+    bool first = true;
+    char timing[96];
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    std::lock_guard<std::mutex> lock{ blocksMutex };
+    for (const auto & block : allBlocks)
+    {
+        if (block->trace.empty())
+        {
+            continue;
+        }
+
+        const std::string threadName = (block->threadIndex == 0) ? "main" : "worker " + std::to_string(block->threadIndex);
+        out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << block->threadIndex
+            << ",\"args\":{\"name\":" << jsonString(threadName) << "}}";
+        first = false;
+
+        for (const TraceEvent & event : block->trace)
+        {
+            std::snprintf(timing, sizeof(timing), "\"ts\":%.3f,\"dur\":%.3f",
+                          static_cast<double>(event.startNs - traceStartNs) / 1000.0,
+                          static_cast<double>(event.durNs) / 1000.0);
+
+            out << ",\n{";
+            if (event.phase == OtherPhase)
+            {
+                const std::size_t slash = event.file.find_last_of("/\\");
+                out << "\"name\":" << jsonString(slash == std::string::npos ? event.file : event.file.substr(slash + 1))
+                    << ",\"cat\":\"file\",\"args\":{\"path\":" << jsonString(event.file) << "},";
+            }
+            else
+            {
+                out << "\"name\":\"" << phaseNames[event.phase] << "\",\"cat\":\"phase\",";
+            }
+            out << "\"ph\":\"X\"," << timing << ",\"pid\":1,\"tid\":" << block->threadIndex << "}";
+        }
+        numDropped += block->numTraceEvents - block->trace.size();
+    }
+    out << "\n],\"otherData\":{\"droppedEvents\":" << numDropped << "}}\n";
+
+    if (numDropped != 0)
+    {
+        errOut << "Trace ring buffers wrapped; the oldest " << numDropped << " events were dropped.\n";
+    }
+    if (!out)
+    {
+        errOut << "Unable to write \"" << filename << "\"!\n";
+        return false;
+    }
+    return true;
+}
+
+// ========================================================
+// Allocation hooks
+// ========================================================
+
+#ifdef PPEDUMP_TRACK_ALLOCS
+
+// Every block is prefixed by its size, so operator delete can account for it.
+// Keeps the alignment malloc() gives.
+static constexpr std::size_t AllocHeaderSize = alignof(std::max_align_t);
+
+static void * trackedAlloc(const std::size_t size, const bool throwOnFailure)
+{
+    auto * raw = static_cast<unsigned char *>(std::malloc(size + AllocHeaderSize));
+    if (raw == nullptr)
+    {
+        if (throwOnFailure)
+        {
+            throw std::bad_alloc{};
+        }
+        return nullptr;
+    }
+    *reinterpret_cast<std::size_t *>(raw) = size;
+    trackAlloc(size);
+    return raw + AllocHeaderSize;
+}
+
+static void trackedFree(void * ptr)
+{
+    if (ptr != nullptr)
+    {
+        auto * raw = static_cast<unsigned char *>(ptr) - AllocHeaderSize;
+        trackFree(*reinterpret_cast<const std::size_t *>(raw));
+        std::free(raw);
+    }
+}
+
+#endif // PPEDUMP_TRACK_ALLOCS
+
+} // namespace stats {}
+
+#ifdef PPEDUMP_TRACK_ALLOCS
+
+// The nothrow forms are replaced too, since the library
+// versions may not go through the ones above.
+void * operator new(std::size_t size) { return stats::trackedAlloc(size, true); }
+void * operator new[](std::size_t size) { return stats::trackedAlloc(size, true); }
+void * operator new(std::size_t size, const std::nothrow_t &) noexcept { return stats::trackedAlloc(size, false); }
+void * operator new[](std::size_t size, const std::nothrow_t &) noexcept { return stats::trackedAlloc(size, false); }
+
+void operator delete(void * ptr) noexcept { stats::trackedFree(ptr); }
+void operator delete[](void * ptr) noexcept { stats::trackedFree(ptr); }
+void operator delete(void * ptr, std::size_t) noexcept { stats::trackedFree(ptr); }
+void operator delete[](void * ptr, std::size_t) noexcept { stats::trackedFree(ptr); }
+void operator delete(void * ptr, const std::nothrow_t &) noexcept { stats::trackedFree(ptr); }
+void operator delete[](void * ptr, const std::nothrow_t &) noexcept { stats::trackedFree(ptr); }
+
+#endif // PPEDUMP_TRACK_ALLOCS
@@ -0,0 +1,681 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: server_mode.cpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: Daemon mode. Serves dump requests over a Unix domain socket from a pool of workers.
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "portable_pe_dump.hpp"
+
+#ifdef PPEDUMP_POSIX
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <pthread.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif // PPEDUMP_POSIX
+
+/*
+-------------------------------------
+Daemon protocol
+-------------------------------------
+
+Clients connect to the Unix domain socket and send one request per line.
+A request is the same command line a normal ppedump run would take, minus
+the program name, with the arguments separated by TAB characters so that
+paths can contain spaces:
+
+    /abs/path/to/file.dll <TAB> -e <TAB> -i <LF>
+
+Each request is answered with a status line followed by the payload:
+
+    OK <payload length in bytes> <LF> <payload>
+    ERR <payload length in bytes> <LF> <payload>
+
+The payload of an OK reply is exactly what ppedump would have written to
+stdout (without colors). The payload of an ERR reply is the error message.
+A connection can send any number of requests; they are answered in order.
+
+The main thread polls the listening socket and every connection that has
+no request in flight. Each complete request line is queued on its own, so
+a worker is only held for the time it takes to answer one request, and
+idle connections cost no worker. Separate connections are served in
+parallel by the worker threads, which all share the same process-wide
+caches (demangled names, etc). The workers block SIGINT and SIGTERM, so
+the stop signals always land on the main thread.
+
+-------------------------------------
+*/
+
+#ifdef PPEDUMP_POSIX
+
+namespace
+{
+
+// Total demangled names kept by the server. At a few hundred bytes per
+// entry this caps the cache at a few tens of megabytes.
+const std::size_t ServerDemangleCacheSize = 128 * 1024;
+
+// Requests longer than this are considered garbage and drop the connection.
+const std::size_t MaxRequestLength = 64 * 1024;
+
+volatile std::sig_atomic_t stopRequested = 0;
+
+void onStopSignal(int)
+{
+    stopRequested = 1;
+}
+
+bool writeAll(const int fd, const char * data, std::size_t sizeInBytes)
+{
+    while (sizeInBytes > 0)
+    {
+        const ssize_t written = ::write(fd, data, sizeInBytes);
+        if (written < 0)
+        {
+            if (errno == EINTR) { continue; }
+            return false;
+        }
+        data        += written;
+        sizeInBytes -= static_cast<std::size_t>(written);
+    }
+    return true;
+}
+
+// Buffered line reader over a socket. Returns false on EOF or error.
+class LineReader
+{
+public:
+    explicit LineReader(const int fd) : fd_{ fd }, buffer_{}, start_{ 0 } { }
+
+    bool readLine(std::string & line)
+    {
+        while (!takeLine(line))
+        {
+            if (overflowed() || !readMore())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Moves the next complete line out of the buffer, without reading the socket.
+    bool takeLine(std::string & line)
+    {
+        const auto newline = std::find(buffer_.begin() + start_, buffer_.end(), '\n');
+        if (newline == buffer_.end())
+        {
+            return false;
+        }
+        line.assign(buffer_.begin() + start_, newline);
+        start_ = static_cast<std::size_t>(newline - buffer_.begin()) + 1;
+        return true;
+    }
+
+    // A partial line longer than any sane request.
+    bool overflowed() const
+    {
+        return (buffer_.size() - start_) > MaxRequestLength;
+    }
+
+    // Appends one read() worth of data to the buffer. Returns false on EOF or error.
+    bool readMore()
+    {
+        // Compact before reading more.
+        buffer_.erase(buffer_.begin(), buffer_.begin() + start_);
+        start_ = 0;
+
+        for (;;)
+        {
+            char chunk[4096];
+            const ssize_t count = ::read(fd_, chunk, sizeof(chunk));
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                return false;
+            }
+            buffer_.insert(buffer_.end(), chunk, chunk + count);
+            return true;
+        }
+    }
+
+    // Reads exactly 'count' bytes (used by the client to fetch the reply payload).
+    bool readBytes(std::string & data, const std::size_t count)
+    {
+        data.clear();
+        const std::size_t buffered = std::min(count, buffer_.size() - start_);
+        data.assign(buffer_.begin() + start_, buffer_.begin() + start_ + buffered);
+        start_ += buffered;
+
+        while (data.size() < count)
+        {
+            char chunk[4096];
+            const ssize_t got = ::read(fd_, chunk, std::min(sizeof(chunk), count - data.size()));
+            if (got < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (got <= 0)
+            {
+                return false;
+            }
+            data.append(chunk, static_cast<std::size_t>(got));
+        }
+        return true;
+    }
+
+private:
+    const int fd_;
+    std::vector<char> buffer_;
+    std::size_t start_;
+};
+
+std::vector<std::string> splitRequest(const std::string & line)
+{
+    std::vector<std::string> args;
+    std::string::size_type start = 0;
+    for (;;)
+    {
+        const auto tab = line.find('\t', start);
+        args.emplace_back(line, start, (tab == std::string::npos) ? std::string::npos : (tab - start));
+        if (tab == std::string::npos)
+        {
+            break;
+        }
+        start = tab + 1;
+    }
+    return args;
+}
+
+bool sendReply(const int fd, const bool ok, const std::string & payload)
+{
+    const std::string status = (ok ? "OK " : "ERR ") + std::to_string(payload.size()) + "\n";
+    return writeAll(fd, status.data(), status.size()) &&
+           writeAll(fd, payload.data(), payload.size());
+}
+
+// Returns false if the reply couldn't be sent.
+bool serveRequest(const int fd, const std::string & line)
+{
+    const std::vector<std::string> args = splitRequest(line);
+
+    // Rebuild an argv[] like main() would see it.
+    std::vector<const char *> argv;
+    argv.push_back("ppedump");
+    for (const auto & arg : args)
+    {
+        argv.push_back(arg.c_str());
+    }
+
+    std::ostringstream out;
+    std::ostringstream errOut;
+
+    const ProgramFlags prog = processCmdLine(static_cast<int>(argv.size()), argv.data());
+    if (prog.invalidCmdLine || prog.printHelpAndExit ||
+        !prog.serveSocketPath.empty() || !prog.clientSocketPath.empty())
+    {
+        return sendReply(fd, false, "Invalid request: \"" + line + "\"\n");
+    }
+
+    bool ok;
+    try
+    {
+        ok = processFile(argv[1], prog, out, errOut);
+    }
+    catch (const std::exception & e)
+    {
+        ok = false;
+        errOut << "Exception while processing \"" << argv[1] << "\": " << e.what() << "\n";
+    }
+
+    return sendReply(fd, ok, ok ? out.str() : errOut.str());
+}
+
+struct Request
+{
+    int         fd = -1;
+    std::string line{};
+};
+
+// Requests read by the main thread and waiting for a worker. Workers hand
+// their connection back through finish(), which wakes up the main thread's
+// poll() by writing to 'wakeFd'.
+class RequestQueue
+{
+public:
+    explicit RequestQueue(const int wakeFd)
+        : mutex_{}, cond_{}, pending_{}, finished_{}, wakeFd_{ wakeFd }, closed_{ false } { }
+
+    void push(const int fd, std::string && line)
+    {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        Request request;
+        request.fd   = fd;
+        request.line = std::move(line);
+        pending_.push_back(std::move(request));
+        cond_.notify_one();
+    }
+
+    // Blocks until a request is available. Returns false once closed.
+    bool pop(Request & request)
+    {
+        std::unique_lock<std::mutex> lock{ mutex_ };
+        cond_.wait(lock, [this]() { return closed_ || !pending_.empty(); });
+        if (closed_)
+        {
+            return false;
+        }
+        request = std::move(pending_.front());
+        pending_.pop_front();
+        return true;
+    }
+
+    // The request on 'fd' was answered; 'keep' is false if the connection broke.
+    void finish(const int fd, const bool keep)
+    {
+        {
+            std::lock_guard<std::mutex> lock{ mutex_ };
+            finished_.emplace_back(fd, keep);
+        }
+        // Non-blocking: if the pipe is full the main thread is already due to wake up.
+        const char wake = 1;
+        const ssize_t ignored = ::write(wakeFd_, &wake, 1);
+        (void)ignored;
+    }
+
+    std::vector<std::pair<int, bool>> takeFinished()
+    {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        std::vector<std::pair<int, bool>> finished;
+        finished.swap(finished_);
+        return finished;
+    }
+
+    // Wakes up all workers. Requests still queued are dropped.
+    void close()
+    {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        closed_ = true;
+        pending_.clear();
+        cond_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<Request> pending_;
+    std::vector<std::pair<int, bool>> finished_;
+    const int wakeFd_;
+    bool closed_;
+};
+
+void workerLoop(RequestQueue & queue)
+{
+    Request request;
+    while (queue.pop(request))
+    {
+        const bool sent = serveRequest(request.fd, request.line);
+        queue.finish(request.fd, sent);
+    }
+}
+
+// A client connection, owned by the main thread. It is polled only while
+// no request of it is with a worker, so its replies go out in order.
+struct Connection
+{
+    explicit Connection(const int fd) : reader{ fd } { }
+
+    LineReader reader;
+    bool       busy = false; // A request is queued or being served.
+    bool       eof  = false; // The client closed its end (or the read failed).
+};
+
+// Queues the next buffered request of an idle connection. Returns false
+// once the connection has nothing left to send and should be closed.
+bool dispatchNext(const int fd, Connection & conn, RequestQueue & queue)
+{
+    std::string line;
+    while (conn.reader.takeLine(line))
+    {
+        if (!line.empty())
+        {
+            conn.busy = true;
+            queue.push(fd, std::move(line));
+            return true;
+        }
+    }
+    return !conn.eof && !conn.reader.overflowed();
+}
+
+bool makeSocketAddress(const std::string & socketPath, sockaddr_un & addr)
+{
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path))
+    {
+        std::cerr << "Socket path \"" << socketPath << "\" is too long!\n";
+        return false;
+    }
+    std::memcpy(addr.sun_path, socketPath.c_str(), socketPath.size() + 1);
+    return true;
+}
+
+} // namespace {}
+
+int runServer(const ProgramFlags & prog)
+{
+    const std::string & socketPath = prog.serveSocketPath;
+
+    sockaddr_un addr;
+    if (!makeSocketAddress(socketPath, addr))
+    {
+        return EXIT_FAILURE;
+    }
+
+    // Remove a stale socket left by a previous run, but never clobber a regular file.
+    struct stat st;
+    if (::stat(socketPath.c_str(), &st) == 0)
+    {
+        if (!S_ISSOCK(st.st_mode))
+        {
+            std::cerr << "\"" << socketPath << "\" exists and is not a socket!\n";
+            return EXIT_FAILURE;
+        }
+        ::unlink(socketPath.c_str());
+    }
+
+    const int listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0)
+    {
+        std::cerr << "socket() failed: " << std::strerror(errno) << "\n";
+        return EXIT_FAILURE;
+    }
+    if (::bind(listenFd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        ::listen(listenFd, SOMAXCONN) != 0)
+    {
+        std::cerr << "Unable to listen on \"" << socketPath << "\": " << std::strerror(errno) << "\n";
+        ::close(listenFd);
+        return EXIT_FAILURE;
+    }
+
+    // No SA_RESTART, so that poll() returns with EINTR when asked to stop.
+    struct sigaction sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onStopSignal;
+    sigemptyset(&sa.sa_mask);
+    ::sigaction(SIGINT,  &sa, nullptr);
+    ::sigaction(SIGTERM, &sa, nullptr);
+
+    // Clients going away mid-reply must not kill the server.
+    std::signal(SIGPIPE, SIG_IGN);
+
+    // Replies go to sockets, never to a terminal.
+    setColorPrintEnabled(false);
+    enableDemangleCache(ServerDemangleCacheSize);
+
+    unsigned numWorkers = prog.numWorkers;
+    if (numWorkers == 0)
+    {
+        numWorkers = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Workers write to it when they hand a connection back, waking up poll().
+    int wakePipe[2];
+    if (::pipe(wakePipe) != 0)
+    {
+        std::cerr << "pipe() failed: " << std::strerror(errno) << "\n";
+        ::close(listenFd);
+        ::unlink(socketPath.c_str());
+        return EXIT_FAILURE;
+    }
+    for (const int fd : wakePipe)
+    {
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    // The workers inherit a mask blocking the stop signals, so these
+    // can only interrupt the main thread's poll().
+    sigset_t stopSignals, savedMask;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    ::pthread_sigmask(SIG_BLOCK, &stopSignals, &savedMask);
+
+    RequestQueue queue{ wakePipe[1] };
+    std::vector<std::thread> workers;
+    for (unsigned w = 0; w < numWorkers; ++w)
+    {
+        workers.emplace_back(workerLoop, std::ref(queue));
+    }
+
+    ::pthread_sigmask(SIG_SETMASK, &savedMask, nullptr);
+
+    std::cerr << "Listening on \"" << socketPath << "\" with " << numWorkers << " workers.\n";
+
+    std::map<int, std::unique_ptr<Connection>> connections;
+    const auto dropConnection = [&connections](const int fd)
+    {
+        connections.erase(fd);
+        ::close(fd);
+    };
+
+    std::vector<pollfd> pollFds;
+    while (!stopRequested)
+    {
+        pollFds.clear();
+        pollFds.push_back(pollfd{ listenFd, POLLIN, 0 });
+        pollFds.push_back(pollfd{ wakePipe[0], POLLIN, 0 });
+        for (const auto & entry : connections)
+        {
+            if (!entry.second->busy)
+            {
+                pollFds.push_back(pollfd{ entry.first, POLLIN, 0 });
+            }
+        }
+
+        if (::poll(pollFds.data(), pollFds.size(), -1) < 0)
+        {
+            if (errno == EINTR) { continue; }
+            std::cerr << "poll() failed: " << std::strerror(errno) << "\n";
+            break;
+        }
+
+        // Connections whose request was answered are idle again.
+        if (pollFds[1].revents != 0)
+        {
+            char drain[256];
+            while (::read(wakePipe[0], drain, sizeof(drain)) > 0) { }
+
+            for (const auto & finished : queue.takeFinished())
+            {
+                Connection & conn = *connections[finished.first];
+                conn.busy = false;
+                if (!finished.second || !dispatchNext(finished.first, conn, queue))
+                {
+                    dropConnection(finished.first);
+                }
+            }
+        }
+
+        // None of these was busy when polled, and finishing a request doesn't touch idle ones.
+        for (std::size_t i = 2; i < pollFds.size(); ++i)
+        {
+            if (pollFds[i].revents == 0)
+            {
+                continue;
+            }
+            const int fd = pollFds[i].fd;
+            Connection & conn = *connections[fd];
+            conn.eof = !conn.reader.readMore();
+            if (!dispatchNext(fd, conn, queue))
+            {
+                dropConnection(fd);
+            }
+        }
+
+        if (pollFds[0].revents & POLLIN)
+        {
+            const int clientFd = ::accept(listenFd, nullptr, nullptr);
+            if (clientFd >= 0)
+            {
+                connections.emplace(clientFd, std::unique_ptr<Connection>{ new Connection{ clientFd } });
+            }
+            else if (errno != EINTR && errno != ECONNABORTED)
+            {
+                std::cerr << "accept() failed: " << std::strerror(errno) << "\n";
+                break;
+            }
+        }
+    }
+
+    ::close(listenFd);
+    ::unlink(socketPath.c_str());
+
+    // Unblock the workers writing to slow clients; queued requests are dropped.
+    for (const auto & entry : connections)
+    {
+        ::shutdown(entry.first, SHUT_RDWR);
+    }
+    queue.close();
+    for (auto & worker : workers)
+    {
+        worker.join();
+    }
+    for (const auto & entry : connections)
+    {
+        ::close(entry.first);
+    }
+    ::close(wakePipe[0]);
+    ::close(wakePipe[1]);
+
+    std::cerr << "Server stopped.\n";
+    return EXIT_SUCCESS;
+}
+
+int runClient(const ProgramFlags & prog, int argc, const char * argv[])
+{
+    // Forward everything but the "--client <socket>" pair. The first
+    // remaining argument is the filename, which is made absolute since
+    // the server doesn't share our working directory.
+    std::string request;
+    bool firstArg = true;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--client") == 0)
+        {
+            ++i;
+            continue;
+        }
+
+        std::string arg = argv[i];
+        if (firstArg && !arg.empty() && arg[0] != '-')
+        {
+            char resolved[PATH_MAX];
+            if (::realpath(argv[i], resolved) != nullptr)
+            {
+                arg = resolved;
+            }
+        }
+        if (arg.find_first_of("\t\n") != std::string::npos)
+        {
+            std::cerr << "Arguments sent to the server can't contain tabs or newlines!\n";
+            return EXIT_FAILURE;
+        }
+
+        if (!firstArg) { request += '\t'; }
+        request += arg;
+        firstArg = false;
+    }
+    request += '\n';
+
+    sockaddr_un addr;
+    if (!makeSocketAddress(prog.clientSocketPath, addr))
+    {
+        return EXIT_FAILURE;
+    }
+
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0)
+    {
+        std::cerr << "Unable to connect to \"" << prog.clientSocketPath << "\": " << std::strerror(errno) << "\n";
+        if (fd >= 0) { ::close(fd); }
+        return EXIT_FAILURE;
+    }
+
+    std::signal(SIGPIPE, SIG_IGN);
+
+    LineReader reader{ fd };
+    std::string status, payload;
+    if (!writeAll(fd, request.data(), request.size()) || !reader.readLine(status))
+    {
+        std::cerr << "Lost connection to the server!\n";
+        ::close(fd);
+        return EXIT_FAILURE;
+    }
+
+    const auto space = status.find(' ');
+    const bool ok = (status.compare(0, space, "OK") == 0);
+    const std::size_t length = (space != std::string::npos) ?
+                               std::strtoull(status.c_str() + space + 1, nullptr, 10) : 0;
+
+    if (!reader.readBytes(payload, length))
+    {
+        std::cerr << "Truncated reply from the server!\n";
+        ::close(fd);
+        return EXIT_FAILURE;
+    }
+    ::close(fd);
+
+    (ok ? std::cout : std::cerr) << payload;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#else // !PPEDUMP_POSIX
+
+int runServer(const ProgramFlags &)
+{
+    std::cerr << "Daemon mode is not supported on this platform.\n";
+    return EXIT_FAILURE;
+}
+
+int runClient(const ProgramFlags &, int, const char * [])
+{
+    std::cerr << "Daemon mode is not supported on this platform.\n";
+    return EXIT_FAILURE;
+}
+
+#endif // PPEDUMP_POSIX
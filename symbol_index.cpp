@@ -0,0 +1,439 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: symbol_index.cpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: Per-file Bloom filters of imported/exported names, for fast "who uses X?" queries.
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "portable_pe_dump.hpp"
+
+/*
+-------------------------------------
+Symbol index
+-------------------------------------
+
+Answering "which files import or export symbol X?" over a big corpus
+by fully parsing every file is slow, and almost all of that work is
+thrown away, since few files have the symbol. The index stores, for
+each file, a small Bloom filter of its names:
+
+ - every exported name (or forwarder string, like "NTDLL.RtlAllocateHeap");
+ - every imported name;
+ - every imported DLL name, lower-cased.
+
+A query tests its names against every filter, which takes a handful of
+memory reads per file and never touches the PEs themselves. A filter can
+say "maybe" for a name that isn't there (about 1% of the time with the
+sizes used below), but never "no" for a name that is, so the candidates
+are then verified with a real parse, unless --no-verify is given.
+
+Filters are sized per file (~10 bits per name), so a DLL with thousands
+of exports doesn't inflate the filters of the small executables. All the
+filter bits are stored back to back, apart from the paths, so a scan is a
+linear pass over one array.
+
+The index file is written in the native byte order, like the sketch files
+of --aggregate. It is not updated when the files change; rebuild it.
+
+-------------------------------------
+*/
+
+namespace
+{
+
+const char IndexFileMagic[8] = { 'P', 'P', 'E', 'I', 'D', 'X', '0', '1' };
+
+const double BitsPerName   = 9.6; // ~1% false positives with the optimal hash count
+const std::uint32_t MaxHashes = 16;
+
+std::string toLower(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(),
+                   [](const char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+    return str;
+}
+
+// The set of names a file is indexed by. Used both to build the
+// filters and to verify the candidates, so the two always agree.
+// Streamed from the tables, so each name is copied once.
+class SymbolNameCollector final
+    : public PEVisitor
+{
+public:
+    explicit SymbolNameCollector(std::vector<std::string> & names)
+        : names_(names)
+    { }
+
+    void onImportDll(const ImportedDllRef & dll) override
+    {
+        names_.push_back(toLower(dll.dllName.str()));
+    }
+
+    void onImportSymbol(const ImportedDllRef &, const ImportedSymbolRef & symbol) override
+    {
+        if (!symbol.byOrdinal)
+        {
+            names_.push_back(symbol.name.str());
+        }
+    }
+
+    void onExport(const ExportedSymbolRef & symbol) override
+    {
+        names_.push_back(symbol.name.str());
+    }
+
+private:
+    std::vector<std::string> & names_;
+};
+
+void collectSymbolNames(const PEImage & image, std::vector<std::string> & names)
+{
+    SymbolNameCollector collector{ names };
+    image.visit(collector);
+
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+}
+
+// ========================================================
+// BloomFilterRef - a filter inside the shared bits array
+// ========================================================
+
+struct BloomFilterRef
+{
+    std::uint64_t firstWord; // Index into the bits array
+    std::uint32_t numWords;  // Filter size in 64-bit words
+    std::uint32_t numHashes;
+};
+
+// Kirsch-Mitzenmacher: the k bit positions come from the two halves of one hash.
+inline std::uint64_t bitPosition(const std::uint64_t hash, const std::uint32_t i, const std::uint64_t numBits)
+{
+    const std::uint64_t h1 = hash & 0xFFFFFFFFull;
+    const std::uint64_t h2 = (hash >> 32) | 1;
+    return (h1 + i * h2) % numBits;
+}
+
+void bloomAdd(std::uint64_t * words, const BloomFilterRef & filter, const std::uint64_t hash)
+{
+    const std::uint64_t numBits = std::uint64_t{ filter.numWords } * 64;
+    for (std::uint32_t i = 0; i < filter.numHashes; ++i)
+    {
+        const std::uint64_t bit = bitPosition(hash, i, numBits);
+        words[bit / 64] |= std::uint64_t{ 1 } << (bit % 64);
+    }
+}
+
+bool bloomMayContain(const std::uint64_t * words, const BloomFilterRef & filter, const std::uint64_t hash)
+{
+    const std::uint64_t numBits = std::uint64_t{ filter.numWords } * 64;
+    for (std::uint32_t i = 0; i < filter.numHashes; ++i)
+    {
+        const std::uint64_t bit = bitPosition(hash, i, numBits);
+        if ((words[bit / 64] & (std::uint64_t{ 1 } << (bit % 64))) == 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ========================================================
+// SymbolIndex
+// ========================================================
+
+class SymbolIndex
+{
+public:
+    SymbolIndex() = default;
+    SymbolIndex(const SymbolIndex &) = delete;
+    SymbolIndex & operator = (const SymbolIndex &) = delete;
+
+    void addFile(const std::string & path, const std::vector<std::string> & names)
+    {
+        const auto numNames = std::max<std::size_t>(names.size(), 1);
+        const auto numBits  = static_cast<std::uint64_t>(std::ceil(numNames * BitsPerName));
+
+        BloomFilterRef filter;
+        filter.firstWord = words_.size();
+        filter.numWords  = static_cast<std::uint32_t>((numBits + 63) / 64);
+        filter.numHashes = static_cast<std::uint32_t>(std::lround(filter.numWords * 64.0 / numNames * 0.6931));
+        filter.numHashes = std::min(std::max(filter.numHashes, 1u), MaxHashes);
+
+        words_.resize(words_.size() + filter.numWords, 0);
+        for (const auto & name : names)
+        {
+            bloomAdd(&words_[filter.firstWord], filter, mixHash(hashString(name)));
+        }
+
+        paths_.push_back(path);
+        filters_.push_back(filter);
+    }
+
+    // Appends the index of every file whose filter may contain all the names.
+    void findCandidates(const std::vector<std::string> & names, std::vector<std::size_t> & candidates) const
+    {
+        std::vector<std::uint64_t> hashes;
+        for (const auto & name : names)
+        {
+            hashes.push_back(mixHash(hashString(name)));
+        }
+
+        for (std::size_t f = 0; f < filters_.size(); ++f)
+        {
+            const BloomFilterRef & filter = filters_[f];
+            const std::uint64_t * words = &words_[filter.firstWord];
+
+            bool mayContainAll = true;
+            for (const std::uint64_t hash : hashes)
+            {
+                if (!bloomMayContain(words, filter, hash))
+                {
+                    mayContainAll = false;
+                    break;
+                }
+            }
+            if (mayContainAll)
+            {
+                candidates.push_back(f);
+            }
+        }
+    }
+
+    void merge(const SymbolIndex & other)
+    {
+        for (std::size_t f = 0; f < other.filters_.size(); ++f)
+        {
+            BloomFilterRef filter = other.filters_[f];
+            const auto first = other.words_.begin() + static_cast<std::ptrdiff_t>(filter.firstWord);
+            filter.firstWord = words_.size();
+            words_.insert(words_.end(), first, first + filter.numWords);
+            paths_.push_back(other.paths_[f]);
+            filters_.push_back(filter);
+        }
+    }
+
+    bool save(const std::string & filename) const
+    {
+        std::ofstream out{ filename, std::ios::binary };
+        const std::uint64_t numFiles = filters_.size();
+        const std::uint64_t numWords = words_.size();
+
+        out.write(IndexFileMagic, sizeof(IndexFileMagic));
+        out.write(reinterpret_cast<const char *>(&numFiles), sizeof(numFiles));
+        out.write(reinterpret_cast<const char *>(&numWords), sizeof(numWords));
+        out.write(reinterpret_cast<const char *>(filters_.data()),
+                  static_cast<std::streamsize>(numFiles * sizeof(BloomFilterRef)));
+        out.write(reinterpret_cast<const char *>(words_.data()),
+                  static_cast<std::streamsize>(numWords * sizeof(std::uint64_t)));
+        for (const auto & path : paths_)
+        {
+            out << path << '\0';
+        }
+        return static_cast<bool>(out);
+    }
+
+    bool load(const std::string & filename)
+    {
+        std::ifstream in{ filename, std::ios::binary };
+        char magic[sizeof(IndexFileMagic)];
+        std::uint64_t numFiles = 0;
+        std::uint64_t numWords = 0;
+
+        if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, IndexFileMagic, sizeof(magic)) != 0 ||
+            !in.read(reinterpret_cast<char *>(&numFiles), sizeof(numFiles)) ||
+            !in.read(reinterpret_cast<char *>(&numWords), sizeof(numWords)) ||
+            numFiles > (1ull << 32) || numWords > (1ull << 36))
+        {
+            return false;
+        }
+
+        filters_.resize(numFiles);
+        words_.resize(numWords);
+        if (!in.read(reinterpret_cast<char *>(filters_.data()), static_cast<std::streamsize>(numFiles * sizeof(BloomFilterRef))) ||
+            !in.read(reinterpret_cast<char *>(words_.data()), static_cast<std::streamsize>(numWords * sizeof(std::uint64_t))))
+        {
+            return false;
+        }
+
+        paths_.resize(numFiles);
+        for (std::size_t f = 0; f < numFiles; ++f)
+        {
+            const BloomFilterRef & filter = filters_[f];
+            if (filter.numWords == 0 || filter.numHashes == 0 || filter.numHashes > MaxHashes ||
+                filter.firstWord + filter.numWords > numWords || !std::getline(in, paths_[f], '\0'))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::size_t fileCount() const { return paths_.size(); }
+    const std::string & path(const std::size_t f) const { return paths_[f]; }
+
+private:
+    std::vector<BloomFilterRef> filters_{};
+    std::vector<std::uint64_t>  words_{};
+    std::vector<std::string>    paths_{};
+};
+
+int buildIndex(const ProgramFlags & prog)
+{
+    std::vector<std::string> files;
+    expandInputPaths(prog.inputPaths, files);
+    if (files.empty())
+    {
+        std::cerr << "No input files for --index-out!\n";
+        return EXIT_FAILURE;
+    }
+
+    const unsigned numWorkers = batchWorkerCount(prog.numWorkers, files.size());
+
+    // Each worker builds a partial index of the files it picked up, and the
+    // partial indexes are concatenated. File order in the index is not significant.
+    std::vector<std::unique_ptr<SymbolIndex>> workerIndexes;
+    std::vector<std::size_t> workerFailures(numWorkers, 0);
+    for (unsigned w = 0; w < numWorkers; ++w)
+    {
+        workerIndexes.emplace_back(new SymbolIndex{});
+    }
+
+    parallelForEach(files.size(), numWorkers,
+        [&files, &workerIndexes, &workerFailures](const std::size_t i, const unsigned w)
+        {
+            PEImage image;
+            std::ostringstream ignoredErrors;
+            if (image.load(files[i].c_str(), ignoredErrors))
+            {
+                std::vector<std::string> names;
+                collectSymbolNames(image, names);
+                workerIndexes[w]->addFile(files[i], names);
+            }
+            else
+            {
+                ++workerFailures[w];
+            }
+        });
+
+    SymbolIndex & index = *workerIndexes[0];
+    std::size_t failures = workerFailures[0];
+    for (unsigned w = 1; w < numWorkers; ++w)
+    {
+        index.merge(*workerIndexes[w]);
+        failures += workerFailures[w];
+    }
+
+    if (!index.save(prog.indexOutput))
+    {
+        std::cerr << "Unable to write index file \"" << prog.indexOutput << "\"!\n";
+        return EXIT_FAILURE;
+    }
+
+    std::cerr << "Indexed " << index.fileCount() << " files (" << failures << " failed to parse).\n";
+    return EXIT_SUCCESS;
+}
+
+// Re-parses a candidate and checks that it really has all the names.
+bool verifyCandidate(const std::string & path, const std::vector<std::string> & wanted)
+{
+    PEImage image;
+    std::ostringstream ignoredErrors;
+    if (!image.load(path.c_str(), ignoredErrors))
+    {
+        return false;
+    }
+
+    std::vector<std::string> names;
+    collectSymbolNames(image, names);
+    for (const auto & name : wanted)
+    {
+        if (!std::binary_search(names.begin(), names.end(), name))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int queryIndex(const ProgramFlags & prog)
+{
+    SymbolIndex index;
+    if (!index.load(prog.indexInput))
+    {
+        std::cerr << "Unable to load index file \"" << prog.indexInput << "\"!\n";
+        return EXIT_FAILURE;
+    }
+
+    // DLL names are indexed lower-cased, so "KERNEL32.dll" finds them too. Only
+    // lower the names that look like a DLL; symbol names are case sensitive.
+    std::vector<std::string> wanted;
+    for (const auto & name : prog.findSymbols)
+    {
+        const std::string lowered = toLower(name);
+        const bool isDllName = lowered.size() > 4 && lowered.compare(lowered.size() - 4, 4, ".dll") == 0;
+        wanted.push_back(isDllName ? lowered : name);
+    }
+
+    std::vector<std::size_t> candidates;
+    index.findCandidates(wanted, candidates);
+
+    std::size_t matches = 0;
+    for (const std::size_t f : candidates)
+    {
+        if (prog.skipVerify || verifyCandidate(index.path(f), wanted))
+        {
+            std::cout << index.path(f) << "\n";
+            ++matches;
+        }
+    }
+
+    std::cerr << "Scanned " << index.fileCount() << " filters, " << candidates.size() << " candidates";
+    if (!prog.skipVerify)
+    {
+        std::cerr << ", " << matches << " verified";
+    }
+    std::cerr << ".\n";
+
+    return matches != 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+} // namespace {}
+
+int runSymbolIndex(const ProgramFlags & prog)
+{
+    if (!prog.indexOutput.empty())
+    {
+        return buildIndex(prog);
+    }
+    if (prog.indexInput.empty() || prog.findSymbols.empty())
+    {
+        std::cerr << "Usage: --index <file> --find <name> [--find <name>]... [--no-verify]\n";
+        return EXIT_FAILURE;
+    }
+    return queryIndex(prog);
+}
@@ -0,0 +1,530 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: watch_mode.cpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: Watch mode. Scans a directory tree, then re-parses PEs as they change (Linux inotify).
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "portable_pe_dump.hpp"
+
+#ifdef __linux__
+    #include <dirent.h>
+    #include <poll.h>
+    #include <sys/inotify.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif // __linux__
+
+/*
+-------------------------------------
+Watch mode output
+-------------------------------------
+
+One JSON object per line (NDJSON) on stdout, flushed after every record:
+
+  {"event":"scan","path":"a/b.dll","valid":true,"size":1234,"machine":"INTEL_I386",...}
+  {"event":"modified","path":"a/b.dll","valid":false,"error":"Bad PE NT signature!..."}
+  {"event":"deleted","path":"a/b.dll"}
+
+"scan" records come from the initial walk of the directory tree. After that,
+"created", "modified" and "deleted" are only emitted for files that change,
+so the steady-state cost is proportional to the rate of changes, not to the
+size of the tree. Files that don't start with 'MZ' are silently ignored.
+
+A directory deleted or moved out of the tree gets a "deleted" record for
+every PE that was under it, and its watches are dropped. If the inotify
+queue overflows, the tree is walked again and compared with the files
+known so far, so that changes and deletions in the lost events are still
+reported.
+
+A file is only parsed after it has been quiet (no inotify events) for the
+debounce interval, so a PE being written by a linker is parsed once when it
+is complete instead of once for every write() of it.
+
+-------------------------------------
+*/
+
+#ifdef __linux__
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+volatile std::sig_atomic_t stopRequested = 0;
+
+void onStopSignal(int)
+{
+    stopRequested = 1;
+}
+
+std::string trimmed(std::string str)
+{
+    while (!str.empty() && std::isspace(static_cast<unsigned char>(str.back())))
+    {
+        str.pop_back();
+    }
+    return str;
+}
+
+void writeRecord(const char * event, const std::string & path, const PEInfo * info, const std::string & error)
+{
+    std::ostringstream json;
+    json << "{\"event\":\"" << event << "\",\"path\":" << jsonString(path);
+
+    if (info != nullptr)
+    {
+        std::size_t importedSymbols = 0;
+        for (const auto & module : info->imports.modules)
+        {
+            importedSymbols += module.symbols.size();
+        }
+
+        json << ",\"valid\":true"
+             << ",\"size\":" << info->fileSize
+             << ",\"machine\":" << jsonString(fileHeaderMachine(info->machine))
+             << ",\"timestamp\":" << info->timeDateStamp
+             << ",\"characteristics\":" << info->fileCharacteristics
+             << ",\"subsystem\":" << jsonString(optionalHeaderSubsystem(info->subsystem))
+             << ",\"entryPoint\":" << info->addressOfEntryPoint;
+
+        json << ",\"sections\":[";
+        for (std::size_t s = 0; s < info->sections.size(); ++s)
+        {
+            json << (s ? "," : "") << jsonString(info->sections[s].name);
+        }
+        json << "],\"imports\":[";
+        for (std::size_t m = 0; m < info->imports.modules.size(); ++m)
+        {
+            json << (m ? "," : "") << jsonString(info->imports.modules[m].dllName);
+        }
+        json << "],\"importedSymbols\":" << importedSymbols
+             << ",\"exports\":" << info->exports.symbols.size();
+    }
+    else if (!error.empty())
+    {
+        json << ",\"valid\":false,\"error\":" << jsonString(error);
+    }
+
+    json << "}\n";
+    std::cout << json.str() << std::flush;
+}
+
+class DirectoryWatcher
+{
+public:
+    DirectoryWatcher(const int inotifyFd, const std::string & rootDir, const std::chrono::milliseconds debounce)
+        : inotifyFd_{ inotifyFd }
+        , rootDir_{ rootDir }
+        , debounce_{ debounce }
+        , watchedDirs_{}
+        , knownFiles_{}
+        , pending_{}
+        , rescannedDirs_{}
+        , rescanning_{ false }
+    { }
+
+    // Adds watches for 'dir' and all its subdirectories, parsing every PE found.
+    void scanTree(const std::string & dir, const char * event)
+    {
+        const int wd = ::inotify_add_watch(inotifyFd_, dir.c_str(),
+                                           IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_MOVED_TO |
+                                           IN_MOVED_FROM | IN_DELETE | IN_DELETE_SELF | IN_ONLYDIR);
+        if (wd < 0)
+        {
+            std::cerr << "Unable to watch \"" << dir << "\": " << std::strerror(errno) << "\n";
+            return;
+        }
+        watchedDirs_[wd] = dir;
+        if (rescanning_)
+        {
+            rescannedDirs_.insert(wd);
+        }
+
+        DIR * dirHandle = ::opendir(dir.c_str());
+        if (dirHandle == nullptr)
+        {
+            return;
+        }
+        while (const dirent * entry = ::readdir(dirHandle))
+        {
+            if (std::strcmp(entry->d_name, ".") == 0 || std::strcmp(entry->d_name, "..") == 0)
+            {
+                continue;
+            }
+
+            const std::string path = dir + "/" + entry->d_name;
+            struct stat st;
+            if (::lstat(path.c_str(), &st) != 0)
+            {
+                continue;
+            }
+            if (S_ISDIR(st.st_mode))
+            {
+                scanTree(path, event);
+            }
+            else if (S_ISREG(st.st_mode))
+            {
+                parseIfChanged(path, event);
+            }
+        }
+        ::closedir(dirHandle);
+    }
+
+    // Drains the inotify descriptor. Returns false if it is broken.
+    bool readEvents()
+    {
+        alignas(inotify_event) char buffer[64 * 1024];
+        const ssize_t count = ::read(inotifyFd_, buffer, sizeof(buffer));
+        if (count < 0)
+        {
+            return (errno == EINTR || errno == EAGAIN);
+        }
+
+        for (ssize_t offset = 0; offset < count; )
+        {
+            const auto event = reinterpret_cast<const inotify_event *>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+            handleEvent(*event);
+        }
+        return true;
+    }
+
+    // Parses the files that have been quiet for the debounce interval.
+    void flushPending()
+    {
+        const auto now = Clock::now();
+        for (auto iter = pending_.begin(); iter != pending_.end(); )
+        {
+            if (now >= iter->second)
+            {
+                const std::string path = iter->first;
+                iter = pending_.erase(iter);
+                parseIfChanged(path, nullptr);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+    }
+
+    // How long poll() can sleep before the next pending file is due. -1 = forever.
+    int pollTimeoutMs() const
+    {
+        if (pending_.empty())
+        {
+            return -1;
+        }
+        auto next = pending_.begin()->second;
+        for (const auto & entry : pending_)
+        {
+            if (entry.second < next) { next = entry.second; }
+        }
+        const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - Clock::now()).count();
+        return (wait > 0) ? static_cast<int>(wait) + 1 : 0;
+    }
+
+private:
+    struct FileState
+    {
+        off_t  size;
+        time_t mtimeSec;
+        long   mtimeNsec;
+        bool   isPE;
+    };
+
+    void handleEvent(const inotify_event & event)
+    {
+        if (event.mask & IN_Q_OVERFLOW)
+        {
+            rescan();
+            return;
+        }
+
+        auto dirIter = watchedDirs_.find(event.wd);
+        if (dirIter == watchedDirs_.end())
+        {
+            return;
+        }
+        if (event.mask & IN_DELETE_SELF)
+        {
+            forgetTree(dirIter->second);
+            return;
+        }
+        if (event.mask & IN_IGNORED)
+        {
+            watchedDirs_.erase(dirIter);
+            return;
+        }
+        if (event.len == 0)
+        {
+            return;
+        }
+
+        const std::string path = dirIter->second + "/" + event.name;
+
+        if (event.mask & IN_ISDIR)
+        {
+            if (event.mask & (IN_CREATE | IN_MOVED_TO))
+            {
+                scanTree(path, "created");
+            }
+            else if (event.mask & (IN_DELETE | IN_MOVED_FROM))
+            {
+                forgetTree(path);
+            }
+            return;
+        }
+
+        if (event.mask & (IN_DELETE | IN_MOVED_FROM))
+        {
+            pending_.erase(path);
+            auto fileIter = knownFiles_.find(path);
+            if (fileIter != knownFiles_.end())
+            {
+                if (fileIter->second.isPE)
+                {
+                    writeRecord("deleted", path, nullptr, "");
+                }
+                knownFiles_.erase(fileIter);
+            }
+            return;
+        }
+
+        // IN_CREATE, IN_MODIFY, IN_CLOSE_WRITE, IN_MOVED_TO: (re)start the quiet period.
+        pending_[path] = Clock::now() + debounce_;
+    }
+
+    // 'dir' was deleted or moved away: everything known under it is gone,
+    // and its watches (and those of its subdirectories) are dropped.
+    void forgetTree(const std::string & dir)
+    {
+        const std::string prefix = dir + "/";
+        const auto isUnder = [&dir, &prefix](const std::string & path)
+        {
+            return path == dir || path.compare(0, prefix.size(), prefix) == 0;
+        };
+
+        for (auto iter = watchedDirs_.begin(); iter != watchedDirs_.end(); )
+        {
+            if (isUnder(iter->second))
+            {
+                ::inotify_rm_watch(inotifyFd_, iter->first);
+                iter = watchedDirs_.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+        forgetFiles(isUnder);
+    }
+
+    // Events were lost. Walks the tree again (files whose size and mtime didn't
+    // change are still not re-parsed), then drops what the walk didn't find.
+    void rescan()
+    {
+        rescannedDirs_.clear();
+        rescanning_ = true;
+        scanTree(rootDir_, nullptr);
+        rescanning_ = false;
+
+        for (auto iter = watchedDirs_.begin(); iter != watchedDirs_.end(); )
+        {
+            if (rescannedDirs_.count(iter->first) == 0)
+            {
+                ::inotify_rm_watch(inotifyFd_, iter->first);
+                iter = watchedDirs_.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+        forgetFiles([](const std::string & path)
+        {
+            struct stat st;
+            return ::lstat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode);
+        });
+    }
+
+    // Emits "deleted" for the known PEs matching 'isGone', in path order, and forgets them.
+    template<typename Pred>
+    void forgetFiles(const Pred & isGone)
+    {
+        std::vector<std::string> deleted;
+        for (auto iter = knownFiles_.begin(); iter != knownFiles_.end(); )
+        {
+            if (isGone(iter->first))
+            {
+                if (iter->second.isPE)
+                {
+                    deleted.push_back(iter->first);
+                }
+                pending_.erase(iter->first);
+                iter = knownFiles_.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+        for (auto iter = pending_.begin(); iter != pending_.end(); )
+        {
+            iter = isGone(iter->first) ? pending_.erase(iter) : std::next(iter);
+        }
+
+        std::sort(deleted.begin(), deleted.end());
+        for (const auto & path : deleted)
+        {
+            writeRecord("deleted", path, nullptr, "");
+        }
+    }
+
+    void parseIfChanged(const std::string & path, const char * event)
+    {
+        struct stat st;
+        if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            return;
+        }
+
+        auto fileIter = knownFiles_.find(path);
+        const bool isNew = (fileIter == knownFiles_.end());
+        if (!isNew &&
+            fileIter->second.size      == st.st_size         &&
+            fileIter->second.mtimeSec  == st.st_mtim.tv_sec  &&
+            fileIter->second.mtimeNsec == st.st_mtim.tv_nsec)
+        {
+            return; // Touched but not changed.
+        }
+
+        const bool isPE = looksLikePE(path.c_str());
+        knownFiles_[path] = FileState{ st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec, isPE };
+        if (!isPE)
+        {
+            return;
+        }
+
+        if (event == nullptr)
+        {
+            event = isNew ? "created" : "modified";
+        }
+
+        PEInfo info;
+        std::ostringstream errors;
+        if (parsePEFile(path.c_str(), ParseAll, info, errors))
+        {
+            writeRecord(event, path, &info, "");
+        }
+        else
+        {
+            writeRecord(event, path, nullptr, trimmed(errors.str()));
+        }
+    }
+
+    const int inotifyFd_;
+    const std::string rootDir_;
+    const std::chrono::milliseconds debounce_;
+
+    std::unordered_map<int, std::string> watchedDirs_;
+    std::unordered_map<std::string, FileState> knownFiles_;
+    std::unordered_map<std::string, Clock::time_point> pending_;
+
+    // Watches (re)added by the walk of rescan().
+    std::unordered_set<int> rescannedDirs_;
+    bool rescanning_;
+};
+
+} // namespace {}
+
+int runWatch(const ProgramFlags & prog)
+{
+    std::string rootDir = prog.watchDir;
+    while (rootDir.size() > 1 && rootDir.back() == '/')
+    {
+        rootDir.pop_back();
+    }
+
+    const int inotifyFd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0)
+    {
+        std::cerr << "inotify_init1() failed: " << std::strerror(errno) << "\n";
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onStopSignal;
+    sigemptyset(&sa.sa_mask);
+    ::sigaction(SIGINT,  &sa, nullptr);
+    ::sigaction(SIGTERM, &sa, nullptr);
+
+    // Error messages end up inside JSON strings.
+    setColorPrintEnabled(false);
+
+    // Watches are added before each directory is listed, so
+    // files created during the initial scan are not missed.
+    DirectoryWatcher watcher{ inotifyFd, rootDir, std::chrono::milliseconds{ prog.debounceMs } };
+    watcher.scanTree(rootDir, "scan");
+
+    while (!stopRequested)
+    {
+        pollfd pfd;
+        pfd.fd      = inotifyFd;
+        pfd.events  = POLLIN;
+        pfd.revents = 0;
+
+        const int ready = ::poll(&pfd, 1, watcher.pollTimeoutMs());
+        if (ready < 0 && errno != EINTR)
+        {
+            std::cerr << "poll() failed: " << std::strerror(errno) << "\n";
+            break;
+        }
+        if (ready > 0 && !watcher.readEvents())
+        {
+            std::cerr << "Reading inotify events failed: " << std::strerror(errno) << "\n";
+            break;
+        }
+        watcher.flushPending();
+    }
+
+    ::close(inotifyFd);
+    return EXIT_SUCCESS;
+}
+
+#else // !__linux__
+
+int runWatch(const ProgramFlags &)
+{
+    std::cerr << "Watch mode requires inotify and is only supported on Linux.\n";
+    return EXIT_FAILURE;
+}
+
+#endif // __linux__
@@ -0,0 +1,663 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File: where_filter.cpp
+// Author: Guilherme R. Lampert
+// Created on: 18/10/26
+// Brief: The --where filter expressions: parsing and lazy per-file evaluation.
+//
+// Source code licensed under the MIT license.
+// Copyright (C) 2015 Guilherme R. Lampert
+//
+// This software is provided "as is" without express or implied
+// warranties. You may freely copy and compile this source into
+// applications you distribute provided that this copyright text
+// is included in the resulting source code.
+// ================================================================================================
+
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "portable_pe_dump.hpp"
+
+/*
+-------------------------------------
+Filter expressions
+-------------------------------------
+
+  expr      := and ( '||' and )*
+  and       := unary ( '&&' unary )*
+  unary     := '!' unary | '(' expr ')' | predicate
+  predicate := field ( '==' | '!=' | '<' | '<=' | '>' | '>=' ) value
+             | field 'has' value
+             | 'dll'
+
+Fields, by the parsing stage they need:
+
+  headers:  size, timestamp, entrypoint, imagebase, sizeofimage,
+            characteristics, dllcharacteristics, machine, subsystem,
+            sections (count; 'has' tests a section name), dll (flag)
+  imports:  dlls    (count; 'has' tests a DLL name, ignoring case)
+            imports (count of functions; 'has' tests a DLL or function name)
+  exports:  exports (count; 'has' tests an exported name)
+
+'machine' and 'subsystem' also compare with names, like AMD64 or GUI.
+Values are numbers (decimal or 0x hex), bare words or "quoted strings".
+'has' on imports/exports first compares the raw (mangled) names, and
+only demangles them if nothing matched, so demangling is paid for just
+by the files that get that far. A file whose optional header is neither
+PE32 nor PE32+ has tables that can't be read, so it never matches a test
+that needs them and is reported on stderr instead.
+
+The expression is parsed once into a tree. The operands of every chain
+of && or || are then stably sorted by the stage they need, so the cheap
+header tests run first, and the evaluation short-circuits; a file is only
+asked for its imports/exports (PEImage parses them on first use) if the
+tests that come before couldn't decide the result without them.
+
+-------------------------------------
+*/
+
+namespace
+{
+
+enum class Stage
+{
+    Headers,
+    Imports,
+    Exports
+};
+
+enum class Field
+{
+    Size,
+    Timestamp,
+    EntryPoint,
+    ImageBase,
+    SizeOfImage,
+    Characteristics,
+    DllCharacteristics,
+    Machine,
+    Subsystem,
+    Sections,
+    IsDll,
+    Dlls,
+    Imports,
+    Exports
+};
+
+enum class NodeKind
+{
+    And,
+    Or,
+    Not,
+    Compare,
+    Has,
+    Flag
+};
+
+enum class CompareOp
+{
+    Equal,
+    NotEqual,
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual
+};
+
+struct FieldDesc
+{
+    const char * name;
+    Field        field;
+    Stage        stage;
+    bool         hasSet; // Supports 'has'
+};
+
+const FieldDesc fieldTable[] = {
+    { "size",               Field::Size,               Stage::Headers, false },
+    { "timestamp",          Field::Timestamp,          Stage::Headers, false },
+    { "entrypoint",         Field::EntryPoint,         Stage::Headers, false },
+    { "imagebase",          Field::ImageBase,          Stage::Headers, false },
+    { "sizeofimage",        Field::SizeOfImage,        Stage::Headers, false },
+    { "characteristics",    Field::Characteristics,    Stage::Headers, false },
+    { "dllcharacteristics", Field::DllCharacteristics, Stage::Headers, false },
+    { "machine",            Field::Machine,            Stage::Headers, false },
+    { "subsystem",          Field::Subsystem,          Stage::Headers, false },
+    { "sections",           Field::Sections,           Stage::Headers, true  },
+    { "dll",                Field::IsDll,              Stage::Headers, false },
+    { "dlls",               Field::Dlls,               Stage::Imports, true  },
+    { "imports",            Field::Imports,            Stage::Imports, true  },
+    { "exports",            Field::Exports,            Stage::Exports, true  }
+};
+
+// Names accepted for 'machine' and 'subsystem', on top of plain numbers.
+const struct { const char * name; std::uint32_t id; } machineNames[] = {
+    { "i386",  0x14C  }, { "x86",   0x14C  }, { "intel_i386", 0x14C },
+    { "amd64", 0x8664 }, { "x64",   0x8664 }, { "win_64",     0x8664 },
+    { "arm",   0x1C0  }, { "armnt", 0x1C4  }, { "arm64",      0xAA64 },
+    { "ia64",  0x200  }, { "intel_i860", 0x14D }, { "dec_alpha_axp", 0x183 }
+};
+const struct { const char * name; std::uint32_t id; } subsystemNames[] = {
+    { "native", 1 }, { "gui", 2 }, { "windows_gui", 2 }, { "cui", 3 }, { "windows_cui", 3 },
+    { "os2_cui", 5 }, { "posix_cui", 7 }, { "efi_application", 10 }
+};
+
+std::string toLower(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(),
+                   [](const char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+    return str;
+}
+
+bool equalsIgnoreCase(const std::string & a, const std::string & b)
+{
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(), [](const char x, const char y) {
+               return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+           });
+}
+
+// A mangled name in the filter is only compared with the raw names.
+bool looksMangled(const std::string & name)
+{
+    return !name.empty() && (name[0] == '?' || name.compare(0, 2, "_Z") == 0);
+}
+
+// Demangled names come out as "Class::Method()"; the parentheses are optional in the filter.
+bool demangledMatches(const std::string & mangledName, const std::string & text)
+{
+    const std::string name = demangleCached(mangledName);
+    return name == text || (name.size() == text.size() + 2 && name.compare(0, text.size(), text) == 0 &&
+                            name.compare(text.size(), 2, "()") == 0);
+}
+
+struct Node
+{
+    NodeKind      kind    = NodeKind::Flag;
+    Field         field   = Field::Size;
+    CompareOp     op      = CompareOp::Equal;
+    Stage         stage   = Stage::Headers;
+    std::uint64_t number  = 0;  // Compare
+    std::string   text    {};   // Has
+    std::vector<std::unique_ptr<Node>> children{};
+};
+
+// ========================================================
+// Parser
+// ========================================================
+
+class Parser
+{
+public:
+    Parser(const std::string & source, std::ostream & errOut)
+        : source_{ source }
+        , errOut_{ errOut }
+        , pos_{ 0 }
+        , failed_{ false }
+    { }
+
+    std::unique_ptr<Node> parse()
+    {
+        std::unique_ptr<Node> root = parseChain(NodeKind::Or);
+        skipSpaces();
+        if (!failed_ && pos_ != source_.size())
+        {
+            error("unexpected input");
+        }
+        return failed_ ? nullptr : std::move(root);
+    }
+
+private:
+    // Or-chains of And-chains of unary terms, flattened into n-ary nodes.
+    std::unique_ptr<Node> parseChain(const NodeKind kind)
+    {
+        const char * token = (kind == NodeKind::Or) ? "||" : "&&";
+        auto operand = [this, kind]() { return (kind == NodeKind::Or) ? parseChain(NodeKind::And) : parseUnary(); };
+
+        std::unique_ptr<Node> first = operand();
+        if (failed_ || !accept(token))
+        {
+            return first;
+        }
+
+        std::unique_ptr<Node> chain{ new Node{} };
+        chain->kind = kind;
+        chain->children.push_back(std::move(first));
+        do
+        {
+            chain->children.push_back(operand());
+            if (failed_) { return nullptr; }
+        } while (accept(token));
+
+        // Cheapest operands first. Stable, so ties keep the order they were written in.
+        std::stable_sort(chain->children.begin(), chain->children.end(),
+                         [](const std::unique_ptr<Node> & a, const std::unique_ptr<Node> & b) { return a->stage < b->stage; });
+        chain->stage = chain->children.back()->stage;
+        return chain;
+    }
+
+    std::unique_ptr<Node> parseUnary()
+    {
+        if (accept("!"))
+        {
+            std::unique_ptr<Node> node{ new Node{} };
+            node->kind = NodeKind::Not;
+            node->children.push_back(parseUnary());
+            if (failed_) { return nullptr; }
+            node->stage = node->children[0]->stage;
+            return node;
+        }
+        if (accept("("))
+        {
+            std::unique_ptr<Node> node = parseChain(NodeKind::Or);
+            if (!failed_ && !accept(")"))
+            {
+                error("expected ')'");
+            }
+            return node;
+        }
+        return parsePredicate();
+    }
+
+    std::unique_ptr<Node> parsePredicate()
+    {
+        const std::size_t fieldPos = pos_;
+        const std::string name = toLower(word());
+        const FieldDesc * desc = nullptr;
+        for (const FieldDesc & d : fieldTable)
+        {
+            if (name == d.name) { desc = &d; break; }
+        }
+        if (desc == nullptr)
+        {
+            pos_ = fieldPos;
+            error(name.empty() ? "expected a field name" : "unknown field");
+            return nullptr;
+        }
+
+        std::unique_ptr<Node> node{ new Node{} };
+        node->field = desc->field;
+        node->stage = desc->stage;
+
+        if (desc->field == Field::IsDll)
+        {
+            node->kind = NodeKind::Flag;
+            return node;
+        }
+
+        const std::size_t opPos = pos_;
+        if (toLower(word()) == "has")
+        {
+            if (!desc->hasSet)
+            {
+                pos_ = opPos;
+                error("'has' is not supported by this field");
+                return nullptr;
+            }
+            node->kind = NodeKind::Has;
+            node->text = value();
+            return node;
+        }
+        pos_ = opPos;
+
+        static const struct { const char * token; CompareOp op; } ops[] = {
+            { "==", CompareOp::Equal   }, { "!=", CompareOp::NotEqual     },
+            { "<=", CompareOp::LessEqual }, { ">=", CompareOp::GreaterEqual },
+            { "<",  CompareOp::Less    }, { ">",  CompareOp::Greater      }
+        };
+        bool foundOp = false;
+        for (const auto & o : ops)
+        {
+            if (accept(o.token)) { node->op = o.op; foundOp = true; break; }
+        }
+        if (!foundOp)
+        {
+            error("expected a comparison or 'has'");
+            return nullptr;
+        }
+
+        node->kind = NodeKind::Compare;
+        const std::size_t valuePos = pos_;
+        const std::string text = value();
+        if (failed_)
+        {
+            return nullptr;
+        }
+
+        char * end = nullptr;
+        node->number = std::strtoull(text.c_str(), &end, 0);
+        if (!text.empty() && *end == '\0')
+        {
+            return node;
+        }
+
+        // Not a number; try the names of machines and subsystems.
+        const std::string lowered = toLower(text);
+        if (desc->field == Field::Machine)
+        {
+            for (const auto & m : machineNames)
+            {
+                if (lowered == m.name) { node->number = m.id; return node; }
+            }
+        }
+        else if (desc->field == Field::Subsystem)
+        {
+            for (const auto & s : subsystemNames)
+            {
+                if (lowered == s.name) { node->number = s.id; return node; }
+            }
+        }
+
+        pos_ = valuePos;
+        error("expected a number");
+        return nullptr;
+    }
+
+    // A bare word or a quoted string.
+    std::string value()
+    {
+        skipSpaces();
+        if (pos_ < source_.size() && source_[pos_] == '"')
+        {
+            std::string str;
+            for (++pos_; pos_ < source_.size() && source_[pos_] != '"'; ++pos_)
+            {
+                if (source_[pos_] == '\\' && pos_ + 1 < source_.size())
+                {
+                    ++pos_;
+                }
+                str += source_[pos_];
+            }
+            if (pos_ == source_.size())
+            {
+                error("unterminated string");
+                return "";
+            }
+            ++pos_; // Closing quote
+            return str;
+        }
+
+        std::string str = word();
+        if (str.empty())
+        {
+            error("expected a value");
+        }
+        return str;
+    }
+
+    std::string word()
+    {
+        skipSpaces();
+        const std::size_t start = pos_;
+        while (pos_ < source_.size() &&
+               (std::isalnum(static_cast<unsigned char>(source_[pos_])) || std::strchr("_.$@?", source_[pos_]) != nullptr))
+        {
+            ++pos_;
+        }
+        return source_.substr(start, pos_ - start);
+    }
+
+    bool accept(const char * token)
+    {
+        skipSpaces();
+        const std::size_t length = std::strlen(token);
+        if (source_.compare(pos_, length, token) == 0)
+        {
+            pos_ += length;
+            return true;
+        }
+        return false;
+    }
+
+    void skipSpaces()
+    {
+        while (pos_ < source_.size() && std::isspace(static_cast<unsigned char>(source_[pos_])))
+        {
+            ++pos_;
+        }
+    }
+
+    void error(const char * message)
+    {
+        if (failed_)
+        {
+            return; // Only the first error is meaningful.
+        }
+        failed_ = true;
+        errOut_ << "Invalid --where expression: " << message << "\n"
+                << "  " << source_ << "\n"
+                << "  " << std::string(pos_, ' ') << "^\n";
+    }
+
+    const std::string & source_;
+    std::ostream &      errOut_;
+    std::size_t         pos_;
+    bool                failed_;
+};
+
+// ========================================================
+// Evaluation
+// ========================================================
+
+std::uint64_t fieldValue(const Field field, PEImage & file)
+{
+    const PEInfo & info = file.info();
+    switch (field)
+    {
+    case Field::Size               : return info.fileSize;
+    case Field::Timestamp          : return info.timeDateStamp;
+    case Field::EntryPoint         : return info.addressOfEntryPoint;
+    case Field::ImageBase          : return info.imageBase;
+    case Field::SizeOfImage        : return info.sizeOfImage;
+    case Field::Characteristics    : return info.fileCharacteristics;
+    case Field::DllCharacteristics : return info.dllCharacteristics;
+    case Field::Machine            : return info.machine;
+    case Field::Subsystem          : return info.subsystem;
+    case Field::Sections           : return info.sections.size();
+    case Field::IsDll              : return (info.fileCharacteristics & 0x2000) != 0;
+    case Field::Dlls               : return file.imports().modules.size();
+    case Field::Imports :
+        {
+            std::uint64_t count = 0;
+            for (const auto & module : file.imports().modules)
+            {
+                count += module.symbols.size();
+            }
+            return count;
+        }
+    case Field::Exports            : return file.exports().symbols.size();
+    } // switch (field)
+    return 0;
+}
+
+bool hasValue(const Node & node, PEImage & file)
+{
+    switch (node.field)
+    {
+    case Field::Sections :
+        for (const auto & section : file.info().sections)
+        {
+            if (section.name == node.text) { return true; }
+        }
+        return false;
+
+    case Field::Dlls :
+    case Field::Imports :
+        {
+            const auto & modules = file.imports().modules;
+            for (const auto & module : modules)
+            {
+                if (equalsIgnoreCase(module.dllName, node.text)) { return true; }
+            }
+            if (node.field == Field::Dlls)
+            {
+                return false;
+            }
+            for (const auto & module : modules)
+            {
+                for (const auto & symbol : module.symbols)
+                {
+                    if (symbol.name == node.text) { return true; }
+                }
+            }
+            if (looksMangled(node.text))
+            {
+                return false;
+            }
+            for (const auto & module : modules)
+            {
+                for (const auto & symbol : module.symbols)
+                {
+                    if (demangledMatches(symbol.name, node.text)) { return true; }
+                }
+            }
+            return false;
+        }
+
+    case Field::Exports :
+        {
+            const auto & symbols = file.exports().symbols;
+            for (const auto & symbol : symbols)
+            {
+                if (symbol.name == node.text) { return true; }
+            }
+            if (looksMangled(node.text))
+            {
+                return false;
+            }
+            for (const auto & symbol : symbols)
+            {
+                if (!symbol.forwarder && demangledMatches(symbol.name, node.text)) { return true; }
+            }
+            return false;
+        }
+
+    default :
+        return false;
+    } // switch (node.field)
+}
+
+bool evaluate(const Node & node, PEImage & file)
+{
+    switch (node.kind)
+    {
+    case NodeKind::And :
+        for (const auto & child : node.children)
+        {
+            if (!evaluate(*child, file)) { return false; }
+        }
+        return true;
+
+    case NodeKind::Or :
+        for (const auto & child : node.children)
+        {
+            if (evaluate(*child, file)) { return true; }
+        }
+        return false;
+
+    case NodeKind::Not :
+        return !evaluate(*node.children[0], file);
+
+    case NodeKind::Flag :
+        return fieldValue(node.field, file) != 0;
+
+    case NodeKind::Has :
+        return hasValue(node, file);
+
+    case NodeKind::Compare :
+        {
+            const std::uint64_t value = fieldValue(node.field, file);
+            switch (node.op)
+            {
+            case CompareOp::Equal        : return value == node.number;
+            case CompareOp::NotEqual     : return value != node.number;
+            case CompareOp::Less         : return value <  node.number;
+            case CompareOp::LessEqual    : return value <= node.number;
+            case CompareOp::Greater      : return value >  node.number;
+            case CompareOp::GreaterEqual : return value >= node.number;
+            } // switch (node.op)
+        }
+    } // switch (node.kind)
+    return false;
+}
+
+} // namespace {}
+
+int runWhere(const ProgramFlags & prog)
+{
+    Parser parser{ prog.whereExpression, std::cerr };
+    const std::unique_ptr<Node> filter = parser.parse();
+    if (filter == nullptr)
+    {
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::string> files;
+    expandInputPaths(prog.inputPaths, files);
+    if (files.empty())
+    {
+        std::cerr << "No input files for --where!\n";
+        return EXIT_FAILURE;
+    }
+
+    // Output is buffered per file and printed in input order once all are done.
+    std::vector<std::string> outputs(files.size());
+    std::vector<std::string> failures(files.size());
+    std::vector<char> matched(files.size(), 0);
+
+    const bool dumpMatches = prog.anyFlagSet();
+    parallelForEach(files.size(), batchWorkerCount(prog.numWorkers, files.size()),
+        [&](const std::size_t i, unsigned)
+        {
+            stats::FileScope statsFile{ files[i].c_str() };
+            PEImage file;
+            std::ostringstream errors;
+            if (!file.load(files[i].c_str(), errors))
+            {
+                return;
+            }
+
+            const bool isMatch = evaluate(*filter, file);
+            if (file.info().imports.status == PETableStatus::Unsupported ||
+                file.info().exports.status == PETableStatus::Unsupported)
+            {
+                failures[i] = files[i] + ": can't test imports/exports, optional header is neither PE32 nor PE32+\n";
+                return;
+            }
+            if (!isMatch)
+            {
+                return;
+            }
+
+            matched[i] = 1;
+            if (dumpMatches)
+            {
+                std::ostringstream out;
+                processFile(files[i].c_str(), prog, out, errors);
+                outputs[i] = out.str();
+            }
+            else
+            {
+                outputs[i] = files[i] + "\n";
+            }
+        });
+
+    std::size_t numMatched = 0;
+    for (std::size_t i = 0; i < files.size(); ++i)
+    {
+        std::cout << outputs[i];
+        std::cerr << failures[i];
+        numMatched += matched[i];
+    }
+    return numMatched != 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}